@@ -8,13 +8,22 @@
 
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
 #include <fcntl.h>
+#include <strings.h>
 #include <zlib.h>
 
 #include <rapidjson/error/en.h>
+#include <rapidjson/stringbuffer.h>
+#include <rapidjson/writer.h>
 #include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <mutex>
+#include <thread>
+#include <unordered_set>
 
 
 namespace ibd_ninja {
@@ -35,6 +44,58 @@ namespace ibd_ninja {
   } while (0)
 
 
+/* ------Dictionary memory------ */
+static const std::string* InternString(const std::string& str) {
+  // Looked up by the threads parsing SDI records in parallel
+  static std::mutex mutex;
+  static std::unordered_set<std::string>* pool =
+                                  new std::unordered_set<std::string>();
+  std::lock_guard<std::mutex> guard(mutex);
+  return &*pool->insert(str).first;
+}
+
+InternedString::InternedString() {
+  static const std::string* empty = InternString("");
+  str_ = empty;
+}
+
+InternedString::InternedString(const std::string& str)
+  : str_(InternString(str)) {
+}
+
+InternedString& InternedString::operator=(const std::string& str) {
+  str_ = InternString(str);
+  return *this;
+}
+
+constexpr size_t DICT_ARENA_MIN_BLOCK_SIZE = 4096;
+constexpr size_t DICT_ARENA_MAX_BLOCK_SIZE = 64 * 1024;
+
+DictArena::~DictArena() {
+  for (auto iter = destructors_.rbegin(); iter != destructors_.rend();
+       ++iter) {
+    iter->first(iter->second);
+  }
+  for (auto block : blocks_) {
+    delete[] block;
+  }
+}
+
+void* DictArena::Allocate(size_t size, size_t align) {
+  size_t offset = (block_used_ + align - 1) & ~(align - 1);
+  if (blocks_.empty() || offset + size > block_size_) {
+    // Blocks double in size, so small tables waste little
+    block_size_ = std::max(std::min(block_size_ * 2,
+                                    DICT_ARENA_MAX_BLOCK_SIZE),
+                           DICT_ARENA_MIN_BLOCK_SIZE);
+    block_size_ = std::max(block_size_, size);
+    blocks_.push_back(new unsigned char[block_size_]);
+    offset = 0;
+  }
+  block_used_ = offset + size;
+  return blocks_.back() + offset;
+}
+
 /* ------Properties------ */
 template <typename GV>
 bool ReadValue(bool* ap, const GV& gv) {
@@ -90,6 +151,15 @@ bool ReadValue(std::string* ap, const GV& gv) {
   return true;
 }
 
+template <typename GV>
+bool ReadValue(InternedString* ap, const GV& gv) {
+  if (!gv.IsString()) {
+    return false;
+  }
+  *ap = std::string(gv.GetString(), gv.GetStringLength());
+  return true;
+}
+
 template <typename T, typename GV>
 bool Read(T* ap, const GV& gv, const char* key) {
   if (!gv.HasMember(key)) {
@@ -109,10 +179,28 @@ bool ReadEnum(ENUM_T* ap, const GV& gv, const char* key) {
 }
 
 bool Properties::ValidKey(const std::string& key) const {
-  bool ret = (keys_.empty() || keys_.find(key) != keys_.end());
+  bool ret = (keys_ == nullptr || keys_->find(key) != keys_->end());
   return ret;
 }
 
+const Properties::Value* Properties::Find(const std::string& key) const {
+  // Only a handful of keys, a linear search is the fastest
+  for (const auto& iter : kvs_) {
+    if (iter.key == key) {
+      return &iter;
+    }
+  }
+  return nullptr;
+}
+
+std::string Properties::Value::ToString() const {
+  if (!is_number) {
+    return text;
+  }
+  return is_negative ? std::to_string(static_cast<int64_t>(number)) :
+                       std::to_string(number);
+}
+
 bool GetValue(const std::string& value_str, std::string* value) {
   *value = value_str;
   return true;
@@ -165,18 +253,26 @@ bool GetValue(const std::string& value_str, uint64_t* value) {
 
 template <typename T>
 bool Properties::Get(const std::string& key, T* value) const {
-  std::string value_str;
   if (!ValidKey(key)) {
     assert(false);
     return false;
   }
-  const auto& iter = kvs_.find(key);
-  if (iter == kvs_.end()) {
+  const Value* entry = Find(key);
+  if (entry == nullptr) {
     return false;
-  } else {
-    value_str = iter->second;
   }
-  GetValue(value_str, value);
+  if constexpr (std::is_same_v<T, bool>) {
+    if (entry->is_number) {
+      *value = (entry->number != 0);
+      return true;
+    }
+  } else if constexpr (std::is_integral_v<T> || std::is_enum_v<T>) {
+    if (entry->is_number) {
+      *value = static_cast<T>(entry->number);
+      return true;
+    }
+  }
+  GetValue(entry->ToString(), value);
   return true;
 }
 
@@ -184,12 +280,7 @@ bool Properties::Exists(const std::string& key) const {
   if (!ValidKey(key)) {
     return false;
   }
-  const auto& iter = kvs_.find(key);
-  if (iter != kvs_.end()) {
-    return true;
-  } else {
-    return false;
-  }
+  return Find(key) != nullptr;
 }
 
 bool Properties::InsertValues(const std::string& opt_string) {
@@ -236,7 +327,32 @@ bool Properties::InsertValues(const std::string& opt_string) {
     }
 
     if (ValidKey(key)) {
-      kvs_[key] = value;
+      // Only numbers that print back the same are kept as numbers
+      size_t start = (!value.empty() && value[0] == '-') ? 1 : 0;
+      bool is_number =
+        value.size() > start && value.size() - start <= 18 &&
+        std::all_of(value.begin() + start, value.end(), ::isdigit) &&
+        (value[start] != '0' || (start == 0 && value.size() == 1));
+      Value entry;
+      entry.key = key;
+      entry.is_number = is_number;
+      entry.is_negative = (start == 1);
+      entry.number = 0;
+      if (is_number) {
+        entry.number = static_cast<uint64_t>(strtoll(value.c_str(),
+                                                     nullptr, 10));
+      } else {
+        entry.text = value;
+      }
+      auto existing = std::find_if(kvs_.begin(), kvs_.end(),
+                                   [&key](const Value& iter) {
+                                     return iter.key == key;
+                                   });
+      if (existing != kvs_.end()) {
+        *existing = entry;
+      } else {
+        kvs_.push_back(entry);
+      }
       key.clear();
       found_key = false;
       value.clear();
@@ -322,11 +438,11 @@ bool Column::Init(const rapidjson::Value& dd_col_obj) {
   return true;
 }
 
-Column* Column::CreateColumn(const rapidjson::Value& dd_col_obj) {
-  Column* column = new Column();
+Column* Column::CreateColumn(const rapidjson::Value& dd_col_obj,
+                             DictArena* arena) {
+  Column* column = arena->New<Column>();
   bool init_ret = column->Init(dd_col_obj);
   if (!init_ret) {
-    delete column;
     column = nullptr;
   }
   return column;
@@ -938,2668 +1054,8367 @@ bool Column::IsBigCol() const {
            ib_mtype_ == DATA_GEOMETRY));
 }
 
-/* ------ IndexColumn ------ */
-bool IndexColumn::Init(const rapidjson::Value& dd_index_col_obj,
-                              const std::vector<Column*>& columns) {
-  Read(&dd_ordinal_position_, dd_index_col_obj, "ordinal_position");
-  Read(&dd_length_, dd_index_col_obj, "length");
-  ReadEnum(&dd_order_, dd_index_col_obj, "order");
-  Read(&dd_hidden_, dd_index_col_obj, "hidden");
-  Read(&dd_column_opx_, dd_index_col_obj, "column_opx");
-
-  /*
-   * Points to the corresponding Column object.
-   * NOTICE:
-   * The ordinal_position of a Column starts from 1, while
-   * the column_opx of an IndexColumn starts from 0.
-   * However, this is not an issue, as the columns array starts from 0.
-   */
-  column_ = columns[dd_column_opx_];
-  column_->set_index_column(this);
-  return true;
-}
-
-IndexColumn* IndexColumn::CreateIndexColumn(
-                        const rapidjson::Value& dd_index_col_obj,
-                        const std::vector<Column*>& columns) {
-  IndexColumn* element = new IndexColumn(false);
-  bool init_ret = element->Init(dd_index_col_obj, columns);
-  if (!init_ret) {
-    delete element;
-    element = nullptr;
+/* ------ Column values ------ */
+static uint64_t ReadFromNB(const unsigned char* b, uint32_t len) {
+  uint64_t value = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    value = (value << 8) | b[i];
   }
-  return element;
+  return value;
 }
 
-// Used only when creating index columns for a dropped column.
-IndexColumn* IndexColumn::CreateIndexDroppedColumn(Column* dropped_col) {
-  IndexColumn* index_column = new IndexColumn(true);
-  index_column->set_column(dropped_col);
-  dropped_col->set_index_column(index_column);
-
-  return index_column;
+static void WriteToNB(uint64_t value, uint32_t len, std::string* out) {
+  for (uint32_t i = len; i > 0; i--) {
+    out->push_back(static_cast<char>((value >> (8 * (i - 1))) & 0xFF));
+  }
 }
-// Used only when creating a FTS_DOC_ID index column.
-IndexColumn* IndexColumn::CreateIndexFTSDocIdColumn(Column* doc_id_col) {
-  IndexColumn* index_column = new IndexColumn(true);
-  index_column->set_column(doc_id_col);
-  doc_id_col->set_index_column(index_column);
 
-  return index_column;
+static std::string BytesToHex(const unsigned char* data, uint32_t len) {
+  static const char digits[] = "0123456789abcdef";
+  std::string hex = "0x";
+  for (uint32_t i = 0; i < len; i++) {
+    hex.push_back(digits[data[i] >> 4]);
+    hex.push_back(digits[data[i] & 0xF]);
+  }
+  return hex;
 }
 
-/* ------ Index ------ */
-const std::set<std::string> Index::default_valid_option_keys = {
-  "block_size",
-  "flags",
-  "parser_name",
-  "gipk" /* generated implicit primary key */
-};
-
-bool Index::Init(const rapidjson::Value& dd_index_obj,
-                 const std::vector<Column*>& columns) {
-  Read(&dd_name_, dd_index_obj, "name");
-  Read(&dd_hidden_, dd_index_obj, "hidden");
-  Read(&dd_is_generated_, dd_index_obj, "is_generated");
-  Read(&dd_ordinal_position_, dd_index_obj, "ordinal_position");
-  Read(&dd_comment_, dd_index_obj, "comment");
-  ReadProperties(&dd_options_, dd_index_obj, "options");
-  ReadProperties(&dd_se_private_data_, dd_index_obj, "se_private_data");
-  ReadEnum(&dd_type_, dd_index_obj, "type");
-  ReadEnum(&dd_algorithm_, dd_index_obj, "algorithm");
-  Read(&dd_is_algorithm_explicit_, dd_index_obj, "is_algorithm_explicit");
-  Read(&dd_is_visible_, dd_index_obj, "is_visible");
-  Read(&dd_engine_, dd_index_obj, "engine");
-  Read(&dd_engine_attribute_, dd_index_obj, "engine_attribute");
-  Read(&dd_secondary_engine_attribute_, dd_index_obj,
-      "secondary_engine_attribute");
-  if (!dd_index_obj.HasMember("elements") ||
-      !dd_index_obj["elements"].IsArray()) {
-    std::cerr << "[SDI]Can't find index elements" << std::endl;
+static bool HexToBytes(const std::string& str, std::string* out) {
+  if (str.size() < 2 || str[0] != '0' || (str[1] != 'x' && str[1] != 'X') ||
+      str.size() % 2 != 0) {
     return false;
   }
-  const rapidjson::Value& elements = dd_index_obj["elements"].GetArray();
-  for (rapidjson::SizeType i = 0; i < elements.Size(); i++) {
-    if (!elements[i].IsObject()) {
-      std::cerr << "[SDI]Index element isn't an object" << std::endl;
-      return false;
-    }
-    IndexColumn* element = IndexColumn::CreateIndexColumn(elements[i], columns);
-    if (element == nullptr) {
+  for (size_t i = 2; i < str.size(); i += 2) {
+    if (!isxdigit(str[i]) || !isxdigit(str[i + 1])) {
       return false;
     }
-    dd_elements_.push_back(element);
+    out->push_back(static_cast<char>(std::stoul(str.substr(i, 2),
+                                                 nullptr, 16)));
   }
-  Read(&dd_tablespace_ref_, dd_index_obj, "tablespace_ref");
   return true;
 }
 
-Index* Index::CreateIndex(const rapidjson::Value& dd_index_obj,
-                          const std::vector<Column*>& columns,
-                          Table* table) {
-  Index* index = new Index(table);
-  bool init_ret = index->Init(dd_index_obj, columns);
-  if (!init_ret) {
-    delete index;
-    index = nullptr;
+/*
+ * Integers are stored big-endian with the sign bit flipped for signed
+ * types, so that memcmp() order matches numeric order.
+ */
+static int64_t DecodeSignedInt(const unsigned char* data, uint32_t len) {
+  uint64_t value = ReadFromNB(data, len);
+  value ^= (1ULL << (8 * len - 1));
+  if (len < 8 && (value & (1ULL << (8 * len - 1)))) {
+    value |= (~0ULL << (8 * len));
   }
-  return index;
+  return static_cast<int64_t>(value);
 }
 
-#define HA_NOSAME 1
-#define HA_FULLTEXT (1 << 7)
-#define HA_SPATIAL (1 << 10)
-bool Index::FillIndex(uint32_t ind) {
-  s_user_defined_key_parts_ = 0;
-  s_key_length_ = 0;
-  s_flags_ = 0;
+static std::string FormatFraction(uint64_t usec, uint32_t dec) {
+  if (dec == 0) {
+    return "";
+  }
+  char buf[16];
+  snprintf(buf, sizeof(buf), ".%06" PRIu64, usec);
+  return std::string(buf, dec + 1);
+}
 
-  for (auto* iter : dd_elements_) {
-    if (iter->hidden()) {
-      continue;
-    }
-    s_user_defined_key_parts_++;
-    s_key_length_ += iter->length();
+static uint32_t TruncateFraction(uint32_t usec, uint32_t dec) {
+  static const uint32_t pow10[] = {1000000, 100000, 10000, 1000, 100, 10, 1};
+  return usec / pow10[dec] * pow10[dec];
+}
+
+/*
+ * Reads the fractional part of TIME2/DATETIME2/TIMESTAMP2 values,
+ * returned in microseconds (signed for TIME2 and DATETIME2).
+ */
+static int64_t DecodeFraction(const unsigned char* data, uint32_t dec,
+                              bool is_signed) {
+  switch (dec) {
+    case 1:
+    case 2:
+      return (is_signed ? static_cast<int8_t>(data[0]) : data[0]) * 10000LL;
+    case 3:
+    case 4:
+      return (is_signed ? static_cast<int16_t>(ReadFrom2B(data)) :
+                          ReadFrom2B(data)) * 100LL;
+    case 5:
+    case 6:
+      if (is_signed) {
+        int64_t frac = ReadFrom3B(data);
+        return (frac & 0x800000) ? frac - 0x1000000 : frac;
+      }
+      return ReadFrom3B(data);
+    default:
+      return 0;
   }
-  switch (type()) {
-    case Index::IT_MULTIPLE:
-      s_flags_ = 0;
-      break;
-    case Index::IT_FULLTEXT:
-      s_flags_ = HA_FULLTEXT;
+}
+
+static void EncodeFraction(int64_t frac, uint32_t dec, std::string* out) {
+  switch (dec) {
+    case 1:
+    case 2:
+      WriteToNB(static_cast<uint64_t>(frac / 10000), 1, out);
       break;
-    case Index::IT_SPATIAL:
-      s_flags_ = HA_SPATIAL;
+    case 3:
+    case 4:
+      WriteToNB(static_cast<uint64_t>(frac / 100), 2, out);
       break;
-    case Index::IT_PRIMARY:
-    case Index::IT_UNIQUE:
-      s_flags_ = HA_NOSAME;
+    case 5:
+    case 6:
+      WriteToNB(static_cast<uint64_t>(frac), 3, out);
       break;
     default:
-      assert(0);
-      s_flags_ = 0;
+      break;
   }
-  FillSeIndex(ind);
-  return true;
 }
 
-#define FTS_DOC_ID_COL_NAME "FTS_DOC_ID"
-bool Index::IndexAddCol(Column* col, uint32_t prefix_len) {
-  if (col->index_column() != nullptr) {
-    ib_fields_.push_back(col->index_column());
-  } else if (col->name() == FTS_DOC_ID_COL_NAME) {
-    /*
-     * The FTS_DOC_ID column is not defined in the SDI's PRIMARY index columns,
-     * so we need to create it manually.
-     */
-    IndexColumn* index_column = IndexColumn::CreateIndexFTSDocIdColumn(col);
-    ib_fields_.push_back(index_column);
+constexpr uint64_t DATETIMEF_INT_OFS = 0x8000000000ULL;
+constexpr int64_t TIMEF_INT_OFS = 0x800000LL;
+constexpr int64_t TIMEF_OFS = 0x800000000000LL;
+
+static std::string DecodeDatetime2(const unsigned char* data, uint32_t dec) {
+  int64_t intpart = static_cast<int64_t>(ReadFromNB(data, 5) -
+                                         DATETIMEF_INT_OFS);
+  int64_t packed = intpart * (1LL << 24) +
+                   DecodeFraction(data + 5, dec, true);
+  bool neg = packed < 0;
+  uint64_t tmp = neg ? -packed : packed;
+  uint64_t usec = tmp % (1ULL << 24);
+  uint64_t ymdhms = tmp >> 24;
+  uint64_t ymd = ymdhms >> 17;
+  uint64_t ym = ymd >> 5;
+  uint64_t hms = ymdhms % (1 << 17);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s%04u-%02u-%02u %02u:%02u:%02u",
+           neg ? "-" : "",
+           static_cast<uint32_t>(ym / 13), static_cast<uint32_t>(ym % 13),
+           static_cast<uint32_t>(ymd % 32),
+           static_cast<uint32_t>(hms >> 12),
+           static_cast<uint32_t>((hms >> 6) % 64),
+           static_cast<uint32_t>(hms % 64));
+  return buf + FormatFraction(usec, dec);
+}
+
+static std::string DecodeTime2(const unsigned char* data, uint32_t dec) {
+  int64_t packed = 0;
+  if (dec == 5 || dec == 6) {
+    packed = static_cast<int64_t>(ReadFromNB(data, 6)) - TIMEF_OFS;
   } else {
-    assert(col->IsInstantDropped());
-    IndexColumn* index_column = IndexColumn::CreateIndexDroppedColumn(col);
-    ib_fields_.push_back(index_column);
+    int64_t intpart = static_cast<int64_t>(ReadFrom3B(data)) - TIMEF_INT_OFS;
+    int64_t frac = 0;
+    if (dec == 1 || dec == 2) {
+      frac = data[3];
+      if (intpart < 0 && frac) {
+        intpart++;
+        frac -= 0x100;
+      }
+      frac *= 10000;
+    } else if (dec == 3 || dec == 4) {
+      frac = ReadFrom2B(data + 3);
+      if (intpart < 0 && frac) {
+        intpart++;
+        frac -= 0x10000;
+      }
+      frac *= 100;
+    }
+    packed = intpart * (1LL << 24) + frac;
+  }
+  bool neg = packed < 0;
+  uint64_t tmp = neg ? -packed : packed;
+  uint64_t hms = tmp >> 24;
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%s%02u:%02u:%02u", neg ? "-" : "",
+           static_cast<uint32_t>((hms >> 12) % (1 << 10)),
+           static_cast<uint32_t>((hms >> 6) % 64),
+           static_cast<uint32_t>(hms % 64));
+  return buf + FormatFraction(tmp % (1ULL << 24), dec);
+}
+
+static std::string DecodeTimestamp2(const unsigned char* data, uint32_t dec) {
+  time_t seconds = ReadFrom4B(data);
+  int64_t usec = DecodeFraction(data + 4, dec, false);
+  if (seconds == 0 && usec == 0) {
+    return "0000-00-00 00:00:00" + FormatFraction(0, dec);
+  }
+  // TIMESTAMP is stored in UTC, and is shown in UTC here
+  struct tm tm_utc;
+  gmtime_r(&seconds, &tm_utc);
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%04d-%02d-%02d %02d:%02d:%02d",
+           tm_utc.tm_year + 1900, tm_utc.tm_mon + 1, tm_utc.tm_mday,
+           tm_utc.tm_hour, tm_utc.tm_min, tm_utc.tm_sec);
+  return buf + FormatFraction(usec, dec);
+}
+
+/*
+ * Parses "YYYY-MM-DD[ HH:MM:SS[.ffffff]]" and "[-]HH:MM:SS[.ffffff]".
+ */
+static bool ParseFraction(const char* p, uint32_t* usec) {
+  *usec = 0;
+  if (*p == '\0') {
+    return true;
   }
-  ib_n_def_++;
-  if (ib_type_ & HA_SPATIAL &&
-      (col->ib_mtype() == DATA_POINT ||
-       col->ib_mtype() == DATA_VAR_POINT) &&
-      ib_n_def_ == 1) {
-    col->index_column()->set_ib_fixed_len(DATA_MBR_LEN);
-  } else {
-    col->index_column()->set_ib_fixed_len(col->GetFixedSize());
+  if (*p != '.') {
+    return false;
+  }
+  p++;
+  uint32_t n_digits = 0;
+  while (isdigit(*p)) {
+    if (n_digits < 6) {
+      *usec = *usec * 10 + (*p - '0');
+      n_digits++;
+    }
+    p++;
+  }
+  if (*p != '\0' || n_digits == 0) {
+    return false;
+  }
+  for (; n_digits < 6; n_digits++) {
+    *usec *= 10;
   }
+  return true;
+}
 
-  if (prefix_len && col->index_column()->ib_fixed_len() > prefix_len) {
-    col->index_column()->set_ib_fixed_len(prefix_len);
+static bool ParseDatetime(const std::string& str, uint32_t* year,
+                          uint32_t* month, uint32_t* day, uint32_t* hour,
+                          uint32_t* minute, uint32_t* second,
+                          uint32_t* usec) {
+  int consumed = 0;
+  *hour = *minute = *second = *usec = 0;
+  if (sscanf(str.c_str(), "%4u-%2u-%2u%n", year, month, day,
+             &consumed) != 3) {
+    return false;
+  }
+  const char* p = str.c_str() + consumed;
+  if (*p == ' ' || *p == 'T') {
+    int time_consumed = 0;
+    if (sscanf(p + 1, "%2u:%2u:%2u%n", hour, minute, second,
+               &time_consumed) != 3) {
+      return false;
+    }
+    p += 1 + time_consumed;
+    if (!ParseFraction(p, usec)) {
+      return false;
+    }
+  } else if (*p != '\0') {
+    return false;
   }
+  return (*month <= 12 && *day <= 31 && *hour < 24 &&
+          *minute < 60 && *second < 60);
+}
 
-  if (col->index_column()->ib_fixed_len() > DICT_MAX_FIXED_COL_LEN) {
-    col->index_column()->set_ib_fixed_len(0);
+static bool ParseTime(const std::string& str, bool* neg, uint32_t* hour,
+                      uint32_t* minute, uint32_t* second, uint32_t* usec) {
+  const char* p = str.c_str();
+  *neg = (*p == '-');
+  if (*neg) {
+    p++;
+  }
+  int consumed = 0;
+  if (sscanf(p, "%u:%2u:%2u%n", hour, minute, second, &consumed) != 3) {
+    return false;
+  }
+  if (!ParseFraction(p + consumed, usec)) {
+    return false;
   }
+  return (*hour <= 838 && *minute < 60 && *second < 60);
+}
 
-  if (col->is_nullable() &&
-      !col->IsInstantDropped()) {
-    ib_n_nullable_++;
+/*
+ * DECIMAL is stored as groups of 9 digits in 4 bytes, with a shorter
+ * leading and trailing group. Negative values have all bits inverted,
+ * and the sign bit is flipped to make the format memcmp()-comparable.
+ */
+static bool DecimalGetLayout(uint32_t precision, uint32_t scale,
+                             int* intg0, int* intg0x,
+                             int* frac0, int* frac0x) {
+  if (precision == 0 || scale > precision) {
+    return false;
   }
+  int intg = precision - scale;
+  *intg0 = intg / DIG_PER_DEC1;
+  *frac0 = scale / DIG_PER_DEC1;
+  *intg0x = intg - *intg0 * DIG_PER_DEC1;
+  *frac0x = scale - *frac0 * DIG_PER_DEC1;
   return true;
 }
 
-uint32_t Index::GetNOriginalFields() {
-  assert(table_->HasInstantCols());
-  uint32_t n_inst_cols_v1 =  table_->GetNInstantAddedColV1();
-  uint32_t n_drop_cols = table_->GetNInstantDropCols();
-  uint32_t n_add_cols = table_->GetNInstantAddCols();
-  uint32_t n_instant_fields =
-    ib_n_fields_ + n_drop_cols - n_add_cols - n_inst_cols_v1;
-
-  return n_instant_fields;
+static bool DecimalLenMatches(uint32_t len, uint32_t precision,
+                              uint32_t scale) {
+  int intg0, intg0x, frac0, frac0x;
+  return DecimalGetLayout(precision, scale, &intg0, &intg0x,
+                          &frac0, &frac0x) &&
+         len == static_cast<uint32_t>(intg0 * 4 + dig2bytes[intg0x] +
+                                      frac0 * 4 + dig2bytes[frac0x]);
 }
 
-uint32_t Index::GetNNullableBefore(uint32_t nth) {
-  uint32_t nullable = 0;
-  for (uint32_t i = 0; i < nth; i++) {
-    const IndexColumn* index_col = ib_fields_[i];
-    assert(!index_col->column()->IsInstantDropped());
-    if (index_col->column()->is_nullable()) {
-      nullable++;
+// Malformed values are returned as hex
+static std::string DecodeDecimal(const unsigned char* data, uint32_t len,
+                                 uint32_t precision, uint32_t scale) {
+  int intg0, intg0x, frac0, frac0x;
+  if (!DecimalLenMatches(len, precision, scale) ||
+      !DecimalGetLayout(precision, scale, &intg0, &intg0x, &frac0, &frac0x)) {
+    return BytesToHex(data, len);
+  }
+  std::vector<unsigned char> bin(data, data + len);
+  bool neg = ((bin[0] & 0x80) == 0);
+  bin[0] ^= 0x80;
+  if (neg) {
+    for (auto& byte : bin) {
+      byte = ~byte;
     }
   }
-  return nullable;
+  const unsigned char* p = bin.data();
+  std::string int_part;
+  std::string frac_part;
+  char buf[16];
+  if (intg0x > 0) {
+    snprintf(buf, sizeof(buf), "%" PRIu64,
+             ReadFromNB(p, dig2bytes[intg0x]));
+    int_part += buf;
+    p += dig2bytes[intg0x];
+  }
+  for (int i = 0; i < intg0; i++, p += 4) {
+    snprintf(buf, sizeof(buf), "%09u", ReadFrom4B(p));
+    int_part += buf;
+  }
+  for (int i = 0; i < frac0; i++, p += 4) {
+    snprintf(buf, sizeof(buf), "%09u", ReadFrom4B(p));
+    frac_part += buf;
+  }
+  if (frac0x > 0) {
+    snprintf(buf, sizeof(buf), "%0*" PRIu64, frac0x,
+             ReadFromNB(p, dig2bytes[frac0x]));
+    frac_part += buf;
+  }
+  size_t first_digit = int_part.find_first_not_of('0');
+  int_part = (first_digit == std::string::npos) ?
+             "0" : int_part.substr(first_digit);
+  return (neg ? "-" : "") + int_part +
+         (scale > 0 ? "." + frac_part : "");
 }
 
-uint32_t Index::CalculateNInstantNullable(uint32_t n_fields) {
-  if (!table_->HasRowVersions()) {
-    return GetNNullableBefore(n_fields);
+static bool EncodeDecimal(const std::string& str, uint32_t precision,
+                          uint32_t scale, std::string* out) {
+  int intg0, intg0x, frac0, frac0x;
+  if (!DecimalGetLayout(precision, scale, &intg0, &intg0x, &frac0, &frac0x)) {
+    return false;
   }
+  size_t pos = 0;
+  bool neg = false;
+  if (pos < str.size() && (str[pos] == '-' || str[pos] == '+')) {
+    neg = (str[pos] == '-');
+    pos++;
+  }
+  size_t dot = str.find('.', pos);
+  std::string int_part = str.substr(pos, dot == std::string::npos ?
+                                         std::string::npos : dot - pos);
+  std::string frac_part = (dot == std::string::npos) ?
+                          "" : str.substr(dot + 1);
+  if ((int_part.empty() && frac_part.empty()) ||
+      !std::all_of(int_part.begin(), int_part.end(), ::isdigit) ||
+      !std::all_of(frac_part.begin(), frac_part.end(), ::isdigit)) {
+    return false;
+  }
+  size_t first_digit = int_part.find_first_not_of('0');
+  int_part = (first_digit == std::string::npos) ?
+             "" : int_part.substr(first_digit);
+  uint32_t intg = precision - scale;
+  if (int_part.size() > intg || frac_part.size() > scale) {
+    return false;
+  }
+  int_part.insert(0, intg - int_part.size(), '0');
+  frac_part.append(scale - frac_part.size(), '0');
 
-  uint32_t n_drop_nullable_cols = 0;
-  uint32_t new_n_nullable = 0;
-  for (uint32_t i = 0; i < ib_n_def_; i++) {
-    const IndexColumn* index_col = ib_fields_[i];
-    if (index_col->column()->IsInstantAdded()) {
-      continue;
-    }
-    if (index_col->column()->IsInstantDropped()) {
-      if (index_col->column()->ib_phy_pos() < n_fields &&
-          index_col->column()->is_nullable()) {
-        n_drop_nullable_cols++;
-      }
-      continue;
-    }
-
-    if (index_col->column()->ib_phy_pos() < n_fields) {
-      if (index_col->column()->is_nullable()) {
-        new_n_nullable++;
-      }
+  std::string bin;
+  const char* p = int_part.c_str();
+  if (intg0x > 0) {
+    WriteToNB(std::stoull(std::string(p, intg0x)), dig2bytes[intg0x], &bin);
+    p += intg0x;
+  }
+  for (int i = 0; i < intg0; i++, p += DIG_PER_DEC1) {
+    WriteToNB(std::stoull(std::string(p, DIG_PER_DEC1)), 4, &bin);
+  }
+  p = frac_part.c_str();
+  for (int i = 0; i < frac0; i++, p += DIG_PER_DEC1) {
+    WriteToNB(std::stoull(std::string(p, DIG_PER_DEC1)), 4, &bin);
+  }
+  if (frac0x > 0) {
+    WriteToNB(std::stoull(std::string(p, frac0x)), dig2bytes[frac0x], &bin);
+  }
+  bool is_zero = (int_part.find_first_not_of('0') == std::string::npos &&
+                  frac_part.find_first_not_of('0') == std::string::npos);
+  if (neg && !is_zero) {
+    for (auto& byte : bin) {
+      byte = ~byte;
     }
   }
-  new_n_nullable += n_drop_nullable_cols;
-  return new_n_nullable;
+  bin[0] ^= 0x80;
+  out->append(bin);
+  return true;
 }
 
-bool Index::HasInstantColsOrRowVersions() {
-  if (!IsClustered()) {
-    return false;
-  }
-  return (ib_row_versions_ || ib_instant_cols_);
+// Floating point values are stored in little-endian format
+static double DecodeReal(const unsigned char* data, uint32_t len) {
+  uint64_t bits = 0;
+  for (uint32_t i = 0; i < len; i++) {
+    bits |= static_cast<uint64_t>(data[i]) << (8 * i);
+  }
+  if (len == sizeof(float)) {
+    uint32_t bits32 = static_cast<uint32_t>(bits);
+    float value;
+    memcpy(&value, &bits32, sizeof(value));
+    return value;
+  }
+  double value;
+  memcpy(&value, &bits, sizeof(value));
+  return value;
 }
 
-uint32_t Index::GetNullableInVersion(uint8_t version) {
-  return ib_nullables_[version];
+static std::string FormatReal(double value, int precision) {
+  char buf[64];
+  snprintf(buf, sizeof(buf), "%.*g", precision, value);
+  return buf;
 }
 
-uint16_t Index::GetNullableBeforeInstantAddDrop() {
-  if (ib_instant_cols_) {
-    return ib_n_instant_nullable_;
+bool Column::IsUnsignedInt() const {
+  if (se_explicit_ || ib_mtype_ == DATA_SYS) {
+    // DB_ROW_ID, DB_TRX_ID, DB_ROLL_PTR and FTS_DOC_ID
+    return true;
   }
-
-  if (ib_row_versions_) {
-    return GetNullableInVersion(0);
+  switch (DDType2FieldType(dd_type_)) {
+    case MYSQL_TYPE_ENUM:
+    case MYSQL_TYPE_SET:
+    case MYSQL_TYPE_YEAR:
+      // Stored as unsigned integers by InnoDB
+      return true;
+    default:
+      return dd_is_unsigned_;
   }
-
-  return ib_n_nullable_;
 }
 
-uint16_t Index::GetNUniqueInTree() {
-  if (IsClustered()) {
-    return static_cast<uint16_t>(ib_n_uniq_);
-  } else {
-    return static_cast<uint16_t>(GetNFields());
+std::string Column::ValueToString(const unsigned char* data,
+                                  uint32_t len) const {
+  char buf[64];
+  switch (ib_mtype_) {
+    case DATA_SYS:
+      if (dd_name_ == "DB_ROLL_PTR") {
+        return BytesToHex(data, len);
+      }
+      snprintf(buf, sizeof(buf), "%" PRIu64, ReadFromNB(data, len));
+      return buf;
+    case DATA_INT: {
+      if (len == 0 || len > 8) {
+        return BytesToHex(data, len);
+      }
+      bool is_unsigned = IsUnsignedInt();
+      uint64_t u_value = ReadFromNB(data, len);
+      int64_t s_value = is_unsigned ? 0 : DecodeSignedInt(data, len);
+      if (!se_explicit_) {
+        switch (DDType2FieldType(dd_type_)) {
+          case MYSQL_TYPE_YEAR:
+            snprintf(buf, sizeof(buf), "%04" PRIu64,
+                     u_value == 0 ? 0 : u_value + 1900);
+            return buf;
+          case MYSQL_TYPE_NEWDATE:
+            snprintf(buf, sizeof(buf), "%04" PRId64 "-%02" PRId64
+                     "-%02" PRId64, s_value >> 9, (s_value >> 5) & 15,
+                     s_value & 31);
+            return buf;
+          default:
+            break;
+        }
+      }
+      if (is_unsigned) {
+        snprintf(buf, sizeof(buf), "%" PRIu64, u_value);
+      } else {
+        snprintf(buf, sizeof(buf), "%" PRId64, s_value);
+      }
+      return buf;
+    }
+    case DATA_FLOAT: {
+      if (len != sizeof(float)) {
+        return BytesToHex(data, len);
+      }
+      return FormatReal(DecodeReal(data, len), 6);
+    }
+    case DATA_DOUBLE: {
+      if (len != sizeof(double)) {
+        return BytesToHex(data, len);
+      }
+      double value = DecodeReal(data, len);
+      std::string str = FormatReal(value, 15);
+      if (strtod(str.c_str(), nullptr) != value) {
+        str = FormatReal(value, 17);
+      }
+      return str;
+    }
+    case DATA_FIXBINARY:
+    case DATA_BINARY:
+      if (se_explicit_) {
+        return BytesToHex(data, len);
+      }
+      switch (DDType2FieldType(dd_type_)) {
+        case MYSQL_TYPE_NEWDECIMAL:
+          return DecodeDecimal(data, len, dd_numeric_precision_,
+                               dd_numeric_scale_);
+        case MYSQL_TYPE_DATETIME2:
+          if (len != PackLength()) {
+            return BytesToHex(data, len);
+          }
+          return DecodeDatetime2(data, dd_datetime_precision_);
+        case MYSQL_TYPE_TIME2:
+          if (len != PackLength()) {
+            return BytesToHex(data, len);
+          }
+          return DecodeTime2(data, dd_datetime_precision_);
+        case MYSQL_TYPE_TIMESTAMP2:
+          if (len != PackLength()) {
+            return BytesToHex(data, len);
+          }
+          return DecodeTimestamp2(data, dd_datetime_precision_);
+        default:
+          return BytesToHex(data, len);
+      }
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB: {
+      enum_field_types real_type = DDType2FieldType(dd_type_);
+      if (dd_collation_id_ == 63 || real_type == MYSQL_TYPE_JSON ||
+          real_type == MYSQL_TYPE_GEOMETRY) {
+        return BytesToHex(data, len);
+      }
+      std::string value(reinterpret_cast<const char*>(data), len);
+      if (real_type == MYSQL_TYPE_STRING) {
+        // CHAR values are right-padded with spaces
+        value.erase(value.find_last_not_of(' ') + 1);
+      }
+      return value;
+    }
+    default:
+      return BytesToHex(data, len);
   }
 }
-uint16_t Index::GetNUniqueInTreeNonleaf() {
-  if (ib_type_ & DICT_SPATIAL) {
-    // TODO(zhao): support spatial Index
-    assert(0);
-    return DICT_INDEX_SPATIAL_NODEPTR_SIZE;
-  } else {
-    return static_cast<uint16_t>(GetNUniqueInTree());
+
+bool Column::StringToValue(const std::string& str, std::string* value) const {
+  value->clear();
+  switch (ib_mtype_) {
+    case DATA_SYS:
+    case DATA_INT: {
+      uint32_t len = ib_col_len_;
+      if (len == 0 || len > 8 || str.empty()) {
+        return false;
+      }
+      if (dd_name_ == "DB_ROLL_PTR") {
+        return HexToBytes(str, value) && value->size() == len;
+      }
+      if (!se_explicit_) {
+        switch (DDType2FieldType(dd_type_)) {
+          case MYSQL_TYPE_YEAR: {
+            if (!std::all_of(str.begin(), str.end(), ::isdigit)) {
+              return false;
+            }
+            uint64_t year = std::stoull(str);
+            if (year != 0 && (year < 1901 || year > 2155)) {
+              return false;
+            }
+            WriteToNB(year == 0 ? 0 : year - 1900, len, value);
+            return true;
+          }
+          case MYSQL_TYPE_NEWDATE: {
+            uint32_t year, month, day, hour, minute, second, usec;
+            if (!ParseDatetime(str, &year, &month, &day,
+                               &hour, &minute, &second, &usec)) {
+              return false;
+            }
+            uint64_t packed = (year << 9) | (month << 5) | day;
+            WriteToNB(packed ^ (1ULL << (8 * len - 1)), len, value);
+            return true;
+          }
+          default:
+            break;
+        }
+      }
+      size_t end = 0;
+      if (IsUnsignedInt()) {
+        if (str[0] == '-' || !isdigit(str[0])) {
+          return false;
+        }
+        uint64_t u_value = 0;
+        try {
+          u_value = std::stoull(str, &end);
+        } catch (...) {
+          return false;
+        }
+        if (end != str.size() ||
+            (len < 8 && u_value >= (1ULL << (8 * len)))) {
+          return false;
+        }
+        WriteToNB(u_value, len, value);
+      } else {
+        int64_t s_value = 0;
+        try {
+          s_value = std::stoll(str, &end);
+        } catch (...) {
+          return false;
+        }
+        if (end != str.size()) {
+          return false;
+        }
+        if (len < 8 && (s_value >= (1LL << (8 * len - 1)) ||
+                        s_value < -(1LL << (8 * len - 1)))) {
+          return false;
+        }
+        WriteToNB(static_cast<uint64_t>(s_value) ^ (1ULL << (8 * len - 1)),
+                  len, value);
+      }
+      return true;
+    }
+    case DATA_FLOAT:
+    case DATA_DOUBLE: {
+      // strtod, unlike std::stod, accepts denormals such as 5e-324
+      char* end = nullptr;
+      double real = strtod(str.c_str(), &end);
+      if (str.empty() || end != str.c_str() + str.size()) {
+        return false;
+      }
+      uint64_t bits = 0;
+      uint32_t len = 0;
+      if (ib_mtype_ == DATA_FLOAT) {
+        float single = static_cast<float>(real);
+        uint32_t bits32;
+        memcpy(&bits32, &single, sizeof(single));
+        bits = bits32;
+        len = sizeof(float);
+      } else {
+        memcpy(&bits, &real, sizeof(real));
+        len = sizeof(double);
+      }
+      for (uint32_t i = 0; i < len; i++) {
+        value->push_back(static_cast<char>((bits >> (8 * i)) & 0xFF));
+      }
+      return true;
+    }
+    case DATA_FIXBINARY:
+    case DATA_BINARY:
+      if (!se_explicit_) {
+        uint32_t dec = dd_datetime_precision_;
+        switch (DDType2FieldType(dd_type_)) {
+          case MYSQL_TYPE_NEWDECIMAL:
+            return EncodeDecimal(str, dd_numeric_precision_,
+                                 dd_numeric_scale_, value);
+          case MYSQL_TYPE_DATETIME2: {
+            uint32_t year, month, day, hour, minute, second, usec;
+            if (!ParseDatetime(str, &year, &month, &day,
+                               &hour, &minute, &second, &usec)) {
+              return false;
+            }
+            uint64_t ymd = ((year * 13ULL + month) << 5) | day;
+            uint64_t hms = (hour << 12) | (minute << 6) | second;
+            WriteToNB(((ymd << 17) | hms) + DATETIMEF_INT_OFS, 5, value);
+            EncodeFraction(TruncateFraction(usec, dec), dec, value);
+            return true;
+          }
+          case MYSQL_TYPE_TIMESTAMP2: {
+            uint32_t year, month, day, hour, minute, second, usec;
+            if (!ParseDatetime(str, &year, &month, &day,
+                               &hour, &minute, &second, &usec)) {
+              return false;
+            }
+            uint64_t seconds = 0;
+            if (year != 0) {
+              struct tm tm_utc = {};
+              tm_utc.tm_year = year - 1900;
+              tm_utc.tm_mon = month - 1;
+              tm_utc.tm_mday = day;
+              tm_utc.tm_hour = hour;
+              tm_utc.tm_min = minute;
+              tm_utc.tm_sec = second;
+              seconds = timegm(&tm_utc);
+            }
+            WriteToNB(seconds, 4, value);
+            EncodeFraction(TruncateFraction(usec, dec), dec, value);
+            return true;
+          }
+          case MYSQL_TYPE_TIME2: {
+            bool neg;
+            uint32_t hour, minute, second, usec;
+            if (!ParseTime(str, &neg, &hour, &minute, &second, &usec)) {
+              return false;
+            }
+            int64_t hms = (hour << 12) | (minute << 6) | second;
+            int64_t packed = hms * (1LL << 24) + TruncateFraction(usec, dec);
+            if (neg) {
+              packed = -packed;
+            }
+            if (dec == 5 || dec == 6) {
+              WriteToNB(packed + TIMEF_OFS, 6, value);
+              return true;
+            }
+            int64_t intpart = packed >> 24;
+            int64_t frac = packed % (1LL << 24);
+            if (dec == 1 || dec == 2) {
+              frac /= 10000;
+              if (intpart < 0 && frac) {
+                intpart--;
+                frac += 0x100;
+              }
+            } else if (dec == 3 || dec == 4) {
+              frac /= 100;
+              if (intpart < 0 && frac) {
+                intpart--;
+                frac += 0x10000;
+              }
+            }
+            WriteToNB(intpart + TIMEF_INT_OFS, 3, value);
+            if (dec > 0) {
+              WriteToNB(frac, (dec + 1) / 2, value);
+            }
+            return true;
+          }
+          default:
+            break;
+        }
+      }
+      if (!HexToBytes(str, value)) {
+        value->assign(str);
+      }
+      if (ib_mtype_ == DATA_FIXBINARY && value->size() < ib_col_len_) {
+        // BINARY(N) values are right-padded with 0x00
+        value->append(ib_col_len_ - value->size(), '\0');
+      }
+      return true;
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB:
+      if (dd_collation_id_ != 63 || !HexToBytes(str, value)) {
+        value->assign(str);
+      }
+      return true;
+    default:
+      return false;
   }
 }
 
-IndexColumn* Index::GetPhysicalField(size_t pos) {
-  if (ib_row_versions_) {
-    return ib_fields_[ib_fields_array_[pos]];
-  }
+/*
+ * Strings are only ordered exactly in the collations that compare bytes:
+ * binary and utf8mb4_0900_bin compare them as they are (NO PAD), and the
+ * other _bin collations of ASCII-based character sets compare them as if
+ * the shorter one were padded with spaces (PAD SPACE). Byte order is code
+ * point order in UTF-8, which is what utf8mb4_bin compares. Every other
+ * collation, e.g., the UCA-based utf8mb4_0900_ai_ci or the _general_ci
+ * ones, orders strings by weight tables that are not implemented here, so
+ * features that rely on the order of string values refuse such columns.
+ */
+struct StringCollation {
+  bool no_pad;
+  bool is_exact;
+  bool utf8;
+};
 
-  return ib_fields_[pos];
+static StringCollation GetStringCollation(uint64_t collation_id) {
+  auto iter = g_collation_map.find(static_cast<int>(collation_id));
+  std::string name = (iter == g_collation_map.end()) ?
+                     "" : iter->second.name;
+  // Character sets in which a space is not the single byte 0x20, or whose
+  // _bin collation does not compare bytes
+  static const char* const non_byte_charsets[] = {
+    "ucs2_", "utf16_", "utf16le_", "utf32_", "gb18030_"
+  };
+  StringCollation coll;
+  coll.no_pad = (name == "binary" ||
+                 name.find("_0900_") != std::string::npos ||
+                 name.find("_nopad_") != std::string::npos);
+  coll.is_exact = (name == "binary" ||
+                   (name.size() > 4 &&
+                    name.compare(name.size() - 4, 4, "_bin") == 0));
+  for (const char* charset : non_byte_charsets) {
+    if (name.compare(0, strlen(charset), charset) == 0) {
+      coll.is_exact = false;
+    }
+  }
+  coll.utf8 = (name.compare(0, 4, "utf8") == 0);
+  return coll;
 }
 
-uint32_t Index::GetNFields() const {
-  if (table_->HasRowVersions()) {
-    return ib_n_total_fields_;
+static uint32_t NextCodePoint(const unsigned char** p,
+                              const unsigned char* end, bool utf8) {
+  uint32_t c = *(*p)++;
+  if (!utf8 || c < 0x80) {
+    return c;
   }
-  return ib_n_fields_;
+  uint32_t n_extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+  c &= (0x3F >> n_extra);
+  for (uint32_t i = 0; i < n_extra && *p < end && (**p & 0xC0) == 0x80; i++) {
+    c = (c << 6) | (*(*p)++ & 0x3F);
+  }
+  return c;
 }
 
-#define UNSUPP_INDEX_MASK 0x7
-#define UNSUPP_INDEX_MASK_VIRTUAL 0x1
-#define UNSUPP_INDEX_MASK_FTS 0x2
-#define UNSUPP_INDEX_MASK_SPATIAL 0x4
-void Index::PreCheck() {
-  if (dd_type_ == IT_FULLTEXT) {
-    unsupported_reason_ |= UNSUPP_INDEX_MASK_FTS;
+static int CompareString(uint64_t collation_id,
+                         const unsigned char* a, uint32_t a_len,
+                         const unsigned char* b, uint32_t b_len) {
+  StringCollation coll = GetStringCollation(collation_id);
+  int ret = memcmp(a, b, std::min(a_len, b_len));
+  if (ret != 0) {
+    return (ret < 0) ? -1 : 1;
+  }
+  if (coll.no_pad || a_len == b_len) {
+    return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
+  }
+  // PAD SPACE: the rest of the longer string is compared with spaces
+  const unsigned char* rest = (a_len > b_len) ? a + b_len : b + a_len;
+  const unsigned char* rest_end = (a_len > b_len) ? a + a_len : b + b_len;
+  int sign = (a_len > b_len) ? 1 : -1;
+  for (; rest < rest_end; rest++) {
+    if (*rest != ' ') {
+      return (*rest > ' ') ? sign : -sign;
+    }
   }
-  if (dd_type_ == IT_SPATIAL) {
-    unsupported_reason_ |= UNSUPP_INDEX_MASK_SPATIAL;
+  return 0;
+}
+
+/*
+ * Bytes are escaped so that the encoding is prefix-free: 0x00 becomes
+ * 0x00 0xFF and the value ends with 0x00 0x01, which sorts a value before
+ * any longer value it is a prefix of.
+ */
+static void AppendEscapedBytes(const unsigned char* data, uint32_t len,
+                               std::string* out) {
+  for (uint32_t i = 0; i < len; i++) {
+    out->push_back(static_cast<char>(data[i]));
+    if (data[i] == 0) {
+      out->push_back(static_cast<char>(0xFF));
+    }
   }
-  for (auto* iter : dd_elements_) {
-    if (iter->hidden()) {
+  out->push_back(0);
+  out->push_back(1);
+}
+
+/*
+ * The sort key of a PAD SPACE string, where the end of a string compares
+ * like an endless run of spaces. Trailing spaces are dropped, and the
+ * other bytes are kept except spaces: a run of k spaces before a byte c
+ * becomes 0x20, then 0x02 and ~k if c sorts after a space, or 0x00 and k
+ * if it sorts before one. The string ends with 0x20 0x01, which sorts
+ * between the two kinds of runs, and after any byte below 0x20.
+ */
+static void AppendPadSpaceSortKey(const unsigned char* data, uint32_t len,
+                                  std::string* out) {
+  while (len > 0 && data[len - 1] == ' ') {
+    len--;
+  }
+  for (uint32_t i = 0; i < len;) {
+    if (data[i] != ' ') {
+      out->push_back(static_cast<char>(data[i++]));
       continue;
     }
-    if (iter->column()->is_virtual()) {
-      unsupported_reason_ |= UNSUPP_INDEX_MASK_VIRTUAL;
-      break;
+    uint32_t n_spaces = 0;
+    while (data[i] == ' ') {
+      n_spaces++;
+      i++;
     }
-  }
-}
-bool Index::IsIndexSupported() {
-  return (unsupported_reason_ & UNSUPP_INDEX_MASK) == 0;
+    // Not a trailing run, so data[i] is the byte after it
+    bool after = (data[i] > ' ');
+    out->push_back(' ');
+    out->push_back(after ? 2 : 0);
+    WriteToNB(after ? ~n_spaces : n_spaces, 4, out);
+  }
+  out->push_back(' ');
+  out->push_back(1);
 }
-std::string Index::UnsupportedReason() {
-  assert(!IsIndexSupported());
-  std::string reason = "";
-  if (unsupported_reason_ & UNSUPP_INDEX_MASK_VIRTUAL) {
-    reason += "[Index using virtual columns as keys]";
+
+static void AppendStringSortKey(uint64_t collation_id,
+                                const unsigned char* data, uint32_t len,
+                                std::string* out) {
+  if (GetStringCollation(collation_id).no_pad) {
+    AppendEscapedBytes(data, len, out);
+  } else {
+    AppendPadSpaceSortKey(data, len, out);
   }
-  if (unsupported_reason_ & UNSUPP_INDEX_MASK_FTS) {
-    reason += "[Fulltext index]";
+}
+
+bool Column::IsOrderSupported() const {
+  switch (ib_mtype_) {
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB: {
+      enum_field_types real_type = DDType2FieldType(dd_type_);
+      if (dd_collation_id_ == 63 || real_type == MYSQL_TYPE_JSON ||
+          real_type == MYSQL_TYPE_GEOMETRY) {
+        return true;
+      }
+      return GetStringCollation(dd_collation_id_).is_exact;
+    }
+    default:
+      return true;
   }
-  if (unsupported_reason_ & UNSUPP_INDEX_MASK_SPATIAL) {
-    reason += "[Spatial index]";
+}
+
+bool Column::IsPadSpace() const {
+  switch (ib_mtype_) {
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB: {
+      enum_field_types real_type = DDType2FieldType(dd_type_);
+      if (dd_collation_id_ == 63 || real_type == MYSQL_TYPE_JSON ||
+          real_type == MYSQL_TYPE_GEOMETRY) {
+        return false;
+      }
+      // CHAR values are space-padded, even with NO PAD collations
+      return real_type == MYSQL_TYPE_STRING ||
+             !GetStringCollation(dd_collation_id_).no_pad;
+    }
+    default:
+      return false;
   }
-  return reason;
 }
-bool Index::IsIndexParsingRecSupported() {
-  if (!table_->IsTableParsingRecSupported()) {
-    return false;
+
+std::string Column::CollationName() const {
+  auto iter = g_collation_map.find(static_cast<int>(dd_collation_id_));
+  if (iter == g_collation_map.end()) {
+    return "#" + std::to_string(dd_collation_id_);
   }
-  return IsIndexSupported();
-  // Additional checks may be needed here.
+  return iter->second.name;
 }
-#define FTS_DOC_ID_INDEX_NAME "FTS_DOC_ID_INDEX"
-bool Index::FillSeIndex(uint32_t ind) {
-  PreCheck();
-  if (!IsIndexSupported()) {
+
+// Features that rely on the order or equality of values refuse a column
+// whose collation is not implemented exactly
+static bool CheckOrderSupported(const Column* col) {
+  if (col->IsOrderSupported()) {
     return true;
   }
-  ib_n_fields_ = s_user_defined_key_parts_;
-  ib_n_uniq_ = ib_n_fields_;
-  if (s_flags_ & HA_SPATIAL) {
-    ib_type_ = DICT_SPATIAL;
-    assert(ib_n_fields_ == 1);
-  } else if (s_flags_ & HA_FULLTEXT) {
-    ib_type_ = DICT_FTS;
-    ib_n_uniq_ = 0;
-  } else if (ind == 0) {
-    assert(s_flags_ & HA_NOSAME);
-    // dd_hidden_ == true means there no explicit primary index
-    assert(ib_n_uniq_ > 0 || dd_hidden_ == true);
-    if (dd_hidden_ == false) {
-      ib_type_ = DICT_CLUSTERED | DICT_UNIQUE;
-    } else {
-      /*
-       * The implicit primary index type is DICT_CLUSTERED.
-       * This is made consistent with InnoDB.
-       */
-      ib_type_ = DICT_CLUSTERED;
-    }
-  } else {
-    ib_type_ = (s_flags_ & HA_NOSAME) ? DICT_UNIQUE : 0;
-  }
-
-  ib_n_def_ = 0;
-  ib_n_nullable_ = 0;
-  ib_fields_.clear();
+  ninja_error("Column %s uses collation %s, whose order is not implemented. "
+              "Only binary and _bin collations are supported",
+              col->name().c_str(), col->CollationName().c_str());
+  return false;
+}
 
-  for (auto* iter : dd_elements_) {
-    if (iter->hidden()) {
-      continue;
+int Column::CompareValue(const unsigned char* a, uint32_t a_len,
+                         const unsigned char* b, uint32_t b_len) const {
+  switch (ib_mtype_) {
+    case DATA_FLOAT:
+    case DATA_DOUBLE: {
+      double a_value = DecodeReal(a, a_len);
+      double b_value = DecodeReal(b, b_len);
+      return (a_value < b_value) ? -1 : (a_value > b_value) ? 1 : 0;
     }
-    uint32_t prefix_len = 0;
-    IndexAddCol(iter->column(), prefix_len);
-  }
-
-  /*
-   * Special case: "FTS_DOC_ID_INDEX"
-   * The columns of FTS_DOC_ID_INDEX defined in the SDI are correct,
-   * but the information for the FTS_DOC_ID column is
-   * missing (e.g., ib_mtype_).
-   * Note that we have created a new FTS_DOC_ID in Table::ib_cols_,
-   * so use that instead.
-   */
-  if (dd_name_ == FTS_DOC_ID_INDEX_NAME) {
-    for (auto* iter : dd_elements_) {
-      if (iter->column()->name() == FTS_DOC_ID_COL_NAME) {
-        for (auto* col : *table()->ib_cols()) {
-          if (col->name() == FTS_DOC_ID_COL_NAME) {
-            iter->set_column(col);
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB: {
+      enum_field_types real_type = DDType2FieldType(dd_type_);
+      if (dd_collation_id_ != 63 && real_type != MYSQL_TYPE_JSON &&
+          real_type != MYSQL_TYPE_GEOMETRY) {
+        if (real_type == MYSQL_TYPE_STRING) {
+          // CHAR values are space-padded, even with NO PAD collations
+          while (a_len > 0 && a[a_len - 1] == ' ') {
+            a_len--;
+          }
+          while (b_len > 0 && b[b_len - 1] == ' ') {
+            b_len--;
           }
         }
+        return CompareString(dd_collation_id_, a, a_len, b, b_len);
       }
-      /*
-       * The user has explicitly defined the FTS_DOC_ID column,
-       * so no need to add another.
-       */
-      if (iter->hidden()) {
-        IndexAddCol(iter->column(), 0);
+    }
+      [[fallthrough]];
+    default: {
+      int ret = memcmp(a, b, std::min(a_len, b_len));
+      if (ret != 0) {
+        return (ret < 0) ? -1 : 1;
       }
+      return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
     }
   }
+}
 
-  if (IsClustered()) {
-    ib_n_user_defined_cols_ = s_user_defined_key_parts_;
-    if (!IsIndexUnique()) {
-      ib_n_uniq_ += 1;
-    }
-    uint32_t n_fields_processed = 0;
-    while (n_fields_processed < ib_n_def_) {
-      IndexColumn* col = ib_fields_[n_fields_processed];
-      if (!table()->HasRowVersions()) {
-        col->column()->set_ib_phy_pos(n_fields_processed);
-      } else {
-        assert(col->column()->ib_phy_pos() != UINT32_UNDEFINED);
+void Column::AppendSortKey(const unsigned char* data, uint32_t len,
+                           std::string* out) const {
+  switch (ib_mtype_) {
+    case DATA_SYS:
+    case DATA_INT:
+      // Stored big-endian with the sign bit flipped, in a fixed length
+      out->append(reinterpret_cast<const char*>(data), len);
+      return;
+    case DATA_FLOAT:
+    case DATA_DOUBLE: {
+      double value = DecodeReal(data, len);
+      if (value == 0) {
+        // -0 and 0 are equal
+        value = 0;
       }
-      n_fields_processed++;
+      uint64_t bits;
+      memcpy(&bits, &value, sizeof(bits));
+      bits = (bits & (1ULL << 63)) ? ~bits : (bits | (1ULL << 63));
+      for (int shift = 56; shift >= 0; shift -= 8) {
+        out->push_back(static_cast<char>((bits >> shift) & 0xFF));
+      }
+      return;
     }
-    bool found_db_row_id = false;
-    bool found_db_trx_id = false;
-    bool found_db_roll_ptr = false;
-    for (auto* col : *(table()->ib_cols())) {
-      if (!IsIndexUnique() && col->name() == "DB_ROW_ID") {
-        found_db_row_id = true;
-        if (!table()->HasRowVersions()) {
-          col->set_ib_phy_pos(n_fields_processed);
-        } else {
-          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
+    case DATA_CHAR:
+    case DATA_MYSQL:
+    case DATA_VARCHAR:
+    case DATA_VARMYSQL:
+    case DATA_BLOB: {
+      enum_field_types real_type = DDType2FieldType(dd_type_);
+      if (dd_collation_id_ != 63 && real_type != MYSQL_TYPE_JSON &&
+          real_type != MYSQL_TYPE_GEOMETRY) {
+        if (real_type == MYSQL_TYPE_STRING) {
+          while (len > 0 && data[len - 1] == ' ') {
+            len--;
+          }
         }
-        IndexAddCol(col, 0);
-        n_fields_processed++;
-        ib_n_fields_++;
+        AppendStringSortKey(dd_collation_id_, data, len, out);
+        return;
       }
-      if (col->name() == "DB_TRX_ID") {
-        found_db_trx_id = true;
-        if (!table()->HasRowVersions()) {
-          col->set_ib_phy_pos(n_fields_processed);
-        } else {
-          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
-        }
-        IndexAddCol(col, 0);
-        n_fields_processed++;
-        ib_n_fields_++;
+    }
+      [[fallthrough]];
+    default:
+      AppendEscapedBytes(data, len, out);
+      return;
+  }
+}
+
+/*
+ * Integer, YEAR, DECIMAL, FLOAT and DOUBLE columns, and DB_ROW_ID/DB_TRX_ID,
+ * can be summed and averaged.
+ */
+bool Column::IsNumeric() const {
+  switch (ib_mtype_) {
+    case DATA_SYS:
+      return dd_name_ != "DB_ROLL_PTR";
+    case DATA_INT:
+      if (se_explicit_) {
+        return true;
       }
-      if (col->name() == "DB_ROLL_PTR") {
-        found_db_roll_ptr = true;
-        if (!table()->HasRowVersions()) {
-          col->set_ib_phy_pos(n_fields_processed);
-        } else {
-          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
+      switch (DDType2FieldType(dd_type_)) {
+        case MYSQL_TYPE_NEWDATE:
+        case MYSQL_TYPE_ENUM:
+        case MYSQL_TYPE_SET:
+          return false;
+        default:
+          return true;
+      }
+    case DATA_FLOAT:
+    case DATA_DOUBLE:
+      return true;
+    case DATA_FIXBINARY:
+      return !se_explicit_ &&
+             DDType2FieldType(dd_type_) == MYSQL_TYPE_NEWDECIMAL;
+    default:
+      return false;
+  }
+}
+
+bool Column::ValueToNumber(const unsigned char* data, uint32_t len,
+                           long double* value) const {
+  switch (ib_mtype_) {
+    case DATA_SYS:
+    case DATA_INT:
+      if (len == 0 || len > 8) {
+        return false;
+      }
+      if (IsUnsignedInt()) {
+        uint64_t u_value = ReadFromNB(data, len);
+        if (!se_explicit_ && ib_mtype_ == DATA_INT &&
+            DDType2FieldType(dd_type_) == MYSQL_TYPE_YEAR && u_value != 0) {
+          u_value += 1900;
         }
-        IndexAddCol(col, 0);
-        n_fields_processed++;
-        ib_n_fields_++;
+        *value = u_value;
+      } else {
+        *value = DecodeSignedInt(data, len);
+      }
+      return true;
+    case DATA_FLOAT:
+    case DATA_DOUBLE:
+      if (len != ((ib_mtype_ == DATA_FLOAT) ? sizeof(float) :
+                                               sizeof(double))) {
+        return false;
       }
+      *value = DecodeReal(data, len);
+      return true;
+    case DATA_FIXBINARY: {
+      std::string str = DecodeDecimal(data, len, dd_numeric_precision_,
+                                      dd_numeric_scale_);
+      char* end = nullptr;
+      *value = strtold(str.c_str(), &end);
+      return !str.empty() && *end == '\0';
     }
-    assert((IsIndexUnique() || found_db_row_id) &&
-        found_db_trx_id && found_db_roll_ptr);
+    default:
+      return false;
+  }
+}
 
-    std::vector<bool> indexed(table()->GetTotalCols(), false);
-    for (auto* iter : ib_fields_) {
-      indexed[iter->column()->ib_ind()] = true;
-    }
-    for (uint32_t i = 0; i < table()->ib_n_cols() - DATA_N_SYS_COLS; i++) {
-      Column* col = table()->ib_cols()->at(i);
-      assert(col->ib_mtype() != DATA_SYS);
-      if (indexed[col->ib_ind()]) {
-        continue;
+/*
+ * Decodes a value of an exact numeric column (integers and DECIMAL) as
+ * decimal text with NumberScale() fractional digits, e.g., "-12.50".
+ * Returns false for other columns and malformed values.
+ */
+bool Column::ValueToDecimal(const unsigned char* data, uint32_t len,
+                            std::string* value) const {
+  if (!IsNumeric() || NumberScale() < 0) {
+    return false;
+  }
+  switch (ib_mtype_) {
+    case DATA_SYS:
+    case DATA_INT:
+      if (len == 0 || len > 8) {
+        return false;
       }
-      if (!table()->HasRowVersions()) {
-        col->set_ib_phy_pos(n_fields_processed);
+      if (IsUnsignedInt()) {
+        uint64_t u_value = ReadFromNB(data, len);
+        if (!se_explicit_ && ib_mtype_ == DATA_INT &&
+            DDType2FieldType(dd_type_) == MYSQL_TYPE_YEAR && u_value != 0) {
+          u_value += 1900;
+        }
+        *value = std::to_string(u_value);
       } else {
-        assert(col->ib_phy_pos() != UINT32_UNDEFINED);
+        *value = std::to_string(DecodeSignedInt(data, len));
+      }
+      return true;
+    case DATA_FIXBINARY:
+      if (!DecimalLenMatches(len, dd_numeric_precision_,
+                             dd_numeric_scale_)) {
+        return false;
       }
+      *value = DecodeDecimal(data, len, dd_numeric_precision_,
+                             dd_numeric_scale_);
+      return true;
+    default:
+      return false;
+  }
+}
 
-      IndexAddCol(col, 0);
-      n_fields_processed++;
-      ib_n_fields_++;
-    }
-    for (uint32_t i = table()->ib_n_cols(); i < table()->GetTotalCols(); i++) {
-      Column* col = table()->ib_cols()->at(i);
-      assert(col->ib_mtype() != DATA_SYS);
-      IndexAddCol(col, 0);
-      n_fields_processed++;
-      // Do not add ib_n_fields_ here, as we are adding dropped columns.
-    }
-    if (!table()->ib_is_system_table()) {
-      ib_fields_array_.clear();
-      memset(ib_nullables_, 0,
-          (MAX_ROW_VERSION + 1) * sizeof(ib_nullables_[0]));
-      if (table()->HasRowVersions()) {
-        ib_fields_array_.resize(ib_n_def_);
-        for (uint32_t i = 0; i < ib_n_def_; i++) {
-          IndexColumn *index_col = ib_fields_[i];
-          assert(index_col != nullptr && index_col->column() != nullptr);
+int Column::NumberScale() const {
+  switch (ib_mtype_) {
+    case DATA_FLOAT:
+    case DATA_DOUBLE:
+      return -1;
+    case DATA_FIXBINARY:
+      return dd_numeric_scale_;
+    default:
+      return 0;
+  }
+}
 
-          size_t pos = index_col->column()->ib_phy_pos();
+/*
+ * Checks whether a stored string value starts with prefix, comparing the
+ * same number of characters with the column collation.
+ */
+bool Column::HasPrefix(const unsigned char* data, uint32_t len,
+                       const std::string& prefix) const {
+  auto iter = g_collation_map.find(static_cast<int>(dd_collation_id_));
+  bool utf8 = (iter != g_collation_map.end() &&
+               iter->second.name.compare(0, 4, "utf8") == 0);
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(
+                               prefix.data());
+  const unsigned char* p_end = p + prefix.size();
+  const unsigned char* d = data;
+  const unsigned char* d_end = data + len;
+  while (p < p_end) {
+    if (d >= d_end) {
+      return false;
+    }
+    NextCodePoint(&p, p_end, utf8);
+    NextCodePoint(&d, d_end, utf8);
+  }
+  return CompareValue(reinterpret_cast<const unsigned char*>(prefix.data()),
+                      prefix.size(), data, d - data) == 0;
+}
 
-          ib_fields_array_[pos] = i;
-        }
+/* ------ IndexColumn ------ */
+bool IndexColumn::Init(const rapidjson::Value& dd_index_col_obj,
+                              const std::vector<Column*>& columns) {
+  Read(&dd_ordinal_position_, dd_index_col_obj, "ordinal_position");
+  Read(&dd_length_, dd_index_col_obj, "length");
+  ReadEnum(&dd_order_, dd_index_col_obj, "order");
+  Read(&dd_hidden_, dd_index_col_obj, "hidden");
+  Read(&dd_column_opx_, dd_index_col_obj, "column_opx");
 
-        uint32_t current_row_version = table()->ib_current_row_version();
-        auto update_nullable = [&](size_t start_version, bool is_increment) {
-          for (size_t i = start_version; i <= current_row_version; i++) {
-            assert(is_increment || ib_nullables_[i] > 0);
+  /*
+   * Points to the corresponding Column object.
+   * NOTICE:
+   * The ordinal_position of a Column starts from 1, while
+   * the column_opx of an IndexColumn starts from 0.
+   * However, this is not an issue, as the columns array starts from 0.
+   */
+  column_ = columns[dd_column_opx_];
+  column_->set_index_column(this);
+  return true;
+}
 
-            if (is_increment) {
-              ++ib_nullables_[i];
-            } else {
-              --ib_nullables_[i];
-            }
-          }
-        };
-        for (uint32_t i = 0; i < ib_n_def_; i++) {
-          IndexColumn *index_col = ib_fields_[i];
+IndexColumn* IndexColumn::CreateIndexColumn(
+                        const rapidjson::Value& dd_index_col_obj,
+                        const std::vector<Column*>& columns,
+                        DictArena* arena) {
+  IndexColumn* element = arena->New<IndexColumn>(false);
+  bool init_ret = element->Init(dd_index_col_obj, columns);
+  if (!init_ret) {
+    element = nullptr;
+  }
+  return element;
+}
 
-          if (index_col->column()->name() == "DB_ROW_ID" ||
-               index_col->column()->name() == "DB_TRX_ID" ||
-               index_col->column()->name() == "DB_ROLL_PTR") {
-            continue;
-          }
-
-          if (!index_col->column()->is_nullable()) {
-            continue;
-          }
-
-          size_t start_from = 0;
-          if (index_col->column()->IsInstantAdded()) {
-            start_from = index_col->column()->GetVersionAdded();
-          }
-          update_nullable(start_from, true);
-
-          if (index_col->column()->IsInstantDropped()) {
-            update_nullable(index_col->column()->GetVersionDropped(), false);
-          }
-        }
-      }
-    }
-    assert(table_->clust_index() == nullptr);
-    table_->set_clust_index(this);
-  } else {
-    ib_n_user_defined_cols_ = s_user_defined_key_parts_;
-    std::vector<bool> indexed(table()->GetTotalCols(), false);
-    for (auto* iter : ib_fields_) {
-      if (iter->column()->is_virtual()) {
-        continue;
-      }
-      indexed[iter->column()->ib_ind()] = true;
-    }
-    assert(table_->clust_index() != nullptr);
-    for (uint32_t i = 0; i < table_->clust_index()->ib_n_uniq(); i++) {
-      IndexColumn* clust_index_col = table_->clust_index()->ib_fields()->at(i);
-      if (!indexed[clust_index_col->column()->ib_ind()]) {
-        uint32_t prefix_len = 0;
-        IndexAddCol(clust_index_col->column(), prefix_len);
-      } else {
-        // TODO(Zhao): Support spatial index
-      }
-    }
-
-    if (IsIndexUnique()) {
-      ib_n_uniq_ = ib_n_fields_;
-    } else {
-      ib_n_uniq_ = ib_n_def_;
-    }
-    ib_n_fields_ = ib_n_def_;
-  }
-  dd_se_private_data_.Get("id", &ib_id_);
-  dd_se_private_data_.Get("root", &ib_page_);
-
-  ib_n_fields_ = ib_n_def_;
+// Used only when creating index columns for a dropped column.
+IndexColumn* IndexColumn::CreateIndexDroppedColumn(Column* dropped_col,
+                                                   DictArena* arena) {
+  IndexColumn* index_column = arena->New<IndexColumn>(true);
+  index_column->set_column(dropped_col);
+  dropped_col->set_index_column(index_column);
 
-  if (IsClustered() && table_->HasRowVersions()) {
-    ib_n_fields_ = ib_n_def_ - table_->GetNInstantDropCols();
-  }
+  return index_column;
+}
+// Used only when creating a FTS_DOC_ID index column.
+IndexColumn* IndexColumn::CreateIndexFTSDocIdColumn(Column* doc_id_col,
+                                                    DictArena* arena) {
+  IndexColumn* index_column = arena->New<IndexColumn>(true);
+  index_column->set_column(doc_id_col);
+  doc_id_col->set_index_column(index_column);
 
-  ib_n_total_fields_ = ib_n_def_;
-  ib_row_versions_ = false;
-  ib_instant_cols_ = false;
-  ib_n_instant_nullable_ = ib_n_nullable_;
-  if (IsClustered()) {
-    ib_row_versions_ = table_->HasRowVersions();
-    if (table_->HasInstantCols()) {
-      ib_instant_cols_ = true;
-      uint32_t n_instant_fields = GetNOriginalFields();
-      uint32_t new_n_nullable = CalculateNInstantNullable(n_instant_fields);
-      ib_n_instant_nullable_ = new_n_nullable;
-    }
-  }
-  return true;
+  return index_column;
 }
 
-/* ------ Table ------ */
-const std::set<std::string> Table::default_valid_option_keys = {
-  "avg_row_length",
-  "checksum",
-  "compress",
-  "connection_string",
-  "delay_key_write",
-  "encrypt_type",
-  "explicit_tablespace",
-  "key_block_size",
-  "keys_disabled",
-  "max_rows",
-  "min_rows",
-  "pack_keys",
-  "pack_record",
-  "plugin_version",
-  "row_type",
-  "secondary_engine",
-  "secondary_load",
-  "server_i_s_table",
-  "server_p_s_table",
-  "stats_auto_recalc",
-  "stats_persistent",
-  "stats_sample_pages",
-  "storage",
-  "tablespace",
-  "timestamp",
-  "view_valid",
-  "gipk"
+/* ------ Index ------ */
+const std::set<std::string> Index::default_valid_option_keys = {
+  "block_size",
+  "flags",
+  "parser_name",
+  "gipk" /* generated implicit primary key */
 };
 
-bool Table::Init(const rapidjson::Value& dd_obj) {
-  // Table
-  Read(&dd_name_, dd_obj, "name");
-  Read(&dd_mysql_version_id_, dd_obj, "mysql_version_id");
-  Read(&dd_created_, dd_obj, "created");
-  Read(&dd_last_altered_, dd_obj, "last_altered");
-  ReadEnum(&dd_hidden_, dd_obj, "hidden");
-  ReadProperties(&dd_options_, dd_obj, "options");
-
-  // Columns
-  if (!dd_obj.HasMember("columns") || !dd_obj["columns"].IsArray()) {
-    std::cerr << "[SDI]Can't find columns" << std::endl;
+bool Index::Init(const rapidjson::Value& dd_index_obj,
+                 const std::vector<Column*>& columns) {
+  Read(&dd_name_, dd_index_obj, "name");
+  Read(&dd_hidden_, dd_index_obj, "hidden");
+  Read(&dd_is_generated_, dd_index_obj, "is_generated");
+  Read(&dd_ordinal_position_, dd_index_obj, "ordinal_position");
+  Read(&dd_comment_, dd_index_obj, "comment");
+  ReadProperties(&dd_options_, dd_index_obj, "options");
+  ReadProperties(&dd_se_private_data_, dd_index_obj, "se_private_data");
+  ReadEnum(&dd_type_, dd_index_obj, "type");
+  ReadEnum(&dd_algorithm_, dd_index_obj, "algorithm");
+  Read(&dd_is_algorithm_explicit_, dd_index_obj, "is_algorithm_explicit");
+  Read(&dd_is_visible_, dd_index_obj, "is_visible");
+  Read(&dd_engine_, dd_index_obj, "engine");
+  Read(&dd_engine_attribute_, dd_index_obj, "engine_attribute");
+  Read(&dd_secondary_engine_attribute_, dd_index_obj,
+      "secondary_engine_attribute");
+  if (!dd_index_obj.HasMember("elements") ||
+      !dd_index_obj["elements"].IsArray()) {
+    std::cerr << "[SDI]Can't find index elements" << std::endl;
     return false;
   }
-  const rapidjson::Value& columns = dd_obj["columns"].GetArray();
-  for (rapidjson::SizeType i = 0; i < columns.Size(); i++) {
-    if (!columns[i].IsObject()) {
-      std::cerr << "[SDI]Column isn't an object" << std::endl;
+  const rapidjson::Value& elements = dd_index_obj["elements"].GetArray();
+  for (rapidjson::SizeType i = 0; i < elements.Size(); i++) {
+    if (!elements[i].IsObject()) {
+      std::cerr << "[SDI]Index element isn't an object" << std::endl;
       return false;
     }
-    Column* column = Column::CreateColumn(columns[i]);
-    if (column == nullptr) {
+    IndexColumn* element = IndexColumn::CreateIndexColumn(
+                               elements[i], columns, table_->arena());
+    if (element == nullptr) {
       return false;
     }
-    columns_.push_back(column);
+    dd_elements_.push_back(element);
   }
+  Read(&dd_tablespace_ref_, dd_index_obj, "tablespace_ref");
+  return true;
+}
 
-  // Table
-  Read(&dd_schema_ref_, dd_obj, "schema_ref");
-  Read(&dd_se_private_id_, dd_obj, "se_private_id");
-  Read(&dd_engine_, dd_obj, "engine");
-  Read(&dd_last_checked_for_upgrade_version_id_, dd_obj,
-       "last_checked_for_upgrade_version_id");
-  Read(&dd_comment_, dd_obj, "comment");
-  ReadProperties(&dd_se_private_data_, dd_obj, "se_private_data");
-  Read(&dd_engine_attribute_, dd_obj, "engine_attribute");
-  Read(&dd_secondary_engine_attribute_, dd_obj, "secondary_engine_attribute");
-  ReadEnum(&dd_row_format_, dd_obj, "row_format");
-  ReadEnum(&dd_partition_type_, dd_obj, "partition_type");
-  Read(&dd_partition_expression_, dd_obj, "partition_expression");
-  Read(&dd_partition_expression_utf8_, dd_obj, "partition_expression_utf8");
-  ReadEnum(&dd_default_partitioning_, dd_obj, "default_partitioning");
-  ReadEnum(&dd_subpartition_type_, dd_obj, "subpartition_type");
-  Read(&dd_subpartition_expression_, dd_obj, "subpartition_expression");
-  Read(&dd_subpartition_expression_utf8_, dd_obj,
-       "subpartition_expression_utf8");
-  ReadEnum(&dd_default_subpartitioning_, dd_obj, "default_subpartitioning");
-  ReadEnum(&dd_collation_id_, dd_obj, "collation_id");
-
-  // Indexes
-  if (!dd_obj.HasMember("indexes") || !dd_obj["indexes"].IsArray()) {
-    std::cerr << "Can't find indexes" << std::endl;
-    return false;
-  }
-  const rapidjson::Value& indexes = dd_obj["indexes"].GetArray();
-  for (rapidjson::SizeType i = 0; i < indexes.Size(); i++) {
-    if (!indexes[i].IsObject()) {
-      std::cerr << "Index isn't an object" << std::endl;
-      return false;
-    }
-    Index* index = Index::CreateIndex(indexes[i], columns_, this);
-    if (index == nullptr) {
-      return false;
-    }
-    indexes_.push_back(index);
+Index* Index::CreateIndex(const rapidjson::Value& dd_index_obj,
+                          const std::vector<Column*>& columns,
+                          Table* table) {
+  Index* index = table->arena()->New<Index>(table);
+  bool init_ret = index->Init(dd_index_obj, columns);
+  if (!init_ret) {
+    index = nullptr;
   }
+  return index;
+}
 
-  /* TABLE_SHARE */
-  s_field_.clear();
-  for (auto* iter : columns_) {
-    if (iter->IsSeHidden()) {
+#define HA_NOSAME 1
+#define HA_FULLTEXT (1 << 7)
+#define HA_SPATIAL (1 << 10)
+bool Index::FillIndex(uint32_t ind) {
+  s_user_defined_key_parts_ = 0;
+  s_key_length_ = 0;
+  s_flags_ = 0;
+
+  for (auto* iter : dd_elements_) {
+    if (iter->hidden()) {
       continue;
     }
-    if (iter->is_nullable()) {
-      s_null_fields_++;
-    }
-    s_fields_++;
-    s_field_.push_back(iter);
+    s_user_defined_key_parts_++;
+    s_key_length_ += iter->length();
   }
-
-  /* SE */
-  if (!InitSeTable()) {
-    return false;
+  switch (type()) {
+    case Index::IT_MULTIPLE:
+      s_flags_ = 0;
+      break;
+    case Index::IT_FULLTEXT:
+      s_flags_ = HA_FULLTEXT;
+      break;
+    case Index::IT_SPATIAL:
+      s_flags_ = HA_SPATIAL;
+      break;
+    case Index::IT_PRIMARY:
+    case Index::IT_UNIQUE:
+      s_flags_ = HA_NOSAME;
+      break;
+    default:
+      assert(0);
+      s_flags_ = 0;
   }
+  FillSeIndex(ind);
   return true;
 }
 
-Column* Table::FindColumn(const std::string& col_name) {
-  for (const auto& iter : columns_) {
-    if (iter->name() == col_name) {
-      return iter;
-    }
+#define FTS_DOC_ID_COL_NAME "FTS_DOC_ID"
+bool Index::IndexAddCol(Column* col, uint32_t prefix_len) {
+  if (col->index_column() != nullptr) {
+    ib_fields_.push_back(col->index_column());
+  } else if (col->name() == FTS_DOC_ID_COL_NAME) {
+    /*
+     * The FTS_DOC_ID column is not defined in the SDI's PRIMARY index columns,
+     * so we need to create it manually.
+     */
+    IndexColumn* index_column = IndexColumn::CreateIndexFTSDocIdColumn(
+                                    col, table_->arena());
+    ib_fields_.push_back(index_column);
+  } else {
+    assert(col->IsInstantDropped());
+    IndexColumn* index_column = IndexColumn::CreateIndexDroppedColumn(
+                                    col, table_->arena());
+    ib_fields_.push_back(index_column);
+  }
+  ib_n_def_++;
+  if (ib_type_ & HA_SPATIAL &&
+      (col->ib_mtype() == DATA_POINT ||
+       col->ib_mtype() == DATA_VAR_POINT) &&
+      ib_n_def_ == 1) {
+    col->index_column()->set_ib_fixed_len(DATA_MBR_LEN);
+  } else {
+    col->index_column()->set_ib_fixed_len(col->GetFixedSize());
   }
-  return nullptr;
-}
 
-bool Table::ContainFulltext() {
-  for (const auto& iter : indexes_) {
-    if (iter->type() == Index::enum_index_type::IT_FULLTEXT) {
-      return true;
-    }
+  if (prefix_len && col->index_column()->ib_fixed_len() > prefix_len) {
+    col->index_column()->set_ib_fixed_len(prefix_len);
   }
-  return false;
-}
 
-#define UNSUPP_TABLE_MASK 0x1F
-#define UNSUPP_TABLE_MASK_PARTITION 0x1
-#define UNSUPP_TABLE_MASK_ENCRYPT 0x2
-#define UNSUPP_TABLE_MASK_FTS_AUX_INDEX 0x4
-#define UNSUPP_TABLE_MASK_FTS_COM_INDEX 0x8
-#define UNSUPP_TABLE_MASK_VERSION 0x10
-void Table::PreCheck() {
-  // TODO(Zhao): Support more MySQL versions
-  if (dd_mysql_version_id_ < 80016 || dd_mysql_version_id_ > 80040) {
-    unsupported_reason_ |= UNSUPP_TABLE_MASK_VERSION;
+  if (col->index_column()->ib_fixed_len() > DICT_MAX_FIXED_COL_LEN) {
+    col->index_column()->set_ib_fixed_len(0);
   }
 
-  if (dd_partition_type_ != enum_partition_type::PT_NONE) {
-    unsupported_reason_ |= UNSUPP_TABLE_MASK_PARTITION;
+  if (col->is_nullable() &&
+      !col->IsInstantDropped()) {
+    ib_n_nullable_++;
   }
+  return true;
+}
 
-  if (dd_options_.Exists("encrypt_type")) {
-    std::string encrypted;
-    dd_options_.Get("encrypt_type", &encrypted);
-    if (encrypted != "" && encrypted != "N" && encrypted != "n") {
-      unsupported_reason_ |= UNSUPP_TABLE_MASK_ENCRYPT;
+uint32_t Index::GetNOriginalFields() {
+  assert(table_->HasInstantCols());
+  uint32_t n_inst_cols_v1 =  table_->GetNInstantAddedColV1();
+  uint32_t n_drop_cols = table_->GetNInstantDropCols();
+  uint32_t n_add_cols = table_->GetNInstantAddCols();
+  uint32_t n_instant_fields =
+    ib_n_fields_ + n_drop_cols - n_add_cols - n_inst_cols_v1;
+
+  return n_instant_fields;
+}
+
+uint32_t Index::GetNNullableBefore(uint32_t nth) {
+  uint32_t nullable = 0;
+  for (uint32_t i = 0; i < nth; i++) {
+    const IndexColumn* index_col = ib_fields_[i];
+    assert(!index_col->column()->IsInstantDropped());
+    if (index_col->column()->is_nullable()) {
+      nullable++;
     }
   }
+  return nullable;
+}
 
-  for (const auto& index : indexes_) {
-    if (index->name() == "FTS_INDEX_TABLE_IND" &&
-        dd_hidden_ == enum_hidden_type::HT_HIDDEN_SE) {
-      unsupported_reason_ |= UNSUPP_TABLE_MASK_FTS_AUX_INDEX;
+uint32_t Index::CalculateNInstantNullable(uint32_t n_fields) {
+  if (!table_->HasRowVersions()) {
+    return GetNNullableBefore(n_fields);
+  }
+
+  uint32_t n_drop_nullable_cols = 0;
+  uint32_t new_n_nullable = 0;
+  for (uint32_t i = 0; i < ib_n_def_; i++) {
+    const IndexColumn* index_col = ib_fields_[i];
+    if (index_col->column()->IsInstantAdded()) {
       continue;
     }
-    if (index->name() == "FTS_COMMON_TABLE_IND" &&
-        dd_hidden_ == enum_hidden_type::HT_HIDDEN_SE) {
-      unsupported_reason_ |= UNSUPP_TABLE_MASK_FTS_COM_INDEX;
+    if (index_col->column()->IsInstantDropped()) {
+      if (index_col->column()->ib_phy_pos() < n_fields &&
+          index_col->column()->is_nullable()) {
+        n_drop_nullable_cols++;
+      }
       continue;
     }
+
+    if (index_col->column()->ib_phy_pos() < n_fields) {
+      if (index_col->column()->is_nullable()) {
+        new_n_nullable++;
+      }
+    }
   }
+  new_n_nullable += n_drop_nullable_cols;
+  return new_n_nullable;
 }
 
-bool Table::IsTableSupported() {
-  return (unsupported_reason_ & UNSUPP_TABLE_MASK) == 0;
+bool Index::HasInstantColsOrRowVersions() {
+  if (!IsClustered()) {
+    return false;
+  }
+  return (ib_row_versions_ || ib_instant_cols_);
 }
 
-std::string Table::UnsupportedReason() {
-  assert(!IsTableSupported());
-  std::string reason = "";
-  if (unsupported_reason_ & UNSUPP_TABLE_MASK_PARTITION) {
-    reason += "[Partition table]";
-  }
-  if (unsupported_reason_ & UNSUPP_TABLE_MASK_ENCRYPT) {
-    reason += "[Encrpted table]";
-  }
-  if (unsupported_reason_ & UNSUPP_TABLE_MASK_FTS_AUX_INDEX) {
-    reason += "[FTS Auxiliary index table]";
-  }
-  if (unsupported_reason_ & UNSUPP_TABLE_MASK_FTS_COM_INDEX) {
-    reason += "[FTS Common index table]";
+uint32_t Index::GetNullableInVersion(uint8_t version) {
+  return ib_nullables_[version];
+}
+
+uint16_t Index::GetNullableBeforeInstantAddDrop() {
+  if (ib_instant_cols_) {
+    return ib_n_instant_nullable_;
   }
-  if (unsupported_reason_ & UNSUPP_TABLE_MASK_VERSION) {
-    reason += ("[Table was created in unsupported version " +
-                std::to_string(dd_mysql_version_id_) +
-                ", expected in [80016, 80040] ]");
+
+  if (ib_row_versions_) {
+    return GetNullableInVersion(0);
   }
-  return reason;
+
+  return ib_n_nullable_;
 }
 
-bool Table::InitSeTable() {
-  PreCheck();
-  if (!IsTableSupported()) {
-    return true;
+uint16_t Index::GetNUniqueInTree() {
+  if (IsClustered()) {
+    return static_cast<uint16_t>(ib_n_uniq_);
+  } else {
+    return static_cast<uint16_t>(GetNFields());
   }
-  std::string norm_name = dd_schema_ref_ + "/" + dd_name_;
-
-  if (dd_schema_ref_ == "mysql" && dd_schema_ref_ == "information_schema" &&
-      dd_schema_ref_ == "performance_schema") {
-    ib_is_system_table_ = true;
+}
+uint16_t Index::GetNUniqueInTreeNonleaf() {
+  if (ib_type_ & DICT_SPATIAL) {
+    // TODO(zhao): support spatial Index
+    assert(0);
+    return DICT_INDEX_SPATIAL_NODEPTR_SIZE;
   } else {
-    ib_is_system_table_ = false;
+    return static_cast<uint16_t>(GetNUniqueInTree());
   }
+}
 
-  [[maybe_unused]] bool is_encrypted = false;
-  if (dd_options_.Exists("encrypt_type")) {
-    std::string encrypted;
-    dd_options_.Get("encrypt_type", &encrypted);
-    if (encrypted != "" && encrypted != "N" && encrypted != "n") {
-      is_encrypted = true;
-    }
+IndexColumn* Index::GetPhysicalField(size_t pos) {
+  if (ib_row_versions_) {
+    return ib_fields_[ib_fields_array_[pos]];
   }
 
-  bool has_doc_id = false;
-  const Column* col = FindColumn(FTS_DOC_ID_COL_NAME);
-  if (col != 0 && col->type() == Column::enum_column_types::LONGLONG &&
-      !col->is_nullable()) {
-    has_doc_id = true;
-  }
-  bool add_doc_id = false;
-  if (has_doc_id && col->IsSeHidden()) {
-    add_doc_id = true;
-  }
+  return ib_fields_[pos];
+}
 
-  // TODO(Zhao): Support partition table
+/*
+ * Finds a non-dropped physical field by its column name, ignoring case.
+ * Returns nullptr if there is no such field.
+ */
+Column* Index::GetPhysicalFieldByName(const std::string& name, uint32_t* n) {
+  for (uint32_t i = 0; i < GetNFields(); i++) {
+    Column* col = GetPhysicalField(i)->column();
+    if (!col->IsColumnDropped() &&
+        strcasecmp(col->name().c_str(), name.c_str()) == 0) {
+      *n = i;
+      return col;
+    }
+  }
+  return nullptr;
+}
 
-  uint32_t n_cols = s_fields_ + (add_doc_id ? 1 : 0);
-  uint32_t n_v_cols = 0;
-  uint32_t n_m_v_cols = 0;
-  for (const auto& iter : columns_) {
-    if (iter->IsSeHidden()) {
+bool Index::IsFieldAscending(uint32_t n) {
+  uint32_t n_user_fields = 0;
+  for (auto* iter : dd_elements_) {
+    if (iter->hidden()) {
       continue;
     }
-    if (iter->is_virtual()) {
-      n_v_cols++;
-      if (iter->options().Exists("is_array")) {
-        bool is_array = false;
-        iter->options().Get("is_array", &is_array);
-        if (is_array) {
-          n_m_v_cols++;
-        }
+    if (n_user_fields == n) {
+      return (iter->order() != IndexColumn::ORDER_DESC);
+    }
+    n_user_fields++;
+  }
+  // Fields appended by InnoDB, i.e., the primary key of a secondary index
+  Index* clust_index = table_->clust_index();
+  if (clust_index != nullptr && clust_index != this && n < ib_fields_.size()) {
+    Column* col = ib_fields_[n]->column();
+    std::vector<IndexColumn*>* clust_fields = clust_index->ib_fields();
+    for (uint32_t i = 0; i < clust_index->ib_n_uniq(); i++) {
+      if (clust_fields->at(i)->column() == col) {
+        return clust_index->IsFieldAscending(i);
       }
     }
   }
+  return true;
+}
 
-  uint32_t current_row_version = 0;
-  uint32_t n_current_cols = 0;
-  uint32_t n_initial_cols = 0;
-  uint32_t n_total_cols = 0;
-
-  uint32_t n_dropped_cols = 0;
-  uint32_t n_added_cols = 0;
-  uint32_t n_added_and_dropped_cols = 0;
-  bool has_row_version = false;
-  for (const auto& iter : columns_) {
-    if (iter->IsSystemColumn() || iter->is_virtual()) {
-      continue;
+/*
+ * Splits "1,'a,b',NULL" into literals. Single-quoted literals may contain
+ * commas, and '' stands for a quote. An unquoted NULL means SQL NULL.
+ */
+static bool SplitKeyLiterals(const std::string& str,
+                             std::vector<std::pair<bool, std::string>>* out) {
+  size_t pos = 0;
+  while (pos <= str.size()) {
+    while (pos < str.size() && isspace(str[pos])) {
+      pos++;
     }
-
-    if (!has_row_version) {
-      if (iter->se_private_data().Exists("physical_pos")) {
-        has_row_version = true;
+    std::string literal;
+    bool quoted = (pos < str.size() && str[pos] == '\'');
+    if (quoted) {
+      pos++;
+      bool closed = false;
+      while (pos < str.size()) {
+        if (str[pos] == '\'') {
+          if (pos + 1 < str.size() && str[pos + 1] == '\'') {
+            literal.push_back('\'');
+            pos += 2;
+            continue;
+          }
+          closed = true;
+          pos++;
+          break;
+        }
+        literal.push_back(str[pos++]);
       }
-    }
-
-    if (iter->IsColumnDropped()) {
-      n_dropped_cols++;
-      if (iter->IsColumnAdded()) {
-        n_added_and_dropped_cols++;
+      if (!closed) {
+        return false;
       }
-      uint32_t v_dropped = iter->GetVersionDropped();
-      current_row_version = std::max(current_row_version, v_dropped);
-      continue;
+      while (pos < str.size() && isspace(str[pos])) {
+        pos++;
+      }
+      if (pos < str.size() && str[pos] != ',') {
+        return false;
+      }
+    } else {
+      size_t comma = str.find(',', pos);
+      literal = str.substr(pos, comma == std::string::npos ?
+                                std::string::npos : comma - pos);
+      literal.erase(literal.find_last_not_of(" \t") + 1);
+      pos = (comma == std::string::npos) ? str.size() : comma;
     }
+    out->push_back({!quoted && literal == "NULL", literal});
+    pos++;
+  }
+  return true;
+}
 
-    if (iter->IsColumnAdded()) {
-      n_added_cols++;
-      uint32_t v_added = iter->GetVersionAdded();
-      current_row_version = std::max(current_row_version, v_added);
+bool Index::BuildSearchKey(const std::string& key_str, SearchKey* key) {
+  key->clear();
+  if (key_str.empty()) {
+    return true;
+  }
+  std::vector<std::pair<bool, std::string>> literals;
+  if (!SplitKeyLiterals(key_str, &literals)) {
+    ninja_error("Malformed key: %s", key_str.c_str());
+    return false;
+  }
+  if (literals.size() > GetNUniqueInTree()) {
+    ninja_error("Key '%s' has %zu fields, but index %s has only %u key "
+                "fields", key_str.c_str(), literals.size(),
+                dd_name_.c_str(), GetNUniqueInTree());
+    return false;
+  }
+  for (uint32_t i = 0; i < literals.size(); i++) {
+    Column* col = ib_fields_[i]->column();
+    if (!CheckOrderSupported(col)) {
+      return false;
     }
-    n_current_cols++;
+    SearchKeyField field;
+    field.is_null = literals[i].first;
+    if (field.is_null) {
+      if (!col->is_nullable()) {
+        ninja_error("Column %s is not nullable", col->name().c_str());
+        return false;
+      }
+    } else if (!col->StringToValue(literals[i].second, &field.data)) {
+      ninja_error("Invalid value '%s' for column %s (%s)",
+                  literals[i].second.c_str(), col->name().c_str(),
+                  col->dd_column_type_utf8().c_str());
+      return false;
+    }
+    key->push_back(field);
   }
-  n_initial_cols = (n_current_cols - n_added_cols) +
-                   (n_dropped_cols - n_added_and_dropped_cols);
-  n_total_cols = n_current_cols + n_dropped_cols;
-
-  ib_n_t_cols_ = n_cols + DATA_N_SYS_COLS;
-  ib_n_v_cols_ = n_v_cols;
-  ib_n_m_v_cols_ = n_m_v_cols;
-  ib_n_cols_ = ib_n_t_cols_ - ib_n_v_cols_;
-  ib_n_instant_cols_ = ib_n_cols_;
-  ib_initial_col_count_ = n_initial_cols;
-  ib_current_col_count_ = n_current_cols;
-  ib_total_col_count_ = n_total_cols;
-  ib_current_row_version_ = current_row_version;
-  ib_m_upgraded_instant_ = false;
-
-  ib_id_ = dd_se_private_id_;
+  return true;
+}
 
-  if (dd_se_private_data_.Exists("instant_col")) {
-    uint32_t n_inst_cols = 0;
-    if (dd_partition_type_ != enum_partition_type::PT_NONE) {
-      // TODO(Zhao): Support partition table
+/*
+ * Compares a search key with the leading fields of an index record, which
+ * must be a user record with its column offsets initialized.
+ * Returns <0, 0 or >0 if the key is less than, equal to (as a prefix) or
+ * greater than the record.
+ */
+int Index::CompareKey(const SearchKey& key, Record* record) {
+  if (record->IsMinRec()) {
+    // The leftmost node pointer on each non-leaf level is less than any key
+    return 1;
+  }
+  for (uint32_t i = 0; i < key.size(); i++) {
+    const unsigned char* data = nullptr;
+    uint32_t len = 0;
+    uint32_t flags = record->GetField(i, &data, &len);
+    bool rec_is_null = (flags & REC_OFFS_SQL_NULL);
+    int ret = 0;
+    if (key[i].is_null || rec_is_null) {
+      // NULL is smaller than any other value
+      ret = (key[i].is_null && rec_is_null) ? 0 : key[i].is_null ? -1 : 1;
     } else {
-      dd_se_private_data_.Get("instant_col", &n_inst_cols);
-      ib_n_instant_cols_ = n_inst_cols + DATA_N_SYS_COLS;
-      ib_m_upgraded_instant_ = true;
+      Column* col = ib_fields_[i]->column();
+      ret = col->CompareValue(
+                reinterpret_cast<const unsigned char*>(key[i].data.data()),
+                key[i].data.size(), data, len);
+    }
+    if (ret != 0) {
+      return IsFieldAscending(i) ? ret : -ret;
     }
   }
+  return 0;
+}
 
-  ib_cols_.clear();
-  ib_n_def_ = 0;
-  ib_n_v_def_ = 0;
-  ib_n_t_def_ = 0;
-
-  for (auto* iter : s_field_) {
-    iter->set_ib_mtype(iter->FieldType2SeType());
-    ib_n_t_def_++;
-    if (!iter->is_virtual()) {
-      iter->set_ib_ind(ib_n_def_);
-      ib_n_def_++;
-      uint32_t v_added = iter->GetVersionAdded();
-      uint32_t phy_pos = UINT32_UNDEFINED;
-      bool is_hidden_by_system =
-        (iter->hidden() == Column::enum_hidden_type::HT_HIDDEN_SE ||
-         iter->hidden() == Column::enum_hidden_type::HT_HIDDEN_SQL);
-      if (has_row_version) {
-        if (iter->se_private_data().Exists("physical_pos")) {
-          iter->se_private_data().Get("physical_pos", &phy_pos);
-          assert(phy_pos != UINT32_UNDEFINED);
-        }
-      }
-      iter->set_ib_is_visible(!is_hidden_by_system);
-      iter->set_ib_version_added(v_added);
-      iter->set_ib_version_dropped(UINT8_UNDEFINED);
-      iter->set_ib_phy_pos(phy_pos);
-      if (iter->FieldType() == Column::enum_field_types::MYSQL_TYPE_VARCHAR) {
-        // The col_len of VARCHAR in InnoDB does not include the length header.
-        uint32_t col_len = iter->PackLength() - iter->VarcharLenBytes();
-        iter->set_ib_col_len(col_len);
-      } else {
-        iter->set_ib_col_len(iter->PackLength());
-      }
-
-      ib_cols_.push_back(iter);
+/*
+ * Compares two search keys field by field in the order of this index.
+ * A key that is a prefix of the other one compares as smaller.
+ */
+int Index::CompareSearchKeys(const SearchKey& a, const SearchKey& b) {
+  size_t n = std::min(a.size(), b.size());
+  for (uint32_t i = 0; i < n; i++) {
+    int ret = 0;
+    if (a[i].is_null || b[i].is_null) {
+      ret = (a[i].is_null && b[i].is_null) ? 0 : a[i].is_null ? -1 : 1;
     } else {
-      ib_n_v_def_++;
+      Column* col = ib_fields_[i]->column();
+      ret = col->CompareValue(
+                reinterpret_cast<const unsigned char*>(a[i].data.data()),
+                a[i].data.size(),
+                reinterpret_cast<const unsigned char*>(b[i].data.data()),
+                b[i].data.size());
     }
-  }
-
-  if (add_doc_id) {
-    Column* doc_id_col = new Column(FTS_DOC_ID_COL_NAME, ib_n_def_, true);
-    ib_n_t_def_++;
-    ib_n_def_++;
-    doc_id_col->set_type(Column::enum_column_types::LONGLONG);
-    doc_id_col->set_ib_mtype(DATA_INT);
-    doc_id_col->set_ib_col_len(sizeof(uint64_t));
-    ib_cols_.push_back(doc_id_col);
-  }
-
-  Column* row_id_col = FindColumn("DB_ROW_ID");
-  if (row_id_col != nullptr) {
-    // DB_ROW_ID is already in the columns_
-    ib_n_t_def_++;
-    row_id_col->set_ib_ind(ib_n_def_);
-    ib_n_def_++;
-    row_id_col->set_ib_mtype(DATA_SYS);
-    row_id_col->set_ib_is_visible(false);
-    row_id_col->set_ib_version_added(0);
-    row_id_col->set_ib_version_dropped(0);
-    uint32_t phy_pos = UINT32_UNDEFINED;
-    if (has_row_version) {
-      if (row_id_col->se_private_data().Exists("physical_pos")) {
-        row_id_col->se_private_data().Get("physical_pos", &phy_pos);
-      }
+    if (ret != 0) {
+      return IsFieldAscending(i) ? ret : -ret;
     }
-    row_id_col->set_ib_phy_pos(phy_pos);
-    row_id_col->set_ib_col_len(DATA_ROW_ID_LEN);
-    ib_cols_.push_back(row_id_col);
-  } else {
-    row_id_col_ = new Column("DB_ROW_ID", ib_n_def_);
-    ib_n_t_def_++;
-    ib_n_def_++;
-    row_id_col_->set_ib_col_len(DATA_ROW_ID_LEN);
-    row_id_col_->set_type(Column::enum_column_types::INT24);
-    ib_cols_.push_back(row_id_col_);
   }
+  return (a.size() < b.size()) ? -1 : (a.size() > b.size()) ? 1 : 0;
+}
 
-  Column* trx_id_col = FindColumn("DB_TRX_ID");
-  assert(trx_id_col != nullptr);
-  if (trx_id_col != nullptr) {
-    ib_n_t_def_++;
-    trx_id_col->set_ib_ind(ib_n_def_);
-    ib_n_def_++;
-    trx_id_col->set_ib_mtype(DATA_SYS);
-    trx_id_col->set_ib_is_visible(false);
-    trx_id_col->set_ib_version_added(0);
-    trx_id_col->set_ib_version_dropped(0);
-    uint32_t phy_pos = UINT32_UNDEFINED;
-    if (has_row_version) {
-      if (trx_id_col->se_private_data().Exists("physical_pos")) {
-        trx_id_col->se_private_data().Get("physical_pos", &phy_pos);
-      }
+/*
+ * Each field is a 0x00 (NULL) or 0x01 marker followed by the sort key of
+ * its value, with all its bytes inverted if the field is descending.
+ */
+void Index::EncodeSortKey(const SearchKey& key, std::string* out) {
+  out->clear();
+  for (uint32_t i = 0; i < key.size(); i++) {
+    size_t start = out->size();
+    out->push_back(key[i].is_null ? 0 : 1);
+    if (!key[i].is_null) {
+      ib_fields_[i]->column()->AppendSortKey(
+          reinterpret_cast<const unsigned char*>(key[i].data.data()),
+          key[i].data.size(), out);
     }
-    trx_id_col->set_ib_phy_pos(phy_pos);
-    trx_id_col->set_ib_col_len(DATA_TRX_ID_LEN);
-    ib_cols_.push_back(trx_id_col);
-  }
-
-  Column* roll_ptr_col = FindColumn("DB_ROLL_PTR");
-  assert(roll_ptr_col != nullptr);
-  if (roll_ptr_col != nullptr) {
-    ib_n_t_def_++;
-    roll_ptr_col->set_ib_ind(ib_n_def_);
-    ib_n_def_++;
-    roll_ptr_col->set_ib_mtype(DATA_SYS);
-    roll_ptr_col->set_ib_is_visible(false);
-    roll_ptr_col->set_ib_version_added(0);
-    roll_ptr_col->set_ib_version_dropped(0);
-    uint32_t phy_pos = UINT32_UNDEFINED;
-    if (has_row_version) {
-      if (roll_ptr_col->se_private_data().Exists("physical_pos")) {
-        roll_ptr_col->se_private_data().Get("physical_pos", &phy_pos);
+    if (!IsFieldAscending(i)) {
+      for (size_t j = start; j < out->size(); j++) {
+        (*out)[j] = ~(*out)[j];
       }
     }
-    roll_ptr_col->set_ib_phy_pos(phy_pos);
-    roll_ptr_col->set_ib_col_len(DATA_ROLL_PTR_LEN);
-    ib_cols_.push_back(roll_ptr_col);
   }
+}
 
-  if (HasInstantDropCols()) {
-    for (auto* iter : columns_) {
-      if (iter->IsSystemColumn()) {
-        continue;
-      }
-      if (iter->IsColumnDropped()) {
-        iter->set_ib_mtype(iter->FieldType2SeType());
-        iter->set_ib_ind(ib_n_def_);
-        ib_n_def_++;
-        ib_n_t_def_++;
-        uint32_t v_added = iter->GetVersionAdded();
-        uint32_t v_dropped = iter->GetVersionDropped();
-        uint32_t phy_pos = UINT32_UNDEFINED;
-        assert(iter->se_private_data().Exists("physical_pos"));
-        iter->se_private_data().Get("physical_pos", &phy_pos);
-        assert(phy_pos != UINT32_UNDEFINED);
-        iter->set_ib_is_visible(false);
-        iter->set_ib_version_added(v_added);
-        iter->set_ib_version_dropped(v_dropped);
-        iter->set_ib_phy_pos(phy_pos);
-        if (iter->FieldType() == Column::enum_field_types::MYSQL_TYPE_VARCHAR) {
-          // The col_len of VARCHAR in InnoDB does not include the length header.
-          uint32_t col_len = iter->PackLength() - iter->VarcharLenBytes();
-          iter->set_ib_col_len(col_len);
-        } else {
-          iter->set_ib_col_len(iter->PackLength());
-        }
-        ib_cols_.push_back(iter);
-      }
+void Index::EncodeSortKey(Record* record, uint32_t n_fields,
+                          std::string* out) {
+  out->clear();
+  for (uint32_t i = 0; i < n_fields; i++) {
+    const unsigned char* data = nullptr;
+    uint32_t len = 0;
+    uint32_t flags = record->GetField(i, &data, &len);
+    bool is_null = (flags & REC_OFFS_SQL_NULL);
+    size_t start = out->size();
+    out->push_back(is_null ? 0 : 1);
+    if (!is_null) {
+      ib_fields_[i]->column()->AppendSortKey(data, len, out);
     }
-  }
-
-  if (HasInstantCols() || HasRowVersions()) {
-    // TODO(Zhao): Support partition table
-    for (auto* iter : columns_) {
-      iter->set_ib_instant_default(false);
-      if (iter->is_virtual() || iter->IsSystemColumn()) {
-        continue;
-      }
-      if (iter->IsColumnDropped()) {
-        continue;
-      }
-      if (!iter->se_private_data().Exists("default_null") &&
-          !iter->se_private_data().Exists("default")) {
-        // This is not INSTANT ADD column
-        continue;
-      }
-
-      if (iter->se_private_data().Exists("default_null")) {
-        iter->set_ib_instant_default(false);
-      } else if (iter->se_private_data().Exists("default")) {
-        iter->set_ib_instant_default(true);
-        // TODO(Zhao): parse the default value
+    if (!IsFieldAscending(i)) {
+      for (size_t j = start; j < out->size(); j++) {
+        (*out)[j] = ~(*out)[j];
       }
     }
   }
-
-  assert(!indexes_.empty());
-  uint32_t ind = 0;
-  for (auto* iter : indexes_) {
-    iter->FillIndex(ind);
-    ind++;
-  }
-
-  return true;
 }
 
-Table* Table::CreateTable(const rapidjson::Value& dd_obj,
-                          unsigned char* sdi_data) {
-  Table* table = new Table(sdi_data);
-  bool init_ret = table->Init(dd_obj);
-  if (!init_ret) {
-    delete table;
-    table = nullptr;
+uint32_t Index::GetNFields() const {
+  if (table_->HasRowVersions()) {
+    return ib_n_total_fields_;
   }
-  return table;
+  return ib_n_fields_;
 }
 
-bool Table::IsTableParsingRecSupported() {
-  if (!IsTableSupported()) {
-    return false;
+#define UNSUPP_INDEX_MASK 0x7
+#define UNSUPP_INDEX_MASK_VIRTUAL 0x1
+#define UNSUPP_INDEX_MASK_FTS 0x2
+#define UNSUPP_INDEX_MASK_SPATIAL 0x4
+void Index::PreCheck() {
+  if (dd_type_ == IT_FULLTEXT) {
+    unsupported_reason_ |= UNSUPP_INDEX_MASK_FTS;
   }
-  if (dd_row_format_ != RF_DYNAMIC &&
-      dd_row_format_ != RF_COMPACT) {
-    ninja_error("Parsing of record with row format %s is not yet supported",
-                 RowFormatString().c_str());
-    return false;
+  if (dd_type_ == IT_SPATIAL) {
+    unsupported_reason_ |= UNSUPP_INDEX_MASK_SPATIAL;
+  }
+  for (auto* iter : dd_elements_) {
+    if (iter->hidden()) {
+      continue;
+    }
+    if (iter->column()->is_virtual()) {
+      unsupported_reason_ |= UNSUPP_INDEX_MASK_VIRTUAL;
+      break;
+    }
   }
-  return true;
 }
-
-/* ------ Record ------ */
-uint32_t Record::GetBitsFrom1B(uint32_t offs, uint32_t mask, uint32_t shift) {
-  return ((ReadFrom1B(rec_ - offs) & mask) >> shift);
+bool Index::IsIndexSupported() {
+  return (unsupported_reason_ & UNSUPP_INDEX_MASK) == 0;
 }
-uint32_t Record::GetBitsFrom2B(uint32_t offs, uint32_t mask, uint32_t shift) {
-  return ((ReadFrom2B(rec_ - offs) & mask) >> shift);
+std::string Index::UnsupportedReason() {
+  assert(!IsIndexSupported());
+  std::string reason = "";
+  if (unsupported_reason_ & UNSUPP_INDEX_MASK_VIRTUAL) {
+    reason += "[Index using virtual columns as keys]";
+  }
+  if (unsupported_reason_ & UNSUPP_INDEX_MASK_FTS) {
+    reason += "[Fulltext index]";
+  }
+  if (unsupported_reason_ & UNSUPP_INDEX_MASK_SPATIAL) {
+    reason += "[Spatial index]";
+  }
+  return reason;
 }
-
-uint32_t Record::GetStatus() {
-  uint32_t ret = 0;
-  ret = GetBitsFrom1B(REC_NEW_STATUS, REC_NEW_STATUS_MASK,
-                      REC_NEW_STATUS_SHIFT);
-  assert((ret & ~REC_NEW_STATUS_MASK) == 0);
-  return ret;
+bool Index::IsIndexParsingRecSupported() {
+  if (!table_->IsTableParsingRecSupported()) {
+    return false;
+  }
+  return IsIndexSupported();
+  // Additional checks may be needed here.
 }
-
-uint32_t* Record::GetColumnOffsets() {
-  uint32_t n = 0;
-  if (index_->table()->IsCompact()) {
-    switch (GetStatus()) {
-      case REC_STATUS_ORDINARY:
-       n = index_->GetNFields();
-       break;
-      case REC_STATUS_NODE_PTR:
-       n = index_->GetNUniqueInTreeNonleaf() + 1;
-       break;
-      case REC_STATUS_INFIMUM:
-      case REC_STATUS_SUPREMUM:
-        n = 1;
-        break;
-      default:
-        assert(0);
+#define FTS_DOC_ID_INDEX_NAME "FTS_DOC_ID_INDEX"
+bool Index::FillSeIndex(uint32_t ind) {
+  PreCheck();
+  if (!IsIndexSupported()) {
+    return true;
+  }
+  ib_n_fields_ = s_user_defined_key_parts_;
+  ib_n_uniq_ = ib_n_fields_;
+  if (s_flags_ & HA_SPATIAL) {
+    ib_type_ = DICT_SPATIAL;
+    assert(ib_n_fields_ == 1);
+  } else if (s_flags_ & HA_FULLTEXT) {
+    ib_type_ = DICT_FTS;
+    ib_n_uniq_ = 0;
+  } else if (ind == 0) {
+    assert(s_flags_ & HA_NOSAME);
+    // dd_hidden_ == true means there no explicit primary index
+    assert(ib_n_uniq_ > 0 || dd_hidden_ == true);
+    if (dd_hidden_ == false) {
+      ib_type_ = DICT_CLUSTERED | DICT_UNIQUE;
+    } else {
+      /*
+       * The implicit primary index type is DICT_CLUSTERED.
+       * This is made consistent with InnoDB.
+       */
+      ib_type_ = DICT_CLUSTERED;
     }
   } else {
-    // TODO(Zhao): Support redundant row format
-  }
-  uint32_t size = n + (1 + REC_OFFS_HEADER_SIZE);
-  assert(offsets_ == nullptr);
-  offsets_ = new uint32_t[size];
-  SetNAlloc(size);
-  SetNFields(n);
-  InitColumnOffsets();
-
-  return offsets_;
-}
-
-static uint32_t* RecOffsBase(uint32_t* offsets) {
-  return offsets + REC_OFFS_HEADER_SIZE;
-}
-
-static uint32_t RecOffsNFields(uint32_t* offsets) {
-  uint32_t n_fields = offsets[1];
-  assert(n_fields > 0);
-  return n_fields;
-}
-
-void Record::InitColumnOffsetsCompact() {
-  uint32_t n_node_ptr_field = ULINT_UNDEFINED;
-  switch (GetStatus()) {
-    case REC_STATUS_INFIMUM:
-    case REC_STATUS_SUPREMUM:
-      RecOffsBase(offsets_)[0] = REC_N_NEW_EXTRA_BYTES | REC_OFFS_COMPACT;
-      RecOffsBase(offsets_)[1] = 8;
-      return;
-    case REC_STATUS_NODE_PTR:
-      n_node_ptr_field = index_->GetNUniqueInTreeNonleaf();
-      break;
-    case REC_STATUS_ORDINARY:
-      InitColumnOffsetsCompactLeaf();
-      return;
+    ib_type_ = (s_flags_ & HA_NOSAME) ? DICT_UNIQUE : 0;
   }
 
-  // non-leaf page record
-  assert(!IsVersionedCompact());
-  const unsigned char* nulls = rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
-  const size_t nullable_cols = index_->GetNullableBeforeInstantAddDrop();
-
-  const unsigned char* lens = nulls - UT_BITS_IN_BYTES(nullable_cols);
-  uint32_t offs = 0;
-  uint32_t null_mask = 1;
+  ib_n_def_ = 0;
+  ib_n_nullable_ = 0;
+  ib_fields_.clear();
 
-  uint32_t i = 0;
-  IndexColumn* index_col = nullptr;
-  Column* col = nullptr;
-  do {
-    uint32_t len;
-    if (i == n_node_ptr_field) {
-      len = offs += REC_NODE_PTR_SIZE;
-      goto resolved;
+  for (auto* iter : dd_elements_) {
+    if (iter->hidden()) {
+      continue;
     }
+    uint32_t prefix_len = 0;
+    IndexAddCol(iter->column(), prefix_len);
+  }
 
-    index_col = index_->ib_fields()->at(i);
-    col = index_col->column();
-    if (col->is_nullable()) {
-      if (!(unsigned char)null_mask) {
-        nulls--;
-        null_mask = 1;
+  /*
+   * Special case: "FTS_DOC_ID_INDEX"
+   * The columns of FTS_DOC_ID_INDEX defined in the SDI are correct,
+   * but the information for the FTS_DOC_ID column is
+   * missing (e.g., ib_mtype_).
+   * Note that we have created a new FTS_DOC_ID in Table::ib_cols_,
+   * so use that instead.
+   */
+  if (dd_name_ == FTS_DOC_ID_INDEX_NAME) {
+    for (auto* iter : dd_elements_) {
+      if (iter->column()->name() == FTS_DOC_ID_COL_NAME) {
+        for (auto* col : *table()->ib_cols()) {
+          if (col->name() == FTS_DOC_ID_COL_NAME) {
+            iter->set_column(col);
+          }
+        }
       }
-
-      if (*nulls & null_mask) {
-        null_mask <<= 1;
-        len = offs | REC_OFFS_SQL_NULL;
-        goto resolved;
+      /*
+       * The user has explicitly defined the FTS_DOC_ID column,
+       * so no need to add another.
+       */
+      if (iter->hidden()) {
+        IndexAddCol(iter->column(), 0);
       }
-      null_mask <<= 1;
     }
+  }
 
-    if (!index_col->ib_fixed_len()) {
-      /* DATA_POINT should always be a fixed
-      length column. */
-      assert(col->ib_mtype() != DATA_POINT);
-      /* Variable-length field: read the length */
-      len = *lens--;
-      if (col->IsBigCol()) {
-        if (len & 0x80) {
-          len <<= 8;
-          len |= *lens--;
-          assert(!(len & 0x4000));
-          offs += len & 0x3fff;
-          len = offs;
-
-          goto resolved;
+  if (IsClustered()) {
+    ib_n_user_defined_cols_ = s_user_defined_key_parts_;
+    if (!IsIndexUnique()) {
+      ib_n_uniq_ += 1;
+    }
+    uint32_t n_fields_processed = 0;
+    while (n_fields_processed < ib_n_def_) {
+      IndexColumn* col = ib_fields_[n_fields_processed];
+      if (!table()->HasRowVersions()) {
+        col->column()->set_ib_phy_pos(n_fields_processed);
+      } else {
+        assert(col->column()->ib_phy_pos() != UINT32_UNDEFINED);
+      }
+      n_fields_processed++;
+    }
+    bool found_db_row_id = false;
+    bool found_db_trx_id = false;
+    bool found_db_roll_ptr = false;
+    for (auto* col : *(table()->ib_cols())) {
+      if (!IsIndexUnique() && col->name() == "DB_ROW_ID") {
+        found_db_row_id = true;
+        if (!table()->HasRowVersions()) {
+          col->set_ib_phy_pos(n_fields_processed);
+        } else {
+          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
         }
+        IndexAddCol(col, 0);
+        n_fields_processed++;
+        ib_n_fields_++;
+      }
+      if (col->name() == "DB_TRX_ID") {
+        found_db_trx_id = true;
+        if (!table()->HasRowVersions()) {
+          col->set_ib_phy_pos(n_fields_processed);
+        } else {
+          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
+        }
+        IndexAddCol(col, 0);
+        n_fields_processed++;
+        ib_n_fields_++;
+      }
+      if (col->name() == "DB_ROLL_PTR") {
+        found_db_roll_ptr = true;
+        if (!table()->HasRowVersions()) {
+          col->set_ib_phy_pos(n_fields_processed);
+        } else {
+          assert(col->ib_phy_pos() != UINT32_UNDEFINED);
+        }
+        IndexAddCol(col, 0);
+        n_fields_processed++;
+        ib_n_fields_++;
       }
-
-      len = offs += len;
-    } else {
-      len = offs += index_col->ib_fixed_len();
     }
-  resolved:
-    RecOffsBase(offsets_)[i + 1] = len;
-  } while (++i < RecOffsNFields(offsets_));
-
-  *RecOffsBase(offsets_) = (rec_ - (lens + 1)) | REC_OFFS_COMPACT;
-}
+    assert((IsIndexUnique() || found_db_row_id) &&
+        found_db_trx_id && found_db_roll_ptr);
 
-void Record::InitColumnOffsets() {
-  if (index_->table()->IsCompact()) {
-    InitColumnOffsetsCompact();
-  } else {
-    // TODO(Zhao): Support redundant row format
-  }
-}
-
-void Record::InitColumnOffsetsCompactLeaf() {
-  const unsigned char* nulls = nullptr;
-  const unsigned char* lens = nullptr;
-  uint16_t n_null = 0;
-  enum REC_INSERT_STATE rec_insert_state = REC_INSERT_STATE::NONE;
-  uint8_t row_version = UINT8_UNDEFINED;
-  uint16_t non_default_fields = 0;
-  rec_insert_state = InitNullAndLengthCompact(&nulls, &lens, &n_null,
-                                 &non_default_fields, &row_version);
-
-  uint32_t offs = 0;
-  uint32_t any_ext = 0;
-  uint32_t null_mask = 1;
-  uint16_t i = 0;
-  do {
-    IndexColumn* index_col = index_->GetPhysicalField(i);
-    Column* col = index_col->column();
-    uint64_t len;
-    switch (rec_insert_state) {
-      case INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION:
-        assert(!index_->HasInstantColsOrRowVersions());
-        break;
-
-      case INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
-        assert(row_version == UINT8_UNDEFINED || row_version == 0);
-        assert(index_->ib_row_versions());
-        row_version = 0;
+    std::vector<bool> indexed(table()->GetTotalCols(), false);
+    for (auto* iter : ib_fields_) {
+      indexed[iter->column()->ib_ind()] = true;
+    }
+    for (uint32_t i = 0; i < table()->ib_n_cols() - DATA_N_SYS_COLS; i++) {
+      Column* col = table()->ib_cols()->at(i);
+      assert(col->ib_mtype() != DATA_SYS);
+      if (indexed[col->ib_ind()]) {
+        continue;
+      }
+      if (!table()->HasRowVersions()) {
+        col->set_ib_phy_pos(n_fields_processed);
+      } else {
+        assert(col->ib_phy_pos() != UINT32_UNDEFINED);
       }
-      [[fallthrough]];
-      case INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION:
-      case INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION: {
-        assert(index_->ib_row_versions() ||
-              (index_->table()->ib_m_upgraded_instant() && row_version == 0));
 
-        if (col->IsDroppedInOrBefore(row_version)) {
-          len = offs | REC_OFFS_DROP;
-          goto resolved;
-        } else if (col->IsAddedAfter(row_version)) {
-          len = GetInstantOffset(i, offs);
-          goto resolved;
-        }
-      } break;
+      IndexAddCol(col, 0);
+      n_fields_processed++;
+      ib_n_fields_++;
+    }
+    for (uint32_t i = table()->ib_n_cols(); i < table()->GetTotalCols(); i++) {
+      Column* col = table()->ib_cols()->at(i);
+      assert(col->ib_mtype() != DATA_SYS);
+      IndexAddCol(col, 0);
+      n_fields_processed++;
+      // Do not add ib_n_fields_ here, as we are adding dropped columns.
+    }
+    if (!table()->ib_is_system_table()) {
+      ib_fields_array_.clear();
+      memset(ib_nullables_, 0,
+          (MAX_ROW_VERSION + 1) * sizeof(ib_nullables_[0]));
+      if (table()->HasRowVersions()) {
+        ib_fields_array_.resize(ib_n_def_);
+        for (uint32_t i = 0; i < ib_n_def_; i++) {
+          IndexColumn *index_col = ib_fields_[i];
+          assert(index_col != nullptr && index_col->column() != nullptr);
 
-      case INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION:
-      case INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION: {
-        assert(non_default_fields > 0);
-        assert(index_->ib_instant_cols());
+          size_t pos = index_col->column()->ib_phy_pos();
 
-        if (i >= non_default_fields) {
-          len = GetInstantOffset(i, offs);
-          goto resolved;
+          ib_fields_array_[pos] = i;
         }
-      } break;
 
-      default:
-        assert(false);
-    }
+        uint32_t current_row_version = table()->ib_current_row_version();
+        auto update_nullable = [&](size_t start_version, bool is_increment) {
+          for (size_t i = start_version; i <= current_row_version; i++) {
+            assert(is_increment || ib_nullables_[i] > 0);
 
-    if (col->is_nullable()) {
-      assert(n_null--);
+            if (is_increment) {
+              ++ib_nullables_[i];
+            } else {
+              --ib_nullables_[i];
+            }
+          }
+        };
+        for (uint32_t i = 0; i < ib_n_def_; i++) {
+          IndexColumn *index_col = ib_fields_[i];
 
-      if (!(unsigned char)null_mask) {
-        nulls--;
-        null_mask = 1;
-      }
+          if (index_col->column()->name() == "DB_ROW_ID" ||
+               index_col->column()->name() == "DB_TRX_ID" ||
+               index_col->column()->name() == "DB_ROLL_PTR") {
+            continue;
+          }
 
-      if (*nulls & null_mask) {
-        null_mask <<= 1;
-        len = offs | REC_OFFS_SQL_NULL;
-        goto resolved;
-      }
-      null_mask <<= 1;
-    }
+          if (!index_col->column()->is_nullable()) {
+            continue;
+          }
 
-    if (!index_col->ib_fixed_len()) {
-      /* Variable-length field: read the length */
-      len = *lens--;
-      if (col->IsBigCol()) {
-        if (len & 0x80) {
-          len <<= 8;
-          len |= *lens--;
+          size_t start_from = 0;
+          if (index_col->column()->IsInstantAdded()) {
+            start_from = index_col->column()->GetVersionAdded();
+          }
+          update_nullable(start_from, true);
 
-          offs += len & 0x3fff;
-          if (len & 0x4000) {
-            assert(index_->IsClustered());
-            any_ext = REC_OFFS_EXTERNAL;
-            len = offs | REC_OFFS_EXTERNAL;
-          } else {
-            len = offs;
+          if (index_col->column()->IsInstantDropped()) {
+            update_nullable(index_col->column()->GetVersionDropped(), false);
           }
-          goto resolved;
         }
       }
+    }
+    assert(table_->clust_index() == nullptr);
+    table_->set_clust_index(this);
+  } else {
+    ib_n_user_defined_cols_ = s_user_defined_key_parts_;
+    std::vector<bool> indexed(table()->GetTotalCols(), false);
+    for (auto* iter : ib_fields_) {
+      if (iter->column()->is_virtual()) {
+        continue;
+      }
+      indexed[iter->column()->ib_ind()] = true;
+    }
+    assert(table_->clust_index() != nullptr);
+    for (uint32_t i = 0; i < table_->clust_index()->ib_n_uniq(); i++) {
+      IndexColumn* clust_index_col = table_->clust_index()->ib_fields()->at(i);
+      if (!indexed[clust_index_col->column()->ib_ind()]) {
+        uint32_t prefix_len = 0;
+        IndexAddCol(clust_index_col->column(), prefix_len);
+      } else {
+        // TODO(Zhao): Support spatial index
+      }
+    }
 
-      len = offs += len;
+    if (IsIndexUnique()) {
+      ib_n_uniq_ = ib_n_fields_;
     } else {
-      len = offs += index_col->ib_fixed_len();
+      ib_n_uniq_ = ib_n_def_;
     }
-  resolved:
-    RecOffsBase(offsets_)[i + 1] = len;
-  } while (++i < RecOffsNFields(offsets_));
-
-  *RecOffsBase(offsets_) = (rec_ - (lens + 1)) | REC_OFFS_COMPACT | any_ext;
-}
-
-#define UT_BITS_IN_BYTES(b) (((b) + 7UL) / 8UL)
-Record::REC_INSERT_STATE Record::InitNullAndLengthCompact(
-            const unsigned char** nulls, const unsigned char** lens,
-            uint16_t* n_null, uint16_t* non_default_fields,
-            uint8_t* row_version) {
-  *non_default_fields = static_cast<uint16_t>(index_->GetNFields());
-  *row_version = UINT8_UNDEFINED;
-
-  *nulls = rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
-
-  const enum REC_INSERT_STATE rec_insert_state =
-            GetInsertState();
-  switch (rec_insert_state) {
-    case INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION: {
-      assert(!GetInstantFlagCompact());
-      assert(!IsVersionedCompact());
-
-      *n_null = index_->ib_n_nullable();
-    } break;
-
-    case INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION:
-    case INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
-      *row_version = (uint8_t)(**nulls);
-
-      *nulls -= 1;
-      *n_null = index_->GetNullableInVersion(*row_version);
-    } break;
-
-    case INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION: {
-      uint16_t length;
-      *non_default_fields =
-          GetNFieldsInstant(REC_N_NEW_EXTRA_BYTES, &length);
-      assert(length == 1 || length == 2);
-
-      *nulls -= length;
-      *n_null = index_->CalculateNInstantNullable(*non_default_fields);
-    } break;
-
-    case INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION: {
-      *n_null = index_->GetNullableBeforeInstantAddDrop();
-      *non_default_fields = index_->GetNOriginalFields();
-    } break;
+    ib_n_fields_ = ib_n_def_;
+  }
+  dd_se_private_data_.Get("id", &ib_id_);
+  dd_se_private_data_.Get("root", &ib_page_);
 
-    case INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
-      *n_null = index_->GetNullableBeforeInstantAddDrop();
-    } break;
+  ib_n_fields_ = ib_n_def_;
 
-    default:
-      assert(0);
+  if (IsClustered() && table_->HasRowVersions()) {
+    ib_n_fields_ = ib_n_def_ - table_->GetNInstantDropCols();
   }
-  *lens = *nulls - UT_BITS_IN_BYTES(*n_null);
 
-  return (rec_insert_state);
+  ib_n_total_fields_ = ib_n_def_;
+  ib_row_versions_ = false;
+  ib_instant_cols_ = false;
+  ib_n_instant_nullable_ = ib_n_nullable_;
+  if (IsClustered()) {
+    ib_row_versions_ = table_->HasRowVersions();
+    if (table_->HasInstantCols()) {
+      ib_instant_cols_ = true;
+      uint32_t n_instant_fields = GetNOriginalFields();
+      uint32_t new_n_nullable = CalculateNInstantNullable(n_instant_fields);
+      ib_n_instant_nullable_ = new_n_nullable;
+    }
+  }
+  return true;
 }
 
-Record::REC_INSERT_STATE Record::GetInsertState() {
-  if (!index_->HasInstantColsOrRowVersions()) {
-    return INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION;
-  }
-  const unsigned char* v_ptr =
-      (const unsigned char*)rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
-  const bool is_versioned = IsVersionedCompact();
-  const uint8_t version = (is_versioned) ? (uint8_t)(*v_ptr) : UINT8_UNDEFINED;
-  const bool is_instant = GetInstantFlagCompact();
-  assert(!is_versioned || !is_instant);
-  enum REC_INSERT_STATE rec_insert_state = REC_INSERT_STATE::NONE;
-  if (is_versioned) {
-    if (version == 0) {
-      assert(index_->ib_instant_cols());
-      rec_insert_state =
-          INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION;
-    } else {
-      assert(index_->ib_row_versions());
-      rec_insert_state = INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION;
+/* ------ Table ------ */
+const std::set<std::string> Table::default_valid_option_keys = {
+  "avg_row_length",
+  "checksum",
+  "compress",
+  "connection_string",
+  "delay_key_write",
+  "encrypt_type",
+  "explicit_tablespace",
+  "key_block_size",
+  "keys_disabled",
+  "max_rows",
+  "min_rows",
+  "pack_keys",
+  "pack_record",
+  "plugin_version",
+  "row_type",
+  "secondary_engine",
+  "secondary_load",
+  "server_i_s_table",
+  "server_p_s_table",
+  "stats_auto_recalc",
+  "stats_persistent",
+  "stats_sample_pages",
+  "storage",
+  "tablespace",
+  "timestamp",
+  "view_valid",
+  "gipk"
+};
+
+bool Table::Init(const rapidjson::Value& dd_obj) {
+  // Table
+  Read(&dd_name_, dd_obj, "name");
+  Read(&dd_mysql_version_id_, dd_obj, "mysql_version_id");
+  Read(&dd_created_, dd_obj, "created");
+  Read(&dd_last_altered_, dd_obj, "last_altered");
+  ReadEnum(&dd_hidden_, dd_obj, "hidden");
+  ReadProperties(&dd_options_, dd_obj, "options");
+
+  // Columns
+  if (!dd_obj.HasMember("columns") || !dd_obj["columns"].IsArray()) {
+    std::cerr << "[SDI]Can't find columns" << std::endl;
+    return false;
+  }
+  const rapidjson::Value& columns = dd_obj["columns"].GetArray();
+  for (rapidjson::SizeType i = 0; i < columns.Size(); i++) {
+    if (!columns[i].IsObject()) {
+      std::cerr << "[SDI]Column isn't an object" << std::endl;
+      return false;
     }
-  } else if (is_instant) {
-    assert(index_->table()->HasInstantCols());
-    rec_insert_state = INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION;
-  } else if (index_->table()->HasInstantCols()) {
-    rec_insert_state = INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION;
-  } else {
-    rec_insert_state = INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION;
+    Column* column = Column::CreateColumn(columns[i], &arena_);
+    if (column == nullptr) {
+      return false;
+    }
+    columns_.push_back(column);
   }
 
-  assert(rec_insert_state != REC_INSERT_STATE::NONE);
-  return rec_insert_state;
-}
+  // Table
+  Read(&dd_schema_ref_, dd_obj, "schema_ref");
+  Read(&dd_se_private_id_, dd_obj, "se_private_id");
+  Read(&dd_engine_, dd_obj, "engine");
+  Read(&dd_last_checked_for_upgrade_version_id_, dd_obj,
+       "last_checked_for_upgrade_version_id");
+  Read(&dd_comment_, dd_obj, "comment");
+  ReadProperties(&dd_se_private_data_, dd_obj, "se_private_data");
+  Read(&dd_engine_attribute_, dd_obj, "engine_attribute");
+  Read(&dd_secondary_engine_attribute_, dd_obj, "secondary_engine_attribute");
+  ReadEnum(&dd_row_format_, dd_obj, "row_format");
+  ReadEnum(&dd_partition_type_, dd_obj, "partition_type");
+  Read(&dd_partition_expression_, dd_obj, "partition_expression");
+  Read(&dd_partition_expression_utf8_, dd_obj, "partition_expression_utf8");
+  ReadEnum(&dd_default_partitioning_, dd_obj, "default_partitioning");
+  ReadEnum(&dd_subpartition_type_, dd_obj, "subpartition_type");
+  Read(&dd_subpartition_expression_, dd_obj, "subpartition_expression");
+  Read(&dd_subpartition_expression_utf8_, dd_obj,
+       "subpartition_expression_utf8");
+  ReadEnum(&dd_default_subpartitioning_, dd_obj, "default_subpartitioning");
+  ReadEnum(&dd_collation_id_, dd_obj, "collation_id");
 
-bool Record::IsVersionedCompact() {
-  uint32_t info = GetInfoBits(true);
-  return ((info & REC_INFO_VERSION_FLAG) != 0);
+  // Indexes
+  if (!dd_obj.HasMember("indexes") || !dd_obj["indexes"].IsArray()) {
+    std::cerr << "Can't find indexes" << std::endl;
+    return false;
+  }
+  const rapidjson::Value& indexes = dd_obj["indexes"].GetArray();
+  for (rapidjson::SizeType i = 0; i < indexes.Size(); i++) {
+    if (!indexes[i].IsObject()) {
+      std::cerr << "Index isn't an object" << std::endl;
+      return false;
+    }
+    Index* index = Index::CreateIndex(indexes[i], columns_, this);
+    if (index == nullptr) {
+      return false;
+    }
+    indexes_.push_back(index);
+  }
+
+  /* TABLE_SHARE */
+  s_field_.clear();
+  for (auto* iter : columns_) {
+    if (iter->IsSeHidden()) {
+      continue;
+    }
+    if (iter->is_nullable()) {
+      s_null_fields_++;
+    }
+    s_fields_++;
+    s_field_.push_back(iter);
+  }
+
+  /* SE */
+  if (!InitSeTable()) {
+    return false;
+  }
+  return true;
 }
-uint32_t Record::GetInfoBits(bool comp) {
-  const uint32_t val = GetBitsFrom1B(comp ?
-                                     REC_NEW_INFO_BITS : REC_OLD_INFO_BITS,
-                                     REC_INFO_BITS_MASK, REC_INFO_BITS_SHIFT);
-  return val;
+
+Column* Table::FindColumn(const std::string& col_name) {
+  for (const auto& iter : columns_) {
+    if (iter->name() == col_name) {
+      return iter;
+    }
+  }
+  return nullptr;
 }
-bool Record::GetInstantFlagCompact() {
-  uint32_t info = GetInfoBits(true);
-  return ((info & REC_INFO_INSTANT_FLAG) != 0);
+
+bool Table::ContainFulltext() {
+  for (const auto& iter : indexes_) {
+    if (iter->type() == Index::enum_index_type::IT_FULLTEXT) {
+      return true;
+    }
+  }
+  return false;
 }
 
-uint32_t Record::GetNFieldsInstant(const uint32_t extra_bytes,
-                                   uint16_t* length) {
-  uint16_t n_fields;
-  const unsigned char *ptr;
+#define UNSUPP_TABLE_MASK 0x1F
+#define UNSUPP_TABLE_MASK_PARTITION 0x1
+#define UNSUPP_TABLE_MASK_ENCRYPT 0x2
+#define UNSUPP_TABLE_MASK_FTS_AUX_INDEX 0x4
+#define UNSUPP_TABLE_MASK_FTS_COM_INDEX 0x8
+#define UNSUPP_TABLE_MASK_VERSION 0x10
+void Table::PreCheck() {
+  // TODO(Zhao): Support more MySQL versions
+  if (dd_mysql_version_id_ < 80016 || dd_mysql_version_id_ > 80040) {
+    unsupported_reason_ |= UNSUPP_TABLE_MASK_VERSION;
+  }
 
-  ptr = rec_ - (extra_bytes + 1);
+  if (dd_partition_type_ != enum_partition_type::PT_NONE) {
+    unsupported_reason_ |= UNSUPP_TABLE_MASK_PARTITION;
+  }
 
-  if ((*ptr & REC_N_FIELDS_TWO_BYTES_FLAG) == 0) {
-    *length = 1;
-    return (*ptr);
+  if (dd_options_.Exists("encrypt_type")) {
+    std::string encrypted;
+    dd_options_.Get("encrypt_type", &encrypted);
+    if (encrypted != "" && encrypted != "N" && encrypted != "n") {
+      unsupported_reason_ |= UNSUPP_TABLE_MASK_ENCRYPT;
+    }
   }
 
-  *length = 2;
-  n_fields = ((*ptr-- & REC_N_FIELDS_ONE_BYTE_MAX) << 8);
-  n_fields |= *ptr;
-  assert(n_fields < REC_MAX_N_FIELDS);
-  assert(n_fields != 0);
+  for (const auto& index : indexes_) {
+    if (index->name() == "FTS_INDEX_TABLE_IND" &&
+        dd_hidden_ == enum_hidden_type::HT_HIDDEN_SE) {
+      unsupported_reason_ |= UNSUPP_TABLE_MASK_FTS_AUX_INDEX;
+      continue;
+    }
+    if (index->name() == "FTS_COMMON_TABLE_IND" &&
+        dd_hidden_ == enum_hidden_type::HT_HIDDEN_SE) {
+      unsupported_reason_ |= UNSUPP_TABLE_MASK_FTS_COM_INDEX;
+      continue;
+    }
+  }
+}
 
-  return (n_fields);
+bool Table::IsTableSupported() {
+  return (unsupported_reason_ & UNSUPP_TABLE_MASK) == 0;
 }
 
-uint64_t Record::GetInstantOffset(uint32_t n, uint64_t offs) {
-  assert(index_->HasInstantColsOrRowVersions());
-  Column* col = index_->GetPhysicalField(n)->column();
-  if (col->ib_instant_default()) {
-    return (offs | REC_OFFS_DEFAULT);
-  } else {
-    return (offs | REC_OFFS_SQL_NULL);
+std::string Table::UnsupportedReason() {
+  assert(!IsTableSupported());
+  std::string reason = "";
+  if (unsupported_reason_ & UNSUPP_TABLE_MASK_PARTITION) {
+    reason += "[Partition table]";
+  }
+  if (unsupported_reason_ & UNSUPP_TABLE_MASK_ENCRYPT) {
+    reason += "[Encrpted table]";
   }
+  if (unsupported_reason_ & UNSUPP_TABLE_MASK_FTS_AUX_INDEX) {
+    reason += "[FTS Auxiliary index table]";
+  }
+  if (unsupported_reason_ & UNSUPP_TABLE_MASK_FTS_COM_INDEX) {
+    reason += "[FTS Common index table]";
+  }
+  if (unsupported_reason_ & UNSUPP_TABLE_MASK_VERSION) {
+    reason += ("[Table was created in unsupported version " +
+                std::to_string(dd_mysql_version_id_) +
+                ", expected in [80016, 80040] ]");
+  }
+  return reason;
 }
 
-struct PageAnalysisResult {
-  uint32_t n_recs_non_leaf = 0;
-  uint32_t n_recs_leaf = 0;
-  uint32_t headers_len_non_leaf = 0;
-  uint32_t headers_len_leaf = 0;
-  uint32_t recs_len_non_leaf = 0;
-  uint32_t recs_len_leaf = 0;
-  uint32_t n_deleted_recs_non_leaf = 0;
-  uint32_t n_deleted_recs_leaf = 0;
-  uint32_t deleted_recs_len_non_leaf = 0;
-  uint32_t deleted_recs_len_leaf = 0;
-  uint32_t n_contain_dropped_cols_recs_non_leaf = 0;  // should always be 0
-  uint32_t n_contain_dropped_cols_recs_leaf = 0;
-  uint32_t dropped_cols_len_non_leaf = 0;  // should always be 0
-  uint32_t dropped_cols_len_leaf = 0;
-  uint32_t innodb_internal_used_non_leaf = 0;
-  uint32_t innodb_internal_used_leaf = 0;
-  uint32_t free_non_leaf = 0;
-  uint32_t free_leaf = 0;
-};
-
-struct IndexAnalyzeResult {
-  uint32_t n_level = 0;
-  uint32_t n_pages_non_leaf = 0;
-  uint32_t n_pages_leaf = 0;
-  PageAnalysisResult recs_result;
-};
-
-void Record::ParseRecord(bool leaf, uint32_t row_no,
-                         PageAnalysisResult* result,
-                         bool print) {
-  uint32_t n_fields = leaf ? index_->GetNFields() :
-                             index_->GetNUniqueInTreeNonleaf() + 1;
-  uint32_t header_len = (RecOffsBase(offsets_)[0] & REC_OFFS_MASK);
-  uint32_t rec_len = (RecOffsBase(offsets_)[n_fields] &
-                      REC_OFFS_MASK);
-  ninja_pt(print, "=========================================="
-                  "=============================\n");
-  ninja_pt(print, "[ROW %u] Length: %u (%d | %d), Number of fields: %u\n",
-                   row_no,
-                   header_len + rec_len,
-                   header_len,
-                   rec_len,
-                   n_fields);
-  bool deleted = false;
-  if (RecGetDeletedFlag(rec_, true) != 0) {
-    ninja_pt(print, "[DELETED MARK]\n");
-    deleted = true;
+bool Table::InitSeTable() {
+  PreCheck();
+  if (!IsTableSupported()) {
+    return true;
   }
-  if (!deleted) {
-    if (leaf) {
-      result->n_recs_leaf++;
-      result->headers_len_leaf += header_len;
-      result->recs_len_leaf += rec_len;
-    } else {
-      result->n_recs_non_leaf++;
-      result->headers_len_non_leaf += header_len;
-      result->recs_len_non_leaf += rec_len;
-    }
+  std::string norm_name = dd_schema_ref_.str() + "/" + dd_name_.str();
+
+  if (dd_schema_ref_ == "mysql" && dd_schema_ref_ == "information_schema" &&
+      dd_schema_ref_ == "performance_schema") {
+    ib_is_system_table_ = true;
   } else {
-    if (leaf) {
-      result->n_deleted_recs_leaf++;
-      result->deleted_recs_len_leaf += (header_len + rec_len);
-    } else {
-      result->n_deleted_recs_non_leaf++;
-      result->deleted_recs_len_non_leaf += (header_len + rec_len);
-    }
+    ib_is_system_table_ = false;
   }
-  uint32_t start_pos = 0;
-  uint32_t len = 0;
-  uint32_t end_pos = 0;
-  ibd_ninja::IndexColumn* index_col = nullptr;
-  ninja_pt(print, "------------------------------------------"
-                  "-----------------------------\n");
-  ninja_pt(print, "  [HEADER   ]         ");
-  int count = 0;
-  for (uint32_t i = 0; i < header_len; i++) {
-    ninja_pt(print, "%02x ", (rec_ - header_len)[i]);
-    count++;
-    if (count == 8) {
-      ninja_pt(print, " ");
-    } else if (count == 16) {
-      ninja_pt(print, "\n                      ");
-      count = 0;
+
+  [[maybe_unused]] bool is_encrypted = false;
+  if (dd_options_.Exists("encrypt_type")) {
+    std::string encrypted;
+    dd_options_.Get("encrypt_type", &encrypted);
+    if (encrypted != "" && encrypted != "N" && encrypted != "n") {
+      is_encrypted = true;
     }
   }
-  ninja_pt(print, "\n");
-  bool dropped_column_counted = false;
-  for (uint32_t i = 0; i < n_fields; i++) {
-    index_col = nullptr;
-    if (!leaf && i == n_fields - 1) {
-      ninja_pt(print, "  [FIELD %3u] Name  : *NODE_PTR(Child page no)\n",
-                         i + 1);
-    } else {
-      index_col = index_->GetPhysicalField(i);
-      ninja_pt(print, "  [FIELD %3u] Name  : %s\n",
-                         i + 1,
-                         index_col->column()->name().c_str());
-    }
 
-    len = RecOffsBase(offsets_)[i + 1];
-    end_pos = (len & REC_OFFS_MASK);
-    ninja_pt(print, "              "
-                    "Length: %-5u\n",
-                    end_pos - start_pos);
-    // TODO(Zhao): handle external part
-    if (index_col != nullptr &&
-        index_col->column()->IsColumnDropped()) {
-      // Only count valid records with non-zero size for dropped columns.
-      if (!deleted && !(len & REC_OFFS_DROP)) {
-        if (leaf) {
-          result->dropped_cols_len_leaf += (end_pos - start_pos);
-          if (!dropped_column_counted) {
-            result->n_contain_dropped_cols_recs_leaf++;
-          }
-        } else {
-          result->dropped_cols_len_non_leaf += (end_pos - start_pos);
-          if (!dropped_column_counted) {
-            result->n_contain_dropped_cols_recs_non_leaf++;
-          }
+  bool has_doc_id = false;
+  const Column* col = FindColumn(FTS_DOC_ID_COL_NAME);
+  if (col != 0 && col->type() == Column::enum_column_types::LONGLONG &&
+      !col->is_nullable()) {
+    has_doc_id = true;
+  }
+  bool add_doc_id = false;
+  if (has_doc_id && col->IsSeHidden()) {
+    add_doc_id = true;
+  }
+
+  // TODO(Zhao): Support partition table
+
+  uint32_t n_cols = s_fields_ + (add_doc_id ? 1 : 0);
+  uint32_t n_v_cols = 0;
+  uint32_t n_m_v_cols = 0;
+  for (const auto& iter : columns_) {
+    if (iter->IsSeHidden()) {
+      continue;
+    }
+    if (iter->is_virtual()) {
+      n_v_cols++;
+      if (iter->options().Exists("is_array")) {
+        bool is_array = false;
+        iter->options().Get("is_array", &is_array);
+        if (is_array) {
+          n_m_v_cols++;
         }
-        dropped_column_counted = true;
       }
     }
+  }
 
-    // index_col is nullptr for node_ptr
-    if (index_col != nullptr) {
-    ninja_pt(print, "              "
-                    "Type  : %-15s | %-12s | %-20s\n",
-                    index_col->column()->dd_column_type_utf8().c_str(),
-                    index_col->column()->FieldTypeString().c_str(),
-                    index_col->column()->SeTypeString().c_str());
-    }
+  uint32_t current_row_version = 0;
+  uint32_t n_current_cols = 0;
+  uint32_t n_initial_cols = 0;
+  uint32_t n_total_cols = 0;
 
-    ninja_pt(print, "              "
-                    "Value : ");
-    if (len & REC_OFFS_SQL_NULL) {
-      ninja_pt(print, "*NULL*\n");
-      start_pos = end_pos;
-      continue;
-    }
-    if (len & REC_OFFS_DROP) {
-      ninja_pt(print, "*NULL*\n"
-                      "                      "
-                      "(This row was inserted after this column "
-                      "was instantly dropped)\n");
-      start_pos = end_pos;
+  uint32_t n_dropped_cols = 0;
+  uint32_t n_added_cols = 0;
+  uint32_t n_added_and_dropped_cols = 0;
+  bool has_row_version = false;
+  for (const auto& iter : columns_) {
+    if (iter->IsSystemColumn() || iter->is_virtual()) {
       continue;
     }
-    if (len & REC_OFFS_DEFAULT) {
-      ninja_pt(print, "*DEFAULT*\n"
-                      "                      "
-                      "(This row was inserted before this column "
-                      "was instantly added)\n");
-      start_pos = end_pos;
-      continue;
+
+    if (!has_row_version) {
+      if (iter->se_private_data().Exists("physical_pos")) {
+        has_row_version = true;
+      }
     }
-    count = 0;
-    while (start_pos < end_pos) {
-      ninja_pt(print, "%02x ", rec_[start_pos]);
-      count++;
-      if (count == 8) {
-        ninja_pt(print, " ");
-      } else if (count == 16) {
-        ninja_pt(print, "\n                      ");
-        count = 0;
+
+    if (iter->IsColumnDropped()) {
+      n_dropped_cols++;
+      if (iter->IsColumnAdded()) {
+        n_added_and_dropped_cols++;
       }
-      start_pos++;
+      uint32_t v_dropped = iter->GetVersionDropped();
+      current_row_version = std::max(current_row_version, v_dropped);
+      continue;
     }
-    if (len & REC_OFFS_EXTERNAL) {
-      const unsigned char* ext_ref = &rec_[end_pos - 20];
-      [[maybe_unused]] uint32_t space_id =
-                         ReadFrom4B(ext_ref + BTR_EXTERN_SPACE_ID);
-      [[maybe_unused]] uint32_t page_no =
-                         ReadFrom4B(ext_ref + BTR_EXTERN_PAGE_NO);
-      uint64_t ext_len = ReadFrom4B(ext_ref + BTR_EXTERN_LEN + 4);
-      ninja_pt(print, "\n                      "
-              "[Remaining %" PRIu64 " bytes have been offloaded externally...]",
-              ext_len);
+
+    if (iter->IsColumnAdded()) {
+      n_added_cols++;
+      uint32_t v_added = iter->GetVersionAdded();
+      current_row_version = std::max(current_row_version, v_added);
     }
-    ninja_pt(print, "\n");
+    n_current_cols++;
   }
-}
+  n_initial_cols = (n_current_cols - n_added_cols) +
+                   (n_dropped_cols - n_added_and_dropped_cols);
+  n_total_cols = n_current_cols + n_dropped_cols;
 
-uint32_t Record::GetChildPageNo() {
-  uint32_t n_fields = GetNFields();
-  assert(n_fields >= 2);
-  uint32_t last_2_len = (RecOffsBase(offsets_)[n_fields - 1]);
-  uint32_t last_2_end_pos = (last_2_len & REC_OFFS_MASK);
-  uint32_t last_len = (RecOffsBase(offsets_)[n_fields]);
-  uint32_t last_end_pos = (last_len & REC_OFFS_MASK);
-  assert(last_end_pos - last_2_end_pos == 4);
-  return ReadFrom4B(&rec_[last_2_end_pos]);
-}
+  ib_n_t_cols_ = n_cols + DATA_N_SYS_COLS;
+  ib_n_v_cols_ = n_v_cols;
+  ib_n_m_v_cols_ = n_m_v_cols;
+  ib_n_cols_ = ib_n_t_cols_ - ib_n_v_cols_;
+  ib_n_instant_cols_ = ib_n_cols_;
+  ib_initial_col_count_ = n_initial_cols;
+  ib_current_col_count_ = n_current_cols;
+  ib_total_col_count_ = n_total_cols;
+  ib_current_row_version_ = current_row_version;
+  ib_m_upgraded_instant_ = false;
 
-/* ------ Ninja ------ */
-static bool ValidateSDI(const rapidjson::Document& doc) {
-  bool ret = true;
-  if (!doc.HasMember("dd_object_type") ||
-      !doc["dd_object_type"].IsString() ||
-      (std::string(doc["dd_object_type"].GetString()) != "Table" &&
-      (std::string(doc["dd_object_type"].GetString()) != "Tablespace")) ||
-      !doc.HasMember("dd_object") ||
-      !doc["dd_object"].IsObject()) {
-    ret = false;
-  }
+  ib_id_ = dd_se_private_id_;
 
-  if (!doc.HasMember("mysqld_version_id") ||
-      !doc["mysqld_version_id"].IsUint() ||
-      !doc.HasMember("dd_version") ||
-      !doc["dd_version"].IsUint() ||
-      !doc.HasMember("sdi_version") ||
-      !doc["sdi_version"].IsUint()) {
-    ret = false;
+  if (dd_se_private_data_.Exists("instant_col")) {
+    uint32_t n_inst_cols = 0;
+    if (dd_partition_type_ != enum_partition_type::PT_NONE) {
+      // TODO(Zhao): Support partition table
+    } else {
+      dd_se_private_data_.Get("instant_col", &n_inst_cols);
+      ib_n_instant_cols_ = n_inst_cols + DATA_N_SYS_COLS;
+      ib_m_upgraded_instant_ = true;
+    }
   }
-  return ret;
-}
 
-const char* ibdNinja::g_version_ = "1.0.0";
+  ib_cols_.clear();
+  ib_n_def_ = 0;
+  ib_n_v_def_ = 0;
+  ib_n_t_def_ = 0;
 
-void ibdNinja::PrintName() {
-  fprintf(stdout,
-"|--------------------------------------------------------------------------------------------------------------|\n"
-"|    _      _                         _   _           _      _                              _                  |\n"
-"|   (_)    (_)                       (_) (_) _       (_)    (_)                            (_)                 |\n"
-"| _  _     (_) _  _  _       _  _  _ (_) (_)(_)_     (_)  _  _      _  _  _  _           _  _     _  _  _      |\n"
-"|(_)(_)    (_)(_)(_)(_)_   _(_)(_)(_)(_) (_)  (_)_   (_) (_)(_)    (_)(_)(_)(_)_        (_)(_)   (_)(_)(_) _   |\n"
-"|   (_)    (_)        (_) (_)        (_) (_)    (_)_ (_)    (_)    (_)        (_)          (_)    _  _  _ (_)  |\n"
-"|   (_)    (_)        (_) (_)        (_) (_)      (_)(_)    (_)    (_)        (_)          (_)  _(_)(_)(_)(_)  |\n"
-"| _ (_) _  (_) _  _  _(_) (_)_  _  _ (_) (_)         (_)  _ (_) _  (_)        (_)          (_) (_)_  _  _ (_)_ |\n"
-"|(_)(_)(_) (_)(_)(_)(_)     (_)(_)(_)(_) (_)         (_) (_)(_)(_) (_)        (_)  _      _(_)   (_)(_)(_)  (_)|\n"
-"|                                                                                 (_)_  _(_)                   |\n"
-"|                                                                                   (_)(_)                     |\n"
-"|--------------------------------------------------------------------------------------------------------------|\n");
-}
+  for (auto* iter : s_field_) {
+    iter->set_ib_mtype(iter->FieldType2SeType());
+    ib_n_t_def_++;
+    if (!iter->is_virtual()) {
+      iter->set_ib_ind(ib_n_def_);
+      ib_n_def_++;
+      uint32_t v_added = iter->GetVersionAdded();
+      uint32_t phy_pos = UINT32_UNDEFINED;
+      bool is_hidden_by_system =
+        (iter->hidden() == Column::enum_hidden_type::HT_HIDDEN_SE ||
+         iter->hidden() == Column::enum_hidden_type::HT_HIDDEN_SQL);
+      if (has_row_version) {
+        if (iter->se_private_data().Exists("physical_pos")) {
+          iter->se_private_data().Get("physical_pos", &phy_pos);
+          assert(phy_pos != UINT32_UNDEFINED);
+        }
+      }
+      iter->set_ib_is_visible(!is_hidden_by_system);
+      iter->set_ib_version_added(v_added);
+      iter->set_ib_version_dropped(UINT8_UNDEFINED);
+      iter->set_ib_phy_pos(phy_pos);
+      if (iter->FieldType() == Column::enum_field_types::MYSQL_TYPE_VARCHAR) {
+        // The col_len of VARCHAR in InnoDB does not include the length header.
+        uint32_t col_len = iter->PackLength() - iter->VarcharLenBytes();
+        iter->set_ib_col_len(col_len);
+      } else {
+        iter->set_ib_col_len(iter->PackLength());
+      }
 
-ibdNinja* ibdNinja::CreateNinja(const char* ibd_filename) {
-  unsigned char buf[UNIV_PAGE_SIZE_MAX];
-  memset(buf, 0, UNIV_PAGE_SIZE_MAX);
-  struct stat stat_info;
-  if (stat(ibd_filename, &stat_info) != 0) {
-    ninja_error("Failed to get file stats: %s, error: %d(%s)",
-            ibd_filename, errno, strerror(errno));
-    return nullptr;
-  }
-  uint64_t size = stat_info.st_size;
-  g_fd = open(ibd_filename, O_RDONLY);
-  if (g_fd == -1) {
-    ninja_error("Failed to open file: %s, error: %d(%s)",
-            ibd_filename, errno, strerror(errno));
-    close(g_fd);
-    return nullptr;
-  }
-  if (size < UNIV_ZIP_SIZE_MIN) {
-    ninja_error("The file is too small to be a valid ibd file");
-    close(g_fd);
-    return nullptr;
-  }
-  ssize_t bytes = read(g_fd, buf, UNIV_ZIP_SIZE_MIN);
-  if (bytes != UNIV_ZIP_SIZE_MIN) {
-    ninja_error("Failed to read file header: %s, error: %d(%s)",
-            ibd_filename, errno, strerror(errno));
-    close(g_fd);
-    return nullptr;
-  }
-  uint32_t space_id = ReadFrom4B(buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
-  uint32_t first_page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
-  uint32_t flags = FSPHeaderGetFlags(buf);
-  bool is_valid_flags = FSPFlagsIsValid(flags);
-  uint32_t page_size = 0;
-  if (is_valid_flags) {
-    uint32_t ssize = FSP_FLAGS_GET_PAGE_SSIZE(flags);
-    if (ssize == 0) {
-      page_size = UNIV_PAGE_SIZE_ORIG;
+      ib_cols_.push_back(iter);
     } else {
-      page_size = ((UNIV_ZIP_SIZE_MIN >> 1) << ssize);
+      ib_n_v_def_++;
     }
-    g_page_size_shift = PageSizeValidate(page_size);
   }
-  if (!is_valid_flags || g_page_size_shift == 0) {
-    ninja_error("Found corruption on page 0 of file %s",
-            ibd_filename);
-    close(g_fd);
-    return nullptr;
-  }
-
-  g_page_logical_size = page_size;
 
-  assert(g_page_logical_size <= UNIV_PAGE_SIZE_MAX);
-  assert(g_page_logical_size <= (1 << PAGE_SIZE_T_SIZE_BITS));
-
-  uint32_t ssize = FSP_FLAGS_GET_ZIP_SSIZE(flags);
-
-  if (ssize == 0) {
-    g_page_compressed = false;
-    g_page_physical_size = g_page_logical_size;
-  } else {
-    g_page_compressed = true;
-
-    g_page_physical_size = ((UNIV_ZIP_SIZE_MIN >> 1) << ssize);
-
-    assert(g_page_physical_size <= UNIV_ZIP_SIZE_MAX);
-    assert(g_page_physical_size <= (1 << PAGE_SIZE_T_SIZE_BITS));
+  if (add_doc_id) {
+    Column* doc_id_col = arena_.New<Column>(FTS_DOC_ID_COL_NAME,
+                                            ib_n_def_, true);
+    ib_n_t_def_++;
+    ib_n_def_++;
+    doc_id_col->set_type(Column::enum_column_types::LONGLONG);
+    doc_id_col->set_ib_mtype(DATA_INT);
+    doc_id_col->set_ib_col_len(sizeof(uint64_t));
+    ib_cols_.push_back(doc_id_col);
   }
-  uint32_t n_pages = size / g_page_physical_size;
-
-  uint32_t post_antelope = FSP_FLAGS_GET_POST_ANTELOPE(flags);
-  uint32_t atomic_blobs = FSP_FLAGS_HAS_ATOMIC_BLOBS(flags);
-  uint32_t has_data_dir = FSP_FLAGS_HAS_DATA_DIR(flags);
-  uint32_t shared = FSP_FLAGS_GET_SHARED(flags);
-  uint32_t temporary = FSP_FLAGS_GET_TEMPORARY(flags);
-  uint32_t encryption = FSP_FLAGS_GET_ENCRYPTION(flags);
-  uint32_t has_sdi = FSP_FLAGS_HAS_SDI(flags);
 
-  bytes = ReadPage(0, buf);
-  if (bytes == -1) {
-    ninja_error("Failed to read file header: %s, error: %d(%s)",
-            ibd_filename, errno, strerror(errno));
-    close(g_fd);
-    return nullptr;
-  }
-  uint32_t sdi_offset = XDES_ARR_OFFSET +
-                    XDES_SIZE * (g_page_physical_size / FSP_EXTENT_SIZE) +
-                    INFO_MAX_SIZE;
-  assert(sdi_offset + 4 < bytes);
-  uint32_t sdi_root = ReadFrom4B(buf + sdi_offset + 4);
-  if (!has_sdi) {
-    ninja_warn("FSP doesn't have SDI flags... "
-               "Attempting to parse the SDI root page %u directly anyway.",
-               sdi_root);
+  Column* row_id_col = FindColumn("DB_ROW_ID");
+  if (row_id_col != nullptr) {
+    // DB_ROW_ID is already in the columns_
+    ib_n_t_def_++;
+    row_id_col->set_ib_ind(ib_n_def_);
+    ib_n_def_++;
+    row_id_col->set_ib_mtype(DATA_SYS);
+    row_id_col->set_ib_is_visible(false);
+    row_id_col->set_ib_version_added(0);
+    row_id_col->set_ib_version_dropped(0);
+    uint32_t phy_pos = UINT32_UNDEFINED;
+    if (has_row_version) {
+      if (row_id_col->se_private_data().Exists("physical_pos")) {
+        row_id_col->se_private_data().Get("physical_pos", &phy_pos);
+      }
+    }
+    row_id_col->set_ib_phy_pos(phy_pos);
+    row_id_col->set_ib_col_len(DATA_ROW_ID_LEN);
+    ib_cols_.push_back(row_id_col);
+  } else {
+    row_id_col_ = arena_.New<Column>("DB_ROW_ID", ib_n_def_);
+    ib_n_t_def_++;
+    ib_n_def_++;
+    row_id_col_->set_ib_col_len(DATA_ROW_ID_LEN);
+    row_id_col_->set_type(Column::enum_column_types::INT24);
+    ib_cols_.push_back(row_id_col_);
   }
-  fprintf(stdout, "=========================================="
-                  "==========================================\n");
-  fprintf(stdout, "|  FILE INFORMATION                       "
-                  "                                         |\n");
-  fprintf(stdout, "------------------------------------------"
-                  "------------------------------------------\n");
-  fprintf(stdout, "    File name:             %s\n", ibd_filename);
-  fprintf(stdout, "    File size:             %" PRIu64 " B\n", size);
-  fprintf(stdout, "    Space id:              %u\n", space_id);
-  fprintf(stdout, "    Page logical size:     %u B\n", g_page_logical_size);
-  fprintf(stdout, "    Page physical size:    %u B\n", g_page_physical_size);
-  fprintf(stdout, "    Total number of pages: %u\n", n_pages);
-  fprintf(stdout, "    Is compressed page?    %u\n", g_page_compressed);
-  fprintf(stdout, "    First page number:     %u\n", first_page_no);
-  fprintf(stdout, "    SDI root page number:  %u\n", sdi_root);
-  fprintf(stdout, "    Post antelop:          %u\n", post_antelope);
-  fprintf(stdout, "    Atomic blobs:          %u\n", atomic_blobs);
-  fprintf(stdout, "    Has data dir:          %u\n", has_data_dir);
-  fprintf(stdout, "    Shared:                %u\n", shared);
-  fprintf(stdout, "    Temporary:             %u\n", temporary);
-  fprintf(stdout, "    Encryption:            %u\n", encryption);
-  fprintf(stdout, "------------------------------------------"
-                  "------------------------------------------\n");
 
-  if (g_page_compressed) {
-    ninja_error("Parsing of compressed table/tablespaces is "
-                "not yet supported.");
-    return nullptr;
-  }
-  if (encryption) {
-    ninja_error("Parsing of encrpted space is not yet supported");
-    return nullptr;
-  }
-  if (temporary) {
-    ninja_error("Parsing of temporary space is not yet supported");
-    return nullptr;
+  Column* trx_id_col = FindColumn("DB_TRX_ID");
+  assert(trx_id_col != nullptr);
+  if (trx_id_col != nullptr) {
+    ib_n_t_def_++;
+    trx_id_col->set_ib_ind(ib_n_def_);
+    ib_n_def_++;
+    trx_id_col->set_ib_mtype(DATA_SYS);
+    trx_id_col->set_ib_is_visible(false);
+    trx_id_col->set_ib_version_added(0);
+    trx_id_col->set_ib_version_dropped(0);
+    uint32_t phy_pos = UINT32_UNDEFINED;
+    if (has_row_version) {
+      if (trx_id_col->se_private_data().Exists("physical_pos")) {
+        trx_id_col->se_private_data().Get("physical_pos", &phy_pos);
+      }
+    }
+    trx_id_col->set_ib_phy_pos(phy_pos);
+    trx_id_col->set_ib_col_len(DATA_TRX_ID_LEN);
+    ib_cols_.push_back(trx_id_col);
   }
 
-  /* DEBUG
-  fprintf(stdout, "[ibdNinja]: Loading SDI...\n"
-                  "            1. Traversaling down to the "
-                  "leafmost leaf page\n");
-  */
-  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
-  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
-  unsigned char* buf_align = static_cast<unsigned char*>(
-                    ut_align(buf_unalign, g_page_physical_size));
-  uint32_t leaf_page_no = 0;
-  bool res = SDIToLeftmostLeaf(buf_align, sdi_root, &leaf_page_no);
-  if (!res) {
-    return nullptr;
+  Column* roll_ptr_col = FindColumn("DB_ROLL_PTR");
+  assert(roll_ptr_col != nullptr);
+  if (roll_ptr_col != nullptr) {
+    ib_n_t_def_++;
+    roll_ptr_col->set_ib_ind(ib_n_def_);
+    ib_n_def_++;
+    roll_ptr_col->set_ib_mtype(DATA_SYS);
+    roll_ptr_col->set_ib_is_visible(false);
+    roll_ptr_col->set_ib_version_added(0);
+    roll_ptr_col->set_ib_version_dropped(0);
+    uint32_t phy_pos = UINT32_UNDEFINED;
+    if (has_row_version) {
+      if (roll_ptr_col->se_private_data().Exists("physical_pos")) {
+        roll_ptr_col->se_private_data().Get("physical_pos", &phy_pos);
+      }
+    }
+    roll_ptr_col->set_ib_phy_pos(phy_pos);
+    roll_ptr_col->set_ib_col_len(DATA_ROLL_PTR_LEN);
+    ib_cols_.push_back(roll_ptr_col);
   }
 
-  /* DEBUG
-  fprintf(stdout, "            2. Parsing SDI records and loading tables:\n");
-  */
-  unsigned char* current_rec = SDIGetFirstUserRec(buf_align,
-                                                  g_page_physical_size);
-  if (current_rec == nullptr) {
-    return nullptr;
-  }
-  ibdNinja* ninja = new ibdNinja(n_pages);
-  bool corrupt = false;
-  uint64_t sdi_id = 0;
-  uint64_t sdi_type = 0;
-  unsigned char* sdi_data = nullptr;
-  uint64_t sdi_data_len = 0;
-  while (current_rec != nullptr && !corrupt) {
-    bool ret = SDIParseRec(current_rec, &sdi_type, &sdi_id, &sdi_data, &sdi_data_len);
-    if (ret == false) {
-      corrupt = true;
-      break;
-    }
-    rapidjson::Document doc;
-    rapidjson::ParseResult ok = doc.Parse(
-                                reinterpret_cast<const char*>(sdi_data));
-    if (!ok) {
-      std::cerr << "JSON parse error: "
-                << rapidjson::GetParseError_En(ok.Code()) << " (offset "
-                << ok.Offset() << ")"
-                << " sdi: " << sdi_data << std::endl;
-      delete[] sdi_data;
-      corrupt = true;
-      delete ninja;
-      return nullptr;
-    }
-    if (!ValidateSDI(doc)) {
-      std::cerr << "Invalid SDI: " << sdi_data << std::endl;
-      delete[] sdi_data;
-      corrupt = true;
-      delete ninja;
-      return nullptr;
+  if (HasInstantDropCols()) {
+    for (auto* iter : columns_) {
+      if (iter->IsSystemColumn()) {
+        continue;
+      }
+      if (iter->IsColumnDropped()) {
+        iter->set_ib_mtype(iter->FieldType2SeType());
+        iter->set_ib_ind(ib_n_def_);
+        ib_n_def_++;
+        ib_n_t_def_++;
+        uint32_t v_added = iter->GetVersionAdded();
+        uint32_t v_dropped = iter->GetVersionDropped();
+        uint32_t phy_pos = UINT32_UNDEFINED;
+        assert(iter->se_private_data().Exists("physical_pos"));
+        iter->se_private_data().Get("physical_pos", &phy_pos);
+        assert(phy_pos != UINT32_UNDEFINED);
+        iter->set_ib_is_visible(false);
+        iter->set_ib_version_added(v_added);
+        iter->set_ib_version_dropped(v_dropped);
+        iter->set_ib_phy_pos(phy_pos);
+        if (iter->FieldType() == Column::enum_field_types::MYSQL_TYPE_VARCHAR) {
+          // The col_len of VARCHAR in InnoDB does not include the length header.
+          uint32_t col_len = iter->PackLength() - iter->VarcharLenBytes();
+          iter->set_ib_col_len(col_len);
+        } else {
+          iter->set_ib_col_len(iter->PackLength());
+        }
+        ib_cols_.push_back(iter);
+      }
     }
+  }
 
-    [[maybe_unused]] uint32_t mysqld_version_id =
-                                doc["mysqld_version_id"].GetUint();
-    [[maybe_unused]] uint32_t dd_version =
-                                doc["dd_version"].GetUint();
-    [[maybe_unused]] uint32_t sdi_version =
-                                doc["sdi_version"].GetUint();
-
-    if (std::string(doc["dd_object_type"].GetString()) == "Table") {
-      const rapidjson::Value& dd_object = doc["dd_object"];
-      Table* table = Table::CreateTable(dd_object, sdi_data);
-      if (table != nullptr) {
-        // table->DebugDump();
-        ninja->AddTable(table);
-        /* DEBUG
-           fprintf(stdout, "              %s.%s\n",
-           table->schema_ref().c_str(),
-           table->name().c_str());
-         */
-      } else {
-        ninja_warn("Failed to recover table %s from SDI, "
-                    "the SDI may be corrupt, skipping it",
-                    dd_object["name"].GetString());
+  if (HasInstantCols() || HasRowVersions()) {
+    // TODO(Zhao): Support partition table
+    for (auto* iter : columns_) {
+      iter->set_ib_instant_default(false);
+      if (iter->is_virtual() || iter->IsSystemColumn()) {
+        continue;
+      }
+      if (iter->IsColumnDropped()) {
+        continue;
+      }
+      if (!iter->se_private_data().Exists("default_null") &&
+          !iter->se_private_data().Exists("default")) {
+        // This is not INSTANT ADD column
+        continue;
       }
-    } else {
-      // Tablespace
-      delete[] sdi_data;
-    }
 
-    current_rec = SDIGetNextRec(current_rec, buf_align,
-                            g_page_physical_size, &corrupt);
+      if (iter->se_private_data().Exists("default_null")) {
+        iter->set_ib_instant_default(false);
+      } else if (iter->se_private_data().Exists("default")) {
+        iter->set_ib_instant_default(true);
+        std::string default_hex;
+        std::string default_value;
+        iter->se_private_data().Get("default", &default_hex);
+        HexToBytes("0x" + default_hex, &default_value);
+        iter->set_ib_instant_default_value(default_value);
+      }
+    }
   }
-  if (corrupt) {
-    delete ninja;
-    return nullptr;
+
+  assert(!indexes_.empty());
+  uint32_t ind = 0;
+  for (auto* iter : indexes_) {
+    iter->FillIndex(ind);
+    ind++;
   }
-  fprintf(stdout, "[ibdNinja]: Successfully loaded %5lu tables "
-                  "with %5lu indexes.\n",
-          ninja->tables()->size(), ninja->indexes()->size());
-  fprintf(stdout, "=========================================="
-                  "==========================================\n\n");
-  return ninja;
+
+  return true;
 }
 
-void ibdNinja::AddTable(Table* table) {
-  all_tables_.push_back(table);
-  if (!table->IsTableSupported()) {
-    ninja_warn("Skipping loading table '%s.%s', Reason: '%s'",
-               table->schema_ref().c_str(), table->name().c_str(),
-               table->UnsupportedReason().c_str());
-    return;
-  }
-  tables_.insert({table->se_private_id(), table});
-  for (auto iter : table->indexes()) {
-    if (!iter->IsIndexSupported()) {
-      ninja_warn("Skipping loading index '%s' of table '%s.%s', "
-                 "Reason: '%s'\n",
-                 iter->name().c_str(),
-                 table->schema_ref().c_str(), table->name().c_str(),
-                 iter->UnsupportedReason().c_str());
-      continue;
-    }
-    uint64_t index_id = 0;
-    assert(iter->se_private_data().Exists("id"));
-    iter->se_private_data().Get("id", &index_id);
-    indexes_.insert({index_id, iter});
+Table* Table::CreateTable(const rapidjson::Value& dd_obj) {
+  Table* table = new Table();
+  bool init_ret = table->Init(dd_obj);
+  if (!init_ret) {
+    delete table;
+    table = nullptr;
   }
+  return table;
 }
 
-bool ibdNinja::SDIToLeftmostLeaf(unsigned char* buf, uint32_t sdi_root,
-                                 uint32_t* leaf_page_no) {
-  uint32_t bytes = ReadPage(sdi_root, buf);
-  if (bytes != g_page_physical_size) {
-    ninja_error("Failed to read page: %u, error: %d(%s)",
-            sdi_root, errno, strerror(errno));
+bool Table::IsTableParsingRecSupported() {
+  if (!IsTableSupported()) {
     return false;
   }
-  uint32_t page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
-  uint32_t n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
-  if (n_of_recs == 0) {
-    ninja_warn("No SDI is found in this file, "
-               "it might be from an older MySQL version.");
-    ninja_warn("ibdNinja currently supports MySQL 8.0.16 to 8.0.40.");
+  if (dd_row_format_ != RF_DYNAMIC &&
+      dd_row_format_ != RF_COMPACT) {
+    ninja_error("Parsing of record with row format %s is not yet supported",
+                 RowFormatString().c_str());
     return false;
   }
+  return true;
+}
 
-  uint32_t curr_page_no = sdi_root;
-  unsigned char rec_type_byte;
-  unsigned char rec_type;
-  /* DEBUG
-  fprintf(stdout, "              Level %u: page %u\n",
-                  page_level, curr_page_no);
-  */
-  while (page_level != 0) {
-    rec_type_byte = *(buf + PAGE_NEW_INFIMUM - REC_OFF_TYPE);
+/* ------ Record ------ */
+uint32_t Record::GetBitsFrom1B(uint32_t offs, uint32_t mask, uint32_t shift) {
+  return ((ReadFrom1B(rec_ - offs) & mask) >> shift);
+}
+uint32_t Record::GetBitsFrom2B(uint32_t offs, uint32_t mask, uint32_t shift) {
+  return ((ReadFrom2B(rec_ - offs) & mask) >> shift);
+}
 
-    rec_type = rec_type_byte & 0x7;
+uint32_t Record::GetStatus() {
+  uint32_t ret = 0;
+  ret = GetBitsFrom1B(REC_NEW_STATUS, REC_NEW_STATUS_MASK,
+                      REC_NEW_STATUS_SHIFT);
+  assert((ret & ~REC_NEW_STATUS_MASK) == 0);
+  return ret;
+}
 
-    if (rec_type != REC_STATUS_INFIMUM) {
-      ninja_error("Failed to get INFIMUM from page: %u", curr_page_no);
-      break;
+uint32_t* Record::GetColumnOffsets() {
+  uint32_t n = 0;
+  if (index_->table()->IsCompact()) {
+    switch (GetStatus()) {
+      case REC_STATUS_ORDINARY:
+       n = index_->GetNFields();
+       break;
+      case REC_STATUS_NODE_PTR:
+       n = index_->GetNUniqueInTreeNonleaf() + 1;
+       break;
+      case REC_STATUS_INFIMUM:
+      case REC_STATUS_SUPREMUM:
+        n = 1;
+        break;
+      default:
+        assert(0);
     }
+  } else {
+    // TODO(Zhao): Support redundant row format
+  }
+  uint32_t size = n + (1 + REC_OFFS_HEADER_SIZE);
+  assert(offsets_ == nullptr);
+  offsets_ = new uint32_t[size];
+  SetNAlloc(size);
+  SetNFields(n);
+  InitColumnOffsets();
 
-    uint32_t next_rec_off_t =
-        ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
-
-    uint32_t child_page_no =
-        ReadFrom4B(buf + PAGE_NEW_INFIMUM + next_rec_off_t +
-                         REC_DATA_TYPE_LEN + REC_DATA_ID_LEN);
-
-    if (child_page_no < SDI_BLOB_ALLOWED) {
-      ninja_error("Failed to get INFIMUM from page: %u", child_page_no);
-      return false;
-    }
+  return offsets_;
+}
 
-    uint64_t curr_page_level = page_level;
+static uint32_t* RecOffsBase(uint32_t* offsets) {
+  return offsets + REC_OFFS_HEADER_SIZE;
+}
 
-    bytes = ReadPage(child_page_no, buf);
-    if (bytes != g_page_physical_size) {
-      ninja_error("Failed to read page: %u, error: %d(%s)",
-              child_page_no, errno, strerror(errno));
-      return false;
-    }
-    page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
-    n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
+static uint32_t RecOffsNFields(uint32_t* offsets) {
+  uint32_t n_fields = offsets[1];
+  assert(n_fields > 0);
+  return n_fields;
+}
 
-    if (page_level != curr_page_level - 1) {
+void Record::InitColumnOffsetsCompact() {
+  uint32_t n_node_ptr_field = ULINT_UNDEFINED;
+  switch (GetStatus()) {
+    case REC_STATUS_INFIMUM:
+    case REC_STATUS_SUPREMUM:
+      RecOffsBase(offsets_)[0] = REC_N_NEW_EXTRA_BYTES | REC_OFFS_COMPACT;
+      RecOffsBase(offsets_)[1] = 8;
+      return;
+    case REC_STATUS_NODE_PTR:
+      n_node_ptr_field = index_->GetNUniqueInTreeNonleaf();
       break;
-    }
-    curr_page_no = child_page_no;
-    /* DEBUG
-    fprintf(stdout, "              Level %u: page %u\n",
-                    page_level, curr_page_no);
-    */
+    case REC_STATUS_ORDINARY:
+      InitColumnOffsetsCompactLeaf();
+      return;
   }
 
-  if (page_level != 0) {
-    ninja_error("Failed to find the leftmost page. "
-                "The page may be compressed or corrupted\n");
-
-    return false;
-  }
-  *leaf_page_no = curr_page_no;
-  return true;
-}
+  // non-leaf page record
+  assert(!IsVersionedCompact());
+  const unsigned char* nulls = rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
+  const size_t nullable_cols = index_->GetNullableBeforeInstantAddDrop();
 
-unsigned char* ibdNinja::SDIGetFirstUserRec(unsigned char* buf,
-                                            uint32_t buf_len) {
-  uint32_t next_rec_off_t =
-            ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
+  const unsigned char* lens = nulls - UT_BITS_IN_BYTES(nullable_cols);
+  uint32_t offs = 0;
+  uint32_t null_mask = 1;
 
-  assert(PAGE_NEW_INFIMUM + next_rec_off_t != PAGE_NEW_SUPREMUM);
-
-  if (next_rec_off_t > buf_len) {
-    assert(0);
-    return (nullptr);
-  }
+  uint32_t i = 0;
+  IndexColumn* index_col = nullptr;
+  Column* col = nullptr;
+  do {
+    uint32_t len;
+    if (i == n_node_ptr_field) {
+      len = offs += REC_NODE_PTR_SIZE;
+      goto resolved;
+    }
 
-  if (memcmp(buf + PAGE_NEW_INFIMUM, "infimum", strlen("infimum")) != 0) {
-    ninja_error("Found corrupt INFIMUM");
-    return nullptr;
-  }
+    index_col = index_->ib_fields()->at(i);
+    col = index_col->column();
+    if (col->is_nullable()) {
+      if (!(unsigned char)null_mask) {
+        nulls--;
+        null_mask = 1;
+      }
 
-  unsigned char* current_rec = buf + PAGE_NEW_INFIMUM + next_rec_off_t;
+      if (*nulls & null_mask) {
+        null_mask <<= 1;
+        len = offs | REC_OFFS_SQL_NULL;
+        goto resolved;
+      }
+      null_mask <<= 1;
+    }
 
-  assert(static_cast<uint32_t>(current_rec - buf) <= buf_len);
+    if (!index_col->ib_fixed_len()) {
+      /* DATA_POINT should always be a fixed
+      length column. */
+      assert(col->ib_mtype() != DATA_POINT);
+      /* Variable-length field: read the length */
+      len = *lens--;
+      if (col->IsBigCol()) {
+        if (len & 0x80) {
+          len <<= 8;
+          len |= *lens--;
+          assert(!(len & 0x4000));
+          offs += len & 0x3fff;
+          len = offs;
 
-  bool is_comp = PageIsCompact(buf);
+          goto resolved;
+        }
+      }
 
-  // TODO(Zhao): Support redundant row format
-  assert(is_comp);
-  /* record is delete marked, get next record */
-  if (RecGetDeletedFlag(current_rec, is_comp) != 0) {
-    bool corrupt;
-    current_rec =
-        SDIGetNextRec(current_rec, buf, buf_len, &corrupt);
-    if (corrupt) {
-      return nullptr;
+      len = offs += len;
+    } else {
+      len = offs += index_col->ib_fixed_len();
     }
-  }
+  resolved:
+    RecOffsBase(offsets_)[i + 1] = len;
+  } while (++i < RecOffsNFields(offsets_));
 
-  return current_rec;
+  *RecOffsBase(offsets_) = (rec_ - (lens + 1)) | REC_OFFS_COMPACT;
 }
 
-unsigned char* ibdNinja::SDIGetNextRec(unsigned char* current_rec,
-                                       unsigned char* buf,
-                                       uint32_t buf_len,
-                                       bool* corrupt) {
-  *corrupt = false;
-  uint32_t page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
-  bool is_comp = PageIsCompact(buf);
-  uint32_t next_rec_offset = RecGetNextOffs(current_rec, is_comp);
-
-  if (next_rec_offset == 0) {
-    ninja_error("Record is corrupt");
-    *corrupt = true;
-    return nullptr;
+void Record::InitColumnOffsets() {
+  if (index_->table()->IsCompact()) {
+    InitColumnOffsetsCompact();
+  } else {
+    // TODO(Zhao): Support redundant row format
   }
+}
 
-  unsigned char* next_rec = buf + next_rec_offset;
+void Record::InitColumnOffsetsCompactLeaf() {
+  const unsigned char* nulls = nullptr;
+  const unsigned char* lens = nullptr;
+  uint16_t n_null = 0;
+  enum REC_INSERT_STATE rec_insert_state = REC_INSERT_STATE::NONE;
+  uint8_t row_version = UINT8_UNDEFINED;
+  uint16_t non_default_fields = 0;
+  rec_insert_state = InitNullAndLengthCompact(&nulls, &lens, &n_null,
+                                 &non_default_fields, &row_version);
 
-  assert(static_cast<uint32_t>(next_rec - buf) <= buf_len);
+  uint32_t offs = 0;
+  uint32_t any_ext = 0;
+  uint32_t null_mask = 1;
+  uint16_t i = 0;
+  do {
+    IndexColumn* index_col = index_->GetPhysicalField(i);
+    Column* col = index_col->column();
+    uint64_t len;
+    switch (rec_insert_state) {
+      case INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION:
+        assert(!index_->HasInstantColsOrRowVersions());
+        break;
 
-  if (RecGetDeletedFlag(next_rec, is_comp) != 0) {
-    unsigned char* curr_rec = next_rec;
-    return SDIGetNextRec(curr_rec, buf, buf_len, corrupt);
-  }
+      case INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
+        assert(row_version == UINT8_UNDEFINED || row_version == 0);
+        assert(index_->ib_row_versions());
+        row_version = 0;
+      }
+      [[fallthrough]];
+      case INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION:
+      case INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION: {
+        assert(index_->ib_row_versions() ||
+              (index_->table()->ib_m_upgraded_instant() && row_version == 0));
 
-  if (RecGetType(next_rec) == REC_STATUS_SUPREMUM) {
-    if (memcmp(next_rec, "supremum", strlen("supremum")) != 0) {
-      ninja_error("Found corrupt SUPREMUM on page %u", page_no);
-      *corrupt = false;
-      return nullptr;
-    }
+        if (col->IsDroppedInOrBefore(row_version)) {
+          len = offs | REC_OFFS_DROP;
+          goto resolved;
+        } else if (col->IsAddedAfter(row_version)) {
+          len = GetInstantOffset(i, offs);
+          goto resolved;
+        }
+      } break;
 
-    uint32_t supremum_next_rec_off = ReadFrom2B(next_rec - REC_OFF_NEXT);
+      case INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION:
+      case INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION: {
+        assert(non_default_fields > 0);
+        assert(index_->ib_instant_cols());
 
-    if (supremum_next_rec_off != 0) {
-      ninja_error("Found corrupt next of SUPREMUM on page %u", page_no);
-      *corrupt = false;
-      return nullptr;
+        if (i >= non_default_fields) {
+          len = GetInstantOffset(i, offs);
+          goto resolved;
+        }
+      } break;
+
+      default:
+        assert(false);
     }
 
-    uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+    if (col->is_nullable()) {
+      assert(n_null--);
 
-    if (next_page_no == FIL_NULL) {
-      *corrupt = false;
-      return nullptr;
-    }
+      if (!(unsigned char)null_mask) {
+        nulls--;
+        null_mask = 1;
+      }
 
-    uint32_t bytes = ReadPage(next_page_no, buf);
-    if (bytes != g_page_physical_size) {
-      ninja_error("Failed to read page: %u, error: %d(%s)",
-              next_page_no, errno, strerror(errno));
-      *corrupt = true;
-      return nullptr;
+      if (*nulls & null_mask) {
+        null_mask <<= 1;
+        len = offs | REC_OFFS_SQL_NULL;
+        goto resolved;
+      }
+      null_mask <<= 1;
     }
 
-    uint16_t page_type = PageGetType(buf);
+    if (!index_col->ib_fixed_len()) {
+      /* Variable-length field: read the length */
+      len = *lens--;
+      if (col->IsBigCol()) {
+        if (len & 0x80) {
+          len <<= 8;
+          len |= *lens--;
 
-    if (page_type != FIL_PAGE_SDI) {
-      ninja_error("Unexpected page type: %u (%u)",
-              page_type, FIL_PAGE_SDI);
-      *corrupt = true;
-      return nullptr;
+          offs += len & 0x3fff;
+          if (len & 0x4000) {
+            assert(index_->IsClustered());
+            any_ext = REC_OFFS_EXTERNAL;
+            len = offs | REC_OFFS_EXTERNAL;
+          } else {
+            len = offs;
+          }
+          goto resolved;
+        }
+      }
+
+      len = offs += len;
+    } else {
+      len = offs += index_col->ib_fixed_len();
     }
+  resolved:
+    RecOffsBase(offsets_)[i + 1] = len;
+  } while (++i < RecOffsNFields(offsets_));
 
-    next_rec = SDIGetFirstUserRec(buf, buf_len);
-  }
+  *RecOffsBase(offsets_) = (rec_ - (lens + 1)) | REC_OFFS_COMPACT | any_ext;
+}
 
-  *corrupt = false;
+#define UT_BITS_IN_BYTES(b) (((b) + 7UL) / 8UL)
+Record::REC_INSERT_STATE Record::InitNullAndLengthCompact(
+            const unsigned char** nulls, const unsigned char** lens,
+            uint16_t* n_null, uint16_t* non_default_fields,
+            uint8_t* row_version) {
+  *non_default_fields = static_cast<uint16_t>(index_->GetNFields());
+  *row_version = UINT8_UNDEFINED;
 
-  return next_rec;
-}
+  *nulls = rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
 
-bool ibdNinja::SDIParseRec(unsigned char* rec,
-                        uint64_t* sdi_type, uint64_t* sdi_id,
-                        unsigned char** sdi_data, uint64_t* sdi_data_len) {
-  if (RecIsInfimum(rec) || RecIsSupremum(rec)) {
-    return false;
-  }
+  const enum REC_INSERT_STATE rec_insert_state =
+            GetInsertState();
+  switch (rec_insert_state) {
+    case INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION: {
+      assert(!GetInstantFlagCompact());
+      assert(!IsVersionedCompact());
 
-  *sdi_type = ReadFrom4B(rec + REC_OFF_DATA_TYPE);
-  *sdi_id = ReadFrom8B(rec + REC_OFF_DATA_ID);
-  uint32_t sdi_uncomp_len = ReadFrom4B(rec + REC_OFF_DATA_UNCOMP_LEN);
-  uint32_t sdi_comp_len = ReadFrom4B(rec + REC_OFF_DATA_COMP_LEN);
+      *n_null = index_->ib_n_nullable();
+    } break;
 
-  unsigned rec_data_len_partial = *(rec - REC_MIN_HEADER_SIZE - 1);
+    case INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION:
+    case INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
+      *row_version = (uint8_t)(**nulls);
 
-  uint64_t rec_data_length;
-  bool is_rec_data_external = false;
-  uint32_t rec_data_in_page_len = 0;
+      *nulls -= 1;
+      *n_null = index_->GetNullableInVersion(*row_version);
+    } break;
 
-  if (rec_data_len_partial & 0x80) {
-    rec_data_in_page_len = (rec_data_len_partial & 0x3f) << 8;
-    if (rec_data_len_partial & 0x40) {
-      is_rec_data_external = true;
-      rec_data_length =
-          ReadFrom8B(rec + REC_OFF_DATA_VARCHAR + rec_data_in_page_len +
-                           BTR_EXTERN_LEN);
-
-      rec_data_length += rec_data_in_page_len;
-    } else {
-      rec_data_length = *(rec - REC_MIN_HEADER_SIZE - 2);
-      rec_data_length += rec_data_in_page_len;
-    }
-  } else {
-    rec_data_length = rec_data_len_partial;
-  }
+    case INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION: {
+      uint16_t length;
+      *non_default_fields =
+          GetNFieldsInstant(REC_N_NEW_EXTRA_BYTES, &length);
+      assert(length == 1 || length == 2);
 
-  unsigned char* str = new unsigned char[rec_data_length + 1]();
+      *nulls -= length;
+      *n_null = index_->CalculateNInstantNullable(*non_default_fields);
+    } break;
 
-  unsigned char* rec_data_origin = rec + REC_OFF_DATA_VARCHAR;
+    case INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION: {
+      *n_null = index_->GetNullableBeforeInstantAddDrop();
+      *non_default_fields = index_->GetNOriginalFields();
+    } break;
 
-  if (is_rec_data_external) {
-    assert(rec_data_in_page_len == 0 ||
-          rec_data_in_page_len == REC_ANTELOPE_MAX_INDEX_COL_LEN);
+    case INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION: {
+      *n_null = index_->GetNullableBeforeInstantAddDrop();
+    } break;
 
-    if (rec_data_in_page_len != 0) {
-      memcpy(str, rec_data_origin, rec_data_in_page_len);
-    }
+    default:
+      assert(0);
+  }
+  *lens = *nulls - UT_BITS_IN_BYTES(*n_null);
 
-    /* Copy from off-page blob-pages */
-    uint32_t first_blob_page_no =
-        ReadFrom4B(rec + REC_OFF_DATA_VARCHAR + rec_data_in_page_len +
-                         BTR_EXTERN_PAGE_NO);
+  return (rec_insert_state);
+}
 
-    uint64_t blob_len_retrieved = 0;
-    if (g_page_compressed) {
-      // TODO(Zhao): Support compressed page
+Record::REC_INSERT_STATE Record::GetInsertState() {
+  if (!index_->HasInstantColsOrRowVersions()) {
+    return INSERTED_INTO_TABLE_WITH_NO_INSTANT_NO_VERSION;
+  }
+  const unsigned char* v_ptr =
+      (const unsigned char*)rec_ - (REC_N_NEW_EXTRA_BYTES + 1);
+  const bool is_versioned = IsVersionedCompact();
+  const uint8_t version = (is_versioned) ? (uint8_t)(*v_ptr) : UINT8_UNDEFINED;
+  const bool is_instant = GetInstantFlagCompact();
+  assert(!is_versioned || !is_instant);
+  enum REC_INSERT_STATE rec_insert_state = REC_INSERT_STATE::NONE;
+  if (is_versioned) {
+    if (version == 0) {
+      assert(index_->ib_instant_cols());
+      rec_insert_state =
+          INSERTED_AFTER_UPGRADE_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION;
     } else {
-      uint32_t n_ext_pages = 0;
-      bool error = false;
-      blob_len_retrieved = SDIFetchUncompBlob(
-          first_blob_page_no, rec_data_length - rec_data_in_page_len,
-          str + rec_data_in_page_len, &n_ext_pages, &error);
+      assert(index_->ib_row_versions());
+      rec_insert_state = INSERTED_AFTER_INSTANT_ADD_NEW_IMPLEMENTATION;
     }
-    *sdi_data_len = rec_data_in_page_len + blob_len_retrieved;
+  } else if (is_instant) {
+    assert(index_->table()->HasInstantCols());
+    rec_insert_state = INSERTED_AFTER_INSTANT_ADD_OLD_IMPLEMENTATION;
+  } else if (index_->table()->HasInstantCols()) {
+    rec_insert_state = INSERTED_BEFORE_INSTANT_ADD_OLD_IMPLEMENTATION;
   } else {
-    memcpy(str, rec_data_origin, static_cast<size_t>(rec_data_length));
-    *sdi_data_len = rec_data_length;
+    rec_insert_state = INSERTED_BEFORE_INSTANT_ADD_NEW_IMPLEMENTATION;
   }
 
-  *sdi_data_len = rec_data_length;
-  *sdi_data = str;
+  assert(rec_insert_state != REC_INSERT_STATE::NONE);
+  return rec_insert_state;
+}
 
-  assert(rec_data_length == sdi_comp_len);
+bool Record::IsVersionedCompact() {
+  uint32_t info = GetInfoBits(true);
+  return ((info & REC_INFO_VERSION_FLAG) != 0);
+}
+uint32_t Record::GetInfoBits(bool comp) {
+  const uint32_t val = GetBitsFrom1B(comp ?
+                                     REC_NEW_INFO_BITS : REC_OLD_INFO_BITS,
+                                     REC_INFO_BITS_MASK, REC_INFO_BITS_SHIFT);
+  return val;
+}
+bool Record::GetInstantFlagCompact() {
+  uint32_t info = GetInfoBits(true);
+  return ((info & REC_INFO_INSTANT_FLAG) != 0);
+}
 
-  if (rec_data_length != sdi_comp_len) {
-    /* Record Corruption */
-    ninja_error("SDI record corruption");
-    delete[] str;
-    return false;
-  }
+uint32_t Record::GetNFieldsInstant(const uint32_t extra_bytes,
+                                   uint16_t* length) {
+  uint16_t n_fields;
+  const unsigned char *ptr;
 
-  unsigned char* uncompressed_sdi = new unsigned char[sdi_uncomp_len + 1]();
-  int ret;
-  uLongf dest_len = sdi_uncomp_len;
-  ret = uncompress(uncompressed_sdi, &dest_len,
-                   str, sdi_comp_len);
+  ptr = rec_ - (extra_bytes + 1);
 
-  if (ret != Z_OK) {
-    ninja_error("Failed to uncompress SDI record, error: %d", ret);
-    delete[] str;
-    return false;
+  if ((*ptr & REC_N_FIELDS_TWO_BYTES_FLAG) == 0) {
+    *length = 1;
+    return (*ptr);
   }
 
-  *sdi_data_len = sdi_uncomp_len + 1;
-  *sdi_data = uncompressed_sdi;
-  delete[] str;
+  *length = 2;
+  n_fields = ((*ptr-- & REC_N_FIELDS_ONE_BYTE_MAX) << 8);
+  n_fields |= *ptr;
+  assert(n_fields < REC_MAX_N_FIELDS);
+  assert(n_fields != 0);
 
-  return true;
+  return (n_fields);
 }
 
-uint64_t ibdNinja::SDIFetchUncompBlob(uint32_t first_blob_page_no,
-                                      uint64_t total_off_page_length,
-                                      unsigned char* dest_buf,
-                                      uint32_t* n_ext_pages,
-                                      bool* error) {
-  unsigned char page_buf[UNIV_PAGE_SIZE_MAX];
-  uint64_t calc_length = 0;
-  uint64_t part_len;
-  uint32_t next_page_no = first_blob_page_no;
-  *error = false;
-  *n_ext_pages = 0;
+uint64_t Record::GetInstantOffset(uint32_t n, uint64_t offs) {
+  assert(index_->HasInstantColsOrRowVersions());
+  Column* col = index_->GetPhysicalField(n)->column();
+  if (col->ib_instant_default()) {
+    return (offs | REC_OFFS_DEFAULT);
+  } else {
+    return (offs | REC_OFFS_SQL_NULL);
+  }
+}
 
-  do {
-    uint32_t bytes = ReadPage(next_page_no, page_buf);
-    *n_ext_pages += 1;
-    if (bytes != g_page_physical_size) {
-      ninja_error("Failed to read BLOB page: %u, error: %d(%s)",
-              next_page_no, errno, strerror(errno));
-      *error = true;
-      break;
-    }
+struct PageAnalysisResult {
+  uint32_t n_recs_non_leaf = 0;
+  uint32_t n_recs_leaf = 0;
+  uint32_t headers_len_non_leaf = 0;
+  uint32_t headers_len_leaf = 0;
+  uint32_t recs_len_non_leaf = 0;
+  uint32_t recs_len_leaf = 0;
+  uint32_t n_deleted_recs_non_leaf = 0;
+  uint32_t n_deleted_recs_leaf = 0;
+  uint32_t deleted_recs_len_non_leaf = 0;
+  uint32_t deleted_recs_len_leaf = 0;
+  uint32_t n_contain_dropped_cols_recs_non_leaf = 0;  // should always be 0
+  uint32_t n_contain_dropped_cols_recs_leaf = 0;
+  uint32_t dropped_cols_len_non_leaf = 0;  // should always be 0
+  uint32_t dropped_cols_len_leaf = 0;
+  uint32_t innodb_internal_used_non_leaf = 0;
+  uint32_t innodb_internal_used_leaf = 0;
+  uint32_t free_non_leaf = 0;
+  uint32_t free_leaf = 0;
+};
 
-    if (PageGetType(page_buf) != FIL_PAGE_SDI_BLOB) {
-      ninja_error("Unexpected BLOB page type: %u (%u)",
-                      PageGetType(page_buf), FIL_PAGE_SDI_BLOB);
-      *error = true;
-      break;
+/*
+ * Fixed-bucket distributions of the pages of one B-tree level. Adding a page
+ * only bumps a few counters, so one instance per worker is cheap to keep, and
+ * instances of the same level merge by adding them bucket by bucket.
+ */
+struct LevelHistograms {
+  // Data size to page size, in 10% buckets
+  static constexpr uint32_t N_FILL_BUCKETS = 10;
+  // Bucket 0 holds 0, bucket i holds [2^(i-1), 2^i)
+  static constexpr uint32_t N_LOG2_BUCKETS = 17;
+  // Records owned by a directory slot, the last bucket is for corrupt slots
+  static constexpr uint32_t N_OWNED_BUCKETS = PAGE_DIR_SLOT_MAX_N_OWNED + 2;
+
+  uint64_t n_pages = 0;
+  uint64_t fill[N_FILL_BUCKETS] = {};
+  uint64_t n_recs[N_LOG2_BUCKETS] = {};
+  uint64_t garbage[N_LOG2_BUCKETS] = {};
+  uint64_t n_owned[N_OWNED_BUCKETS] = {};
+
+  static uint32_t Log2Bucket(uint32_t value) {
+    uint32_t bucket = 0;
+    while (value != 0 && bucket < N_LOG2_BUCKETS - 1) {
+      value >>= 1;
+      bucket++;
     }
+    return bucket;
+  }
+  void AddPage(const unsigned char* buf);
+};
 
-    part_len =
-        ReadFrom4B(page_buf + FIL_PAGE_DATA + LOB_HDR_PART_LEN);
-
-    if (dest_buf) {
-      memcpy(dest_buf + calc_length, page_buf + FIL_PAGE_DATA + LOB_HDR_SIZE,
-          static_cast<size_t>(part_len));
+/*
+ * The fill ratio uses the data size as InnoDB's MERGE_THRESHOLD does: the
+ * record heap minus the garbage. The slot of the infimum, which always owns
+ * only itself, is left out of the n_owned distribution.
+ */
+void LevelHistograms::AddPage(const unsigned char* buf) {
+  uint32_t heap_top = ReadFrom2B(buf + PAGE_HEADER + PAGE_HEAP_TOP);
+  uint32_t page_garbage = ReadFrom2B(buf + PAGE_HEADER + PAGE_GARBAGE);
+  uint32_t page_n_recs = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_RECS);
+  uint32_t n_slots = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIR_SLOTS);
+  uint32_t data_size = 0;
+  if (heap_top > PAGE_NEW_SUPREMUM_END + page_garbage) {
+    data_size = heap_top - PAGE_NEW_SUPREMUM_END - page_garbage;
+  }
+  n_pages++;
+  fill[std::min<uint64_t>(static_cast<uint64_t>(data_size) * N_FILL_BUCKETS /
+                          g_page_logical_size, N_FILL_BUCKETS - 1)]++;
+  n_recs[Log2Bucket(page_n_recs)]++;
+  garbage[Log2Bucket(page_garbage)]++;
+  if (PAGE_DIR + PAGE_DIR_SLOT_SIZE * n_slots > g_page_logical_size / 2) {
+    return;
+  }
+  for (uint32_t slot = 1; slot < n_slots; slot++) {
+    uint32_t offset = ReadFrom2B(buf + g_page_logical_size - PAGE_DIR -
+                                 PAGE_DIR_SLOT_SIZE * (slot + 1));
+    uint32_t owned = N_OWNED_BUCKETS - 1;
+    if (offset >= PAGE_NEW_INFIMUM &&
+        offset < g_page_logical_size - PAGE_DIR) {
+      owned = RecGetBitField1B(buf + offset, REC_NEW_N_OWNED,
+                               REC_N_OWNED_MASK, REC_N_OWNED_SHIFT);
     }
+    n_owned[std::min(owned, N_OWNED_BUCKETS - 1)]++;
+  }
+}
 
-    calc_length += part_len;
-
-    next_page_no =
-        ReadFrom4B(page_buf + FIL_PAGE_DATA + LOB_HDR_NEXT_PAGE_NO);
+/*
+ * The records freed on a page (purged, or moved by an update that changed
+ * their size) are chained from PAGE_FREE and counted in PAGE_GARBAGE. An
+ * insert only tries the first one, if it is too small the record goes to
+ * the top of the heap, and if that has no room either the page is
+ * reorganized to squeeze the holes out, or split. When a smaller record
+ * reuses a freed one, the bytes it leaves over stay in PAGE_GARBAGE but are
+ * no longer on the list, so PAGE_GARBAGE can exceed the listed sizes.
+ */
+struct FreeListStats {
+  uint64_t n_pages = 0;
+  uint64_t n_pages_with_holes = 0;
+  uint64_t n_pages_corrupt = 0;
+  uint64_t n_holes = 0;
+  uint64_t holes_len = 0;
+  // Sum of the sizes of the first freed record of each page
+  uint64_t heads_len = 0;
+  uint64_t garbage = 0;
+  // PAGE_GARBAGE bytes left over by reused freed records
+  uint64_t unlisted_garbage = 0;
+  uint32_t max_hole_len = 0;
+  // Where an insert of the average record size of the page would go
+  uint64_t n_insert_head = 0;
+  uint64_t n_insert_heap = 0;
+  uint64_t n_insert_reorganize = 0;
+  uint64_t n_insert_split = 0;
+  uint64_t holes[LevelHistograms::N_LOG2_BUCKETS] = {};
+  uint64_t heads[LevelHistograms::N_LOG2_BUCKETS] = {};
+
+  bool AddPage(Index* index, const unsigned char* buf, const char** error);
+};
 
-    if (next_page_no <= SDI_BLOB_ALLOWED) {
-      ninja_error("Failed to get next BLOB page: %u", next_page_no);
-      *error = true;
+/*
+ * Walks the free list of the page and adds it to the stats. Returns false,
+ * with the reason in *error, if the list is broken or disagrees with the
+ * page header; the holes found up to that point are still counted.
+ */
+bool FreeListStats::AddPage(Index* index, const unsigned char* buf,
+                            const char** error) {
+  uint32_t heap_top = ReadFrom2B(buf + PAGE_HEADER + PAGE_HEAP_TOP);
+  uint32_t n_heap = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_HEAP) & 0x7FFF;
+  uint32_t free = ReadFrom2B(buf + PAGE_HEADER + PAGE_FREE);
+  uint32_t page_garbage = ReadFrom2B(buf + PAGE_HEADER + PAGE_GARBAGE);
+  uint32_t page_n_recs = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_RECS);
+  uint32_t n_slots = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIR_SLOTS);
+  uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
+  uint32_t status = page_level == 0 ? REC_STATUS_ORDINARY :
+                                      REC_STATUS_NODE_PTR;
+  n_pages++;
+  garbage += page_garbage;
+  *error = nullptr;
+
+  uint32_t n_found = 0;
+  uint32_t found_len = 0;
+  uint32_t head_len = 0;
+  uint32_t offset = free;
+  while (offset != 0) {
+    if (n_found >= n_heap) {
+      *error = "the free list loops";
       break;
     }
-  } while (next_page_no != FIL_NULL);
-
-  if (!*error) {
-    assert(calc_length == total_off_page_length);
+    if (offset < PAGE_NEW_SUPREMUM_END + REC_N_NEW_EXTRA_BYTES ||
+        offset >= heap_top) {
+      *error = "a free record is outside the record heap";
+      break;
+    }
+    Record rec(buf + offset, index);
+    if (rec.GetStatus() != status) {
+      *error = "a free record has the wrong type for the page level";
+      break;
+    }
+    rec.GetColumnOffsets();
+    uint32_t len = rec.GetSize();
+    if (len > heap_top - PAGE_NEW_SUPREMUM_END) {
+      *error = "a free record is larger than the record heap";
+      break;
+    }
+    if (n_found == 0) {
+      head_len = len;
+    }
+    n_found++;
+    found_len += len;
+    holes[LevelHistograms::Log2Bucket(len)]++;
+    max_hole_len = std::max(max_hole_len, len);
+    uint32_t next = ReadFrom2B(buf + offset - REC_NEXT);
+    offset = next == 0 ? 0 : (offset + next) % g_page_logical_size;
+  }
+  n_holes += n_found;
+  holes_len += found_len;
+  if (n_found > 0) {
+    n_pages_with_holes++;
+    heads_len += head_len;
+    heads[LevelHistograms::Log2Bucket(head_len)]++;
+  }
+  if (*error == nullptr && n_heap < PAGE_HEAP_NO_USER_LOW + page_n_recs) {
+    *error = "PAGE_N_HEAP is smaller than the records on the page";
+  } else if (*error == nullptr &&
+             n_found != n_heap - PAGE_HEAP_NO_USER_LOW - page_n_recs) {
+    *error = "the free list length disagrees with PAGE_N_HEAP";
+  } else if (*error == nullptr && found_len > page_garbage) {
+    *error = "the free record sizes exceed PAGE_GARBAGE";
+  }
+  if (*error != nullptr) {
+    n_pages_corrupt++;
+    return false;
   }
-  return calc_length;
-}
-
-unsigned char* ibdNinja::GetFirstUserRec(unsigned char* buf) {
-  uint32_t next_rec_off_t =
-            ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
-
-  assert(PAGE_NEW_INFIMUM + next_rec_off_t != PAGE_NEW_SUPREMUM);
+  unlisted_garbage += page_garbage - found_len;
 
-  if (next_rec_off_t > g_page_physical_size) {
-    assert(0);
-    return (nullptr);
+  uint32_t dir_start = g_page_logical_size - PAGE_DIR -
+                       PAGE_DIR_SLOT_SIZE * n_slots;
+  if (page_n_recs == 0 || dir_start < heap_top ||
+      heap_top < PAGE_NEW_SUPREMUM_END + page_garbage) {
+    return true;
   }
-
-  if (memcmp(buf + PAGE_NEW_INFIMUM, "infimum", strlen("infimum")) != 0) {
-    ninja_error("Found corrupt INFIMUM");
-    return nullptr;
+  uint32_t heap_free = dir_start - heap_top;
+  uint32_t avg_len = (heap_top - PAGE_NEW_SUPREMUM_END - page_garbage) /
+                     page_n_recs;
+  if (n_found > 0 && head_len >= avg_len) {
+    n_insert_head++;
+  } else if (heap_free >= avg_len) {
+    n_insert_heap++;
+  } else if (heap_free + page_garbage >= avg_len) {
+    n_insert_reorganize++;
+  } else {
+    n_insert_split++;
   }
-
-  unsigned char* current_rec = buf + PAGE_NEW_INFIMUM + next_rec_off_t;
-
-  assert(static_cast<uint32_t>(current_rec - buf) <= g_page_physical_size);
-
-  bool is_comp = PageIsCompact(buf);
-
-  // TODO(Zhao): Support redundant row format
-  assert(is_comp);
-
-  return current_rec;
+  return true;
 }
 
-unsigned char* ibdNinja::GetNextRecInPage(unsigned char* current_rec,
-                                          unsigned char* buf,
-                                          bool* corrupt) {
-  *corrupt = false;
-  uint32_t page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
-  bool is_comp = PageIsCompact(buf);
-  uint32_t next_rec_offset = RecGetNextOffs(current_rec, is_comp);
-
-  if (next_rec_offset == 0) {
-    ninja_error("Record is corrupt");
-    *corrupt = true;
-    assert(0);
-    return nullptr;
-  }
-
-  unsigned char* next_rec = buf + next_rec_offset;
+struct IndexAnalyzeResult {
+  uint32_t n_level = 0;
+  uint32_t n_pages_non_leaf = 0;
+  uint32_t n_pages_leaf = 0;
+  PageAnalysisResult recs_result;
+  // Indexed by page level
+  std::vector<LevelHistograms> histograms;
+  FreeListStats free_list;
+};
 
-  assert(static_cast<uint32_t>(next_rec - buf) <= g_page_physical_size);
+void Record::ParseRecord(bool leaf, uint32_t row_no,
+                         PageAnalysisResult* result,
+                         bool print) {
+  uint32_t n_fields = leaf ? index_->GetNFields() :
+                             index_->GetNUniqueInTreeNonleaf() + 1;
+  uint32_t header_len = (RecOffsBase(offsets_)[0] & REC_OFFS_MASK);
+  uint32_t rec_len = (RecOffsBase(offsets_)[n_fields] &
+                      REC_OFFS_MASK);
+  ninja_pt(print, "=========================================="
+                  "=============================\n");
+  ninja_pt(print, "[ROW %u] Length: %u (%d | %d), Number of fields: %u\n",
+                   row_no,
+                   header_len + rec_len,
+                   header_len,
+                   rec_len,
+                   n_fields);
+  bool deleted = false;
+  if (RecGetDeletedFlag(rec_, true) != 0) {
+    ninja_pt(print, "[DELETED MARK]\n");
+    deleted = true;
+  }
+  if (!deleted) {
+    if (leaf) {
+      result->n_recs_leaf++;
+      result->headers_len_leaf += header_len;
+      result->recs_len_leaf += rec_len;
+    } else {
+      result->n_recs_non_leaf++;
+      result->headers_len_non_leaf += header_len;
+      result->recs_len_non_leaf += rec_len;
+    }
+  } else {
+    if (leaf) {
+      result->n_deleted_recs_leaf++;
+      result->deleted_recs_len_leaf += (header_len + rec_len);
+    } else {
+      result->n_deleted_recs_non_leaf++;
+      result->deleted_recs_len_non_leaf += (header_len + rec_len);
+    }
+  }
+  uint32_t start_pos = 0;
+  uint32_t len = 0;
+  uint32_t end_pos = 0;
+  ibd_ninja::IndexColumn* index_col = nullptr;
+  ninja_pt(print, "------------------------------------------"
+                  "-----------------------------\n");
+  ninja_pt(print, "  [HEADER   ]         ");
+  int count = 0;
+  for (uint32_t i = 0; i < header_len; i++) {
+    ninja_pt(print, "%02x ", (rec_ - header_len)[i]);
+    count++;
+    if (count == 8) {
+      ninja_pt(print, " ");
+    } else if (count == 16) {
+      ninja_pt(print, "\n                      ");
+      count = 0;
+    }
+  }
+  ninja_pt(print, "\n");
+  bool dropped_column_counted = false;
+  for (uint32_t i = 0; i < n_fields; i++) {
+    index_col = nullptr;
+    if (!leaf && i == n_fields - 1) {
+      ninja_pt(print, "  [FIELD %3u] Name  : *NODE_PTR(Child page no)\n",
+                         i + 1);
+    } else {
+      index_col = index_->GetPhysicalField(i);
+      ninja_pt(print, "  [FIELD %3u] Name  : %s\n",
+                         i + 1,
+                         index_col->column()->name().c_str());
+    }
 
-  if (RecGetType(next_rec) == REC_STATUS_SUPREMUM) {
-    if (memcmp(next_rec, "supremum", strlen("supremum")) != 0) {
-      ninja_error("Found corrupt SUPREMUM on page %u", page_no);
-      *corrupt = false;
+    len = RecOffsBase(offsets_)[i + 1];
+    end_pos = (len & REC_OFFS_MASK);
+    ninja_pt(print, "              "
+                    "Length: %-5u\n",
+                    end_pos - start_pos);
+    // TODO(Zhao): handle external part
+    if (index_col != nullptr &&
+        index_col->column()->IsColumnDropped()) {
+      // Only count valid records with non-zero size for dropped columns.
+      if (!deleted && !(len & REC_OFFS_DROP)) {
+        if (leaf) {
+          result->dropped_cols_len_leaf += (end_pos - start_pos);
+          if (!dropped_column_counted) {
+            result->n_contain_dropped_cols_recs_leaf++;
+          }
+        } else {
+          result->dropped_cols_len_non_leaf += (end_pos - start_pos);
+          if (!dropped_column_counted) {
+            result->n_contain_dropped_cols_recs_non_leaf++;
+          }
+        }
+        dropped_column_counted = true;
+      }
     }
 
-    uint32_t supremum_next_rec_off = ReadFrom2B(next_rec - REC_OFF_NEXT);
+    // index_col is nullptr for node_ptr
+    if (index_col != nullptr) {
+    ninja_pt(print, "              "
+                    "Type  : %-15s | %-12s | %-20s\n",
+                    index_col->column()->dd_column_type_utf8().c_str(),
+                    index_col->column()->FieldTypeString().c_str(),
+                    index_col->column()->SeTypeString().c_str());
+    }
 
-    if (supremum_next_rec_off != 0) {
-      ninja_error("Found corrupt next rec of SUPREMUM on page %u", page_no);
-      *corrupt = false;
+    ninja_pt(print, "              "
+                    "Value : ");
+    if (len & REC_OFFS_SQL_NULL) {
+      ninja_pt(print, "*NULL*\n");
+      start_pos = end_pos;
+      continue;
     }
-    return nullptr;
+    if (len & REC_OFFS_DROP) {
+      ninja_pt(print, "*NULL*\n"
+                      "                      "
+                      "(This row was inserted after this column "
+                      "was instantly dropped)\n");
+      start_pos = end_pos;
+      continue;
+    }
+    if (len & REC_OFFS_DEFAULT) {
+      ninja_pt(print, "*DEFAULT*\n"
+                      "                      "
+                      "(This row was inserted before this column "
+                      "was instantly added)\n");
+      start_pos = end_pos;
+      continue;
+    }
+    count = 0;
+    while (start_pos < end_pos) {
+      ninja_pt(print, "%02x ", rec_[start_pos]);
+      count++;
+      if (count == 8) {
+        ninja_pt(print, " ");
+      } else if (count == 16) {
+        ninja_pt(print, "\n                      ");
+        count = 0;
+      }
+      start_pos++;
+    }
+    if (len & REC_OFFS_EXTERNAL) {
+      const unsigned char* ext_ref = &rec_[end_pos - 20];
+      [[maybe_unused]] uint32_t space_id =
+                         ReadFrom4B(ext_ref + BTR_EXTERN_SPACE_ID);
+      [[maybe_unused]] uint32_t page_no =
+                         ReadFrom4B(ext_ref + BTR_EXTERN_PAGE_NO);
+      uint64_t ext_len = ReadFrom4B(ext_ref + BTR_EXTERN_LEN + 4);
+      ninja_pt(print, "\n                      "
+              "[Remaining %" PRIu64 " bytes have been offloaded externally...]",
+              ext_len);
+    }
+    ninja_pt(print, "\n");
   }
+}
 
-  *corrupt = false;
+uint32_t Record::GetChildPageNo() {
+  uint32_t n_fields = GetNFields();
+  assert(n_fields >= 2);
+  uint32_t last_2_len = (RecOffsBase(offsets_)[n_fields - 1]);
+  uint32_t last_2_end_pos = (last_2_len & REC_OFFS_MASK);
+  uint32_t last_len = (RecOffsBase(offsets_)[n_fields]);
+  uint32_t last_end_pos = (last_len & REC_OFFS_MASK);
+  assert(last_end_pos - last_2_end_pos == 4);
+  return ReadFrom4B(&rec_[last_2_end_pos]);
+}
 
-  return next_rec;
+bool Record::IsDeleted() {
+  return (GetInfoBits(true) & REC_INFO_DELETED_FLAG) != 0;
 }
 
-ssize_t ibdNinja::ReadPage(uint32_t page_no, unsigned char* buf) {
-  assert(buf != nullptr);
-  memset(buf, 0, g_page_physical_size);
-  off_t offset = page_no * g_page_physical_size;
-  ssize_t n_bytes_read = pread(g_fd, buf, g_page_physical_size, offset);
+bool Record::IsMinRec() {
+  return (GetInfoBits(true) & REC_INFO_MIN_REC_FLAG) != 0;
+}
 
-  // TODO(Zhao): Support compressed page
-  return n_bytes_read;
+uint32_t Record::GetSize() {
+  assert(offsets_);
+  return (RecOffsBase(offsets_)[0] & REC_OFFS_MASK) +
+         (RecOffsBase(offsets_)[GetNFields()] & REC_OFFS_MASK);
 }
 
-bool ibdNinja::ParsePage(uint32_t page_no,
-                         PageAnalysisResult* result_aggr,
-                         bool print,
-                         bool print_record) {
-  if (page_no >= n_pages_) {
-    ninja_error("Page number %u is too large", page_no);
+/*
+ * Points *data at the n-th (physical) field and returns its offsets entry,
+ * so that the caller can check REC_OFFS_SQL_NULL, REC_OFFS_EXTERNAL, etc.
+ */
+uint32_t Record::GetField(uint32_t n, const unsigned char** data,
+                          uint32_t* len) {
+  assert(offsets_ != nullptr && n < GetNFields());
+  uint32_t start_pos = (n == 0) ? 0 :
+                       (RecOffsBase(offsets_)[n] & REC_OFFS_MASK);
+  uint32_t end = RecOffsBase(offsets_)[n + 1];
+  *data = rec_ + start_pos;
+  *len = (end & REC_OFFS_MASK) - start_pos;
+  return end;
+}
+
+/*
+ * Points *data at the value of the n-th (physical) field of a leaf record,
+ * resolving instant defaults. Only the locally stored prefix of an off-page
+ * value is returned. Returns false if the field is SQL NULL.
+ */
+bool Record::GetFieldValue(uint32_t n, const unsigned char** data,
+                           uint32_t* len) {
+  uint32_t flags = GetField(n, data, len);
+  if (flags & (REC_OFFS_SQL_NULL | REC_OFFS_DROP)) {
     return false;
   }
+  if (flags & REC_OFFS_DEFAULT) {
+    const std::string& value =
+        index_->GetPhysicalField(n)->column()->ib_instant_default_value();
+    *data = reinterpret_cast<const unsigned char*>(value.data());
+    *len = value.size();
+  } else if (flags & REC_OFFS_EXTERNAL) {
+    *len -= BTR_EXTERN_FIELD_REF_SIZE;
+  }
+  return true;
+}
 
-  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
-  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
-  unsigned char* buf = static_cast<unsigned char*>(
-                    ut_align(buf_unalign, g_page_physical_size));
-  ssize_t bytes = ReadPage(page_no, buf);
-  if (bytes != g_page_physical_size) {
-    ninja_error("Failed to read page: %u, error: %d(%s)",
-            page_no, errno, strerror(errno));
+/*
+ * Copies the full value of the n-th (physical) field of a leaf record into
+ * *value, reading the off-page part of an external value. Returns false if
+ * the field is SQL NULL. If the off-page part cannot be read, *value holds
+ * the local prefix only and *truncated is set.
+ */
+bool Record::GetFullFieldValue(uint32_t n, std::string* value,
+                               bool* truncated) {
+  const unsigned char* data = nullptr;
+  uint32_t len = 0;
+  *truncated = false;
+  if (!GetFieldValue(n, &data, &len)) {
     return false;
   }
-  if (memcmp(
-          buf + FIL_PAGE_LSN + 4,
-          buf + g_page_logical_size - FIL_PAGE_END_LSN_OLD_CHKSUM + 4,
-          4)) {
-    ninja_error("The LSN on page %u is inconsistent", page_no);
-    return false;
+  value->assign(reinterpret_cast<const char*>(data), len);
+  if (GetField(n, &data, &len) & REC_OFFS_EXTERNAL) {
+    if (!ibdNinja::ReadExternalValue(data + len - BTR_EXTERN_FIELD_REF_SIZE,
+                                     value)) {
+      value->resize(len - BTR_EXTERN_FIELD_REF_SIZE);
+      *truncated = true;
+    }
   }
+  return true;
+}
 
-  uint32_t type = ReadFrom2B(buf + FIL_PAGE_TYPE);
-  if (type != FIL_PAGE_INDEX) {
-    fprintf(stderr, "[ibdNinja] Currently, only INDEX pages are supported. "
-                "Support for other types (e.g., '%s') will be added soon\n",
-                PageType2String(type).c_str());
+/*
+ * Decodes the n-th (physical) field of a leaf record.
+ * Returns false if the field is SQL NULL.
+ */
+bool Record::GetFieldValueString(uint32_t n, std::string* value) {
+  const unsigned char* data = nullptr;
+  uint32_t len = 0;
+  uint32_t flags = GetField(n, &data, &len);
+  if (flags & (REC_OFFS_SQL_NULL | REC_OFFS_DROP)) {
+    *value = "NULL";
     return false;
   }
-
-  uint32_t page_no_in_fil_header = ReadFrom4B(buf + FIL_PAGE_OFFSET);
-  assert(page_no_in_fil_header == page_no);
-  uint32_t prev_page_no = ReadFrom4B(buf + FIL_PAGE_PREV);
-  uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
-  uint32_t space_id = ReadFrom4B(buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
-  uint32_t lsn = ReadFrom8B(buf + FIL_PAGE_LSN);
-  uint32_t flush_lsn = ReadFrom8B(buf + FIL_PAGE_FILE_FLUSH_LSN);
-
-  uint32_t n_dir_slots = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIR_SLOTS);
-  uint32_t heap_top = ReadFrom2B(buf + PAGE_HEADER + PAGE_HEAP_TOP);
-  uint32_t n_heap = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_HEAP);
-  n_heap = (n_heap & 0x7FFF);
-  uint32_t free = ReadFrom2B(buf + PAGE_HEADER + PAGE_FREE);
-  uint32_t garbage = ReadFrom2B(buf + PAGE_HEADER + PAGE_GARBAGE);
-  uint32_t last_insert = ReadFrom2B(buf + PAGE_HEADER + PAGE_LAST_INSERT);
-  uint32_t direction = ReadFrom2B(buf + PAGE_HEADER + PAGE_DIRECTION);
-  uint32_t n_direction = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIRECTION);
-  uint32_t n_recs = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_RECS);
-  uint32_t max_trx_id = ReadFrom2B(buf + PAGE_HEADER + PAGE_MAX_TRX_ID);
-  uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
-  uint64_t index_id = ReadFrom8B(buf + PAGE_HEADER + PAGE_INDEX_ID);
-
-  bool index_not_found = false;
-  Index* index = GetIndex(index_id);
-  if (index == nullptr) {
-    ninja_error("Unable find index %" PRIu64 " in the loaded indexes",
-            index_id);
-    index_not_found = true;
+  if (flags & REC_OFFS_DEFAULT) {
+    *value = "*DEFAULT*";
+    return true;
+  }
+  Column* col = index_->GetPhysicalField(n)->column();
+  if (flags & REC_OFFS_EXTERNAL) {
+    assert(len >= BTR_EXTERN_FIELD_REF_SIZE);
+    const unsigned char* ext_ref = data + len - BTR_EXTERN_FIELD_REF_SIZE;
+    uint64_t ext_len = ReadFrom4B(ext_ref + BTR_EXTERN_LEN + 4);
+    char buf[64];
+    snprintf(buf, sizeof(buf), "[+%" PRIu64 " bytes stored externally]",
+             ext_len);
+    *value = col->ValueToString(data, len - BTR_EXTERN_FIELD_REF_SIZE) + buf;
+    return true;
   }
+  *value = col->ValueToString(data, len);
+  return true;
+}
 
-  ninja_pt(print, "=========================================="
-                  "==========================================\n");
-  ninja_pt(print, "|  PAGE INFORMATION                       "
-                  "                                         |\n");
-  ninja_pt(print, "------------------------------------------"
-                  "------------------------------------------\n");
-  ninja_pt(print, "    Page no:           %u\n", page_no);
-  if (prev_page_no != FIL_NULL) {
-    ninja_pt(print, "    Slibling pages no: %u ", prev_page_no);
-  } else {
-    ninja_pt(print, "    Slibling pages no: NULL ");
+/* ------ RowFilter ------ */
+struct RowFilter::Token {
+  enum Type {
+    WORD,    // Keyword, unquoted literal or column name
+    STRING,  // 'quoted literal'
+    IDENT,   // `quoted column name`
+    SYMBOL,  // ( ) , = != <> < <= > >=
+    END
+  };
+  Type type;
+  std::string text;
+};
+
+static bool TokenizeFilter(const std::string& expr,
+                           std::vector<RowFilter::Token>* tokens) {
+  size_t pos = 0;
+  while (pos < expr.size()) {
+    char c = expr[pos];
+    if (isspace(c)) {
+      pos++;
+      continue;
+    }
+    RowFilter::Token token;
+    if (c == '(' || c == ')' || c == ',') {
+      token = {RowFilter::Token::SYMBOL, std::string(1, c)};
+      pos++;
+    } else if (c == '=' || c == '<' || c == '>' || c == '!') {
+      std::string op(1, c);
+      if (pos + 1 < expr.size() &&
+          (expr[pos + 1] == '=' || (c == '<' && expr[pos + 1] == '>'))) {
+        op.push_back(expr[pos + 1]);
+      }
+      if (op == "!") {
+        ninja_error("Unexpected '!' in the filter, use != or NOT");
+        return false;
+      }
+      token = {RowFilter::Token::SYMBOL, op};
+      pos += op.size();
+    } else if (c == '\'' || c == '`') {
+      token.type = (c == '\'') ? RowFilter::Token::STRING :
+                                 RowFilter::Token::IDENT;
+      bool closed = false;
+      for (pos++; pos < expr.size(); pos++) {
+        if (expr[pos] == c) {
+          if (pos + 1 < expr.size() && expr[pos + 1] == c) {
+            token.text.push_back(c);
+            pos++;
+            continue;
+          }
+          closed = true;
+          pos++;
+          break;
+        }
+        token.text.push_back(expr[pos]);
+      }
+      if (!closed) {
+        ninja_error("Unterminated %s in the filter",
+                    (c == '\'') ? "string" : "column name");
+        return false;
+      }
+    } else {
+      size_t end = expr.find_first_of(" \t\r\n()=<>!,'`", pos);
+      if (end == std::string::npos) {
+        end = expr.size();
+      }
+      token = {RowFilter::Token::WORD, expr.substr(pos, end - pos)};
+      pos = end;
+    }
+    tokens->push_back(token);
   }
-  ninja_pt(print, "[%u] ", page_no_in_fil_header);
-  if (next_page_no != FIL_NULL) {
-    ninja_pt(print, "%u\n", next_page_no);
-  } else {
-    ninja_pt(print, "NULL\n");
+  tokens->push_back({RowFilter::Token::END, ""});
+  return true;
+}
+
+static bool IsKeyword(const RowFilter::Token& token, const char* keyword) {
+  return token.type == RowFilter::Token::WORD &&
+         strcasecmp(token.text.c_str(), keyword) == 0;
+}
+
+static bool IsSymbol(const RowFilter::Token& token, const char* symbol) {
+  return token.type == RowFilter::Token::SYMBOL && token.text == symbol;
+}
+
+RowFilter* RowFilter::CreateRowFilter(const std::string& expr, Index* index) {
+  std::vector<Token> tokens;
+  if (!TokenizeFilter(expr, &tokens)) {
+    return nullptr;
   }
-  ninja_pt(print, "    Space id:          %u\n", space_id);
-  ninja_pt(print, "    Page type:         %s\n", PageType2String(type).c_str());
-  ninja_pt(print, "    Lsn:               %u\n", lsn);
-  ninja_pt(print, "    FLush lsn:         %u\n", flush_lsn);
-  ninja_pt(print, "    -------------------\n");
-  ninja_pt(print, "    Page level:        %u\n", page_level);
-  ninja_pt(print, "    Page size:         [logical: %u B], [physical: %u B]\n",
-                       g_page_logical_size,
-                       g_page_physical_size);
-  ninja_pt(print, "    Number of records: %u\n", n_recs);
-  ninja_pt(print, "    Index id:          %" PRIu64 "\n", index_id);
-  if (!index_not_found) {
-  ninja_pt(print, "    Belongs to:        [table: %s.%s], [index: %s]\n",
-                       index->table()->schema_ref().c_str(),
-                       index->table()->name().c_str(),
-                       index->name().c_str());
-  ninja_pt(print, "    Row format:        %s\n",
-                       index->table()->RowFormatString().c_str());
+  RowFilter* filter = new RowFilter(index);
+  size_t pos = 0;
+  filter->root_ = filter->ParseOr(tokens, &pos);
+  if (filter->root_ != nullptr && tokens[pos].type != Token::END) {
+    ninja_error("Unexpected '%s' in the filter", tokens[pos].text.c_str());
+    delete filter;
+    return nullptr;
   }
-  ninja_pt(print, "    Number dir slots:  %u\n", n_dir_slots);
-  ninja_pt(print, "    Heap top:          %u\n", heap_top);
-  ninja_pt(print, "    Number of heap:    %u\n", n_heap);
-  ninja_pt(print, "    First free rec:    %u\n", free);
-  ninja_pt(print, "    Garbage:           %u B\n", garbage);
-  ninja_pt(print, "    Last insert:       %u\n", last_insert);
-  ninja_pt(print, "    Direction:         %u\n", direction);
-  ninja_pt(print, "    Number direction:  %u\n", n_direction);
-  ninja_pt(print, "    Max trx id:        %u\n", max_trx_id);
+  if (filter->root_ == nullptr) {
+    delete filter;
+    return nullptr;
+  }
+  return filter;
+}
 
-  ninja_pt(print, "\n");
+RowFilter::Node* RowFilter::ParseOr(const std::vector<Token>& tokens,
+                                    size_t* pos) {
+  Node* node = ParseAnd(tokens, pos);
+  if (node == nullptr || !IsKeyword(tokens[*pos], "OR")) {
+    return node;
+  }
+  Node* or_node = new Node();
+  or_node->type = NODE_OR;
+  or_node->children.push_back(node);
+  while (IsKeyword(tokens[*pos], "OR")) {
+    (*pos)++;
+    node = ParseAnd(tokens, pos);
+    if (node == nullptr) {
+      delete or_node;
+      return nullptr;
+    }
+    or_node->children.push_back(node);
+  }
+  return or_node;
+}
 
-  if (index_not_found) {
-    ninja_warn("Skipping record parsing");
-    return false;
+RowFilter::Node* RowFilter::ParseAnd(const std::vector<Token>& tokens,
+                                     size_t* pos) {
+  Node* node = ParsePrimary(tokens, pos);
+  if (node == nullptr || !IsKeyword(tokens[*pos], "AND")) {
+    return node;
+  }
+  Node* and_node = new Node();
+  and_node->type = NODE_AND;
+  and_node->children.push_back(node);
+  while (IsKeyword(tokens[*pos], "AND")) {
+    (*pos)++;
+    node = ParsePrimary(tokens, pos);
+    if (node == nullptr) {
+      delete and_node;
+      return nullptr;
+    }
+    and_node->children.push_back(node);
   }
+  return and_node;
+}
 
-  if (!index->IsIndexParsingRecSupported()) {
-    ninja_warn("Skipping record parsing");
+RowFilter::Node* RowFilter::ParsePrimary(const std::vector<Token>& tokens,
+                                         size_t* pos) {
+  if (!IsSymbol(tokens[*pos], "(")) {
+    return ParsePredicate(tokens, pos);
+  }
+  (*pos)++;
+  Node* node = ParseOr(tokens, pos);
+  if (node == nullptr) {
+    return nullptr;
+  }
+  if (!IsSymbol(tokens[*pos], ")")) {
+    ninja_error("Missing ')' in the filter");
+    delete node;
+    return nullptr;
+  }
+  (*pos)++;
+  return node;
+}
+
+bool RowFilter::EncodeLiteral(Node* node, const Token& token,
+                              std::string* value) {
+  if (!CheckOrderSupported(node->column)) {
+    return false;
+  }
+  if (token.type != Token::WORD && token.type != Token::STRING) {
+    ninja_error("Expected a value for column %s in the filter",
+                node->column->name().c_str());
+    return false;
+  }
+  if (token.type == Token::WORD && strcasecmp(token.text.c_str(),
+                                              "NULL") == 0) {
+    ninja_error("Comparing with NULL never matches, "
+                "use IS NULL or IS NOT NULL instead");
+    return false;
+  }
+  if (!node->column->StringToValue(token.text, value)) {
+    ninja_error("Invalid value '%s' for column %s (%s)",
+                token.text.c_str(), node->column->name().c_str(),
+                node->column->dd_column_type_utf8().c_str());
     return false;
   }
+  return true;
+}
 
-  bool print_rec = print & print_record;
-  ninja_pt(print_rec, "=========================================="
-                  "==========================================\n");
-  ninja_pt(print_rec, "|  RECORDS INFORMATION                    "
-                  "                                         |\n");
-  ninja_pt(print_rec, "------------------------------------------"
-                  "------------------------------------------\n");
-  uint32_t i = 0;
-  unsigned char* current_rec = nullptr;
-  PageAnalysisResult result;
-  if (n_recs > 0) {
-    current_rec = GetFirstUserRec(buf);
-    bool corrupt = false;
-    while (current_rec != nullptr && corrupt != true) {
-      i++;
-      Record rec(current_rec, index);
-      rec.GetColumnOffsets();
-      rec.ParseRecord(page_level == 0, i, &result,
-                      print_rec);
-      current_rec = GetNextRecInPage(current_rec, buf, &corrupt);
+RowFilter::Node* RowFilter::ParsePredicate(const std::vector<Token>& tokens,
+                                           size_t* pos) {
+  const Token& name = tokens[*pos];
+  if (name.type != Token::WORD && name.type != Token::IDENT) {
+    ninja_error("Expected a column name in the filter, but found '%s'",
+                name.text.c_str());
+    return nullptr;
+  }
+  Node* node = new Node();
+  node->type = NODE_PREDICATE;
+  node->column = nullptr;
+  node->negated = false;
+  node->column = index_->GetPhysicalFieldByName(name.text, &node->field_no);
+  if (node->column == nullptr) {
+    ninja_error("Unknown column %s in the filter", name.text.c_str());
+    delete node;
+    return nullptr;
+  }
+  (*pos)++;
+
+  const Token& op = tokens[(*pos)++];
+  bool ok = true;
+  if (op.type == Token::SYMBOL && op.text != "(" && op.text != ")" &&
+      op.text != ",") {
+    static const std::map<std::string, PredicateOp> ops = {
+      {"=", OP_EQ}, {"!=", OP_NE}, {"<>", OP_NE}, {"<", OP_LT},
+      {"<=", OP_LE}, {">", OP_GT}, {">=", OP_GE}
+    };
+    node->op = ops.at(op.text);
+    node->values.resize(1);
+    ok = EncodeLiteral(node, tokens[(*pos)++], &node->values[0]);
+  } else if (IsKeyword(op, "IS")) {
+    node->op = OP_IS_NULL;
+    if (IsKeyword(tokens[*pos], "NOT")) {
+      node->negated = true;
+      (*pos)++;
     }
-    if (corrupt != true) {
-      assert(i == n_recs);
+    if (!IsKeyword(tokens[(*pos)++], "NULL")) {
+      ninja_error("Expected NULL after IS in the filter");
+      ok = false;
     }
   } else {
-    ninja_pt(print_rec, "No record\n");
+    const Token* keyword = &op;
+    if (IsKeyword(op, "NOT")) {
+      node->negated = true;
+      keyword = &tokens[(*pos)++];
+    }
+    if (IsKeyword(*keyword, "IN")) {
+      node->op = OP_IN;
+      ok = IsSymbol(tokens[(*pos)++], "(");
+      while (ok) {
+        std::string value;
+        ok = EncodeLiteral(node, tokens[(*pos)++], &value);
+        node->values.push_back(value);
+        if (ok && IsSymbol(tokens[*pos], ")")) {
+          (*pos)++;
+          break;
+        }
+        ok = ok && IsSymbol(tokens[(*pos)++], ",");
+      }
+      if (!ok) {
+        ninja_error("Malformed IN list for column %s in the filter",
+                    node->column->name().c_str());
+      }
+    } else if (IsKeyword(*keyword, "LIKE")) {
+      node->op = OP_LIKE_PREFIX;
+      const Token& pattern = tokens[(*pos)++];
+      uint32_t mtype = node->column->ib_mtype();
+      size_t wildcard = pattern.text.find_first_of("%_");
+      if (pattern.type != Token::STRING ||
+          wildcard != pattern.text.size() - 1 ||
+          pattern.text[wildcard] != '%') {
+        ninja_error("Only prefix patterns such as 'abc%%' are supported "
+                    "by LIKE");
+        ok = false;
+      } else if (mtype != DATA_CHAR && mtype != DATA_MYSQL &&
+                 mtype != DATA_VARCHAR && mtype != DATA_VARMYSQL &&
+                 mtype != DATA_BLOB) {
+        ninja_error("LIKE is only supported on string columns, but %s is %s",
+                    node->column->name().c_str(),
+                    node->column->dd_column_type_utf8().c_str());
+        ok = false;
+      } else if (!CheckOrderSupported(node->column)) {
+        ok = false;
+      } else {
+        node->values.push_back(pattern.text.substr(0, wildcard));
+      }
+    } else if (keyword->type == Token::END) {
+      ninja_error("Incomplete predicate on column %s in the filter",
+                  node->column->name().c_str());
+      ok = false;
+    } else {
+      ninja_error("Unexpected '%s' after column %s in the filter",
+                  keyword->text.c_str(), node->column->name().c_str());
+      ok = false;
+    }
   }
+  if (!ok) {
+    delete node;
+    return nullptr;
+  }
+  return node;
+}
 
+void RowFilter::EvaluateBatch(const std::vector<Record*>& records,
+                              std::vector<uint8_t>* sel) const {
+  Evaluate(root_, records, sel);
+}
 
-  ninja_pt(print, "=========================================="
-      "==========================================\n");
-  ninja_pt(print, "|  PAGE ANALYSIS RESULT                    "
-      "                                         |\n");
-  ninja_pt(print, "------------------------------------------"
-      "------------------------------------------\n");
-  if (page_level == 0) {
-    ninja_pt(print, "Total valid records count:                %u\n",
-        result.n_recs_leaf);
-    ninja_pt(print, "Total valid records size:                 %u B\n"
-        "                                            "
-        "[Headers: %u B]\n"
-        "                                            "
-        "[Bodies:  %u B]\n",
-        result.headers_len_leaf + result.recs_len_leaf,
-        result.headers_len_leaf, result.recs_len_leaf);
-    ninja_pt(print, "Valid records to page space ratio:        "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          (result.headers_len_leaf +
-           result.recs_len_leaf)) /
-        g_page_physical_size * 100);
-
-    ninja_pt(print, "\n");
-    ninja_pt(print, "Total records with dropped columns count: %u\n",
-        result.n_contain_dropped_cols_recs_leaf);
-    ninja_pt(print, "Total instant dropped columns size:       %u B\n",
-        result.dropped_cols_len_leaf);
-    ninja_pt(print, "Dropped columns to page space ratio:      "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.dropped_cols_len_leaf) /
-        g_page_physical_size * 100);
+void RowFilter::Evaluate(const Node* node,
+                         const std::vector<Record*>& records,
+                         std::vector<uint8_t>* sel) const {
+  switch (node->type) {
+    case NODE_PREDICATE:
+      EvaluatePredicate(node, records, sel);
+      break;
+    case NODE_AND:
+      // Each conjunct only evaluates the records the previous ones kept
+      for (const auto* child : node->children) {
+        Evaluate(child, records, sel);
+      }
+      break;
+    case NODE_OR: {
+      // Each disjunct only evaluates the records not yet matched
+      std::vector<uint8_t> pending = *sel;
+      std::fill(sel->begin(), sel->end(), 0);
+      for (const auto* child : node->children) {
+        std::vector<uint8_t> child_sel = pending;
+        Evaluate(child, records, &child_sel);
+        for (size_t i = 0; i < records.size(); i++) {
+          if (child_sel[i]) {
+            (*sel)[i] = 1;
+            pending[i] = 0;
+          }
+        }
+      }
+      break;
+    }
+  }
+}
 
-    ninja_pt(print, "\n");
-    ninja_pt(print, "Total delete-marked records count:        %u\n",
-        result.n_deleted_recs_leaf);
-    ninja_pt(print, "Total delete-marked records size:         %u B\n",
-        result.deleted_recs_len_leaf);
-    ninja_pt(print, "Delete-marked recs to page space ratio:   "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.deleted_recs_len_leaf) /
-        g_page_physical_size * 100);
+/*
+ * Points *data at the value of a field of a leaf record, like
+ * Record::GetFieldValue(), but reads an off-page value in full into *buf.
+ * If that fails, a warning is printed and the local prefix is used.
+ */
+static bool GetLeafFieldValue(Record* record, uint32_t field_no,
+                              const Column* col, std::string* buf,
+                              const unsigned char** data, uint32_t* len) {
+  if (!record->GetFieldValue(field_no, data, len)) {
+    return false;
+  }
+  const unsigned char* field = nullptr;
+  uint32_t field_len = 0;
+  if (!(record->GetField(field_no, &field, &field_len) & REC_OFFS_EXTERNAL)) {
+    return true;
+  }
+  bool truncated = false;
+  record->GetFullFieldValue(field_no, buf, &truncated);
+  if (truncated) {
+    ninja_warn("Failed to read the off-page value of column %s of the "
+               "record at page %u, offset %u, only its local prefix is used",
+               col->name().c_str(),
+               ReadFrom4B(page_align(record->rec()) + FIL_PAGE_OFFSET),
+               page_offset(record->rec()));
+  }
+  *data = reinterpret_cast<const unsigned char*>(buf->data());
+  *len = buf->size();
+  return true;
+}
 
-    result.innodb_internal_used_leaf =
-      PAGE_NEW_SUPREMUM_END + result.headers_len_leaf +
-      n_dir_slots * PAGE_DIR_SLOT_SIZE  + FIL_PAGE_DATA_END;
-    ninja_pt(print, "\n");
-    ninja_pt(print, "Total InnoDB internal space used:         %u B\n"
-        "                                            "
-        "[FIL HEADER     38 B]\n"
-        "                                            "
-        "[PAGE HEADER    36 B]\n"
-        "                                            "
-        "[FSEG HEADER    20 B]\n"
-        "                                            "
-        "[INFI + SUPRE   26 B]\n"
-        "                                            "
-        "[RECORD HEADERS %u B]*\n"
-        "                                            "
-        "[PAGE DIRECTORY %u B]\n"
-        "                                            "
-        "[FIL TRAILER    8 B]\n",
-        result.innodb_internal_used_leaf,
-        result.headers_len_leaf,
-        n_dir_slots * PAGE_DIR_SLOT_SIZE);
-    ninja_pt(print, "InnoDB internals to page space ratio:     "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.innodb_internal_used_leaf) /
-        g_page_physical_size * 100);
+void RowFilter::EvaluatePredicate(const Node* node,
+                                  const std::vector<Record*>& records,
+                                  std::vector<uint8_t>* sel) const {
+  // Decode the field of the selected records into a column batch first
+  struct FieldRef {
+    size_t row;
+    bool is_null;
+    const unsigned char* data;
+    uint32_t len;
+  };
+  std::vector<FieldRef> batch;
+  batch.reserve(records.size());
+  // Off-page values are read in full, the reserve keeps them in place
+  std::vector<std::string> full_values;
+  full_values.reserve(records.size());
+  for (size_t i = 0; i < records.size(); i++) {
+    if (!(*sel)[i]) {
+      continue;
+    }
+    FieldRef field = {i, false, nullptr, 0};
+    full_values.emplace_back();
+    if (node->op == OP_IS_NULL) {
+      field.is_null = !records[i]->GetFieldValue(node->field_no,
+                                                 &field.data, &field.len);
+    } else {
+      field.is_null = !GetLeafFieldValue(records[i], node->field_no,
+                                         node->column, &full_values.back(),
+                                         &field.data, &field.len);
+    }
+    batch.push_back(field);
+  }
+
+  Column* col = node->column;
+  const std::string& value = node->values.empty() ? "" : node->values[0];
+  const unsigned char* v = reinterpret_cast<const unsigned char*>(
+                               value.data());
+  uint32_t v_len = value.size();
+  for (auto& field : batch) {
+    bool match = false;
+    if (node->op == OP_IS_NULL) {
+      match = field.is_null;
+    } else if (field.is_null) {
+      // Comparisons with NULL are never true, not even when negated
+      (*sel)[field.row] = 0;
+      continue;
+    } else {
+      switch (node->op) {
+        case OP_EQ:
+          match = (col->CompareValue(field.data, field.len, v, v_len) == 0);
+          break;
+        case OP_NE:
+          match = (col->CompareValue(field.data, field.len, v, v_len) != 0);
+          break;
+        case OP_LT:
+          match = (col->CompareValue(field.data, field.len, v, v_len) < 0);
+          break;
+        case OP_LE:
+          match = (col->CompareValue(field.data, field.len, v, v_len) <= 0);
+          break;
+        case OP_GT:
+          match = (col->CompareValue(field.data, field.len, v, v_len) > 0);
+          break;
+        case OP_GE:
+          match = (col->CompareValue(field.data, field.len, v, v_len) >= 0);
+          break;
+        case OP_IN:
+          for (const auto& in_value : node->values) {
+            if (col->CompareValue(field.data, field.len,
+                    reinterpret_cast<const unsigned char*>(in_value.data()),
+                    in_value.size()) == 0) {
+              match = true;
+              break;
+            }
+          }
+          break;
+        case OP_LIKE_PREFIX:
+          match = col->HasPrefix(field.data, field.len, value);
+          break;
+        default:
+          break;
+      }
+    }
+    if (match == node->negated) {
+      (*sel)[field.row] = 0;
+    }
+  }
+}
 
-    ninja_pt(print, "\n");
-    result.free_leaf = garbage + UNIV_PAGE_SIZE - PAGE_DIR -
-      n_dir_slots * PAGE_DIR_SLOT_SIZE - heap_top;
-    ninja_pt(print, "Total free space:                         %u B\n",
-        result.free_leaf);
-    ninja_pt(print, "Free space ratio:                         "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.free_leaf) /
-        g_page_physical_size * 100);
-  } else {
-    ninja_pt(print, "Total valid records count:               %u\n",
-        result.n_recs_non_leaf);
+/*
+ * Derives the ranges of the first key field that can satisfy the filter, in
+ * the column's value order: predicates on that field give ranges, AND
+ * intersects and OR unites them, and anything else allows the whole range.
+ */
+std::vector<RowFilter::KeyInterval> RowFilter::GetKeyIntervals(
+                                        const Node* node) const {
+  std::vector<KeyInterval> intervals;
+  Column* key_col = index_->GetPhysicalField(0)->column();
+  auto compare = [key_col](const std::string& a, const std::string& b) {
+    return key_col->CompareValue(
+               reinterpret_cast<const unsigned char*>(a.data()), a.size(),
+               reinterpret_cast<const unsigned char*>(b.data()), b.size());
+  };
+  // Compares bounds, where a missing low bound is -inf and a missing high
+  // bound is +inf
+  auto compare_low = [&](const KeyInterval& a, const KeyInterval& b) {
+    if (!a.has_low || !b.has_low) {
+      return (a.has_low == b.has_low) ? 0 : a.has_low ? 1 : -1;
+    }
+    return compare(a.low, b.low);
+  };
+  auto compare_high = [&](const KeyInterval& a, const KeyInterval& b) {
+    if (!a.has_high || !b.has_high) {
+      return (a.has_high == b.has_high) ? 0 : a.has_high ? -1 : 1;
+    }
+    return compare(a.high, b.high);
+  };
+  auto is_empty = [&](const KeyInterval& interval) {
+    return interval.has_low && interval.has_high &&
+           compare(interval.low, interval.high) > 0;
+  };
+  const KeyInterval full = {false, "", false, ""};
+
+  switch (node->type) {
+    case NODE_PREDICATE:
+      if (node->field_no != 0 || node->negated) {
+        intervals.push_back(full);
+        break;
+      }
+      switch (node->op) {
+        case OP_EQ:
+          intervals.push_back({true, node->values[0], true, node->values[0]});
+          break;
+        case OP_LT:
+        case OP_LE:
+          intervals.push_back({false, "", true, node->values[0]});
+          break;
+        case OP_GT:
+        case OP_GE:
+          intervals.push_back({true, node->values[0], false, ""});
+          break;
+        case OP_IN:
+          for (const auto& value : node->values) {
+            intervals.push_back({true, value, true, value});
+          }
+          break;
+        case OP_IS_NULL:
+          // Key fields of the clustered index are never NULL
+          break;
+        default:
+          intervals.push_back(full);
+          break;
+      }
+      break;
+    case NODE_AND:
+      intervals.push_back(full);
+      for (const auto* child : node->children) {
+        std::vector<KeyInterval> child_intervals = GetKeyIntervals(child);
+        std::vector<KeyInterval> result;
+        for (const auto& a : intervals) {
+          for (const auto& b : child_intervals) {
+            KeyInterval both;
+            both.has_low = a.has_low || b.has_low;
+            both.low = (compare_low(a, b) >= 0) ? a.low : b.low;
+            both.has_high = a.has_high || b.has_high;
+            both.high = (compare_high(a, b) <= 0) ? a.high : b.high;
+            if (!is_empty(both)) {
+              result.push_back(both);
+            }
+          }
+        }
+        intervals.swap(result);
+      }
+      break;
+    case NODE_OR:
+      for (const auto* child : node->children) {
+        std::vector<KeyInterval> child_intervals = GetKeyIntervals(child);
+        intervals.insert(intervals.end(), child_intervals.begin(),
+                         child_intervals.end());
+      }
+      break;
+  }
+
+  // Sort by low bound, and merge the overlapping intervals
+  std::sort(intervals.begin(), intervals.end(),
+            [&](const KeyInterval& a, const KeyInterval& b) {
+              return compare_low(a, b) < 0;
+            });
+  std::vector<KeyInterval> merged;
+  for (const auto& interval : intervals) {
+    if (!merged.empty()) {
+      KeyInterval& last = merged.back();
+      if (!last.has_high ||
+          (interval.has_low && compare(interval.low, last.high) <= 0)) {
+        if (compare_high(interval, last) > 0) {
+          last.has_high = interval.has_high;
+          last.high = interval.high;
+        }
+        continue;
+      }
+    }
+    merged.push_back(interval);
+  }
+  return merged;
+}
+
+void RowFilter::GetKeyRanges(std::vector<SearchRange>* ranges) const {
+  std::vector<KeyInterval> intervals = GetKeyIntervals(root_);
+  bool ascending = index_->IsFieldAscending(0);
+  if (!ascending) {
+    std::reverse(intervals.begin(), intervals.end());
+  }
+  for (const auto& interval : intervals) {
+    SearchKey low;
+    SearchKey high;
+    if (interval.has_low) {
+      (ascending ? low : high).push_back({false, interval.low});
+    }
+    if (interval.has_high) {
+      (ascending ? high : low).push_back({false, interval.high});
+    }
+    ranges->emplace_back(low, high);
+  }
+}
+
+bool RowFilter::MayMatch(uint32_t n_recs,
+        const std::function<const FieldStats*(uint32_t)>& get_stats) const {
+  return MayMatch(root_, n_recs, get_stats);
+}
+
+/*
+ * Decides from the range of a field whether any record may match, with the
+ * same comparisons as EvaluatePredicate(). Unknown bounds and LIKE never
+ * rule the records out.
+ */
+bool RowFilter::MayMatch(const Node* node, uint32_t n_recs,
+        const std::function<const FieldStats*(uint32_t)>& get_stats) const {
+  switch (node->type) {
+    case NODE_AND:
+      for (const auto* child : node->children) {
+        if (!MayMatch(child, n_recs, get_stats)) {
+          return false;
+        }
+      }
+      return true;
+    case NODE_OR:
+      for (const auto* child : node->children) {
+        if (MayMatch(child, n_recs, get_stats)) {
+          return true;
+        }
+      }
+      return false;
+    case NODE_PREDICATE:
+      break;
+  }
+  const FieldStats* stats = get_stats(node->field_no);
+  if (stats == nullptr) {
+    return true;
+  }
+  if (node->op == OP_IS_NULL) {
+    return node->negated ? (stats->n_nulls < n_recs) : (stats->n_nulls > 0);
+  }
+  if (stats->n_nulls >= n_recs) {
+    // Comparisons with NULL are never true, not even when negated
+    return false;
+  }
+  Column* col = node->column;
+  auto compare = [col](const std::string& a, const std::string& b) {
+    return col->CompareValue(
+               reinterpret_cast<const unsigned char*>(a.data()), a.size(),
+               reinterpret_cast<const unsigned char*>(b.data()), b.size());
+  };
+  // Whether some value in [min, max] may compare to v as the op asks
+  auto may_be = [&](PredicateOp op, const std::string& v) {
+    switch (op) {
+      case OP_EQ:
+        return (!stats->has_min || compare(stats->min, v) <= 0) &&
+               (!stats->has_max || compare(stats->max, v) >= 0);
+      case OP_NE:
+        return !stats->has_min || !stats->has_max ||
+               compare(stats->min, v) != 0 || compare(stats->max, v) != 0;
+      case OP_LT:
+        return !stats->has_min || compare(stats->min, v) < 0;
+      case OP_LE:
+        return !stats->has_min || compare(stats->min, v) <= 0;
+      case OP_GT:
+        return !stats->has_max || compare(stats->max, v) > 0;
+      case OP_GE:
+        return !stats->has_max || compare(stats->max, v) >= 0;
+      default:
+        return true;
+    }
+  };
+  switch (node->op) {
+    case OP_EQ:
+      return may_be(node->negated ? OP_NE : OP_EQ, node->values[0]);
+    case OP_NE:
+      return may_be(node->negated ? OP_EQ : OP_NE, node->values[0]);
+    case OP_LT:
+      return may_be(node->negated ? OP_GE : OP_LT, node->values[0]);
+    case OP_LE:
+      return may_be(node->negated ? OP_GT : OP_LE, node->values[0]);
+    case OP_GT:
+      return may_be(node->negated ? OP_LE : OP_GT, node->values[0]);
+    case OP_GE:
+      return may_be(node->negated ? OP_LT : OP_GE, node->values[0]);
+    case OP_IN:
+      for (const auto& value : node->values) {
+        if (node->negated ? !may_be(OP_NE, value) : may_be(OP_EQ, value)) {
+          // NOT IN is ruled out only if all values equal one of the list
+          return !node->negated;
+        }
+      }
+      return node->negated;
+    default:
+      return true;
+  }
+}
+
+/* ------ Aggregator ------ */
+// Memory of the group tables of all threads before they are spilled
+constexpr uint64_t AGGREGATE_MEMORY_LIMIT = 256ULL << 20;
+// Spilled groups are partitioned by hash, and merged one partition at a time
+constexpr uint32_t AGGREGATE_SPILL_PARTITIONS = 16;
+// Estimated overhead of a hash table entry
+constexpr uint64_t AGGREGATE_GROUP_OVERHEAD = 64;
+
+Aggregator* Aggregator::CreateAggregator(const std::string& spec,
+                                         Index* index, uint32_t n_threads) {
+  Aggregator* aggregator = new Aggregator(index);
+  if (!aggregator->Parse(spec)) {
+    delete aggregator;
+    return nullptr;
+  }
+  aggregator->threads_.resize(std::max(n_threads, 1U));
+  for (auto& thread : aggregator->threads_) {
+    thread.mem_size = 0;
+  }
+  return aggregator;
+}
+
+Aggregator::~Aggregator() {
+  for (auto& thread : threads_) {
+    for (auto* file : thread.spill_files) {
+      fclose(file);
+    }
+  }
+}
+
+bool Aggregator::Parse(const std::string& spec) {
+  std::vector<RowFilter::Token> tokens;
+  if (!TokenizeFilter(spec, &tokens)) {
+    return false;
+  }
+  static const std::map<std::string, AggregateFunc> funcs = {
+    {"COUNT", AGG_COUNT}, {"SUM", AGG_SUM}, {"AVG", AGG_AVG},
+    {"MIN", AGG_MIN}, {"MAX", AGG_MAX}
+  };
+  size_t pos = 0;
+  while (tokens[pos].type != RowFilter::Token::END &&
+         !IsKeyword(tokens[pos], "GROUP")) {
+    if (!aggregates_.empty() && !IsSymbol(tokens[pos++], ",")) {
+      ninja_error("Expected ',' between aggregate functions");
+      return false;
+    }
+    std::string func_name = tokens[pos].text;
+    std::transform(func_name.begin(), func_name.end(), func_name.begin(),
+                   ::toupper);
+    auto iter = funcs.find(func_name);
+    if (tokens[pos].type != RowFilter::Token::WORD || iter == funcs.end() ||
+        !IsSymbol(tokens[pos + 1], "(")) {
+      ninja_error("Expected COUNT, SUM, AVG, MIN or MAX, but found '%s'",
+                  tokens[pos].text.c_str());
+      return false;
+    }
+    pos += 2;
+    AggregateSpec agg;
+    agg.func = iter->second;
+    agg.column = nullptr;
+    agg.field_no = 0;
+    agg.exact = false;
+    const RowFilter::Token& arg = tokens[pos++];
+    if (agg.func == AGG_COUNT && arg.type == RowFilter::Token::WORD &&
+        arg.text == "*") {
+      agg.name = "COUNT(*)";
+    } else {
+      if (arg.type == RowFilter::Token::WORD ||
+          arg.type == RowFilter::Token::IDENT) {
+        agg.column = index_->GetPhysicalFieldByName(arg.text, &agg.field_no);
+      }
+      if (agg.column == nullptr) {
+        ninja_error("Unknown column '%s' in %s()", arg.text.c_str(),
+                    func_name.c_str());
+        return false;
+      }
+      if ((agg.func == AGG_SUM || agg.func == AGG_AVG) &&
+          !agg.column->IsNumeric()) {
+        ninja_error("%s() is only supported on numeric columns, but %s is %s",
+                    func_name.c_str(), agg.column->name().c_str(),
+                    agg.column->dd_column_type_utf8().c_str());
+        return false;
+      }
+      if ((agg.func == AGG_MIN || agg.func == AGG_MAX) &&
+          !CheckOrderSupported(agg.column)) {
+        return false;
+      }
+      agg.exact = (agg.func == AGG_SUM || agg.func == AGG_AVG) &&
+                  agg.column->NumberScale() >= 0;
+      agg.name = func_name + "(" + agg.column->name() + ")";
+    }
+    if (!IsSymbol(tokens[pos++], ")")) {
+      ninja_error("Missing ')' after %s", agg.name.c_str());
+      return false;
+    }
+    aggregates_.push_back(agg);
+  }
+  if (aggregates_.empty()) {
+    ninja_error("No aggregate function was specified");
+    return false;
+  }
+  if (IsKeyword(tokens[pos], "GROUP")) {
+    if (!IsKeyword(tokens[pos + 1], "BY")) {
+      ninja_error("Expected BY after GROUP");
+      return false;
+    }
+    pos += 2;
+    do {
+      uint32_t field_no = 0;
+      const RowFilter::Token& name = tokens[pos++];
+      Column* col = nullptr;
+      if (name.type == RowFilter::Token::WORD ||
+          name.type == RowFilter::Token::IDENT) {
+        col = index_->GetPhysicalFieldByName(name.text, &field_no);
+      }
+      if (col == nullptr) {
+        ninja_error("Unknown column '%s' in GROUP BY", name.text.c_str());
+        return false;
+      }
+      if (!CheckOrderSupported(col)) {
+        return false;
+      }
+      group_fields_.push_back(field_no);
+      group_pad_space_.push_back(col->IsPadSpace());
+    } while (IsSymbol(tokens[pos], ",") && ++pos);
+  }
+  if (tokens[pos].type != RowFilter::Token::END) {
+    ninja_error("Unexpected '%s' in the aggregation",
+                tokens[pos].text.c_str());
+    return false;
+  }
+  return true;
+}
+
+bool Aggregator::UpdateBatch(uint32_t thread_no,
+                             const std::vector<Record*>& records,
+                             const std::vector<uint8_t>& sel) {
+  ThreadState* thread = &threads_[thread_no];
+  std::vector<Record*> rows;
+  for (size_t i = 0; i < records.size(); i++) {
+    if (sel[i]) {
+      rows.push_back(records[i]);
+    }
+  }
+
+  // Resolve the group of each row first. A group key is a sequence of
+  // fields, each a NULL flag optionally followed by a length and the value.
+  std::vector<std::vector<AggregateState>*> states(rows.size());
+  std::string key;
+  // Holds an off-page value read in full
+  std::string full_value;
+  std::string decimal;
+  const unsigned char* data = nullptr;
+  uint32_t len = 0;
+  for (size_t k = 0; k < rows.size(); k++) {
+    key.clear();
+    for (size_t g = 0; g < group_fields_.size(); g++) {
+      if (!GetLeafFieldValue(rows[k], group_fields_[g],
+              index_->GetPhysicalField(group_fields_[g])->column(),
+              &full_value, &data, &len)) {
+        key.push_back('\0');
+        continue;
+      }
+      if (group_pad_space_[g]) {
+        // Values that only differ in trailing spaces are one group
+        while (len > 0 && data[len - 1] == ' ') {
+          len--;
+        }
+      }
+      key.push_back('\1');
+      WriteToNB(len, 4, &key);
+      key.append(reinterpret_cast<const char*>(data), len);
+    }
+    auto iter = thread->groups.find(key);
+    if (iter == thread->groups.end()) {
+      iter = thread->groups.emplace(key, std::vector<AggregateState>(
+                 aggregates_.size(),
+                 AggregateState{0, 0, false, "", DecimalSum()})).first;
+      thread->mem_size += AGGREGATE_GROUP_OVERHEAD + key.size() +
+                          aggregates_.size() * sizeof(AggregateState);
+    }
+    states[k] = &iter->second;
+  }
+
+  // Then update one aggregate at a time over the whole batch
+  for (size_t a = 0; a < aggregates_.size(); a++) {
+    const AggregateSpec& agg = aggregates_[a];
+    if (agg.column == nullptr) {
+      for (size_t k = 0; k < rows.size(); k++) {
+        (*states[k])[a].count++;
+      }
+      continue;
+    }
+    switch (agg.func) {
+      case AGG_COUNT:
+        for (size_t k = 0; k < rows.size(); k++) {
+          if (rows[k]->GetFieldValue(agg.field_no, &data, &len)) {
+            (*states[k])[a].count++;
+          }
+        }
+        break;
+      case AGG_SUM:
+      case AGG_AVG:
+        for (size_t k = 0; k < rows.size(); k++) {
+          long double value = 0;
+          if (!rows[k]->GetFieldValue(agg.field_no, &data, &len)) {
+            continue;
+          }
+          if (agg.exact) {
+            if (agg.column->ValueToDecimal(data, len, &decimal)) {
+              AddDecimal(&(*states[k])[a].exact_sum, decimal);
+              (*states[k])[a].count++;
+            }
+          } else if (agg.column->ValueToNumber(data, len, &value)) {
+            (*states[k])[a].sum += value;
+            (*states[k])[a].count++;
+          }
+        }
+        break;
+      case AGG_MIN:
+      case AGG_MAX:
+        for (size_t k = 0; k < rows.size(); k++) {
+          if (!GetLeafFieldValue(rows[k], agg.field_no, agg.column,
+                                 &full_value, &data, &len)) {
+            continue;
+          }
+          AggregateState* state = &(*states[k])[a];
+          state->count++;
+          if (state->has_value) {
+            int ret = agg.column->CompareValue(data, len,
+                reinterpret_cast<const unsigned char*>(state->value.data()),
+                state->value.size());
+            if ((agg.func == AGG_MIN) ? (ret >= 0) : (ret <= 0)) {
+              continue;
+            }
+          }
+          thread->mem_size += len;
+          thread->mem_size -= state->value.size();
+          state->value.assign(reinterpret_cast<const char*>(data), len);
+          state->has_value = true;
+        }
+        break;
+    }
+  }
+
+  if (thread->mem_size > AGGREGATE_MEMORY_LIMIT / threads_.size()) {
+    return Spill(thread);
+  }
+  return true;
+}
+
+void Aggregator::MergeStates(std::vector<AggregateState>* to,
+                             const std::vector<AggregateState>& from) {
+  for (size_t a = 0; a < aggregates_.size(); a++) {
+    AggregateState* state = &(*to)[a];
+    state->count += from[a].count;
+    state->sum += from[a].sum;
+    MergeDecimalSums(&state->exact_sum, from[a].exact_sum);
+    if (!from[a].has_value) {
+      continue;
+    }
+    if (state->has_value) {
+      int ret = aggregates_[a].column->CompareValue(
+          reinterpret_cast<const unsigned char*>(from[a].value.data()),
+          from[a].value.size(),
+          reinterpret_cast<const unsigned char*>(state->value.data()),
+          state->value.size());
+      if ((aggregates_[a].func == AGG_MIN) ? (ret >= 0) : (ret <= 0)) {
+        continue;
+      }
+    }
+    state->value = from[a].value;
+    state->has_value = true;
+  }
+}
+
+/*
+ * Appends the groups of a thread to its partition files, and empties its
+ * hash table. Each entry is the key, then count, sum, value and exact sum
+ * of each aggregate.
+ */
+bool Aggregator::Spill(ThreadState* thread) {
+  if (thread->spill_files.empty()) {
+    for (uint32_t p = 0; p < AGGREGATE_SPILL_PARTITIONS; p++) {
+      FILE* file = tmpfile();
+      if (file == nullptr) {
+        ninja_error("Failed to create a temporary file, error: %d(%s)",
+                    errno, strerror(errno));
+        return false;
+      }
+      thread->spill_files.push_back(file);
+    }
+  }
+  std::hash<std::string> hasher;
+  bool ret = true;
+  for (const auto& group : thread->groups) {
+    FILE* file = thread->spill_files[hasher(group.first) %
+                                     AGGREGATE_SPILL_PARTITIONS];
+    uint32_t len = group.first.size();
+    ret = ret && fwrite(&len, sizeof(len), 1, file) == 1 &&
+          fwrite(group.first.data(), 1, len, file) == len;
+    for (const auto& state : group.second) {
+      uint8_t has_value = state.has_value;
+      len = state.value.size();
+      ret = ret && fwrite(&state.count, sizeof(state.count), 1, file) == 1 &&
+            fwrite(&state.sum, sizeof(state.sum), 1, file) == 1 &&
+            fwrite(&has_value, sizeof(has_value), 1, file) == 1 &&
+            fwrite(&len, sizeof(len), 1, file) == 1 &&
+            fwrite(state.value.data(), 1, len, file) == len;
+      for (const auto* digits : {&state.exact_sum.positive,
+                                 &state.exact_sum.negative}) {
+        len = digits->size();
+        ret = ret && fwrite(&len, sizeof(len), 1, file) == 1 &&
+              fwrite(digits->data(), sizeof(uint32_t), len, file) == len;
+      }
+    }
+  }
+  if (!ret) {
+    ninja_error("Failed to spill groups to disk, error: %d(%s)",
+                errno, strerror(errno));
+    return false;
+  }
+  n_spilled_groups_ += thread->groups.size();
+  thread->groups.clear();
+  thread->mem_size = 0;
+  return true;
+}
+
+bool Aggregator::ReadSpilled(FILE* file, GroupTable* groups) {
+  rewind(file);
+  std::string key;
+  std::vector<AggregateState> states(aggregates_.size());
+  uint32_t len = 0;
+  while (fread(&len, sizeof(len), 1, file) == 1) {
+    key.resize(len);
+    bool ret = (fread(&key[0], 1, len, file) == len);
+    for (auto& state : states) {
+      uint8_t has_value = 0;
+      ret = ret && fread(&state.count, sizeof(state.count), 1, file) == 1 &&
+            fread(&state.sum, sizeof(state.sum), 1, file) == 1 &&
+            fread(&has_value, sizeof(has_value), 1, file) == 1 &&
+            fread(&len, sizeof(len), 1, file) == 1;
+      state.has_value = has_value;
+      state.value.resize(ret ? len : 0);
+      ret = ret && fread(&state.value[0], 1, len, file) == len;
+      for (auto* digits : {&state.exact_sum.positive,
+                           &state.exact_sum.negative}) {
+        ret = ret && fread(&len, sizeof(len), 1, file) == 1;
+        digits->resize(ret ? len : 0);
+        ret = ret &&
+              fread(digits->data(), sizeof(uint32_t), len, file) == len;
+      }
+    }
+    if (!ret) {
+      ninja_error("Failed to read spilled groups");
+      return false;
+    }
+    auto iter = groups->find(key);
+    if (iter == groups->end()) {
+      groups->emplace(key, states);
+    } else {
+      MergeStates(&iter->second, states);
+    }
+  }
+  return true;
+}
+
+// Decimal digits per element of a DecimalSum
+constexpr uint32_t DECIMAL_SUM_DIGITS = 9;
+constexpr uint32_t DECIMAL_SUM_BASE = 1000000000;
+
+static void AddDecimalDigits(std::vector<uint32_t>* to,
+                             const std::vector<uint32_t>& from) {
+  if (to->size() < from.size()) {
+    to->resize(from.size(), 0);
+  }
+  uint32_t carry = 0;
+  for (size_t i = 0; i < to->size() && (carry != 0 || i < from.size());
+       i++) {
+    uint32_t sum = (*to)[i] + (i < from.size() ? from[i] : 0) + carry;
+    carry = (sum >= DECIMAL_SUM_BASE);
+    (*to)[i] = carry ? sum - DECIMAL_SUM_BASE : sum;
+  }
+  if (carry != 0) {
+    to->push_back(carry);
+  }
+}
+
+// The digits of a DecimalSum element as text, most significant first
+static std::string DecimalDigitsToString(const std::vector<uint32_t>& digits) {
+  std::string str;
+  char buf[16];
+  for (size_t i = digits.size(); i-- > 0;) {
+    snprintf(buf, sizeof(buf), str.empty() ? "%u" : "%09u", digits[i]);
+    if (!str.empty() || digits[i] != 0) {
+      str += buf;
+    }
+  }
+  return str.empty() ? "0" : str;
+}
+
+/*
+ * Adds decimal text with the column scale, as written by
+ * Column::ValueToDecimal(): dropping the point gives the scaled value.
+ */
+void Aggregator::AddDecimal(DecimalSum* sum, const std::string& value) {
+  bool negative = (!value.empty() && value[0] == '-');
+  std::string digits;
+  for (char c : value) {
+    if (c >= '0' && c <= '9') {
+      digits.push_back(c);
+    }
+  }
+  std::vector<uint32_t> addend;
+  for (size_t end = digits.size(); end > 0;) {
+    size_t begin = (end > DECIMAL_SUM_DIGITS) ? end - DECIMAL_SUM_DIGITS : 0;
+    addend.push_back(static_cast<uint32_t>(
+                         std::stoul(digits.substr(begin, end - begin))));
+    end = begin;
+  }
+  AddDecimalDigits(negative ? &sum->negative : &sum->positive, addend);
+}
+
+void Aggregator::MergeDecimalSums(DecimalSum* to, const DecimalSum& from) {
+  AddDecimalDigits(&to->positive, from.positive);
+  AddDecimalDigits(&to->negative, from.negative);
+}
+
+/*
+ * Formats sum / divisor with result_scale fractional digits, where the sum
+ * is scaled by 10^scale. The division rounds half away from zero, as
+ * MySQL's decimal division does.
+ */
+std::string Aggregator::DecimalSumToString(const DecimalSum& sum, int scale,
+                                           uint64_t divisor,
+                                           int result_scale) {
+  std::string positive = DecimalDigitsToString(sum.positive);
+  std::string negative = DecimalDigitsToString(sum.negative);
+  bool is_negative = (negative.size() > positive.size() ||
+                      (negative.size() == positive.size() &&
+                       negative > positive));
+  std::string* larger = is_negative ? &negative : &positive;
+  const std::string& smaller = is_negative ? positive : negative;
+  // larger -= smaller
+  int borrow = 0;
+  for (size_t i = 0; i < larger->size(); i++) {
+    size_t pos = larger->size() - 1 - i;
+    int digit = (*larger)[pos] - '0' - borrow -
+                (i < smaller.size() ? smaller[smaller.size() - 1 - i] - '0' :
+                                      0);
+    borrow = (digit < 0);
+    (*larger)[pos] = static_cast<char>('0' + digit + (borrow ? 10 : 0));
+  }
+  larger->append(result_scale - scale, '0');
+
+  std::string quotient;
+  unsigned __int128 remainder = 0;
+  for (char c : *larger) {
+    remainder = remainder * 10 + (c - '0');
+    uint64_t digit = static_cast<uint64_t>(remainder / divisor);
+    remainder %= divisor;
+    if (!quotient.empty() || digit != 0) {
+      quotient.push_back(static_cast<char>('0' + digit));
+    }
+  }
+  if (remainder * 2 >= divisor) {
+    // Round up
+    size_t pos = quotient.size();
+    while (pos > 0 && quotient[pos - 1] == '9') {
+      quotient[--pos] = '0';
+    }
+    if (pos == 0) {
+      quotient.insert(quotient.begin(), '1');
+    } else {
+      quotient[pos - 1]++;
+    }
+  }
+  if (quotient.size() <= static_cast<size_t>(result_scale)) {
+    quotient.insert(0, result_scale + 1 - quotient.size(), '0');
+  }
+  bool is_zero = (quotient.find_first_not_of('0') == std::string::npos);
+  if (result_scale > 0) {
+    quotient.insert(quotient.size() - result_scale, ".");
+  }
+  return (is_negative && !is_zero ? "-" : "") + quotient;
+}
+
+std::string Aggregator::GroupValueString(const std::string& key,
+                                         uint32_t n) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(
+                               key.data());
+  for (uint32_t i = 0; ; i++) {
+    bool is_null = (*p++ == 0);
+    uint32_t len = is_null ? 0 : ReadFromNB(p, 4);
+    if (!is_null) {
+      p += 4;
+    }
+    if (i == n) {
+      if (is_null) {
+        return "NULL";
+      }
+      return index_->GetPhysicalField(group_fields_[n])->column()->
+                 ValueToString(p, len);
+    }
+    p += len;
+  }
+}
+
+bool Aggregator::PrintGroups(const GroupTable& groups, uint64_t* group_no) {
+  // Print the groups in the order of their GROUP BY values
+  std::vector<const GroupTable::value_type*> sorted;
+  for (const auto& group : groups) {
+    sorted.push_back(&group);
+  }
+  auto compare = [this](const GroupTable::value_type* a,
+                        const GroupTable::value_type* b) {
+    const unsigned char* p[2] = {
+      reinterpret_cast<const unsigned char*>(a->first.data()),
+      reinterpret_cast<const unsigned char*>(b->first.data())};
+    for (uint32_t field_no : group_fields_) {
+      bool is_null[2] = {*p[0]++ == 0, *p[1]++ == 0};
+      if (is_null[0] || is_null[1]) {
+        if (is_null[0] != is_null[1]) {
+          return is_null[0];
+        }
+        continue;
+      }
+      uint32_t len[2] = {static_cast<uint32_t>(ReadFromNB(p[0], 4)),
+                         static_cast<uint32_t>(ReadFromNB(p[1], 4))};
+      int ret = index_->GetPhysicalField(field_no)->column()->CompareValue(
+                    p[0] + 4, len[0], p[1] + 4, len[1]);
+      if (ret != 0) {
+        return ret < 0;
+      }
+      p[0] += 4 + len[0];
+      p[1] += 4 + len[1];
+    }
+    return false;
+  };
+  std::sort(sorted.begin(), sorted.end(), compare);
+
+  char buf[128];
+  for (const auto* group : sorted) {
+    fprintf(stdout, "------------------------------------------"
+                    "------------------------------------------\n");
+    fprintf(stdout, "[GROUP %" PRIu64 "]\n", ++(*group_no));
+    for (uint32_t i = 0; i < group_fields_.size(); i++) {
+      Column* col = index_->GetPhysicalField(group_fields_[i])->column();
+      fprintf(stdout, "  %-24s: %s\n", col->name().c_str(),
+                      GroupValueString(group->first, i).c_str());
+    }
+    for (size_t a = 0; a < aggregates_.size(); a++) {
+      const AggregateSpec& agg = aggregates_[a];
+      const AggregateState& state = group->second[a];
+      std::string value = "NULL";
+      int scale = (agg.column == nullptr) ? 0 : agg.column->NumberScale();
+      switch (agg.func) {
+        case AGG_COUNT:
+          snprintf(buf, sizeof(buf), "%" PRIu64, state.count);
+          value = buf;
+          break;
+        case AGG_SUM:
+        case AGG_AVG: {
+          if (state.count == 0) {
+            break;
+          }
+          if (agg.exact) {
+            // Like MySQL, AVG() has 4 more decimal digits than its argument
+            value = (agg.func == AGG_SUM) ?
+                    DecimalSumToString(state.exact_sum, scale, 1, scale) :
+                    DecimalSumToString(state.exact_sum, scale, state.count,
+                                       scale + 4);
+            break;
+          }
+          long double result = state.sum;
+          if (agg.func == AGG_AVG) {
+            result /= state.count;
+            // Like MySQL, AVG() has 4 more decimal digits than its argument
+            scale = (scale < 0) ? scale : scale + 4;
+          }
+          if (scale < 0) {
+            value = FormatReal(static_cast<double>(result), 15);
+          } else {
+            snprintf(buf, sizeof(buf), "%.*Lf", scale, result);
+            value = buf;
+          }
+          break;
+        }
+        case AGG_MIN:
+        case AGG_MAX:
+          if (state.has_value) {
+            value = agg.column->ValueToString(
+                        reinterpret_cast<const unsigned char*>(
+                            state.value.data()),
+                        state.value.size());
+          }
+          break;
+      }
+      fprintf(stdout, "  %-24s: %s\n", agg.name.c_str(), value.c_str());
+    }
+  }
+  return true;
+}
+
+bool Aggregator::PrintResult() {
+  uint64_t group_no = 0;
+  bool spilled = false;
+  for (const auto& thread : threads_) {
+    spilled = spilled || !thread.spill_files.empty();
+  }
+  if (!spilled) {
+    GroupTable merged;
+    for (auto& thread : threads_) {
+      for (auto& group : thread.groups) {
+        auto iter = merged.find(group.first);
+        if (iter == merged.end()) {
+          merged.emplace(group.first, std::move(group.second));
+        } else {
+          MergeStates(&iter->second, group.second);
+        }
+      }
+      thread.groups.clear();
+    }
+    if (merged.empty() && group_fields_.empty()) {
+      // Without GROUP BY, there is one result even if no rows match
+      merged.emplace("", std::vector<AggregateState>(
+                             aggregates_.size(),
+                             AggregateState{0, 0, false, "", DecimalSum()}));
+    }
+    PrintGroups(merged, &group_no);
+  } else {
+    for (auto& thread : threads_) {
+      if (!thread.groups.empty() && !Spill(&thread)) {
+        return false;
+      }
+    }
+    // Each partition holds all the states of its groups
+    for (uint32_t p = 0; p < AGGREGATE_SPILL_PARTITIONS; p++) {
+      GroupTable merged;
+      for (auto& thread : threads_) {
+        if (!thread.spill_files.empty() &&
+            !ReadSpilled(thread.spill_files[p], &merged)) {
+          return false;
+        }
+      }
+      PrintGroups(merged, &group_no);
+    }
+  }
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Groups:                        %" PRIu64 "\n", group_no);
+  if (spilled) {
+    fprintf(stdout, "Spilled group entries:         %" PRIu64 " "
+                    "(groups are ordered within each of %u partitions)\n",
+                    n_spilled_groups_, AGGREGATE_SPILL_PARTITIONS);
+  }
+  return true;
+}
+
+/* ------ HistogramBuilder ------ */
+// Memory of the value buffers of all threads before they are spilled
+constexpr uint64_t HISTOGRAM_MEMORY_LIMIT = 256ULL << 20;
+// MySQL only keeps this many leading characters of string values
+constexpr uint32_t HISTOGRAM_MAX_COMPARE_LENGTH = 42;
+constexpr uint32_t HISTOGRAM_MAX_BUCKETS = 1024;
+
+/*
+ * An entry is the sort key of a value, the value and its number of
+ * occurrences, each string preceded by its 4-byte length.
+ */
+static void AppendHistogramEntry(std::string* buf, const char* key,
+                                 uint32_t key_len, const char* value,
+                                 uint32_t value_len, uint64_t count) {
+  buf->append(reinterpret_cast<const char*>(&key_len), sizeof(key_len));
+  buf->append(key, key_len);
+  buf->append(reinterpret_cast<const char*>(&value_len), sizeof(value_len));
+  buf->append(value, value_len);
+  buf->append(reinterpret_cast<const char*>(&count), sizeof(count));
+}
+
+struct HistogramEntry {
+  const char* key;
+  uint32_t key_len;
+  const char* value;
+  uint32_t value_len;
+  uint64_t count;
+};
+
+static HistogramEntry ReadHistogramEntry(const char* p) {
+  HistogramEntry entry;
+  memcpy(&entry.key_len, p, sizeof(entry.key_len));
+  entry.key = p + sizeof(entry.key_len);
+  p = entry.key + entry.key_len;
+  memcpy(&entry.value_len, p, sizeof(entry.value_len));
+  entry.value = p + sizeof(entry.value_len);
+  p = entry.value + entry.value_len;
+  memcpy(&entry.count, p, sizeof(entry.count));
+  return entry;
+}
+
+static int CompareHistogramKeys(const char* a, uint32_t a_len,
+                                const char* b, uint32_t b_len) {
+  int ret = memcmp(a, b, std::min(a_len, b_len));
+  if (ret != 0) {
+    return ret;
+  }
+  return (a_len < b_len) ? -1 : (a_len > b_len) ? 1 : 0;
+}
+
+static std::string Base64Encode(const std::string& data) {
+  static const char chars[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZ"
+                              "abcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string out;
+  size_t i = 0;
+  for (; i + 2 < data.size(); i += 3) {
+    uint32_t n = (static_cast<unsigned char>(data[i]) << 16) |
+                 (static_cast<unsigned char>(data[i + 1]) << 8) |
+                 static_cast<unsigned char>(data[i + 2]);
+    out.push_back(chars[(n >> 18) & 63]);
+    out.push_back(chars[(n >> 12) & 63]);
+    out.push_back(chars[(n >> 6) & 63]);
+    out.push_back(chars[n & 63]);
+  }
+  if (i < data.size()) {
+    uint32_t n = static_cast<unsigned char>(data[i]) << 16;
+    if (i + 1 < data.size()) {
+      n |= static_cast<unsigned char>(data[i + 1]) << 8;
+    }
+    out.push_back(chars[(n >> 18) & 63]);
+    out.push_back(chars[(n >> 12) & 63]);
+    out.push_back(i + 1 < data.size() ? chars[(n >> 6) & 63] : '=');
+    out.push_back('=');
+  }
+  return out;
+}
+
+HistogramBuilder* HistogramBuilder::CreateHistogramBuilder(
+    Index* index, const std::string& column, uint32_t n_buckets,
+    uint32_t n_threads) {
+  if (n_buckets == 0 || n_buckets > HISTOGRAM_MAX_BUCKETS) {
+    ninja_error("The number of buckets must be between 1 and %u",
+                HISTOGRAM_MAX_BUCKETS);
+    return nullptr;
+  }
+  uint32_t field_no = 0;
+  Column* col = index->GetPhysicalFieldByName(column, &field_no);
+  if (col == nullptr || col->IsSystemColumn() || col->IsSeHidden()) {
+    ninja_error("No column named %s was found", column.c_str());
+    return nullptr;
+  }
+  ValueType type;
+  if (!GetValueType(col, &type)) {
+    ninja_error("Histograms are not supported on column %s of type %s",
+                col->name().c_str(), col->FieldTypeString().c_str());
+    return nullptr;
+  }
+  // MySQL checks that the buckets are in the order of the collation
+  if (!CheckOrderSupported(col)) {
+    return nullptr;
+  }
+  HistogramBuilder* builder = new HistogramBuilder(index, col, field_no,
+                                                   type, n_buckets);
+  builder->threads_.resize(std::max(n_threads, 1U));
+  for (auto& thread : builder->threads_) {
+    thread.n_values = 0;
+    thread.n_nulls = 0;
+    thread.n_off_page = 0;
+  }
+  return builder;
+}
+
+HistogramBuilder::~HistogramBuilder() {
+  for (auto& thread : threads_) {
+    for (auto* file : thread.spill_files) {
+      fclose(file);
+    }
+  }
+}
+
+// The value types of MySQL histograms, as in their "data-type"
+bool HistogramBuilder::GetValueType(Column* column, ValueType* type) {
+  switch (Column::DDType2FieldType(column->type())) {
+    case Column::MYSQL_TYPE_TINY:
+    case Column::MYSQL_TYPE_SHORT:
+    case Column::MYSQL_TYPE_INT24:
+    case Column::MYSQL_TYPE_LONG:
+    case Column::MYSQL_TYPE_LONGLONG:
+      *type = column->IsUnsignedInt() ? VALUE_UINT : VALUE_INT;
+      return true;
+    case Column::MYSQL_TYPE_YEAR:
+      *type = VALUE_INT;
+      return true;
+    case Column::MYSQL_TYPE_BIT:
+      *type = VALUE_UINT;
+      return true;
+    case Column::MYSQL_TYPE_FLOAT:
+    case Column::MYSQL_TYPE_DOUBLE:
+      *type = VALUE_DOUBLE;
+      return true;
+    case Column::MYSQL_TYPE_NEWDECIMAL:
+      *type = VALUE_DECIMAL;
+      return true;
+    case Column::MYSQL_TYPE_DATETIME2:
+    case Column::MYSQL_TYPE_TIMESTAMP2:
+      *type = VALUE_DATETIME;
+      return true;
+    case Column::MYSQL_TYPE_NEWDATE:
+      *type = VALUE_DATE;
+      return true;
+    case Column::MYSQL_TYPE_TIME2:
+      *type = VALUE_TIME;
+      return true;
+    case Column::MYSQL_TYPE_VARCHAR:
+    case Column::MYSQL_TYPE_VAR_STRING:
+    case Column::MYSQL_TYPE_STRING:
+    case Column::MYSQL_TYPE_TINY_BLOB:
+    case Column::MYSQL_TYPE_MEDIUM_BLOB:
+    case Column::MYSQL_TYPE_LONG_BLOB:
+    case Column::MYSQL_TYPE_BLOB:
+      *type = VALUE_STRING;
+      return true;
+    case Column::MYSQL_TYPE_ENUM:
+      *type = VALUE_ENUM;
+      return true;
+    case Column::MYSQL_TYPE_SET:
+      *type = VALUE_SET;
+      return true;
+    default:
+      return false;
+  }
+}
+
+/*
+ * Bytes of the first HISTOGRAM_MAX_COMPARE_LENGTH characters of a string
+ * value, which are all MySQL keeps. Characters are counted by their lead
+ * bytes in UTF-8, and by the fixed width of other character sets. Other
+ * variable-width character sets are cut by bytes.
+ */
+uint32_t HistogramBuilder::HistogramPrefixLength(const unsigned char* data,
+                                                 uint32_t len,
+                                                 uint32_t* n_chars) {
+  auto iter = g_collation_map.find(static_cast<int>(column_->collation_id()));
+  uint32_t width = 1;
+  bool utf8 = false;
+  if (iter != g_collation_map.end()) {
+    utf8 = (iter->second.name.compare(0, 4, "utf8") == 0);
+    if (iter->second.min == iter->second.max) {
+      width = iter->second.min;
+    }
+  }
+  *n_chars = 0;
+  if (!utf8) {
+    uint32_t prefix_len = std::min(len, HISTOGRAM_MAX_COMPARE_LENGTH * width);
+    *n_chars = prefix_len / width;
+    return prefix_len;
+  }
+  for (uint32_t i = 0; i < len; i++) {
+    if ((data[i] & 0xC0) != 0x80) {
+      if (*n_chars == HISTOGRAM_MAX_COMPARE_LENGTH) {
+        return i;
+      }
+      (*n_chars)++;
+    }
+  }
+  return len;
+}
+
+bool HistogramBuilder::UpdateBatch(uint32_t thread_no,
+                                   const std::vector<Record*>& records) {
+  ThreadState* thread = &threads_[thread_no];
+  bool strip_spaces = (type_ == VALUE_STRING &&
+                       Column::DDType2FieldType(column_->type()) ==
+                       Column::MYSQL_TYPE_STRING &&
+                       column_->collation_id() != 63);
+  std::string key;
+  for (Record* record : records) {
+    if (record->IsDeleted()) {
+      continue;
+    }
+    const unsigned char* data = nullptr;
+    uint32_t len = 0;
+    bool is_external =
+        (record->GetField(field_no_, &data, &len) & REC_OFFS_EXTERNAL);
+    if (!record->GetFieldValue(field_no_, &data, &len)) {
+      thread->n_nulls++;
+      continue;
+    }
+    if (type_ == VALUE_STRING) {
+      if (strip_spaces) {
+        // CHAR values are read without their padding
+        while (len > 0 && data[len - 1] == ' ') {
+          len--;
+        }
+      }
+      uint32_t n_chars = 0;
+      len = HistogramPrefixLength(data, len, &n_chars);
+      if (is_external && n_chars < HISTOGRAM_MAX_COMPARE_LENGTH) {
+        // The rest of the prefix is off-page
+        thread->n_off_page++;
+        continue;
+      }
+    }
+    key.clear();
+    column_->AppendSortKey(data, len, &key);
+    thread->entries.push_back(thread->buf.size());
+    AppendHistogramEntry(&thread->buf, key.data(), key.size(),
+                         reinterpret_cast<const char*>(data), len, 1);
+    thread->n_values++;
+  }
+  if (thread->buf.size() + thread->entries.size() * sizeof(uint64_t) >
+      HISTOGRAM_MEMORY_LIMIT / threads_.size()) {
+    return Spill(thread);
+  }
+  return true;
+}
+
+/*
+ * Sorts the entries of a thread by their sort key, and rewrites its buffer
+ * in that order with one entry per distinct value.
+ */
+void HistogramBuilder::SortRun(ThreadState* thread) {
+  const char* buf = thread->buf.data();
+  std::sort(thread->entries.begin(), thread->entries.end(),
+            [buf](uint64_t a, uint64_t b) {
+              HistogramEntry a_entry = ReadHistogramEntry(buf + a);
+              HistogramEntry b_entry = ReadHistogramEntry(buf + b);
+              return CompareHistogramKeys(a_entry.key, a_entry.key_len,
+                                          b_entry.key, b_entry.key_len) < 0;
+            });
+  std::string sorted;
+  std::vector<uint64_t> entries;
+  for (size_t i = 0; i < thread->entries.size(); ) {
+    HistogramEntry entry = ReadHistogramEntry(buf + thread->entries[i]);
+    uint64_t count = 0;
+    for (; i < thread->entries.size(); i++) {
+      HistogramEntry next = ReadHistogramEntry(buf + thread->entries[i]);
+      if (CompareHistogramKeys(entry.key, entry.key_len,
+                               next.key, next.key_len) != 0) {
+        break;
+      }
+      count += next.count;
+    }
+    entries.push_back(sorted.size());
+    AppendHistogramEntry(&sorted, entry.key, entry.key_len,
+                         entry.value, entry.value_len, count);
+  }
+  thread->buf.swap(sorted);
+  thread->entries.swap(entries);
+}
+
+// Writes the sorted values of a thread to a new run file, and empties them
+bool HistogramBuilder::Spill(ThreadState* thread) {
+  SortRun(thread);
+  FILE* file = tmpfile();
+  if (file == nullptr) {
+    ninja_error("Failed to create a temporary file, error: %d(%s)",
+                errno, strerror(errno));
+    return false;
+  }
+  thread->spill_files.push_back(file);
+  if (fwrite(thread->buf.data(), 1, thread->buf.size(), file) !=
+      thread->buf.size() || fflush(file) != 0) {
+    ninja_error("Failed to spill values to disk, error: %d(%s)",
+                errno, strerror(errno));
+    return false;
+  }
+  thread->buf.clear();
+  thread->buf.shrink_to_fit();
+  thread->entries.clear();
+  thread->entries.shrink_to_fit();
+  return true;
+}
+
+uint64_t HistogramBuilder::n_values() const {
+  uint64_t n = 0;
+  for (const auto& thread : threads_) {
+    n += thread.n_values;
+  }
+  return n;
+}
+
+uint64_t HistogramBuilder::n_nulls() const {
+  uint64_t n = 0;
+  for (const auto& thread : threads_) {
+    n += thread.n_nulls;
+  }
+  return n;
+}
+
+uint64_t HistogramBuilder::n_off_page() const {
+  uint64_t n = 0;
+  for (const auto& thread : threads_) {
+    n += thread.n_off_page;
+  }
+  return n;
+}
+
+uint64_t HistogramBuilder::n_spilled_runs() const {
+  uint64_t n = 0;
+  for (const auto& thread : threads_) {
+    n += thread.spill_files.size();
+  }
+  return n;
+}
+
+// Whether str follows the JSON number grammar, e.g., not "nan" or "0x1F"
+static bool IsJSONNumber(const std::string& str) {
+  size_t pos = (!str.empty() && str[0] == '-') ? 1 : 0;
+  auto digits = [&]() {
+    size_t begin = pos;
+    while (pos < str.size() && isdigit(static_cast<unsigned char>(str[pos]))) {
+      pos++;
+    }
+    return pos - begin;
+  };
+  size_t n_int_digits = digits();
+  if (n_int_digits == 0 ||
+      (n_int_digits > 1 && str[pos - n_int_digits] == '0')) {
+    return false;
+  }
+  if (pos < str.size() && str[pos] == '.') {
+    pos++;
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  if (pos < str.size() && (str[pos] == 'e' || str[pos] == 'E')) {
+    pos++;
+    if (pos < str.size() && (str[pos] == '+' || str[pos] == '-')) {
+      pos++;
+    }
+    if (digits() == 0) {
+      return false;
+    }
+  }
+  return pos == str.size();
+}
+
+/*
+ * Numbers that JSON cannot represent, NaN, infinities and malformed
+ * DECIMAL values, are reported and fail instead of producing a histogram
+ * that MySQL rejects.
+ */
+bool HistogramBuilder::ValueToJSON(const std::string& value,
+                                   std::string* result) {
+  const unsigned char* data =
+      reinterpret_cast<const unsigned char*>(value.data());
+  uint32_t len = value.size();
+  rapidjson::StringBuffer json_buf;
+  rapidjson::Writer<rapidjson::StringBuffer> json(json_buf);
+  switch (type_) {
+    case VALUE_INT: {
+      long double number = 0;
+      column_->ValueToNumber(data, len, &number);
+      json.Int64(static_cast<int64_t>(number));
+      break;
+    }
+    case VALUE_UINT:
+    case VALUE_ENUM:
+    case VALUE_SET:
+      // Unsigned integers, BIT, ENUM and SET are stored big-endian
+      json.Uint64(ReadFromNB(data, len));
+      break;
+    case VALUE_DOUBLE: {
+      long double number = 0;
+      column_->ValueToNumber(data, len, &number);
+      if (!std::isfinite(number)) {
+        ninja_error("Column %s has the value %s, which a histogram cannot "
+                    "hold", column_->name().c_str(),
+                    column_->ValueToString(data, len).c_str());
+        return false;
+      }
+      json.Double(static_cast<double>(number));
+      break;
+    }
+    case VALUE_DECIMAL: {
+      std::string str;
+      if (!column_->ValueToDecimal(data, len, &str) || !IsJSONNumber(str)) {
+        ninja_error("Column %s has the malformed DECIMAL value %s",
+                    column_->name().c_str(),
+                    column_->ValueToString(data, len).c_str());
+        return false;
+      }
+      json.RawValue(str.c_str(), str.size(), rapidjson::kNumberType);
+      break;
+    }
+    case VALUE_DATETIME:
+    case VALUE_TIME: {
+      // Always with microseconds
+      std::string str = column_->ValueToString(data, len);
+      size_t dot = str.find('.');
+      if (dot == std::string::npos) {
+        str += ".000000";
+      } else {
+        str.append(6 - std::min<size_t>(6, str.size() - dot - 1), '0');
+      }
+      json.String(str.c_str(), str.size());
+      break;
+    }
+    case VALUE_DATE: {
+      std::string str = column_->ValueToString(data, len);
+      json.String(str.c_str(), str.size());
+      break;
+    }
+    case VALUE_STRING: {
+      std::string str = "base64:type254:" + Base64Encode(value);
+      json.String(str.c_str(), str.size());
+      break;
+    }
+  }
+  *result = json_buf.GetString();
+  return true;
+}
+
+/*
+ * Merges the sorted runs of all threads, in memory and on disk, into one
+ * stream of distinct values. The first n_buckets + 1 of them are kept, and
+ * if the stream ends before, each becomes a singleton bucket. Otherwise the
+ * values go to equi-height buckets, each closed once its cumulative count
+ * reaches its share of the non-NULL values.
+ */
+bool HistogramBuilder::BuildResult(std::string* result) {
+  std::vector<std::thread> sorters;
+  for (auto& thread : threads_) {
+    if (!thread.entries.empty()) {
+      sorters.emplace_back(SortRun, &thread);
+    }
+  }
+  for (auto& sorter : sorters) {
+    sorter.join();
+  }
+
+  struct RunCursor {
+    const char* pos;
+    const char* end;
+    FILE* file;
+    std::string key;
+    std::string value;
+    uint64_t count;
+    bool Next(bool* error) {
+      if (file == nullptr) {
+        if (pos >= end) {
+          return false;
+        }
+        HistogramEntry entry = ReadHistogramEntry(pos);
+        key.assign(entry.key, entry.key_len);
+        value.assign(entry.value, entry.value_len);
+        count = entry.count;
+        pos = entry.value + entry.value_len + sizeof(count);
+        return true;
+      }
+      uint32_t len = 0;
+      if (fread(&len, sizeof(len), 1, file) != 1) {
+        *error = (ferror(file) != 0);
+        return false;
+      }
+      key.resize(len);
+      bool ret = (fread(&key[0], 1, len, file) == len &&
+                  fread(&len, sizeof(len), 1, file) == 1);
+      value.resize(ret ? len : 0);
+      ret = ret && fread(&value[0], 1, len, file) == len &&
+            fread(&count, sizeof(count), 1, file) == 1;
+      *error = !ret;
+      return ret;
+    }
+  };
+  std::vector<RunCursor> cursors;
+  for (auto& thread : threads_) {
+    for (auto* file : thread.spill_files) {
+      rewind(file);
+      cursors.push_back({nullptr, nullptr, file, "", "", 0});
+    }
+    if (!thread.buf.empty()) {
+      cursors.push_back({thread.buf.data(),
+                         thread.buf.data() + thread.buf.size(),
+                         nullptr, "", "", 0});
+    }
+  }
+  bool error = false;
+  std::vector<size_t> heap;
+  auto greater = [&cursors](size_t a, size_t b) {
+    return CompareHistogramKeys(cursors[a].key.data(), cursors[a].key.size(),
+                                cursors[b].key.data(),
+                                cursors[b].key.size()) > 0;
+  };
+  for (size_t i = 0; i < cursors.size(); i++) {
+    if (cursors[i].Next(&error)) {
+      heap.push_back(i);
+    }
+  }
+  std::make_heap(heap.begin(), heap.end(), greater);
+
+  uint64_t n_values = this->n_values();
+  uint64_t n_rows = n_values + n_nulls();
+  struct Bucket {
+    std::string lower;
+    std::string upper;
+    uint64_t cumulative;
+    uint64_t n_distinct;
+  };
+  std::vector<Group> singletons;
+  std::vector<Bucket> buckets;
+  Bucket bucket = {"", "", 0, 0};
+  uint64_t cumulative = 0;
+  auto add_to_bucket = [&](const Group& group) {
+    if (bucket.n_distinct == 0) {
+      bucket.lower = group.value;
+    }
+    bucket.upper = group.value;
+    bucket.n_distinct++;
+    cumulative += group.count;
+    // Close the bucket once it reaches its share of the values
+    if (static_cast<long double>(cumulative) * n_buckets_ >=
+        static_cast<long double>(n_values) * (buckets.size() + 1)) {
+      bucket.cumulative = cumulative;
+      buckets.push_back(bucket);
+      bucket.n_distinct = 0;
+    }
+  };
+  n_distinct_ = 0;
+  Group group = {"", 0};
+  std::string group_key;
+  while (!heap.empty() || group.count > 0) {
+    RunCursor* cursor = nullptr;
+    if (!heap.empty()) {
+      std::pop_heap(heap.begin(), heap.end(), greater);
+      cursor = &cursors[heap.back()];
+      if (group.count > 0 && cursor->key == group_key) {
+        group.count += cursor->count;
+      }
+    }
+    if (cursor == nullptr || cursor->key != group_key || group.count == 0) {
+      if (group.count > 0) {
+        // The previous distinct value is complete
+        n_distinct_++;
+        if (buckets.empty() && bucket.n_distinct == 0 &&
+            singletons.size() <= n_buckets_) {
+          singletons.push_back(group);
+        } else {
+          add_to_bucket(group);
+        }
+        if (singletons.size() > n_buckets_) {
+          for (const auto& singleton : singletons) {
+            add_to_bucket(singleton);
+          }
+          singletons.clear();
+        }
+      }
+      if (cursor == nullptr) {
+        break;
+      }
+      group_key = cursor->key;
+      group.value = cursor->value;
+      group.count = cursor->count;
+    }
+    if (cursor->Next(&error)) {
+      std::push_heap(heap.begin(), heap.end(), greater);
+    } else {
+      heap.pop_back();
+    }
+  }
+  if (error) {
+    ninja_error("Failed to read the spilled values");
+    return false;
+  }
+
+  rapidjson::StringBuffer json_buf;
+  rapidjson::Writer<rapidjson::StringBuffer> json(json_buf);
+  std::string str;
+  json.StartObject();
+  json.Key("buckets");
+  json.StartArray();
+  if (buckets.empty()) {
+    histogram_type_ = "singleton";
+    cumulative = 0;
+    for (const auto& singleton : singletons) {
+      cumulative += singleton.count;
+      json.StartArray();
+      if (!ValueToJSON(singleton.value, &str)) {
+        return false;
+      }
+      json.RawValue(str.c_str(), str.size(), rapidjson::kStringType);
+      json.Double(static_cast<double>(cumulative) / n_rows);
+      json.EndArray();
+    }
+  } else {
+    histogram_type_ = "equi-height";
+    for (const auto& iter : buckets) {
+      json.StartArray();
+      if (!ValueToJSON(iter.lower, &str)) {
+        return false;
+      }
+      json.RawValue(str.c_str(), str.size(), rapidjson::kStringType);
+      if (!ValueToJSON(iter.upper, &str)) {
+        return false;
+      }
+      json.RawValue(str.c_str(), str.size(), rapidjson::kStringType);
+      json.Double(static_cast<double>(iter.cumulative) / n_rows);
+      json.Uint64(iter.n_distinct);
+      json.EndArray();
+    }
+  }
+  json.EndArray();
+  static const char* data_types[] = {
+    "int", "uint", "double", "decimal", "datetime", "date", "time",
+    "string", "enum", "set"
+  };
+  json.Key("data-type");
+  json.String(data_types[type_]);
+  json.Key("null-values");
+  json.Double(n_rows == 0 ? 0.0 :
+              static_cast<double>(n_rows - n_values) / n_rows);
+  json.Key("collation-id");
+  json.Uint64(type_ == VALUE_STRING ? column_->collation_id() : 8);
+  char now[64];
+  time_t seconds = time(nullptr);
+  struct tm tm_utc;
+  gmtime_r(&seconds, &tm_utc);
+  strftime(now, sizeof(now), "%Y-%m-%d %H:%M:%S.000000", &tm_utc);
+  json.Key("last-updated");
+  json.String(now);
+  json.Key("sampling-rate");
+  json.Double(1.0);
+  json.Key("histogram-type");
+  json.String(histogram_type_);
+  json.Key("number-of-buckets-specified");
+  json.Uint(n_buckets_);
+  json.EndObject();
+  *result = json_buf.GetString();
+  return true;
+}
+
+/* ------ RowExporter ------ */
+bool RowExporter::ParseFormat(const std::string& name, Format* format) {
+  if (name == "text") {
+    *format = FORMAT_TEXT;
+  } else if (name == "csv") {
+    *format = FORMAT_CSV;
+  } else if (name == "json") {
+    *format = FORMAT_JSON;
+  } else {
+    return false;
+  }
+  return true;
+}
+
+RowExporter* RowExporter::CreateRowExporter(Index* index, Format format,
+                                            bool with_changes) {
+  RowExporter* exporter = new RowExporter(index, format, with_changes);
+  for (auto* col : index->table()->columns()) {
+    if (col->is_virtual() || col->IsSystemColumn() || col->IsSeHidden() ||
+        col->IsColumnDropped()) {
+      continue;
+    }
+    for (uint32_t i = 0; i < index->GetNFields(); i++) {
+      if (index->GetPhysicalField(i)->column() == col) {
+        exporter->fields_.push_back(i);
+        break;
+      }
+    }
+  }
+  return exporter;
+}
+
+/*
+ * Writes a field the way LOAD DATA reads it with FIELDS TERMINATED BY ','
+ * OPTIONALLY ENCLOSED BY '"' and the default ESCAPED BY '\\': backslashes
+ * are doubled, so that a literal \N is not read as NULL, and NUL bytes are
+ * written as \0. Fields holding a comma, a quote or a line break are
+ * quoted, with the quotes doubled.
+ */
+static void WriteCSVValue(FILE* out, const std::string& value) {
+  static const char special[] = ",\"\r\n\\";
+  // The terminating NUL of special is searched for too
+  if (value.find_first_of(special, 0, sizeof(special)) == std::string::npos) {
+    fwrite(value.data(), 1, value.size(), out);
+    return;
+  }
+  bool quote = value.find_first_of(",\"\r\n") != std::string::npos;
+  std::string field;
+  field.reserve(value.size() + 8);
+  if (quote) {
+    field.push_back('"');
+  }
+  for (char c : value) {
+    if (c == '\\') {
+      field += "\\\\";
+    } else if (c == '\0') {
+      field += "\\0";
+    } else if (c == '"') {
+      field += "\"\"";
+    } else {
+      field.push_back(c);
+    }
+  }
+  if (quote) {
+    field.push_back('"');
+  }
+  fwrite(field.data(), 1, field.size(), out);
+}
+
+static void AppendUTF8(uint32_t code_point, std::string* out) {
+  if (code_point < 0x80) {
+    out->push_back(static_cast<char>(code_point));
+  } else if (code_point < 0x800) {
+    out->push_back(static_cast<char>(0xC0 | (code_point >> 6)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  } else {
+    out->push_back(static_cast<char>(0xE0 | (code_point >> 12)));
+    out->push_back(static_cast<char>(0x80 | ((code_point >> 6) & 0x3F)));
+    out->push_back(static_cast<char>(0x80 | (code_point & 0x3F)));
+  }
+}
+
+// Rejects overlong forms, surrogates and code points above U+10FFFF
+static bool IsValidUTF8(const std::string& str) {
+  const unsigned char* p = reinterpret_cast<const unsigned char*>(
+                               str.data());
+  const unsigned char* end = p + str.size();
+  while (p < end) {
+    uint32_t c = *p++;
+    if (c < 0x80) {
+      continue;
+    }
+    uint32_t n_extra = (c >= 0xF0) ? 3 : (c >= 0xE0) ? 2 : (c >= 0xC0) ? 1 : 0;
+    if (n_extra == 0 || c > 0xF4 || end - p < n_extra) {
+      return false;
+    }
+    c &= (0x3F >> n_extra);
+    for (uint32_t i = 0; i < n_extra; i++, p++) {
+      if ((*p & 0xC0) != 0x80) {
+        return false;
+      }
+      c = (c << 6) | (*p & 0x3F);
+    }
+    static const uint32_t min_code_point[4] = {0, 0x80, 0x800, 0x10000};
+    if (c < min_code_point[n_extra] || c > 0x10FFFF ||
+        (c >= 0xD800 && c <= 0xDFFF)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Converts a non-numeric value to UTF-8 for JSON. MySQL's latin1 is cp1252,
+ * whose 0x80-0x9F are mapped to their Unicode characters. Values of other
+ * character sets that are not valid UTF-8 are written as hex, like binary
+ * values.
+ */
+static std::string ValueToJSONText(const Column* col,
+                                   const std::string& value) {
+  static const uint16_t cp1252_80_9f[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+  };
+  // Values other than strings are ASCII, so transcoding leaves them as is
+  if (col->CollationName().compare(0, 7, "latin1_") == 0) {
+    std::string utf8;
+    for (unsigned char c : value) {
+      AppendUTF8((c >= 0x80 && c < 0xA0) ? cp1252_80_9f[c - 0x80] : c,
+                 &utf8);
+    }
+    return utf8;
+  }
+  if (IsValidUTF8(value)) {
+    return value;
+  }
+  return BytesToHex(reinterpret_cast<const unsigned char*>(value.data()),
+                    value.size());
+}
+
+void RowExporter::WriteHeader(FILE* out) {
+  if (format_ != FORMAT_CSV) {
+    return;
+  }
+  const char* sep = "";
+  if (with_changes_) {
+    fputs("_op,_trx_id", out);
+    sep = ",";
+  }
+  for (uint32_t field_no : fields_) {
+    fputs(sep, out);
+    WriteCSVValue(out, index_->GetPhysicalField(field_no)->column()->name());
+    sep = ",";
+  }
+  fputc('\n', out);
+}
+
+/*
+ * NULL is written as \N in CSV (as LOAD DATA expects) and as null in JSON.
+ * Numbers are written unquoted in JSON, and other values as UTF-8 strings.
+ */
+void RowExporter::WriteRecord(FILE* out, Record* record, bool is_delete,
+                              uint64_t trx_id) {
+  const char* op = is_delete ? "delete" : "upsert";
+  rapidjson::StringBuffer json_buf;
+  rapidjson::Writer<rapidjson::StringBuffer> json(json_buf);
+  switch (format_) {
+    case FORMAT_TEXT: {
+      const unsigned char* rec = record->rec();
+      fprintf(out, "------------------------------------------"
+                   "------------------------------------------\n");
+      fprintf(out, "[%s] Page: %u, Offset: %u\n",
+                   with_changes_ ? (is_delete ? "DELETE" : "UPSERT") : "ROW",
+                   ReadFrom4B(page_align(rec) + FIL_PAGE_OFFSET),
+                   page_offset(rec));
+      if (with_changes_) {
+        fprintf(out, "  %-24s: %" PRIu64 "\n", "DB_TRX_ID", trx_id);
+      }
+      break;
+    }
+    case FORMAT_CSV:
+      if (with_changes_) {
+        fprintf(out, "%s,%" PRIu64 ",", op, trx_id);
+      }
+      break;
+    case FORMAT_JSON:
+      json.StartObject();
+      if (with_changes_) {
+        json.Key("_op");
+        json.String(op);
+        json.Key("_trx_id");
+        json.Uint64(trx_id);
+      }
+      break;
+  }
+
+  std::string raw;
+  std::string value;
+  std::vector<const char*> truncated_cols;
+  for (size_t i = 0; i < fields_.size(); i++) {
+    Column* col = index_->GetPhysicalField(fields_[i])->column();
+    bool truncated = false;
+    bool is_null = !record->GetFullFieldValue(fields_[i], &raw, &truncated);
+    if (!is_null) {
+      value = col->ValueToString(
+                  reinterpret_cast<const unsigned char*>(raw.data()),
+                  raw.size());
+    }
+    if (truncated) {
+      n_truncated_++;
+      truncated_cols.push_back(col->name().c_str());
+      ninja_warn("Failed to read the off-page value of column %s of the "
+                 "record at page %u, offset %u, only its local prefix "
+                 "is exported", col->name().c_str(),
+                 ReadFrom4B(page_align(record->rec()) + FIL_PAGE_OFFSET),
+                 page_offset(record->rec()));
+    }
+    switch (format_) {
+      case FORMAT_TEXT:
+        fprintf(out, "  %-24s: %s%s\n", col->name().c_str(),
+                     is_null ? "NULL" : value.c_str(),
+                     truncated ? " [TRUNCATED]" : "");
+        break;
+      case FORMAT_CSV:
+        if (i > 0) {
+          fputc(',', out);
+        }
+        if (is_null) {
+          fputs("\\N", out);
+        } else {
+          WriteCSVValue(out, value);
+        }
+        break;
+      case FORMAT_JSON:
+        json.Key(col->name().c_str());
+        if (is_null) {
+          json.Null();
+          break;
+        }
+        if (col->IsNumeric()) {
+          // Exact numbers as decimal text (YEAR 0 is 0, not 0000), others
+          // only if valid, e.g., not NaN or a malformed DECIMAL
+          std::string number;
+          if (!col->ValueToDecimal(
+                   reinterpret_cast<const unsigned char*>(raw.data()),
+                   raw.size(), &number)) {
+            number = value;
+          }
+          if (IsJSONNumber(number)) {
+            json.RawValue(number.c_str(), number.size(),
+                          rapidjson::kNumberType);
+            break;
+          }
+        }
+        value = ValueToJSONText(col, value);
+        json.String(value.c_str(), value.size());
+        break;
+    }
+  }
+
+  if (format_ == FORMAT_CSV) {
+    fputc('\n', out);
+  } else if (format_ == FORMAT_JSON) {
+    if (!truncated_cols.empty()) {
+      json.Key("_truncated");
+      json.StartArray();
+      for (const char* name : truncated_cols) {
+        json.String(name);
+      }
+      json.EndArray();
+    }
+    json.EndObject();
+    fprintf(out, "%s\n", json_buf.GetString());
+  }
+}
+
+/* ------ Ninja ------ */
+static bool ValidateSDI(const rapidjson::Document& doc) {
+  bool ret = true;
+  if (!doc.HasMember("dd_object_type") ||
+      !doc["dd_object_type"].IsString() ||
+      (std::string(doc["dd_object_type"].GetString()) != "Table" &&
+      (std::string(doc["dd_object_type"].GetString()) != "Tablespace")) ||
+      !doc.HasMember("dd_object") ||
+      !doc["dd_object"].IsObject()) {
+    ret = false;
+  }
+
+  if (!doc.HasMember("mysqld_version_id") ||
+      !doc["mysqld_version_id"].IsUint() ||
+      !doc.HasMember("dd_version") ||
+      !doc["dd_version"].IsUint() ||
+      !doc.HasMember("sdi_version") ||
+      !doc["sdi_version"].IsUint()) {
+    ret = false;
+  }
+  return ret;
+}
+
+const char* ibdNinja::g_version_ = "1.0.0";
+
+void ibdNinja::PrintName() {
+  fprintf(stdout,
+"|--------------------------------------------------------------------------------------------------------------|\n"
+"|    _      _                         _   _           _      _                              _                  |\n"
+"|   (_)    (_)                       (_) (_) _       (_)    (_)                            (_)                 |\n"
+"| _  _     (_) _  _  _       _  _  _ (_) (_)(_)_     (_)  _  _      _  _  _  _           _  _     _  _  _      |\n"
+"|(_)(_)    (_)(_)(_)(_)_   _(_)(_)(_)(_) (_)  (_)_   (_) (_)(_)    (_)(_)(_)(_)_        (_)(_)   (_)(_)(_) _   |\n"
+"|   (_)    (_)        (_) (_)        (_) (_)    (_)_ (_)    (_)    (_)        (_)          (_)    _  _  _ (_)  |\n"
+"|   (_)    (_)        (_) (_)        (_) (_)      (_)(_)    (_)    (_)        (_)          (_)  _(_)(_)(_)(_)  |\n"
+"| _ (_) _  (_) _  _  _(_) (_)_  _  _ (_) (_)         (_)  _ (_) _  (_)        (_)          (_) (_)_  _  _ (_)_ |\n"
+"|(_)(_)(_) (_)(_)(_)(_)     (_)(_)(_)(_) (_)         (_) (_)(_)(_) (_)        (_)  _      _(_)   (_)(_)(_)  (_)|\n"
+"|                                                                                 (_)_  _(_)                   |\n"
+"|                                                                                   (_)(_)                     |\n"
+"|--------------------------------------------------------------------------------------------------------------|\n");
+}
+
+ibdNinja* ibdNinja::CreateNinja(const char* ibd_filename, FILE* info_out) {
+  unsigned char buf[UNIV_PAGE_SIZE_MAX];
+  memset(buf, 0, UNIV_PAGE_SIZE_MAX);
+  struct stat stat_info;
+  if (stat(ibd_filename, &stat_info) != 0) {
+    ninja_error("Failed to get file stats: %s, error: %d(%s)",
+            ibd_filename, errno, strerror(errno));
+    return nullptr;
+  }
+  uint64_t size = stat_info.st_size;
+  g_fd = open(ibd_filename, O_RDONLY);
+  if (g_fd == -1) {
+    ninja_error("Failed to open file: %s, error: %d(%s)",
+            ibd_filename, errno, strerror(errno));
+    close(g_fd);
+    return nullptr;
+  }
+  if (size < UNIV_ZIP_SIZE_MIN) {
+    ninja_error("The file is too small to be a valid ibd file");
+    close(g_fd);
+    return nullptr;
+  }
+  ssize_t bytes = read(g_fd, buf, UNIV_ZIP_SIZE_MIN);
+  if (bytes != UNIV_ZIP_SIZE_MIN) {
+    ninja_error("Failed to read file header: %s, error: %d(%s)",
+            ibd_filename, errno, strerror(errno));
+    close(g_fd);
+    return nullptr;
+  }
+  uint32_t space_id = ReadFrom4B(buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
+  uint32_t first_page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
+  uint32_t flags = FSPHeaderGetFlags(buf);
+  bool is_valid_flags = FSPFlagsIsValid(flags);
+  uint32_t page_size = 0;
+  if (is_valid_flags) {
+    uint32_t ssize = FSP_FLAGS_GET_PAGE_SSIZE(flags);
+    if (ssize == 0) {
+      page_size = UNIV_PAGE_SIZE_ORIG;
+    } else {
+      page_size = ((UNIV_ZIP_SIZE_MIN >> 1) << ssize);
+    }
+    g_page_size_shift = PageSizeValidate(page_size);
+  }
+  if (!is_valid_flags || g_page_size_shift == 0) {
+    ninja_error("Found corruption on page 0 of file %s",
+            ibd_filename);
+    close(g_fd);
+    return nullptr;
+  }
+
+  g_page_logical_size = page_size;
+
+  assert(g_page_logical_size <= UNIV_PAGE_SIZE_MAX);
+  assert(g_page_logical_size <= (1 << PAGE_SIZE_T_SIZE_BITS));
+
+  uint32_t ssize = FSP_FLAGS_GET_ZIP_SSIZE(flags);
+
+  if (ssize == 0) {
+    g_page_compressed = false;
+    g_page_physical_size = g_page_logical_size;
+  } else {
+    g_page_compressed = true;
+
+    g_page_physical_size = ((UNIV_ZIP_SIZE_MIN >> 1) << ssize);
+
+    assert(g_page_physical_size <= UNIV_ZIP_SIZE_MAX);
+    assert(g_page_physical_size <= (1 << PAGE_SIZE_T_SIZE_BITS));
+  }
+  uint32_t n_pages = size / g_page_physical_size;
+
+  uint32_t post_antelope = FSP_FLAGS_GET_POST_ANTELOPE(flags);
+  uint32_t atomic_blobs = FSP_FLAGS_HAS_ATOMIC_BLOBS(flags);
+  uint32_t has_data_dir = FSP_FLAGS_HAS_DATA_DIR(flags);
+  uint32_t shared = FSP_FLAGS_GET_SHARED(flags);
+  uint32_t temporary = FSP_FLAGS_GET_TEMPORARY(flags);
+  uint32_t encryption = FSP_FLAGS_GET_ENCRYPTION(flags);
+  uint32_t has_sdi = FSP_FLAGS_HAS_SDI(flags);
+
+  bytes = ReadPage(0, buf);
+  if (bytes == -1) {
+    ninja_error("Failed to read file header: %s, error: %d(%s)",
+            ibd_filename, errno, strerror(errno));
+    close(g_fd);
+    return nullptr;
+  }
+  uint32_t sdi_offset = XDES_ARR_OFFSET +
+                    XDES_SIZE * (g_page_physical_size / FSP_EXTENT_SIZE) +
+                    INFO_MAX_SIZE;
+  assert(sdi_offset + 4 < bytes);
+  uint32_t sdi_root = ReadFrom4B(buf + sdi_offset + 4);
+  if (!has_sdi) {
+    ninja_warn("FSP doesn't have SDI flags... "
+               "Attempting to parse the SDI root page %u directly anyway.",
+               sdi_root);
+  }
+  fprintf(info_out, "=========================================="
+                  "==========================================\n");
+  fprintf(info_out, "|  FILE INFORMATION                       "
+                  "                                         |\n");
+  fprintf(info_out, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(info_out, "    File name:             %s\n", ibd_filename);
+  fprintf(info_out, "    File size:             %" PRIu64 " B\n", size);
+  fprintf(info_out, "    Space id:              %u\n", space_id);
+  fprintf(info_out, "    Page logical size:     %u B\n", g_page_logical_size);
+  fprintf(info_out, "    Page physical size:    %u B\n", g_page_physical_size);
+  fprintf(info_out, "    Total number of pages: %u\n", n_pages);
+  fprintf(info_out, "    Is compressed page?    %u\n", g_page_compressed);
+  fprintf(info_out, "    First page number:     %u\n", first_page_no);
+  fprintf(info_out, "    SDI root page number:  %u\n", sdi_root);
+  fprintf(info_out, "    Post antelop:          %u\n", post_antelope);
+  fprintf(info_out, "    Atomic blobs:          %u\n", atomic_blobs);
+  fprintf(info_out, "    Has data dir:          %u\n", has_data_dir);
+  fprintf(info_out, "    Shared:                %u\n", shared);
+  fprintf(info_out, "    Temporary:             %u\n", temporary);
+  fprintf(info_out, "    Encryption:            %u\n", encryption);
+  fprintf(info_out, "------------------------------------------"
+                  "------------------------------------------\n");
+
+  if (g_page_compressed) {
+    ninja_error("Parsing of compressed table/tablespaces is "
+                "not yet supported.");
+    return nullptr;
+  }
+  if (encryption) {
+    ninja_error("Parsing of encrpted space is not yet supported");
+    return nullptr;
+  }
+  if (temporary) {
+    ninja_error("Parsing of temporary space is not yet supported");
+    return nullptr;
+  }
+
+  /* DEBUG
+  fprintf(info_out, "[ibdNinja]: Loading SDI...\n"
+                  "            1. Traversaling down to the "
+                  "leafmost leaf page\n");
+  */
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf_align = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  if (ReadPage(sdi_root, buf_align) != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+            sdi_root, errno, strerror(errno));
+    return nullptr;
+  }
+  uint64_t sdi_root_lsn = ReadFrom8B(buf_align + FIL_PAGE_LSN);
+  uint32_t leaf_page_no = 0;
+  bool res = SDIToLeftmostLeaf(buf_align, sdi_root, &leaf_page_no);
+  if (!res) {
+    return nullptr;
+  }
+
+  /* DEBUG
+  fprintf(info_out, "            2. Parsing SDI records and loading tables:\n");
+  */
+  unsigned char* current_rec = SDIGetFirstUserRec(buf_align,
+                                                  g_page_physical_size);
+  if (current_rec == nullptr) {
+    return nullptr;
+  }
+  ibdNinja* ninja = new ibdNinja(n_pages);
+  ninja->space_id_ = space_id;
+  ninja->ibd_filename_ = ibd_filename;
+  ninja->sdi_root_lsn_ = sdi_root_lsn;
+  bool corrupt = false;
+  uint64_t sdi_id = 0;
+  uint64_t sdi_type = 0;
+  uint64_t n_sdi_tables = 0;
+  uLong checksum = crc32(0L, Z_NULL, 0);
+  while (current_rec != nullptr && !corrupt) {
+    SDIRecord record;
+    record.page_no = ReadFrom4B(buf_align + FIL_PAGE_OFFSET);
+    record.rec_offset = static_cast<uint32_t>(current_rec - buf_align);
+    record.loaded = false;
+    record.ids_known = false;
+    // The records stay in their pages, only their headers are read
+    uint64_t comp_len = 0;
+    bool ret = SDIParseRec(current_rec, &sdi_type, &sdi_id, SDIChunkVisitor(),
+                           &comp_len, &record.uncomp_len);
+    if (ret == false) {
+      corrupt = true;
+      break;
+    }
+    auto res = ninja->sdi_records_.insert({{sdi_type, sdi_id}, record});
+    if (!res.second) {
+      ninja_warn("Duplicate SDI record (type %" PRIu64 ", id %" PRIu64 "), "
+                 "skipping it", sdi_type, sdi_id);
+    } else {
+      // Any change of a record, including its blob pages, changes the LSN
+      // of its leaf page, so the data itself is not checksummed
+      uint64_t page_lsn = ReadFrom8B(buf_align + FIL_PAGE_LSN);
+      const uint64_t fields[] = {sdi_type, sdi_id, comp_len,
+                                 record.uncomp_len, page_lsn};
+      checksum = crc32(checksum, reinterpret_cast<const Bytef*>(fields),
+                       sizeof(fields));
+      if (sdi_type == SDI_TYPE_TABLE) {
+        n_sdi_tables++;
+      }
+    }
+
+    current_rec = SDIGetNextRec(current_rec, buf_align,
+                            g_page_physical_size, &corrupt);
+  }
+  if (corrupt) {
+    delete ninja;
+    return nullptr;
+  }
+  ninja->sdi_checksum_ = checksum;
+  fprintf(info_out, "[ibdNinja]: Found %5lu tables in %5lu SDI records, "
+                  "loading them on demand.\n",
+          n_sdi_tables, ninja->sdi_records_.size());
+  fprintf(info_out, "=========================================="
+                  "==========================================\n\n");
+  return ninja;
+}
+
+// Names may contain '.', so schema and table are separated by a NUL
+static std::string QualifiedName(const std::string& db_name,
+                                 const std::string& table_name) {
+  std::string name(db_name);
+  name.push_back('\0');
+  name.append(table_name);
+  return name;
+}
+
+void ibdNinja::AddTable(Table* table) {
+  all_tables_.push_back(table);
+  if (!table->IsTableSupported()) {
+    ninja_warn("Skipping loading table '%s.%s', Reason: '%s'",
+               table->schema_ref().c_str(), table->name().c_str(),
+               table->UnsupportedReason().c_str());
+    return;
+  }
+  tables_.insert({table->se_private_id(), table});
+  table_ids_.insert({table->se_private_id(), table});
+  table_names_.insert({QualifiedName(table->schema_ref(), table->name()),
+                       table});
+  for (auto iter : table->indexes()) {
+    if (!iter->IsIndexSupported()) {
+      ninja_warn("Skipping loading index '%s' of table '%s.%s', "
+                 "Reason: '%s'\n",
+                 iter->name().c_str(),
+                 table->schema_ref().c_str(), table->name().c_str(),
+                 iter->UnsupportedReason().c_str());
+      continue;
+    }
+    uint64_t index_id = 0;
+    assert(iter->se_private_data().Exists("id"));
+    iter->se_private_data().Get("id", &index_id);
+    indexes_.insert({index_id, iter});
+    index_ids_.insert({index_id, iter});
+  }
+}
+
+bool ibdNinja::SDIToLeftmostLeaf(unsigned char* buf, uint32_t sdi_root,
+                                 uint32_t* leaf_page_no) {
+  uint32_t bytes = ReadPage(sdi_root, buf);
+  if (bytes != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+            sdi_root, errno, strerror(errno));
+    return false;
+  }
+  uint32_t page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
+  uint32_t n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
+  if (n_of_recs == 0) {
+    ninja_warn("No SDI is found in this file, "
+               "it might be from an older MySQL version.");
+    ninja_warn("ibdNinja currently supports MySQL 8.0.16 to 8.0.40.");
+    return false;
+  }
+
+  uint32_t curr_page_no = sdi_root;
+  unsigned char rec_type_byte;
+  unsigned char rec_type;
+  /* DEBUG
+  fprintf(stdout, "              Level %u: page %u\n",
+                  page_level, curr_page_no);
+  */
+  while (page_level != 0) {
+    rec_type_byte = *(buf + PAGE_NEW_INFIMUM - REC_OFF_TYPE);
+
+    rec_type = rec_type_byte & 0x7;
+
+    if (rec_type != REC_STATUS_INFIMUM) {
+      ninja_error("Failed to get INFIMUM from page: %u", curr_page_no);
+      break;
+    }
+
+    uint32_t next_rec_off_t =
+        ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
+
+    uint32_t child_page_no =
+        ReadFrom4B(buf + PAGE_NEW_INFIMUM + next_rec_off_t +
+                         REC_DATA_TYPE_LEN + REC_DATA_ID_LEN);
+
+    if (child_page_no < SDI_BLOB_ALLOWED) {
+      ninja_error("Failed to get INFIMUM from page: %u", child_page_no);
+      return false;
+    }
+
+    uint64_t curr_page_level = page_level;
+
+    bytes = ReadPage(child_page_no, buf);
+    if (bytes != g_page_physical_size) {
+      ninja_error("Failed to read page: %u, error: %d(%s)",
+              child_page_no, errno, strerror(errno));
+      return false;
+    }
+    page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
+    n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
+
+    if (page_level != curr_page_level - 1) {
+      break;
+    }
+    curr_page_no = child_page_no;
+    /* DEBUG
+    fprintf(stdout, "              Level %u: page %u\n",
+                    page_level, curr_page_no);
+    */
+  }
+
+  if (page_level != 0) {
+    ninja_error("Failed to find the leftmost page. "
+                "The page may be compressed or corrupted\n");
+
+    return false;
+  }
+  *leaf_page_no = curr_page_no;
+  return true;
+}
+
+unsigned char* ibdNinja::SDIGetFirstUserRec(unsigned char* buf,
+                                            uint32_t buf_len) {
+  uint32_t next_rec_off_t =
+            ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
+
+  assert(PAGE_NEW_INFIMUM + next_rec_off_t != PAGE_NEW_SUPREMUM);
+
+  if (next_rec_off_t > buf_len) {
+    assert(0);
+    return (nullptr);
+  }
+
+  if (memcmp(buf + PAGE_NEW_INFIMUM, "infimum", strlen("infimum")) != 0) {
+    ninja_error("Found corrupt INFIMUM");
+    return nullptr;
+  }
+
+  unsigned char* current_rec = buf + PAGE_NEW_INFIMUM + next_rec_off_t;
+
+  assert(static_cast<uint32_t>(current_rec - buf) <= buf_len);
+
+  bool is_comp = PageIsCompact(buf);
+
+  // TODO(Zhao): Support redundant row format
+  assert(is_comp);
+  /* record is delete marked, get next record */
+  if (RecGetDeletedFlag(current_rec, is_comp) != 0) {
+    bool corrupt;
+    current_rec =
+        SDIGetNextRec(current_rec, buf, buf_len, &corrupt);
+    if (corrupt) {
+      return nullptr;
+    }
+  }
+
+  return current_rec;
+}
+
+unsigned char* ibdNinja::SDIGetNextRec(unsigned char* current_rec,
+                                       unsigned char* buf,
+                                       uint32_t buf_len,
+                                       bool* corrupt) {
+  *corrupt = false;
+  uint32_t page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
+  bool is_comp = PageIsCompact(buf);
+  uint32_t next_rec_offset = RecGetNextOffs(current_rec, is_comp);
+
+  if (next_rec_offset == 0) {
+    ninja_error("Record is corrupt");
+    *corrupt = true;
+    return nullptr;
+  }
+
+  unsigned char* next_rec = buf + next_rec_offset;
+
+  assert(static_cast<uint32_t>(next_rec - buf) <= buf_len);
+
+  if (RecGetDeletedFlag(next_rec, is_comp) != 0) {
+    unsigned char* curr_rec = next_rec;
+    return SDIGetNextRec(curr_rec, buf, buf_len, corrupt);
+  }
+
+  if (RecGetType(next_rec) == REC_STATUS_SUPREMUM) {
+    if (memcmp(next_rec, "supremum", strlen("supremum")) != 0) {
+      ninja_error("Found corrupt SUPREMUM on page %u", page_no);
+      *corrupt = false;
+      return nullptr;
+    }
+
+    uint32_t supremum_next_rec_off = ReadFrom2B(next_rec - REC_OFF_NEXT);
+
+    if (supremum_next_rec_off != 0) {
+      ninja_error("Found corrupt next of SUPREMUM on page %u", page_no);
+      *corrupt = false;
+      return nullptr;
+    }
+
+    uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+
+    if (next_page_no == FIL_NULL) {
+      *corrupt = false;
+      return nullptr;
+    }
+
+    uint32_t bytes = ReadPage(next_page_no, buf);
+    if (bytes != g_page_physical_size) {
+      ninja_error("Failed to read page: %u, error: %d(%s)",
+              next_page_no, errno, strerror(errno));
+      *corrupt = true;
+      return nullptr;
+    }
+
+    uint16_t page_type = PageGetType(buf);
+
+    if (page_type != FIL_PAGE_SDI) {
+      ninja_error("Unexpected page type: %u (%u)",
+              page_type, FIL_PAGE_SDI);
+      *corrupt = true;
+      return nullptr;
+    }
+
+    next_rec = SDIGetFirstUserRec(buf, buf_len);
+  }
+
+  *corrupt = false;
+
+  return next_rec;
+}
+
+bool ibdNinja::SDIParseRec(unsigned char* rec,
+                        uint64_t* sdi_type, uint64_t* sdi_id,
+                        const SDIChunkVisitor& visitor,
+                        uint64_t* comp_len, uint32_t* uncomp_len) {
+  if (RecIsInfimum(rec) || RecIsSupremum(rec)) {
+    return false;
+  }
+
+  *sdi_type = ReadFrom4B(rec + REC_OFF_DATA_TYPE);
+  *sdi_id = ReadFrom8B(rec + REC_OFF_DATA_ID);
+  uint32_t sdi_uncomp_len = ReadFrom4B(rec + REC_OFF_DATA_UNCOMP_LEN);
+  uint32_t sdi_comp_len = ReadFrom4B(rec + REC_OFF_DATA_COMP_LEN);
+
+  unsigned rec_data_len_partial = *(rec - REC_MIN_HEADER_SIZE - 1);
+
+  uint64_t rec_data_length;
+  bool is_rec_data_external = false;
+  uint32_t rec_data_in_page_len = 0;
+
+  if (rec_data_len_partial & 0x80) {
+    rec_data_in_page_len = (rec_data_len_partial & 0x3f) << 8;
+    if (rec_data_len_partial & 0x40) {
+      is_rec_data_external = true;
+      rec_data_length =
+          ReadFrom8B(rec + REC_OFF_DATA_VARCHAR + rec_data_in_page_len +
+                           BTR_EXTERN_LEN);
+
+      rec_data_length += rec_data_in_page_len;
+    } else {
+      rec_data_length = *(rec - REC_MIN_HEADER_SIZE - 2);
+      rec_data_length += rec_data_in_page_len;
+    }
+  } else {
+    rec_data_length = rec_data_len_partial;
+  }
+
+  if (rec_data_length != sdi_comp_len) {
+    /* Record Corruption */
+    ninja_error("SDI record corruption");
+    return false;
+  }
+
+  unsigned char* rec_data_origin = rec + REC_OFF_DATA_VARCHAR;
+
+  if (!visitor) {
+    // Only the header is needed, the data and its blob pages are not read
+  } else if (is_rec_data_external) {
+    assert(rec_data_in_page_len == 0 ||
+          rec_data_in_page_len == REC_ANTELOPE_MAX_INDEX_COL_LEN);
+
+    if (rec_data_in_page_len != 0 &&
+        !visitor(rec_data_origin, rec_data_in_page_len)) {
+      return false;
+    }
+
+    /* Visit the off-page blob-pages */
+    uint32_t first_blob_page_no =
+        ReadFrom4B(rec + REC_OFF_DATA_VARCHAR + rec_data_in_page_len +
+                         BTR_EXTERN_PAGE_NO);
+
+    if (g_page_compressed) {
+      // TODO(Zhao): Support compressed page
+    } else {
+      uint32_t n_ext_pages = 0;
+      bool error = false;
+      uint64_t blob_len_retrieved = SDIFetchUncompBlob(
+          first_blob_page_no, rec_data_length - rec_data_in_page_len,
+          visitor, &n_ext_pages, &error);
+      if (error ||
+          rec_data_in_page_len + blob_len_retrieved != rec_data_length) {
+        return false;
+      }
+    }
+  } else if (!visitor(rec_data_origin,
+                      static_cast<uint32_t>(rec_data_length))) {
+    return false;
+  }
+
+  *comp_len = sdi_comp_len;
+  *uncomp_len = sdi_uncomp_len;
+
+  return true;
+}
+
+/*
+ * Inflates an SDI record into context->json, feeding zlib directly from the
+ * leaf and blob page buffers.
+ */
+bool ibdNinja::SDIInflate(const SDIRecord& record, SDIParseContext* context) {
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  if (ReadPage(record.page_no, buf) != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+            record.page_no, errno, strerror(errno));
+    return false;
+  }
+
+  context->json.resize(record.uncomp_len + 1);
+  z_stream stream;
+  memset(&stream, 0, sizeof(stream));
+  int ret = inflateInit(&stream);
+  if (ret != Z_OK) {
+    ninja_error("Failed to uncompress SDI record, error: %d", ret);
+    return false;
+  }
+  stream.next_out = reinterpret_cast<Bytef*>(context->json.data());
+  stream.avail_out = record.uncomp_len;
+  uint64_t sdi_type = 0;
+  uint64_t sdi_id = 0;
+  uint64_t comp_len = 0;
+  uint32_t uncomp_len = 0;
+  bool read = SDIParseRec(buf + record.rec_offset, &sdi_type, &sdi_id,
+                          [&stream, &ret](const unsigned char* chunk,
+                                          uint32_t len) {
+                            if (ret == Z_STREAM_END) {
+                              return len == 0;
+                            }
+                            stream.next_in = const_cast<Bytef*>(chunk);
+                            stream.avail_in = len;
+                            ret = inflate(&stream, Z_NO_FLUSH);
+                            return ret == Z_OK || ret == Z_STREAM_END;
+                          },
+                          &comp_len, &uncomp_len);
+  bool complete = (read && ret == Z_STREAM_END &&
+                   stream.total_out == record.uncomp_len);
+  inflateEnd(&stream);
+  if (!complete) {
+    ninja_error("Failed to uncompress SDI record, error: %d", ret);
+    return false;
+  }
+  context->json[record.uncomp_len] = '\0';
+  return true;
+}
+
+static void SerializeJSONValue(const rapidjson::Value& value,
+                               std::string* out);
+
+/*
+ * Parses the SDI JSON in context->json in situ and builds its table. The
+ * document is also serialized for the dictionary cache if asked. This
+ * touches no shared state, so records can be parsed in parallel, each
+ * thread with its own context.
+ */
+bool ibdNinja::ParseSDIRecord(SDIParseContext* context, Table** table,
+                              std::string* serialized) {
+  *table = nullptr;
+  // Nothing from the previous document is referenced any more
+  context->allocator.Clear();
+  rapidjson::Document doc(&context->allocator);
+  rapidjson::ParseResult ok = doc.ParseInsitu(context->json.data());
+  if (!ok) {
+    std::cerr << "JSON parse error: "
+              << rapidjson::GetParseError_En(ok.Code()) << " (offset "
+              << ok.Offset() << ")" << std::endl;
+    return false;
+  }
+  if (!ValidateSDI(doc)) {
+    std::cerr << "Invalid SDI" << std::endl;
+    return false;
+  }
+  if (serialized != nullptr) {
+    SerializeJSONValue(doc, serialized);
+  }
+  return BuildSDITable(doc, table);
+}
+
+/*
+ * Builds the table of a validated SDI document, *table is left nullptr for
+ * the tablespace document.
+ */
+bool ibdNinja::BuildSDITable(const rapidjson::Document& doc, Table** table) {
+  *table = nullptr;
+  if (std::string(doc["dd_object_type"].GetString()) != "Table") {
+    // Tablespace
+    return true;
+  }
+  const rapidjson::Value& dd_object = doc["dd_object"];
+  *table = Table::CreateTable(dd_object);
+  if (*table == nullptr) {
+    ninja_warn("Failed to recover table %s from SDI, "
+                "the SDI may be corrupt, skipping it",
+                dd_object["name"].GetString());
+    return false;
+  }
+  return true;
+}
+
+bool ibdNinja::LoadSDIRecord(SDIRecord* record, SDIParseContext* context) {
+  record->loaded = true;
+  Table* table = nullptr;
+  if (!ParseSDIRecord(context, &table, nullptr)) {
+    return false;
+  }
+  if (table != nullptr) {
+    AddTable(table);
+  }
+  return true;
+}
+
+/*
+ * Inflates and parses the SDI records on a pool of threads, then adds the
+ * tables serially in SDI order, as a serial load would. The serialized
+ * documents and the tables, nullptr if none, are returned per record if
+ * asked.
+ */
+bool ibdNinja::LoadSDIRecordsParallel(const std::vector<SDIKey>& keys,
+                                      std::vector<std::string>* serialized,
+                                      std::vector<Table*>* tables) {
+  std::vector<Table*> parsed(keys.size(), nullptr);
+  // Not a vector<bool>, which can't be written by several threads
+  std::vector<char> parsed_ok(keys.size(), false);
+  if (serialized != nullptr) {
+    serialized->assign(keys.size(), std::string());
+  }
+
+  // Records differ a lot in size, so they are handed out one by one
+  std::atomic<size_t> next_record(0);
+  auto worker = [&]() {
+    SDIParseContext context;
+    for (size_t i = next_record++; i < keys.size(); i = next_record++) {
+      auto cached = dict_cache_entries_.find(keys[i]);
+      if (cached != dict_cache_entries_.end()) {
+        parsed_ok[i] = ParseCachedSDIRecord(keys[i], cached->second,
+                                            &context, &parsed[i]);
+        continue;
+      }
+      parsed_ok[i] = (SDIInflate(sdi_records_.at(keys[i]), &context) &&
+                      ParseSDIRecord(&context, &parsed[i],
+                                     serialized != nullptr ?
+                                     &(*serialized)[i] : nullptr));
+    }
+  };
+
+  uint32_t n_threads = ScanThreads();
+  n_threads = std::max<size_t>(1, std::min<size_t>(n_threads, keys.size()));
+  std::vector<std::thread> threads;
+  for (uint32_t i = 1; i < n_threads; i++) {
+    threads.emplace_back(worker);
+  }
+  worker();
+  for (auto& thread : threads) {
+    thread.join();
+  }
+
+  bool ok = true;
+  for (size_t i = 0; i < keys.size(); i++) {
+    sdi_records_.at(keys[i]).loaded = true;
+    if (parsed[i] != nullptr) {
+      AddTable(parsed[i]);
+    }
+    ok = ok && parsed_ok[i];
+  }
+  if (tables != nullptr) {
+    *tables = parsed;
+  }
+  return ok;
+}
+
+/*
+ * Finds the value of a JSON key in the text from pos on, skipping the
+ * blanks around the colon. Returns nullptr if the key is not found.
+ */
+static const char* FindJSONValue(const char* pos, const char* key) {
+  pos = strstr(pos, key);
+  if (pos == nullptr) {
+    return nullptr;
+  }
+  pos += strlen(key);
+  while (isspace(static_cast<unsigned char>(*pos))) {
+    pos++;
+  }
+  if (*pos != ':') {
+    return nullptr;
+  }
+  pos++;
+  while (isspace(static_cast<unsigned char>(*pos))) {
+    pos++;
+  }
+  return pos;
+}
+
+/*
+ * Notes the table id and the index ids of an inflated SDI record from its
+ * JSON text, without parsing it: the table's "se_private_id", and the "id"
+ * of every "se_private_data" that also holds a "root", i.e., of an index.
+ * A later search for one of these ids goes straight to the record, and
+ * one for another id no longer inflates it.
+ */
+void ibdNinja::AddSDIRecordIds(const SDIKey& key, const char* json) {
+  const char* value = FindJSONValue(json, "\"se_private_id\"");
+  if (value == nullptr || !isdigit(static_cast<unsigned char>(*value))) {
+    return;
+  }
+  std::vector<uint64_t> index_ids;
+  for (const char* pos = FindJSONValue(json, "\"se_private_data\"");
+       pos != nullptr;
+       pos = FindJSONValue(pos, "\"se_private_data\"")) {
+    if (*pos != '"') {
+      continue;
+    }
+    const char* end = strchr(++pos, '"');
+    if (end == nullptr) {
+      return;
+    }
+    bool has_root = false;
+    uint64_t index_id = 0;
+    // Entries are "name=value;"
+    for (const char* entry = pos; entry < end;) {
+      const char* next = static_cast<const char*>(
+                             memchr(entry, ';', end - entry));
+      if (next == nullptr) {
+        next = end;
+      }
+      if (strncmp(entry, "id=", 3) == 0) {
+        index_id = strtoull(entry + 3, nullptr, 10);
+      } else if (strncmp(entry, "root=", 5) == 0) {
+        has_root = true;
+      }
+      entry = next + 1;
+    }
+    if (has_root && index_id != 0) {
+      index_ids.push_back(index_id);
+    }
+    pos = end + 1;
+  }
+  sdi_table_keys_.insert({strtoull(value, nullptr, 10), key});
+  for (auto index_id : index_ids) {
+    sdi_index_keys_.insert({index_id, key});
+  }
+  sdi_records_.at(key).ids_known = true;
+}
+
+bool ibdNinja::LoadSDIRecordByKey(const SDIKey& key) {
+  if (dict_cache_ != nullptr) {
+    return LoadCachedSDIRecord(key);
+  }
+  SDIRecord& record = sdi_records_.at(key);
+  if (record.loaded) {
+    return true;
+  }
+  SDIParseContext context;
+  if (!SDIInflate(record, &context)) {
+    record.loaded = true;
+    return false;
+  }
+  return LoadSDIRecord(&record, &context);
+}
+
+/*
+ * Loads the table SDI records whose JSON contains the pattern, stopping
+ * as soon as found() holds. Records are inflated to be searched, but only
+ * the matching ones are parsed, the others are dropped again. The ids of
+ * every inflated record are noted, so a search for a number skips the
+ * records whose ids are known: each record is inflated by at most one
+ * search for an id.
+ */
+bool ibdNinja::LoadSDIRecordsMatching(const std::string& pattern,
+                                      bool is_number,
+                                      const std::function<bool()>& found) {
+  SDIParseContext context;
+  for (auto& iter : sdi_records_) {
+    SDIRecord& record = iter.second;
+    if (iter.first.first != SDI_TYPE_TABLE || record.loaded ||
+        (is_number && record.ids_known)) {
+      continue;
+    }
+    if (dict_cache_ != nullptr) {
+      // Strings are stored as is in the cache, numbers are in its directory
+      const DictCacheEntry& entry = dict_cache_entries_[iter.first];
+      if (!is_number &&
+          memmem(entry.data, entry.len,
+                 pattern.c_str(), pattern.size()) != nullptr) {
+        LoadCachedSDIRecord(iter.first);
+        if (found()) {
+          return true;
+        }
+      }
+      continue;
+    }
+    if (!SDIInflate(record, &context)) {
+      record.loaded = true;
+      continue;
+    }
+    const char* json = context.json.data();
+    if (!record.ids_known) {
+      AddSDIRecordIds(iter.first, json);
+    }
+    bool match = false;
+    for (const char* pos = strstr(json, pattern.c_str());
+         pos != nullptr && !match;
+         pos = strstr(pos + 1, pattern.c_str())) {
+      // Numbers must not be part of a longer number
+      match = !is_number ||
+              ((pos == json || !isdigit(*(pos - 1))) &&
+               !isdigit(*(pos + pattern.size())));
+    }
+    if (!match) {
+      continue;
+    }
+    LoadSDIRecord(&record, &context);
+    if (found()) {
+      return true;
+    }
+  }
+  return found();
+}
+
+void ibdNinja::LoadAllTables() {
+  std::vector<SDIKey> keys;
+  for (auto& iter : sdi_records_) {
+    if (!iter.second.loaded) {
+      keys.push_back(iter.first);
+    }
+  }
+  LoadSDIRecordsParallel(keys, nullptr, nullptr);
+}
+
+Table* ibdNinja::GetTable(const std::string& db_name,
+                          const std::string& table_name) {
+  std::string name = QualifiedName(db_name, table_name);
+  auto find_table = [&]() -> Table* {
+    auto iter = table_names_.find(name);
+    return iter == table_names_.end() ? nullptr : iter->second;
+  };
+  Table* tab = find_table();
+  if (tab == nullptr && missing_table_names_.count(name) == 0) {
+    LoadSDIRecordsMatching(table_name, false,
+                           [&]() { return find_table() != nullptr; });
+    tab = find_table();
+    if (tab == nullptr) {
+      missing_table_names_.insert(name);
+    }
+  }
+  return tab;
+}
+
+Table* ibdNinja::GetTable(uint64_t table_id) {
+  auto iter = table_ids_.find(table_id);
+  if (iter != table_ids_.end()) {
+    return iter->second;
+  }
+  if (missing_table_ids_.count(table_id) != 0) {
+    return nullptr;
+  }
+  auto key = sdi_table_keys_.find(table_id);
+  if (key != sdi_table_keys_.end()) {
+    LoadSDIRecordByKey(key->second);
+  } else {
+    LoadSDIRecordsMatching(std::to_string(table_id), true, [&]() {
+      return table_ids_.find(table_id) != table_ids_.end();
+    });
+  }
+  iter = table_ids_.find(table_id);
+  if (iter == table_ids_.end()) {
+    missing_table_ids_.insert(table_id);
+    return nullptr;
+  }
+  return iter->second;
+}
+
+Index* ibdNinja::GetIndex(uint64_t index_id) {
+  auto iter = index_ids_.find(index_id);
+  if (iter != index_ids_.end()) {
+    return iter->second;
+  }
+  if (missing_index_ids_.count(index_id) != 0) {
+    return nullptr;
+  }
+  auto key = sdi_index_keys_.find(index_id);
+  if (key != sdi_index_keys_.end()) {
+    LoadSDIRecordByKey(key->second);
+  } else {
+    LoadSDIRecordsMatching(std::to_string(index_id), true, [&]() {
+      return index_ids_.find(index_id) != index_ids_.end();
+    });
+  }
+  iter = index_ids_.find(index_id);
+  if (iter == index_ids_.end()) {
+    missing_index_ids_.insert(index_id);
+    return nullptr;
+  }
+  return iter->second;
+}
+
+Index* ibdNinja::IndexOfPage(uint32_t page_no, const unsigned char* buf) {
+  if (page_no >= n_pages_) {
+    return nullptr;
+  }
+  if (page_index_slots_.empty()) {
+    page_index_slots_.resize(n_pages_, 0);
+    index_slots_.push_back(nullptr);
+  }
+  uint32_t slot = page_index_slots_[page_no];
+  if (slot != 0) {
+    return index_slots_[slot - 1];
+  }
+  Index* index = nullptr;
+  if (ReadFrom2B(buf + FIL_PAGE_TYPE) == FIL_PAGE_INDEX) {
+    uint64_t index_id = ReadFrom8B(buf + PAGE_HEADER + PAGE_INDEX_ID);
+    auto iter = index_slot_ids_.find(index_id);
+    if (iter != index_slot_ids_.end()) {
+      slot = iter->second;
+    } else {
+      index_slots_.push_back(GetIndex(index_id));
+      slot = index_slots_.size();
+      index_slot_ids_.insert({index_id, slot});
+    }
+    index = index_slots_[slot - 1];
+  } else {
+    slot = 1;
+  }
+  page_index_slots_[page_no] = slot;
+  return index;
+}
+
+/*
+ * The dictionary cache stores every SDI document as a binary stream of
+ * SAX events, so that a cache hit rebuilds the rapidjson DOM without
+ * inflating or parsing the JSON text. It is only valid for the same
+ * space, SDI root page LSN and checksum of the SDI record headers and the
+ * LSNs of their leaf pages, which the tablespace is opened with anyway.
+ *
+ * Layout, in host byte order:
+ *   header:    magic, version, space id, SDI root LSN, SDI checksum,
+ *              number of entries, checksum of the rest of the file
+ *   entries:   sdi_type, sdi_id, data offset, data length, table id,
+ *              number of index ids, index ids
+ *   data:      the serialized documents, offsets are relative to here
+ */
+static const char DICT_CACHE_MAGIC[8] = {'I', 'B', 'D', 'N', 'D', 'I', 'C', 'T'};
+static const uint32_t DICT_CACHE_VERSION = 2;
+static const char* DICT_CACHE_SUFFIX = ".ninjadict";
+
+enum DictCacheTag : unsigned char {
+  DICT_TAG_NULL = 'n',
+  DICT_TAG_FALSE = 'f',
+  DICT_TAG_TRUE = 't',
+  DICT_TAG_INT64 = 'i',
+  DICT_TAG_UINT64 = 'u',
+  DICT_TAG_DOUBLE = 'd',
+  DICT_TAG_STRING = 's',
+  DICT_TAG_OBJECT = 'o',
+  DICT_TAG_ARRAY = 'a'
+};
+
+template <typename T>
+static void DictCacheAppend(std::string* out, T value) {
+  out->append(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+static void DictCacheAppendString(std::string* out, const char* str,
+                                  uint32_t len) {
+  DictCacheAppend(out, len);
+  out->append(str, len);
+}
+
+static void SerializeJSONValue(const rapidjson::Value& value,
+                               std::string* out) {
+  if (value.IsNull()) {
+    DictCacheAppend(out, DICT_TAG_NULL);
+  } else if (value.IsBool()) {
+    DictCacheAppend(out, value.GetBool() ? DICT_TAG_TRUE : DICT_TAG_FALSE);
+  } else if (value.IsDouble()) {
+    DictCacheAppend(out, DICT_TAG_DOUBLE);
+    DictCacheAppend(out, value.GetDouble());
+  } else if (value.IsUint64()) {
+    DictCacheAppend(out, DICT_TAG_UINT64);
+    DictCacheAppend(out, value.GetUint64());
+  } else if (value.IsInt64()) {
+    DictCacheAppend(out, DICT_TAG_INT64);
+    DictCacheAppend(out, value.GetInt64());
+  } else if (value.IsString()) {
+    DictCacheAppend(out, DICT_TAG_STRING);
+    DictCacheAppendString(out, value.GetString(), value.GetStringLength());
+  } else if (value.IsObject()) {
+    DictCacheAppend(out, DICT_TAG_OBJECT);
+    DictCacheAppend(out, static_cast<uint32_t>(value.MemberCount()));
+    for (auto iter = value.MemberBegin(); iter != value.MemberEnd(); ++iter) {
+      DictCacheAppendString(out, iter->name.GetString(),
+                            iter->name.GetStringLength());
+      SerializeJSONValue(iter->value, out);
+    }
+  } else {
+    assert(value.IsArray());
+    DictCacheAppend(out, DICT_TAG_ARRAY);
+    DictCacheAppend(out, static_cast<uint32_t>(value.Size()));
+    for (auto iter = value.Begin(); iter != value.End(); ++iter) {
+      SerializeJSONValue(*iter, out);
+    }
+  }
+}
+
+// Reads the cache file with bounds checks
+class DictCacheReader {
+ public:
+  DictCacheReader(const unsigned char* data, uint64_t len)
+    : pos_(data), end_(data + len) {}
+  template <typename T>
+  bool Read(T* value) {
+    if (static_cast<uint64_t>(end_ - pos_) < sizeof(T)) {
+      return false;
+    }
+    memcpy(value, pos_, sizeof(T));
+    pos_ += sizeof(T);
+    return true;
+  }
+  bool ReadBytes(uint64_t len, const char** bytes) {
+    if (static_cast<uint64_t>(end_ - pos_) < len) {
+      return false;
+    }
+    *bytes = reinterpret_cast<const char*>(pos_);
+    pos_ += len;
+    return true;
+  }
+  bool AtEnd() const {
+    return pos_ == end_;
+  }
+  const unsigned char* pos() const {
+    return pos_;
+  }
+  uint64_t remaining() const {
+    return end_ - pos_;
+  }
+
+ private:
+  const unsigned char* pos_;
+  const unsigned char* end_;
+};
+
+// Replays a serialized document as SAX events, see Document::Populate()
+class DictCacheGenerator {
+ public:
+  DictCacheGenerator(const unsigned char* data, uint64_t len)
+    : reader_(data, len) {}
+  template <typename Handler>
+  bool operator()(Handler& handler) {
+    ok_ = Generate(handler) && reader_.AtEnd();
+    return ok_;
+  }
+  // Document::Populate() leaves the document null on failure, without a
+  // parse error
+  bool ok() const {
+    return ok_;
+  }
+
+ private:
+  template <typename Handler>
+  bool Generate(Handler& handler) {
+    unsigned char tag;
+    if (!reader_.Read(&tag)) {
+      return false;
+    }
+    switch (tag) {
+      case DICT_TAG_NULL:
+        return handler.Null();
+      case DICT_TAG_FALSE:
+        return handler.Bool(false);
+      case DICT_TAG_TRUE:
+        return handler.Bool(true);
+      case DICT_TAG_DOUBLE: {
+        double value;
+        return reader_.Read(&value) && handler.Double(value);
+      }
+      case DICT_TAG_UINT64: {
+        uint64_t value;
+        return reader_.Read(&value) && handler.Uint64(value);
+      }
+      case DICT_TAG_INT64: {
+        int64_t value;
+        return reader_.Read(&value) && handler.Int64(value);
+      }
+      case DICT_TAG_STRING: {
+        uint32_t len;
+        const char* str;
+        return reader_.Read(&len) && reader_.ReadBytes(len, &str) &&
+               handler.String(str, len, true);
+      }
+      case DICT_TAG_OBJECT: {
+        uint32_t n_members;
+        if (!reader_.Read(&n_members) || !handler.StartObject()) {
+          return false;
+        }
+        for (uint32_t i = 0; i < n_members; i++) {
+          uint32_t len;
+          const char* str;
+          if (!reader_.Read(&len) || !reader_.ReadBytes(len, &str) ||
+              !handler.Key(str, len, true) || !Generate(handler)) {
+            return false;
+          }
+        }
+        return handler.EndObject(n_members);
+      }
+      case DICT_TAG_ARRAY: {
+        uint32_t n_elements;
+        if (!reader_.Read(&n_elements) || !handler.StartArray()) {
+          return false;
+        }
+        for (uint32_t i = 0; i < n_elements; i++) {
+          if (!Generate(handler)) {
+            return false;
+          }
+        }
+        return handler.EndArray(n_elements);
+      }
+      default:
+        return false;
+    }
+  }
+  DictCacheReader reader_;
+  bool ok_ = false;
+};
+
+/*
+ * A cached document that does not replay or validate is read from the
+ * tablespace instead, inflating and parsing its SDI record.
+ */
+bool ibdNinja::ParseCachedSDIRecord(const SDIKey& key,
+                                    const DictCacheEntry& entry,
+                                    SDIParseContext* context,
+                                    Table** table) const {
+  *table = nullptr;
+  rapidjson::Document doc;
+  DictCacheGenerator generator(entry.data, entry.len);
+  doc.Populate(generator);
+  if (!generator.ok() || doc.HasParseError() || !ValidateSDI(doc)) {
+    ninja_warn("Invalid SDI record (type %" PRIu64 ", id %" PRIu64 ") "
+               "in the dictionary cache, reading it from the tablespace",
+               key.first, key.second);
+    return SDIInflate(sdi_records_.at(key), context) &&
+           ParseSDIRecord(context, table, nullptr);
+  }
+  return BuildSDITable(doc, table);
+}
+
+bool ibdNinja::LoadCachedSDIRecord(const SDIKey& key) {
+  auto record = sdi_records_.find(key);
+  auto entry = dict_cache_entries_.find(key);
+  if (record == sdi_records_.end() || entry == dict_cache_entries_.end()) {
+    return false;
+  }
+  if (record->second.loaded) {
+    return true;
+  }
+  record->second.loaded = true;
+  SDIParseContext context;
+  Table* table = nullptr;
+  if (!ParseCachedSDIRecord(key, entry->second, &context, &table)) {
+    return false;
+  }
+  if (table != nullptr) {
+    AddTable(table);
+  }
+  return true;
+}
+
+bool ibdNinja::ReadDictCache(const std::string& path) {
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  struct stat st;
+  if (fstat(fd, &st) != 0 || st.st_size == 0) {
+    close(fd);
+    return false;
+  }
+  void* addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return false;
+  }
+  dict_cache_ = static_cast<unsigned char*>(addr);
+  dict_cache_size_ = st.st_size;
+
+  DictCacheReader reader(dict_cache_, dict_cache_size_);
+  const char* magic;
+  uint32_t version;
+  uint32_t space_id;
+  uint64_t sdi_root_lsn;
+  uint32_t sdi_checksum;
+  uint32_t n_entries;
+  uint32_t cache_checksum;
+  bool valid = reader.ReadBytes(sizeof(DICT_CACHE_MAGIC), &magic) &&
+               memcmp(magic, DICT_CACHE_MAGIC,
+                      sizeof(DICT_CACHE_MAGIC)) == 0 &&
+               reader.Read(&version) && version == DICT_CACHE_VERSION &&
+               reader.Read(&space_id) && space_id == space_id_ &&
+               reader.Read(&sdi_root_lsn) && sdi_root_lsn == sdi_root_lsn_ &&
+               reader.Read(&sdi_checksum) && sdi_checksum == sdi_checksum_ &&
+               reader.Read(&n_entries) && n_entries == sdi_records_.size() &&
+               reader.Read(&cache_checksum) &&
+               cache_checksum == crc32(crc32(0L, Z_NULL, 0), reader.pos(),
+                                       reader.remaining());
+  // Data offsets are relative to the end of the entries
+  std::vector<std::pair<SDIKey, std::pair<uint64_t, uint64_t>>> locations;
+  for (uint32_t i = 0; valid && i < n_entries; i++) {
+    SDIKey key;
+    uint64_t offset;
+    uint64_t len;
+    uint64_t table_id;
+    uint32_t n_index_ids;
+    valid = reader.Read(&key.first) && reader.Read(&key.second) &&
+            reader.Read(&offset) && reader.Read(&len) &&
+            reader.Read(&table_id) && reader.Read(&n_index_ids) &&
+            sdi_records_.find(key) != sdi_records_.end();
+    for (uint32_t j = 0; valid && j < n_index_ids; j++) {
+      uint64_t index_id;
+      valid = reader.Read(&index_id);
+      if (valid) {
+        sdi_index_keys_.insert({index_id, key});
+      }
+    }
+    if (valid) {
+      locations.push_back({key, {offset, len}});
+      if (table_id != 0) {
+        sdi_table_keys_.insert({table_id, key});
+      }
+    }
+  }
+  for (size_t i = 0; valid && i < locations.size(); i++) {
+    uint64_t offset = locations[i].second.first;
+    uint64_t len = locations[i].second.second;
+    valid = offset <= reader.remaining() &&
+            len <= reader.remaining() - offset;
+    if (valid) {
+      dict_cache_entries_.insert({locations[i].first,
+                                  {reader.pos() + offset, len}});
+    }
+  }
+  if (!valid) {
+    munmap(dict_cache_, dict_cache_size_);
+    dict_cache_ = nullptr;
+    dict_cache_size_ = 0;
+    dict_cache_entries_.clear();
+    sdi_table_keys_.clear();
+    sdi_index_keys_.clear();
+  }
+  for (size_t i = 0; valid && i < locations.size(); i++) {
+    sdi_records_.at(locations[i].first).ids_known = true;
+  }
+  return valid;
+}
+
+/*
+ * Loads all the SDI records the slow way and writes them to the cache.
+ */
+bool ibdNinja::WriteDictCache(const std::string& path) {
+  std::vector<SDIKey> keys;
+  for (auto& iter : sdi_records_) {
+    assert(!iter.second.loaded);
+    keys.push_back(iter.first);
+  }
+  std::vector<std::string> documents;
+  std::vector<Table*> tables;
+  if (!LoadSDIRecordsParallel(keys, &documents, &tables)) {
+    return false;
+  }
+
+  std::string entries;
+  std::string data;
+  for (size_t i = 0; i < keys.size(); i++) {
+    uint64_t table_id = 0;
+    std::vector<uint64_t> index_ids;
+    if (tables[i] != nullptr) {
+      table_id = tables[i]->se_private_id();
+      for (auto index : tables[i]->indexes()) {
+        uint64_t index_id = 0;
+        if (index->se_private_data().Get("id", &index_id)) {
+          index_ids.push_back(index_id);
+        }
+      }
+    }
+    DictCacheAppend(&entries, keys[i].first);
+    DictCacheAppend(&entries, keys[i].second);
+    DictCacheAppend(&entries, static_cast<uint64_t>(data.size()));
+    DictCacheAppend(&entries, static_cast<uint64_t>(documents[i].size()));
+    DictCacheAppend(&entries, table_id);
+    DictCacheAppend(&entries, static_cast<uint32_t>(index_ids.size()));
+    for (auto index_id : index_ids) {
+      DictCacheAppend(&entries, index_id);
+    }
+    data += documents[i];
+  }
+
+  std::string header(DICT_CACHE_MAGIC, sizeof(DICT_CACHE_MAGIC));
+  DictCacheAppend(&header, DICT_CACHE_VERSION);
+  DictCacheAppend(&header, space_id_);
+  DictCacheAppend(&header, sdi_root_lsn_);
+  DictCacheAppend(&header, sdi_checksum_);
+  DictCacheAppend(&header, static_cast<uint32_t>(sdi_records_.size()));
+  uLong cache_checksum = crc32(0L, Z_NULL, 0);
+  cache_checksum = crc32(cache_checksum,
+                         reinterpret_cast<const Bytef*>(entries.data()),
+                         entries.size());
+  cache_checksum = crc32(cache_checksum,
+                         reinterpret_cast<const Bytef*>(data.data()),
+                         data.size());
+  DictCacheAppend(&header, static_cast<uint32_t>(cache_checksum));
+
+  // Written aside and renamed, so that concurrent runs never see a partial
+  // file
+  std::string tmp_path = path + "." + std::to_string(getpid());
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    ninja_warn("Failed to create the dictionary cache %s, error: %d(%s)",
+               tmp_path.c_str(), errno, strerror(errno));
+    return false;
+  }
+  bool ok = fwrite(header.data(), 1, header.size(), file) == header.size() &&
+            fwrite(entries.data(), 1, entries.size(), file) ==
+                entries.size() &&
+            fwrite(data.data(), 1, data.size(), file) == data.size();
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    ninja_warn("Failed to write the dictionary cache %s, error: %d(%s)",
+               path.c_str(), errno, strerror(errno));
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * Files of the same name in different directories, e.g., backups of the
+ * same table, get their own caches: the name also holds the space id and
+ * the checksum of the absolute path of the ibd file.
+ */
+bool ibdNinja::OpenDictCache(const std::string& cache_dir,
+                             const char* ibd_filename, FILE* info_out) {
+  std::string base_name(ibd_filename);
+  size_t slash = base_name.rfind('/');
+  if (slash != std::string::npos) {
+    base_name = base_name.substr(slash + 1);
+  }
+  char* real_path = realpath(ibd_filename, nullptr);
+  std::string full_path(real_path != nullptr ? real_path : ibd_filename);
+  free(real_path);
+  uLong path_checksum = crc32(0L, Z_NULL, 0);
+  path_checksum = crc32(path_checksum,
+                        reinterpret_cast<const Bytef*>(full_path.data()),
+                        full_path.size());
+  char key[32];
+  snprintf(key, sizeof(key), ".%u.%08x", space_id_,
+           static_cast<uint32_t>(path_checksum));
+  std::string path = cache_dir + "/" + base_name + key + DICT_CACHE_SUFFIX;
+  if (ReadDictCache(path)) {
+    fprintf(info_out, "[ibdNinja]: Using the dictionary cache %s\n\n",
+            path.c_str());
+    return true;
+  }
+  if (!WriteDictCache(path)) {
+    return false;
+  }
+  fprintf(info_out, "[ibdNinja]: Wrote the dictionary cache %s\n\n",
+          path.c_str());
+  return true;
+}
+
+/*
+ * Sidecar files describe the ibd file they were built from. They are only
+ * used while the file keeps the same size and modification time, which a
+ * copy or a write by MySQL changes.
+ */
+bool ibdNinja::InitSidecarHeader(const char* magic, uint32_t version,
+                                 SidecarHeader* header) const {
+  struct stat ibd_stat;
+  if (fstat(g_fd, &ibd_stat) != 0) {
+    ninja_error("Failed to get file stats: %s, error: %d(%s)",
+                ibd_filename_.c_str(), errno, strerror(errno));
+    return false;
+  }
+  memset(header, 0, sizeof(SidecarHeader));
+  memcpy(header->magic, magic, sizeof(header->magic));
+  header->version = version;
+  header->page_size = g_page_physical_size;
+  header->space_id = space_id_;
+  header->file_size = ibd_stat.st_size;
+  header->mtime_sec = ibd_stat.st_mtim.tv_sec;
+  header->mtime_nsec = ibd_stat.st_mtim.tv_nsec;
+  return true;
+}
+
+ibdNinja::SidecarState ibdNinja::CheckSidecarHeader(
+    const SidecarHeader& header, const char* magic, uint32_t version) const {
+  if (memcmp(header.magic, magic, sizeof(header.magic)) != 0 ||
+      header.version != version ||
+      header.page_size != g_page_physical_size ||
+      header.space_id != space_id_) {
+    return SIDECAR_INVALID;
+  }
+  struct stat ibd_stat;
+  if (fstat(g_fd, &ibd_stat) != 0 ||
+      header.file_size != static_cast<uint64_t>(ibd_stat.st_size) ||
+      header.mtime_sec != ibd_stat.st_mtim.tv_sec ||
+      header.mtime_nsec != ibd_stat.st_mtim.tv_nsec) {
+    return SIDECAR_STALE;
+  }
+  return SIDECAR_FRESH;
+}
+
+bool ibdNinja::WriteSidecar(const std::string& path, const char* what,
+    const std::vector<std::pair<const void*, size_t>>& parts) {
+  std::string tmp_path = path + "." + std::to_string(getpid());
+  FILE* file = fopen(tmp_path.c_str(), "wb");
+  if (file == nullptr) {
+    ninja_error("Failed to create the %s %s, error: %d(%s)",
+                what, tmp_path.c_str(), errno, strerror(errno));
+    return false;
+  }
+  bool ok = true;
+  for (const auto& part : parts) {
+    ok = ok && fwrite(part.first, 1, part.second, file) == part.second;
+  }
+  ok = (fclose(file) == 0) && ok;
+  if (!ok || rename(tmp_path.c_str(), path.c_str()) != 0) {
+    ninja_error("Failed to write the %s %s, error: %d(%s)",
+                what, path.c_str(), errno, strerror(errno));
+    unlink(tmp_path.c_str());
+    return false;
+  }
+  return true;
+}
+
+/*
+ * The page map keeps a few fields of every page header, so that structural
+ * questions (which index owns a page, the leftmost page of each level, the
+ * pages of a level) are answered without walking the trees. It is only a
+ * hint: commands still check the pages they read.
+ */
+static const char PAGE_MAP_MAGIC[8] = {'I', 'B', 'D', 'N', 'P', 'M', 'A', 'P'};
+static const uint32_t PAGE_MAP_VERSION = 2;
+static const char* PAGE_MAP_SUFFIX = ".ninjamap";
+// Pages read at once by the sequential scan
+static const uint32_t PAGE_MAP_SCAN_BATCH = 64;
+
+/*
+ * Reads the whole file sequentially and fills in the entries. Pages whose
+ * LSN did not change since old_entries was built are copied from it.
+ */
+bool ibdNinja::ScanPageMap(const PageMapEntry* old_entries,
+                           uint32_t n_old_entries, PageMapEntry* entries,
+                           uint32_t* n_refreshed) {
+  unsigned char* buf_unalign =
+    new unsigned char[(PAGE_MAP_SCAN_BATCH + 1) * UNIV_PAGE_SIZE_MAX];
+  unsigned char* buf = static_cast<unsigned char*>(
+                           ut_align(buf_unalign, g_page_physical_size));
+  *n_refreshed = 0;
+  bool ok = true;
+  for (uint32_t first = 0; ok && first < n_pages_;
+       first += PAGE_MAP_SCAN_BATCH) {
+    uint32_t n_batch = std::min(PAGE_MAP_SCAN_BATCH, n_pages_ - first);
+    size_t len = static_cast<size_t>(n_batch) * g_page_physical_size;
+    ssize_t bytes = pread(g_fd, buf, len,
+                          static_cast<off_t>(first) * g_page_physical_size);
+    if (bytes != static_cast<ssize_t>(len)) {
+      ninja_error("Failed to read pages %u to %u, error: %d(%s)",
+                  first, first + n_batch - 1, errno, strerror(errno));
+      ok = false;
+      break;
+    }
+    for (uint32_t i = 0; i < n_batch; i++) {
+      uint32_t page_no = first + i;
+      const unsigned char* page = buf + i * g_page_physical_size;
+      uint64_t lsn = ReadFrom8B(page + FIL_PAGE_LSN);
+      if (page_no < n_old_entries && old_entries[page_no].lsn == lsn) {
+        entries[page_no] = old_entries[page_no];
+        continue;
+      }
+      (*n_refreshed)++;
+      PageMapEntry* entry = &entries[page_no];
+      memset(entry, 0, sizeof(PageMapEntry));
+      entry->lsn = lsn;
+      entry->type = ReadFrom2B(page + FIL_PAGE_TYPE);
+      entry->prev = ReadFrom4B(page + FIL_PAGE_PREV);
+      entry->next = ReadFrom4B(page + FIL_PAGE_NEXT);
+      if (entry->type == FIL_PAGE_INDEX || entry->type == FIL_PAGE_RTREE ||
+          entry->type == FIL_PAGE_SDI) {
+        entry->index_id = ReadFrom8B(page + PAGE_HEADER + PAGE_INDEX_ID);
+        entry->level = ReadFrom2B(page + PAGE_HEADER + PAGE_LEVEL);
+        entry->n_recs = ReadFrom2B(page + PAGE_HEADER + PAGE_N_RECS);
+        entry->garbage = ReadFrom2B(page + PAGE_HEADER + PAGE_GARBAGE);
+      }
+    }
+  }
+  delete[] buf_unalign;
+  return ok;
+}
+
+/*
+ * Maps the page map of the ibd file. Only if build is set, a missing map is
+ * built, and a map built from an older version of the file is refreshed,
+ * rescanning the file but only rebuilding the entries of the pages whose
+ * LSN changed. Otherwise a stale map is ignored with a warning.
+ */
+bool ibdNinja::LoadPageMap(const char* ibd_filename, bool build,
+                           FILE* info_out) {
+  std::string path = std::string(ibd_filename) + PAGE_MAP_SUFFIX;
+  unsigned char* addr = nullptr;
+  size_t size = 0;
+  int fd = open(path.c_str(), O_RDONLY);
+  struct stat st;
+  if (fd >= 0 && fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(PageMapHeader)) {
+    void* map = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    if (map != MAP_FAILED) {
+      addr = static_cast<unsigned char*>(map);
+      size = st.st_size;
+    }
+  }
+  if (fd >= 0) {
+    close(fd);
+  }
+  if (addr == nullptr && !build) {
+    return false;
+  }
+
+  // Entries of a map of the same tablespace are reused by the refresh
+  const PageMapEntry* old_entries = nullptr;
+  uint32_t n_old_entries = 0;
+  SidecarState state = SIDECAR_INVALID;
+  if (addr != nullptr) {
+    PageMapHeader header;
+    memcpy(&header, addr, sizeof(header));
+    state = CheckSidecarHeader(header.sidecar, PAGE_MAP_MAGIC,
+                               PAGE_MAP_VERSION);
+    if (size != sizeof(PageMapHeader) +
+                static_cast<size_t>(header.n_pages) * sizeof(PageMapEntry)) {
+      state = SIDECAR_INVALID;
+    } else if (state == SIDECAR_FRESH && header.n_pages != n_pages_) {
+      state = SIDECAR_STALE;
+    }
+    if (state != SIDECAR_INVALID) {
+      old_entries = reinterpret_cast<const PageMapEntry*>(
+                        addr + sizeof(PageMapHeader));
+      n_old_entries = header.n_pages;
+    }
+  }
+  if (state == SIDECAR_FRESH) {
+    page_map_ = addr;
+    page_map_size_ = size;
+    page_map_entries_ = old_entries;
+    fprintf(info_out, "[ibdNinja]: Using the page map %s\n\n", path.c_str());
+    return true;
+  }
+  if (!build) {
+    if (state == SIDECAR_STALE) {
+      ninja_warn("The page map %s is stale, the ibd file changed after it "
+                 "was built. Ignoring it, rebuild it with --build-map",
+                 path.c_str());
+    } else {
+      ninja_warn("Ignoring the invalid page map %s", path.c_str());
+    }
+    munmap(addr, size);
+    return false;
+  }
+
+  std::vector<PageMapEntry> entries(n_pages_);
+  uint32_t n_refreshed = 0;
+  bool ok = ScanPageMap(old_entries, n_old_entries, entries.data(),
+                        &n_refreshed);
+  if (addr != nullptr) {
+    munmap(addr, size);
+  }
+  if (!ok) {
+    return false;
+  }
+
+  PageMapHeader header;
+  memset(&header, 0, sizeof(header));
+  if (!InitSidecarHeader(PAGE_MAP_MAGIC, PAGE_MAP_VERSION, &header.sidecar)) {
+    return false;
+  }
+  header.n_pages = n_pages_;
+  size_t entries_len = entries.size() * sizeof(PageMapEntry);
+  if (!WriteSidecar(path, "page map", {{&header, sizeof(header)},
+                                       {entries.data(), entries_len}})) {
+    return false;
+  }
+
+  fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return false;
+  }
+  size = sizeof(header) + entries_len;
+  void* map = mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (map == MAP_FAILED) {
+    return false;
+  }
+  page_map_ = static_cast<unsigned char*>(map);
+  page_map_size_ = size;
+  page_map_entries_ = reinterpret_cast<const PageMapEntry*>(
+                          page_map_ + sizeof(PageMapHeader));
+  if (old_entries != nullptr) {
+    fprintf(info_out, "[ibdNinja]: Refreshed %u of %u pages in the page "
+                      "map %s\n\n", n_refreshed, n_pages_, path.c_str());
+  } else {
+    fprintf(info_out, "[ibdNinja]: Built the page map %s\n\n",
+            path.c_str());
+  }
+  return true;
+}
+
+bool ibdNinja::OpenPageMap(const char* ibd_filename, FILE* info_out) {
+  return LoadPageMap(ibd_filename, false, info_out);
+}
+
+bool ibdNinja::BuildPageMap(const char* ibd_filename, FILE* info_out) {
+  if (!LoadPageMap(ibd_filename, true, info_out)) {
+    return false;
+  }
+  std::map<uint16_t, uint32_t> n_pages_by_type;
+  struct IndexPages {
+    uint32_t n_levels = 0;
+    uint32_t n_pages = 0;
+    uint32_t n_leaf_pages = 0;
+    uint64_t n_recs = 0;
+    uint64_t garbage = 0;
+  };
+  std::map<uint64_t, IndexPages> index_pages;
+  for (uint32_t page_no = 0; page_no < n_pages_; page_no++) {
+    const PageMapEntry& entry = page_map_entries_[page_no];
+    n_pages_by_type[entry.type]++;
+    if (entry.type != FIL_PAGE_INDEX) {
+      continue;
+    }
+    IndexPages& pages = index_pages[entry.index_id];
+    pages.n_levels = std::max<uint32_t>(pages.n_levels, entry.level + 1);
+    pages.n_pages++;
+    pages.n_leaf_pages += (entry.level == 0);
+    pages.n_recs += entry.n_recs;
+    pages.garbage += entry.garbage;
+  }
+
+  fprintf(info_out, "=========================================="
+                    "==========================================\n");
+  fprintf(info_out, "|  PAGE MAP SUMMARY                        "
+                    "                                        |\n");
+  fprintf(info_out, "------------------------------------------"
+                    "------------------------------------------\n");
+  fprintf(info_out, "Pages by type:\n");
+  for (const auto& iter : n_pages_by_type) {
+    fprintf(info_out, "    %-28s %u\n",
+            PageType2String(iter.first).c_str(), iter.second);
+  }
+  // Freed pages keep their header, so an index may show more pages here
+  // than its trees hold
+  fprintf(info_out, "\nINDEX pages by index id:\n");
+  fprintf(info_out, "    %-9s %-6s %-9s %-9s %-11s %-10s %s\n",
+          "Index id", "Levels", "Pages", "Leaves", "Records",
+          "Garbage", "Name");
+  for (const auto& iter : index_pages) {
+    Index* index = GetIndex(iter.first);
+    std::string name = "(unknown)";
+    if (index != nullptr) {
+      name = index->table()->schema_ref() + "." + index->table()->name() +
+             "." + index->name();
+    }
+    fprintf(info_out, "    %-9" PRIu64 " %-6u %-9u %-9u %-11" PRIu64
+                      " %-10" PRIu64 " %s\n",
+            iter.first, iter.second.n_levels, iter.second.n_pages,
+            iter.second.n_leaf_pages, iter.second.n_recs,
+            iter.second.garbage, name.c_str());
+  }
+  return true;
+}
+
+/*
+ * The leftmost page of each level of the index, from the root down. Pages
+ * that were freed keep their header, so the map is only trusted when it
+ * names exactly one leftmost page per level.
+ */
+bool ibdNinja::PageMapLeftmostPages(Index* index,
+                                    std::vector<uint32_t>* pages) {
+  uint32_t root = index->ib_page();
+  if (page_map_entries_ == nullptr || root >= n_pages_) {
+    return false;
+  }
+  const PageMapEntry& root_entry = page_map_entries_[root];
+  if (root_entry.type != FIL_PAGE_INDEX ||
+      root_entry.index_id != index->ib_id() ||
+      root_entry.prev != FIL_NULL || root_entry.next != FIL_NULL) {
+    return false;
+  }
+  uint32_t n_levels = root_entry.level + 1;
+  std::vector<uint32_t> leftmost(n_levels, FIL_NULL);
+  leftmost[root_entry.level] = root;
+  for (uint32_t page_no = 0; page_no < n_pages_; page_no++) {
+    const PageMapEntry& entry = page_map_entries_[page_no];
+    if (entry.type != FIL_PAGE_INDEX || entry.index_id != index->ib_id() ||
+        entry.prev != FIL_NULL || page_no == root) {
+      continue;
+    }
+    if (entry.level >= root_entry.level || leftmost[entry.level] != FIL_NULL) {
+      return false;
+    }
+    leftmost[entry.level] = page_no;
+  }
+  pages->clear();
+  for (uint32_t level = n_levels; level-- > 0; ) {
+    if (leftmost[level] == FIL_NULL) {
+      return false;
+    }
+    pages->push_back(leftmost[level]);
+  }
+  return true;
+}
+
+/*
+ * Follows the sibling links of a level in the map, from its leftmost page.
+ */
+bool ibdNinja::PageMapLevelPages(Index* index, uint32_t leftmost_page_no,
+                                 std::vector<uint32_t>* pages) {
+  pages->clear();
+  if (leftmost_page_no >= n_pages_) {
+    return false;
+  }
+  uint32_t level = page_map_entries_[leftmost_page_no].level;
+  for (uint32_t page_no = leftmost_page_no; page_no != FIL_NULL; ) {
+    if (page_no >= n_pages_ || pages->size() > n_pages_) {
+      return false;
+    }
+    const PageMapEntry& entry = page_map_entries_[page_no];
+    if (entry.type != FIL_PAGE_INDEX || entry.index_id != index->ib_id() ||
+        entry.level != level) {
+      return false;
+    }
+    pages->push_back(page_no);
+    page_no = entry.next;
+  }
+  return true;
+}
+
+/*
+ * Prints how far apart logically adjacent leaf pages are on disk, given the
+ * leaf pages in chain order, and estimates the reads of a full scan: a read
+ * fetches the aligned block of read_ahead pages holding the page, and only
+ * the pages that directly follow it in the chain reuse the block.
+ */
+static void PrintLeafLocality(const std::vector<uint32_t>& leaf_pages,
+                              uint32_t read_ahead) {
+  uint32_t extent_size = FSP_EXTENT_SIZE;
+  uint64_t n_sequential = 0;
+  uint64_t n_same_extent = 0;
+  uint64_t n_backward = 0;
+  uint64_t n_far = 0;
+  uint64_t n_extent_switches = 0;
+  uint64_t n_reads = leaf_pages.empty() ? 0 : 1;
+  for (size_t i = 1; i < leaf_pages.size(); i++) {
+    uint32_t prev = leaf_pages[i - 1];
+    uint32_t page_no = leaf_pages[i];
+    if (page_no == prev + 1) {
+      n_sequential++;
+    } else if (page_no / extent_size == prev / extent_size) {
+      n_same_extent++;
+    } else if (page_no < prev) {
+      n_backward++;
+    } else {
+      n_far++;
+    }
+    if (page_no / extent_size != prev / extent_size) {
+      n_extent_switches++;
+    }
+    if (page_no / read_ahead != prev / read_ahead) {
+      n_reads++;
+    }
+  }
+  uint64_t n_jumps = leaf_pages.empty() ? 0 : leaf_pages.size() - 1;
+  auto ratio = [n_jumps](uint64_t n) {
+    return n_jumps == 0 ? 0.0 : static_cast<double>(n) / n_jumps * 100;
+  };
+  uint64_t n_ideal = (leaf_pages.size() + read_ahead - 1) / read_ahead;
+  fprintf(stdout, "\n--------LEAF-CHAIN-LOCALITY------\n");
+  fprintf(stdout, "Sibling jumps:                                    "
+                  "%" PRIu64 "\n"
+                  "                                                  "
+                  "  [Sequential:  %" PRIu64 " (%.2lf %%)]\n"
+                  "                                                  "
+                  "  [Same extent: %" PRIu64 " (%.2lf %%)]\n"
+                  "                                                  "
+                  "  [Backward:    %" PRIu64 " (%.2lf %%)]\n"
+                  "                                                  "
+                  "  [Far forward: %" PRIu64 " (%.2lf %%)]\n",
+                  n_jumps, n_sequential, ratio(n_sequential),
+                  n_same_extent, ratio(n_same_extent),
+                  n_backward, ratio(n_backward), n_far, ratio(n_far));
+  fprintf(stdout, "Extent switches per 1000 pages:                   "
+                  "%.2lf\n", leaf_pages.empty() ? 0.0 :
+                  static_cast<double>(n_extent_switches) * 1000 /
+                  leaf_pages.size());
+  fprintf(stdout, "Estimated reads of a full scan:                   "
+                  "%" PRIu64 " (%u-page read-ahead)\n"
+                  "                                                  "
+                  "  [In physical order: %" PRIu64 "]\n"
+                  "                                                  "
+                  "  [Without read-ahead: %zu]\n",
+                  n_reads, read_ahead, n_ideal, leaf_pages.size());
+}
+
+static std::vector<std::string> HistogramLabels(uint32_t n_buckets,
+                                                bool fill, bool log2) {
+  std::vector<std::string> labels;
+  char label[32];
+  for (uint32_t i = 0; i < n_buckets; i++) {
+    if (fill) {
+      snprintf(label, sizeof(label), "[%u%%, %u%%%c",
+               i * 100 / n_buckets, (i + 1) * 100 / n_buckets,
+               i + 1 == n_buckets ? ']' : ')');
+    } else if (log2 && i > 1) {
+      snprintf(label, sizeof(label), "%u-%u", 1U << (i - 1), (1U << i) - 1);
+    } else if (!log2 && i + 1 == n_buckets) {
+      snprintf(label, sizeof(label), "invalid");
+    } else {
+      snprintf(label, sizeof(label), "%u", i);
+    }
+    labels.push_back(label);
+  }
+  return labels;
+}
+
+/*
+ * Prints the buckets between the first and the last non-empty ones, with a
+ * bar scaled to the largest bucket.
+ */
+static void PrintHistogram(const char* title, const uint64_t* counts,
+                           const std::vector<std::string>& labels) {
+  constexpr uint32_t BAR_WIDTH = 30;
+  uint32_t first = labels.size();
+  uint32_t last = 0;
+  uint64_t total = 0;
+  uint64_t max = 0;
+  for (uint32_t i = 0; i < labels.size(); i++) {
+    if (counts[i] == 0) {
+      continue;
+    }
+    first = std::min(first, i);
+    last = i;
+    total += counts[i];
+    max = std::max(max, counts[i]);
+  }
+  fprintf(stdout, "%s\n", title);
+  if (total == 0) {
+    fprintf(stdout, "  None\n");
+    return;
+  }
+  for (uint32_t i = first; i <= last; i++) {
+    uint64_t width = counts[i] * BAR_WIDTH / max;
+    if (width == 0 && counts[i] > 0) {
+      width = 1;
+    }
+    fprintf(stdout, "  %-14s %10" PRIu64 " %7.2lf %%  %s\n",
+                    labels[i].c_str(), counts[i],
+                    static_cast<double>(counts[i]) / total * 100,
+                    std::string(width, '#').c_str());
+  }
+}
+
+static void PrintFreeListStats(const FreeListStats& stats) {
+  fprintf(stdout, "\n--------REUSABLE-GARBAGE--------\n");
+  fprintf(stdout, "Pages with freed records:                         "
+                  "%" PRIu64 " of %" PRIu64 "\n",
+                  stats.n_pages_with_holes, stats.n_pages);
+  fprintf(stdout, "Freed records (PAGE_FREE lists):                  "
+                  "%" PRIu64 "\n", stats.n_holes);
+  fprintf(stdout, "Freed records size:                               "
+                  "%" PRIu64 " B\n"
+                  "                                                  "
+                  "  [PAGE_GARBAGE:      %" PRIu64 " B]\n"
+                  "                                                  "
+                  "  [Not on the lists:  %" PRIu64 " B]\n"
+                  "                                                  "
+                  "  [Largest:           %u B]\n"
+                  "                                                  "
+                  "  [Average:           %" PRIu64 " B]\n"
+                  "                                                  "
+                  "  [Average list head: %" PRIu64 " B]\n",
+                  stats.holes_len, stats.garbage, stats.unlisted_garbage,
+                  stats.max_hole_len,
+                  stats.n_holes == 0 ? 0 : stats.holes_len / stats.n_holes,
+                  stats.n_pages_with_holes == 0 ? 0 :
+                  stats.heads_len / stats.n_pages_with_holes);
+  fprintf(stdout, "Pages where an average-sized insert would:        "
+                  "%" PRIu64 "\n"
+                  "                                                  "
+                  "  [Reuse the list head: %" PRIu64 "]\n"
+                  "                                                  "
+                  "  [Use the heap top:    %" PRIu64 "]\n"
+                  "                                                  "
+                  "  [Reorganize the page: %" PRIu64 "]\n"
+                  "                                                  "
+                  "  [Split the page:      %" PRIu64 "]\n",
+                  stats.n_insert_head + stats.n_insert_heap +
+                  stats.n_insert_reorganize + stats.n_insert_split,
+                  stats.n_insert_head, stats.n_insert_heap,
+                  stats.n_insert_reorganize, stats.n_insert_split);
+  if (stats.n_pages_corrupt > 0) {
+    fprintf(stdout, "Pages with a broken free list:                    "
+                    "%" PRIu64 "\n", stats.n_pages_corrupt);
+  }
+  std::vector<std::string> labels =
+    HistogramLabels(LevelHistograms::N_LOG2_BUCKETS, false, true);
+  PrintHistogram("Freed record size (records):", stats.holes, labels);
+  PrintHistogram("First freed record size (pages):", stats.heads, labels);
+}
+
+static void PrintLevelHistograms(const std::vector<LevelHistograms>& levels) {
+  for (uint32_t level = levels.size(); level-- > 0;) {
+    const LevelHistograms& h = levels[level];
+    fprintf(stdout, "\n--------LEVEL %u HISTOGRAMS-------\n", level);
+    PrintHistogram("Page fill ratio (pages):", h.fill,
+                   HistogramLabels(LevelHistograms::N_FILL_BUCKETS,
+                                   true, false));
+    PrintHistogram("Records per page (pages):", h.n_recs,
+                   HistogramLabels(LevelHistograms::N_LOG2_BUCKETS,
+                                   false, true));
+    PrintHistogram("Garbage bytes (pages):", h.garbage,
+                   HistogramLabels(LevelHistograms::N_LOG2_BUCKETS,
+                                   false, true));
+    PrintHistogram("Records owned by a directory slot (slots):", h.n_owned,
+                   HistogramLabels(LevelHistograms::N_OWNED_BUCKETS,
+                                   false, false));
+  }
+}
+
+/*
+ * Every bucket is written, empty or not, so that consumers see the same
+ * shape for every index. Bounds are inclusive except for the fill ratio,
+ * whose buckets are [min_pct, max_pct).
+ */
+static void WriteLog2HistogramJSON(
+    rapidjson::Writer<rapidjson::StringBuffer>* json, const char* key,
+    const char* unit, const uint64_t* counts) {
+  json->Key(key);
+  json->StartArray();
+  for (uint32_t i = 0; i < LevelHistograms::N_LOG2_BUCKETS; i++) {
+    json->StartObject();
+    json->Key("min");
+    json->Uint(i == 0 ? 0 : 1U << (i - 1));
+    json->Key("max");
+    json->Uint(i == 0 ? 0 : (1U << i) - 1);
+    json->Key(unit);
+    json->Uint64(counts[i]);
+    json->EndObject();
+  }
+  json->EndArray();
+}
+
+static void WriteLevelHistogramsJSON(
+    rapidjson::Writer<rapidjson::StringBuffer>* json,
+    const std::vector<LevelHistograms>& levels) {
+  json->Key("levels");
+  json->StartArray();
+  for (uint32_t level = levels.size(); level-- > 0;) {
+    const LevelHistograms& h = levels[level];
+    json->StartObject();
+    json->Key("level");
+    json->Uint(level);
+    json->Key("pages");
+    json->Uint64(h.n_pages);
+    json->Key("fill_ratio");
+    json->StartArray();
+    for (uint32_t i = 0; i < LevelHistograms::N_FILL_BUCKETS; i++) {
+      json->StartObject();
+      json->Key("min_pct");
+      json->Uint(i * 100 / LevelHistograms::N_FILL_BUCKETS);
+      json->Key("max_pct");
+      json->Uint((i + 1) * 100 / LevelHistograms::N_FILL_BUCKETS);
+      json->Key("pages");
+      json->Uint64(h.fill[i]);
+      json->EndObject();
+    }
+    json->EndArray();
+    WriteLog2HistogramJSON(json, "records_per_page", "pages", h.n_recs);
+    WriteLog2HistogramJSON(json, "garbage_bytes", "pages", h.garbage);
+    json->Key("n_owned");
+    json->StartArray();
+    for (uint32_t i = 0; i + 1 < LevelHistograms::N_OWNED_BUCKETS; i++) {
+      json->StartObject();
+      json->Key("n_owned");
+      json->Uint(i);
+      json->Key("slots");
+      json->Uint64(h.n_owned[i]);
+      json->EndObject();
+    }
+    json->EndArray();
+    json->Key("invalid_slots");
+    json->Uint64(h.n_owned[LevelHistograms::N_OWNED_BUCKETS - 1]);
+    json->EndObject();
+  }
+  json->EndArray();
+}
+
+static void WriteFreeListStatsJSON(
+    rapidjson::Writer<rapidjson::StringBuffer>* json,
+    const FreeListStats& stats) {
+  json->Key("free_list");
+  json->StartObject();
+  json->Key("pages");
+  json->Uint64(stats.n_pages);
+  json->Key("pages_with_freed_records");
+  json->Uint64(stats.n_pages_with_holes);
+  json->Key("pages_corrupt");
+  json->Uint64(stats.n_pages_corrupt);
+  json->Key("freed_records");
+  json->Uint64(stats.n_holes);
+  json->Key("freed_bytes");
+  json->Uint64(stats.holes_len);
+  json->Key("page_garbage_bytes");
+  json->Uint64(stats.garbage);
+  json->Key("unlisted_garbage_bytes");
+  json->Uint64(stats.unlisted_garbage);
+  json->Key("largest_freed_record");
+  json->Uint(stats.max_hole_len);
+  json->Key("insert_reuses_head");
+  json->Uint64(stats.n_insert_head);
+  json->Key("insert_uses_heap");
+  json->Uint64(stats.n_insert_heap);
+  json->Key("insert_reorganizes");
+  json->Uint64(stats.n_insert_reorganize);
+  json->Key("insert_splits");
+  json->Uint64(stats.n_insert_split);
+  WriteLog2HistogramJSON(json, "freed_record_size", "records", stats.holes);
+  WriteLog2HistogramJSON(json, "first_freed_record_size", "pages",
+                         stats.heads);
+  json->EndObject();
+}
+
+bool ibdNinja::ParseIndexFast(uint32_t index_id) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to parse the index. "
+                "No index with ID %u was found", index_id);
+    return false;
+  }
+  if (page_map_entries_ == nullptr) {
+    ninja_error("--fast needs a page map, build it with --build-map");
+    return false;
+  }
+  std::vector<uint32_t> leftmost_pages;
+  if (!PageMapLeftmostPages(index, &leftmost_pages)) {
+    ninja_error("The page map doesn't describe index %s, "
+                "rebuild it with --build-map", index->name().c_str());
+    return false;
+  }
+
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  INDEX MAP SUMMARY                       "
+                  "                                        |\n");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Index name:                                       %s\n",
+                   index->name().c_str());
+  fprintf(stdout, "Index id:                                         %u\n",
+                   index->ib_id());
+  fprintf(stdout, "Belongs to:                                       %s.%s\n",
+                   index->table()->schema_ref().c_str(),
+                   index->table()->name().c_str());
+  fprintf(stdout, "Root page no:                                     %u\n",
+                   index->ib_page());
+  fprintf(stdout, "Num of levels:                                    %zu\n",
+                   leftmost_pages.size());
+  uint32_t level = leftmost_pages.size();
+  std::vector<uint32_t> pages;
+  for (auto leftmost_page_no : leftmost_pages) {
+    level--;
+    if (!PageMapLevelPages(index, leftmost_page_no, &pages)) {
+      ninja_error("The sibling links of level %u are broken in the page "
+                  "map, rebuild it with --build-map", level);
+      return false;
+    }
+    uint64_t n_recs = 0;
+    uint64_t garbage = 0;
+    for (auto page_no : pages) {
+      n_recs += page_map_entries_[page_no].n_recs;
+      garbage += page_map_entries_[page_no].garbage;
+    }
+    fprintf(stdout, "\n--------LEVEL %u--------\n", level);
+    fprintf(stdout, "Leftmost page no:                                 "
+                    "%u\n", leftmost_page_no);
+    fprintf(stdout, "Total pages count:                                "
+                    "%zu\n", pages.size());
+    fprintf(stdout, "Total records count:                              "
+                    "%" PRIu64 "\n", n_recs);
+    fprintf(stdout, "Total garbage size:                               "
+                    "%" PRIu64 " B\n", garbage);
+  }
+  PrintLeafLocality(pages, read_ahead_pages());
+  return true;
+}
+
+uint64_t ibdNinja::SDIFetchUncompBlob(uint32_t first_blob_page_no,
+                                      uint64_t total_off_page_length,
+                                      const SDIChunkVisitor& visitor,
+                                      uint32_t* n_ext_pages,
+                                      bool* error) {
+  unsigned char page_buf[UNIV_PAGE_SIZE_MAX];
+  uint64_t calc_length = 0;
+  uint64_t part_len;
+  uint32_t next_page_no = first_blob_page_no;
+  *error = false;
+  *n_ext_pages = 0;
+
+  do {
+    uint32_t bytes = ReadPage(next_page_no, page_buf);
+    *n_ext_pages += 1;
+    if (bytes != g_page_physical_size) {
+      ninja_error("Failed to read BLOB page: %u, error: %d(%s)",
+              next_page_no, errno, strerror(errno));
+      *error = true;
+      break;
+    }
+
+    if (PageGetType(page_buf) != FIL_PAGE_SDI_BLOB) {
+      ninja_error("Unexpected BLOB page type: %u (%u)",
+                      PageGetType(page_buf), FIL_PAGE_SDI_BLOB);
+      *error = true;
+      break;
+    }
+
+    part_len =
+        ReadFrom4B(page_buf + FIL_PAGE_DATA + LOB_HDR_PART_LEN);
+
+    if (part_len > g_page_physical_size - FIL_PAGE_DATA - LOB_HDR_SIZE ||
+        !visitor(page_buf + FIL_PAGE_DATA + LOB_HDR_SIZE,
+                 static_cast<uint32_t>(part_len))) {
+      *error = true;
+      break;
+    }
+
+    calc_length += part_len;
+
+    next_page_no =
+        ReadFrom4B(page_buf + FIL_PAGE_DATA + LOB_HDR_NEXT_PAGE_NO);
+
+    if (next_page_no <= SDI_BLOB_ALLOWED) {
+      ninja_error("Failed to get next BLOB page: %u", next_page_no);
+      *error = true;
+      break;
+    }
+  } while (next_page_no != FIL_NULL);
+
+  if (!*error) {
+    assert(calc_length == total_off_page_length);
+  }
+  return calc_length;
+}
+
+/*
+ * Appends the off-page part of an external value, given its 20 byte
+ * reference, to *value. MySQL 8.0 stores it in a LOB whose first page lists
+ * the pages holding the data, in order, with how much each holds (the first
+ * page holds some itself); values written before 8.0 are a chain of BLOB
+ * pages instead. Compressed LOBs are not supported. Returns false if the
+ * value cannot be read completely.
+ */
+bool ibdNinja::ReadExternalValue(const unsigned char* ext_ref,
+                                 std::string* value) {
+  uint32_t page_no = ReadFrom4B(ext_ref + BTR_EXTERN_PAGE_NO);
+  uint64_t ext_len = ReadFrom4B(ext_ref + BTR_EXTERN_LEN + 4);
+  size_t begin = value->size();
+  std::vector<unsigned char> bufs(3 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* first_buf = bufs.data();
+  unsigned char* entry_buf = first_buf + UNIV_PAGE_SIZE_MAX;
+  unsigned char* data_buf = entry_buf + UNIV_PAGE_SIZE_MAX;
+  if (page_no == FIL_NULL ||
+      ReadPage(page_no, first_buf) != g_page_physical_size) {
+    return false;
+  }
+
+  if (PageGetType(first_buf) == FIL_PAGE_TYPE_BLOB) {
+    unsigned char* buf = first_buf;
+    while (true) {
+      uint32_t part_len = ReadFrom4B(buf + FIL_PAGE_DATA + LOB_HDR_PART_LEN);
+      if (part_len > g_page_logical_size - FIL_PAGE_DATA - LOB_HDR_SIZE ||
+          value->size() - begin + part_len > ext_len) {
+        return false;
+      }
+      value->append(reinterpret_cast<const char*>(buf) + FIL_PAGE_DATA +
+                    LOB_HDR_SIZE, part_len);
+      uint32_t next_page_no =
+          ReadFrom4B(buf + FIL_PAGE_DATA + LOB_HDR_NEXT_PAGE_NO);
+      if (next_page_no == FIL_NULL) {
+        break;
+      }
+      buf = data_buf;
+      if (ReadPage(next_page_no, buf) != g_page_physical_size ||
+          PageGetType(buf) != FIL_PAGE_TYPE_BLOB) {
+        return false;
+      }
+    }
+    return value->size() - begin == ext_len;
+  }
+
+  if (PageGetType(first_buf) != FIL_PAGE_TYPE_LOB_FIRST) {
+    return false;
+  }
+  // The first page has 10 index entries per 16KiB of page size
+  uint32_t first_data_offset = LOB_FIRST_PAGE_DATA +
+      g_page_logical_size * 10 / (16 * 1024) * LOB_INDEX_ENTRY_SIZE;
+  uint32_t entry_page_no = FIL_NULL;
+  const unsigned char* addr = first_buf + LOB_FIRST_INDEX_LIST + FLST_FIRST;
+  for (uint64_t n_entries = 0;
+       ReadFrom4B(addr + FIL_ADDR_PAGE) != FIL_NULL; n_entries++) {
+    uint32_t addr_page_no = ReadFrom4B(addr + FIL_ADDR_PAGE);
+    uint32_t addr_offset = ReadFrom2B(addr + FIL_ADDR_BYTE);
+    if (n_entries > ext_len ||
+        addr_offset + LOB_INDEX_ENTRY_SIZE > g_page_logical_size) {
+      return false;
+    }
+    // The entries past the first page live in LOB index pages
+    const unsigned char* entry_page = first_buf;
+    if (addr_page_no != page_no) {
+      if (addr_page_no != entry_page_no &&
+          (ReadPage(addr_page_no, entry_buf) != g_page_physical_size ||
+           PageGetType(entry_buf) != FIL_PAGE_TYPE_LOB_INDEX)) {
+        return false;
+      }
+      entry_page_no = addr_page_no;
+      entry_page = entry_buf;
+    }
+    const unsigned char* entry = entry_page + addr_offset;
+    uint32_t data_page_no = ReadFrom4B(entry + LOB_INDEX_ENTRY_PAGE_NO);
+    uint32_t data_len = ReadFrom4B(entry + LOB_INDEX_ENTRY_DATA_LEN);
+    const unsigned char* data_page = first_buf;
+    uint32_t data_offset = first_data_offset;
+    if (data_page_no != page_no) {
+      if (ReadPage(data_page_no, data_buf) != g_page_physical_size ||
+          PageGetType(data_buf) != FIL_PAGE_TYPE_LOB_DATA) {
+        return false;
+      }
+      data_page = data_buf;
+      data_offset = LOB_DATA_PAGE_DATA;
+    }
+    if (data_offset + data_len > g_page_logical_size - FIL_PAGE_DATA_END ||
+        value->size() - begin + data_len > ext_len) {
+      return false;
+    }
+    value->append(reinterpret_cast<const char*>(data_page) + data_offset,
+                  data_len);
+    addr = entry + FLST_NEXT;
+  }
+  return value->size() - begin == ext_len;
+}
+
+unsigned char* ibdNinja::GetFirstUserRec(unsigned char* buf) {
+  uint32_t next_rec_off_t =
+            ReadFrom2B(buf + PAGE_NEW_INFIMUM - REC_OFF_NEXT);
+
+  assert(PAGE_NEW_INFIMUM + next_rec_off_t != PAGE_NEW_SUPREMUM);
+
+  if (next_rec_off_t > g_page_physical_size) {
+    assert(0);
+    return (nullptr);
+  }
+
+  if (memcmp(buf + PAGE_NEW_INFIMUM, "infimum", strlen("infimum")) != 0) {
+    ninja_error("Found corrupt INFIMUM");
+    return nullptr;
+  }
+
+  unsigned char* current_rec = buf + PAGE_NEW_INFIMUM + next_rec_off_t;
+
+  assert(static_cast<uint32_t>(current_rec - buf) <= g_page_physical_size);
+
+  bool is_comp = PageIsCompact(buf);
+
+  // TODO(Zhao): Support redundant row format
+  assert(is_comp);
+
+  return current_rec;
+}
+
+unsigned char* ibdNinja::GetNextRecInPage(unsigned char* current_rec,
+                                          unsigned char* buf,
+                                          bool* corrupt) {
+  *corrupt = false;
+  uint32_t page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
+  bool is_comp = PageIsCompact(buf);
+  uint32_t next_rec_offset = RecGetNextOffs(current_rec, is_comp);
+
+  if (next_rec_offset == 0) {
+    ninja_error("Record is corrupt");
+    *corrupt = true;
+    assert(0);
+    return nullptr;
+  }
+
+  unsigned char* next_rec = buf + next_rec_offset;
+
+  assert(static_cast<uint32_t>(next_rec - buf) <= g_page_physical_size);
+
+  if (RecGetType(next_rec) == REC_STATUS_SUPREMUM) {
+    if (memcmp(next_rec, "supremum", strlen("supremum")) != 0) {
+      ninja_error("Found corrupt SUPREMUM on page %u", page_no);
+      *corrupt = false;
+    }
+
+    uint32_t supremum_next_rec_off = ReadFrom2B(next_rec - REC_OFF_NEXT);
+
+    if (supremum_next_rec_off != 0) {
+      ninja_error("Found corrupt next rec of SUPREMUM on page %u", page_no);
+      *corrupt = false;
+    }
+    return nullptr;
+  }
+
+  *corrupt = false;
+
+  return next_rec;
+}
+
+ssize_t ibdNinja::ReadPage(uint32_t page_no, unsigned char* buf) {
+  assert(buf != nullptr);
+  memset(buf, 0, g_page_physical_size);
+  off_t offset = page_no * g_page_physical_size;
+  ssize_t n_bytes_read = pread(g_fd, buf, g_page_physical_size, offset);
+
+  // TODO(Zhao): Support compressed page
+  return n_bytes_read;
+}
+
+bool ibdNinja::ParsePage(uint32_t page_no,
+                         PageAnalysisResult* result_aggr,
+                         bool print,
+                         bool print_record) {
+  if (page_no >= n_pages_) {
+    ninja_error("Page number %u is too large", page_no);
+    return false;
+  }
+
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  ssize_t bytes = ReadPage(page_no, buf);
+  if (bytes != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+            page_no, errno, strerror(errno));
+    return false;
+  }
+  if (memcmp(
+          buf + FIL_PAGE_LSN + 4,
+          buf + g_page_logical_size - FIL_PAGE_END_LSN_OLD_CHKSUM + 4,
+          4)) {
+    ninja_error("The LSN on page %u is inconsistent", page_no);
+    return false;
+  }
+
+  uint32_t type = ReadFrom2B(buf + FIL_PAGE_TYPE);
+  if (type != FIL_PAGE_INDEX) {
+    fprintf(stderr, "[ibdNinja] Currently, only INDEX pages are supported. "
+                "Support for other types (e.g., '%s') will be added soon\n",
+                PageType2String(type).c_str());
+    return false;
+  }
+
+  uint32_t page_no_in_fil_header = ReadFrom4B(buf + FIL_PAGE_OFFSET);
+  assert(page_no_in_fil_header == page_no);
+  uint32_t prev_page_no = ReadFrom4B(buf + FIL_PAGE_PREV);
+  uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+  uint32_t space_id = ReadFrom4B(buf + FIL_PAGE_ARCH_LOG_NO_OR_SPACE_ID);
+  uint32_t lsn = ReadFrom8B(buf + FIL_PAGE_LSN);
+  uint32_t flush_lsn = ReadFrom8B(buf + FIL_PAGE_FILE_FLUSH_LSN);
+
+  uint32_t n_dir_slots = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIR_SLOTS);
+  uint32_t heap_top = ReadFrom2B(buf + PAGE_HEADER + PAGE_HEAP_TOP);
+  uint32_t n_heap = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_HEAP);
+  n_heap = (n_heap & 0x7FFF);
+  uint32_t free = ReadFrom2B(buf + PAGE_HEADER + PAGE_FREE);
+  uint32_t garbage = ReadFrom2B(buf + PAGE_HEADER + PAGE_GARBAGE);
+  uint32_t last_insert = ReadFrom2B(buf + PAGE_HEADER + PAGE_LAST_INSERT);
+  uint32_t direction = ReadFrom2B(buf + PAGE_HEADER + PAGE_DIRECTION);
+  uint32_t n_direction = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIRECTION);
+  uint32_t n_recs = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_RECS);
+  uint32_t max_trx_id = ReadFrom2B(buf + PAGE_HEADER + PAGE_MAX_TRX_ID);
+  uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
+  uint64_t index_id = ReadFrom8B(buf + PAGE_HEADER + PAGE_INDEX_ID);
+
+  bool index_not_found = false;
+  Index* index = IndexOfPage(page_no, buf);
+  if (index == nullptr) {
+    ninja_error("Unable find index %" PRIu64 " in the loaded indexes",
+            index_id);
+    index_not_found = true;
+  }
+
+  ninja_pt(print, "=========================================="
+                  "==========================================\n");
+  ninja_pt(print, "|  PAGE INFORMATION                       "
+                  "                                         |\n");
+  ninja_pt(print, "------------------------------------------"
+                  "------------------------------------------\n");
+  ninja_pt(print, "    Page no:           %u\n", page_no);
+  if (prev_page_no != FIL_NULL) {
+    ninja_pt(print, "    Slibling pages no: %u ", prev_page_no);
+  } else {
+    ninja_pt(print, "    Slibling pages no: NULL ");
+  }
+  ninja_pt(print, "[%u] ", page_no_in_fil_header);
+  if (next_page_no != FIL_NULL) {
+    ninja_pt(print, "%u\n", next_page_no);
+  } else {
+    ninja_pt(print, "NULL\n");
+  }
+  ninja_pt(print, "    Space id:          %u\n", space_id);
+  ninja_pt(print, "    Page type:         %s\n", PageType2String(type).c_str());
+  ninja_pt(print, "    Lsn:               %u\n", lsn);
+  ninja_pt(print, "    FLush lsn:         %u\n", flush_lsn);
+  ninja_pt(print, "    -------------------\n");
+  ninja_pt(print, "    Page level:        %u\n", page_level);
+  ninja_pt(print, "    Page size:         [logical: %u B], [physical: %u B]\n",
+                       g_page_logical_size,
+                       g_page_physical_size);
+  ninja_pt(print, "    Number of records: %u\n", n_recs);
+  ninja_pt(print, "    Index id:          %" PRIu64 "\n", index_id);
+  if (!index_not_found) {
+  ninja_pt(print, "    Belongs to:        [table: %s.%s], [index: %s]\n",
+                       index->table()->schema_ref().c_str(),
+                       index->table()->name().c_str(),
+                       index->name().c_str());
+  ninja_pt(print, "    Row format:        %s\n",
+                       index->table()->RowFormatString().c_str());
+  }
+  ninja_pt(print, "    Number dir slots:  %u\n", n_dir_slots);
+  ninja_pt(print, "    Heap top:          %u\n", heap_top);
+  ninja_pt(print, "    Number of heap:    %u\n", n_heap);
+  ninja_pt(print, "    First free rec:    %u\n", free);
+  ninja_pt(print, "    Garbage:           %u B\n", garbage);
+  ninja_pt(print, "    Last insert:       %u\n", last_insert);
+  ninja_pt(print, "    Direction:         %u\n", direction);
+  ninja_pt(print, "    Number direction:  %u\n", n_direction);
+  ninja_pt(print, "    Max trx id:        %u\n", max_trx_id);
+
+  ninja_pt(print, "\n");
+
+  if (index_not_found) {
+    ninja_warn("Skipping record parsing");
+    return false;
+  }
+
+  if (!index->IsIndexParsingRecSupported()) {
+    ninja_warn("Skipping record parsing");
+    return false;
+  }
+
+  bool print_rec = print & print_record;
+  ninja_pt(print_rec, "=========================================="
+                  "==========================================\n");
+  ninja_pt(print_rec, "|  RECORDS INFORMATION                    "
+                  "                                         |\n");
+  ninja_pt(print_rec, "------------------------------------------"
+                  "------------------------------------------\n");
+  uint32_t i = 0;
+  unsigned char* current_rec = nullptr;
+  PageAnalysisResult result;
+  if (n_recs > 0) {
+    current_rec = GetFirstUserRec(buf);
+    bool corrupt = false;
+    while (current_rec != nullptr && corrupt != true) {
+      i++;
+      Record rec(current_rec, index);
+      rec.GetColumnOffsets();
+      rec.ParseRecord(page_level == 0, i, &result,
+                      print_rec);
+      current_rec = GetNextRecInPage(current_rec, buf, &corrupt);
+    }
+    if (corrupt != true) {
+      assert(i == n_recs);
+    }
+  } else {
+    ninja_pt(print_rec, "No record\n");
+  }
+
+
+  ninja_pt(print, "=========================================="
+      "==========================================\n");
+  ninja_pt(print, "|  PAGE ANALYSIS RESULT                    "
+      "                                         |\n");
+  ninja_pt(print, "------------------------------------------"
+      "------------------------------------------\n");
+  if (page_level == 0) {
+    ninja_pt(print, "Total valid records count:                %u\n",
+        result.n_recs_leaf);
+    ninja_pt(print, "Total valid records size:                 %u B\n"
+        "                                            "
+        "[Headers: %u B]\n"
+        "                                            "
+        "[Bodies:  %u B]\n",
+        result.headers_len_leaf + result.recs_len_leaf,
+        result.headers_len_leaf, result.recs_len_leaf);
+    ninja_pt(print, "Valid records to page space ratio:        "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          (result.headers_len_leaf +
+           result.recs_len_leaf)) /
+        g_page_physical_size * 100);
+
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Total records with dropped columns count: %u\n",
+        result.n_contain_dropped_cols_recs_leaf);
+    ninja_pt(print, "Total instant dropped columns size:       %u B\n",
+        result.dropped_cols_len_leaf);
+    ninja_pt(print, "Dropped columns to page space ratio:      "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.dropped_cols_len_leaf) /
+        g_page_physical_size * 100);
+
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Total delete-marked records count:        %u\n",
+        result.n_deleted_recs_leaf);
+    ninja_pt(print, "Total delete-marked records size:         %u B\n",
+        result.deleted_recs_len_leaf);
+    ninja_pt(print, "Delete-marked recs to page space ratio:   "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.deleted_recs_len_leaf) /
+        g_page_physical_size * 100);
+
+    result.innodb_internal_used_leaf =
+      PAGE_NEW_SUPREMUM_END + result.headers_len_leaf +
+      n_dir_slots * PAGE_DIR_SLOT_SIZE  + FIL_PAGE_DATA_END;
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Total InnoDB internal space used:         %u B\n"
+        "                                            "
+        "[FIL HEADER     38 B]\n"
+        "                                            "
+        "[PAGE HEADER    36 B]\n"
+        "                                            "
+        "[FSEG HEADER    20 B]\n"
+        "                                            "
+        "[INFI + SUPRE   26 B]\n"
+        "                                            "
+        "[RECORD HEADERS %u B]*\n"
+        "                                            "
+        "[PAGE DIRECTORY %u B]\n"
+        "                                            "
+        "[FIL TRAILER    8 B]\n",
+        result.innodb_internal_used_leaf,
+        result.headers_len_leaf,
+        n_dir_slots * PAGE_DIR_SLOT_SIZE);
+    ninja_pt(print, "InnoDB internals to page space ratio:     "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.innodb_internal_used_leaf) /
+        g_page_physical_size * 100);
+
+    ninja_pt(print, "\n");
+    result.free_leaf = garbage + UNIV_PAGE_SIZE - PAGE_DIR -
+      n_dir_slots * PAGE_DIR_SLOT_SIZE - heap_top;
+    ninja_pt(print, "Total free space:                         %u B\n",
+        result.free_leaf);
+    ninja_pt(print, "Free space ratio:                         "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.free_leaf) /
+        g_page_physical_size * 100);
+  } else {
+    ninja_pt(print, "Total valid records count:               %u\n",
+        result.n_recs_non_leaf);
     ninja_pt(print, "Total valid records size:                %u B\n"
         "                                           "
         "[Headers: %u B]\n"
@@ -3610,485 +9425,3810 @@ bool ibdNinja::ParsePage(uint32_t page_no,
     ninja_pt(print, "Valid records to page space ratio:       "
         "%02.05lf %%\n",
         static_cast<double>(
-          (result.headers_len_non_leaf +
-           result.recs_len_non_leaf)) /
-        g_page_physical_size * 100);
+          (result.headers_len_non_leaf +
+           result.recs_len_non_leaf)) /
+        g_page_physical_size * 100);
+
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Total delete-marked records count:       %u\n",
+        result.n_deleted_recs_non_leaf);
+    ninja_pt(print, "Total delete-marked records size:        %u B\n",
+        result.deleted_recs_len_non_leaf);
+    ninja_pt(print, "Delete-marked recs to page space ratio:  "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.deleted_recs_len_non_leaf) /
+        g_page_physical_size * 100);
+
+    assert(result.n_contain_dropped_cols_recs_non_leaf == 0);
+    assert(result.dropped_cols_len_non_leaf == 0);
+
+    result.innodb_internal_used_non_leaf =
+      PAGE_NEW_SUPREMUM_END + result.headers_len_non_leaf +
+      n_dir_slots * PAGE_DIR_SLOT_SIZE  + FIL_PAGE_DATA_END;
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Total innoDB internal space used:        %u B\n"
+        "                                           "
+        "[FIL HEADER     38 B]\n"
+        "                                           "
+        "[PAGE HEADER    36 B]\n"
+        "                                           "
+        "[FSEG HEADER    20 B]\n"
+        "                                           "
+        "[INFI + SUPRE   26 B]\n"
+        "                                           "
+        "[RECORD HEADERS %u B]*\n"
+        "                                           "
+        "[PAGE DIRECTORY %u B]\n"
+        "                                           "
+        "[FIL TRAILER    8 B]\n",
+        result.innodb_internal_used_non_leaf,
+        result.headers_len_non_leaf,
+        n_dir_slots * PAGE_DIR_SLOT_SIZE);
+    ninja_pt(print, "InnoDB internals to page space ratio:    "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.innodb_internal_used_non_leaf) /
+        g_page_physical_size * 100);
+
+    ninja_pt(print, "\n");
+    result.free_non_leaf = garbage + UNIV_PAGE_SIZE - PAGE_DIR -
+      n_dir_slots * PAGE_DIR_SLOT_SIZE - heap_top;
+    ninja_pt(print, "Total free space:                        %u B\n",
+        result.free_non_leaf);
+    ninja_pt(print, "Free space ratio:                        "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          result.free_non_leaf) /
+        g_page_physical_size * 100);
+  }
+  if (print) {
+    FreeListStats free_list;
+    const char* free_list_error = nullptr;
+    if (!free_list.AddPage(index, buf, &free_list_error)) {
+      ninja_warn("Found a broken free list on page %u: %s",
+                 page_no, free_list_error);
+    }
+    ninja_pt(print, "\n");
+    ninja_pt(print, "Freed records (PAGE_FREE list):           %" PRIu64
+        "\n", free_list.n_holes);
+    ninja_pt(print, "Freed records size:                       %" PRIu64
+        " B\n"
+        "                                            "
+        "[Largest: %u B]\n"
+        "                                            "
+        "[Reused by the next insert if it fits: %u B]\n",
+        free_list.holes_len, free_list.max_hole_len,
+        static_cast<uint32_t>(free_list.heads_len));
+  }
+  // aggregate the page result to the index result
+  if (result_aggr != nullptr) {
+    result_aggr->n_recs_non_leaf +=
+      result.n_recs_non_leaf;
+    result_aggr->n_recs_leaf +=
+      result.n_recs_leaf;
+    result_aggr->headers_len_non_leaf +=
+      result.headers_len_non_leaf;
+    result_aggr->headers_len_leaf +=
+      result.headers_len_leaf;
+    result_aggr->recs_len_non_leaf +=
+      result.recs_len_non_leaf;
+    result_aggr->recs_len_leaf +=
+      result.recs_len_leaf;
+    result_aggr->n_deleted_recs_non_leaf +=
+      result.n_deleted_recs_non_leaf;
+    result_aggr->n_deleted_recs_leaf +=
+      result.n_deleted_recs_leaf;
+    result_aggr->deleted_recs_len_non_leaf +=
+      result.deleted_recs_len_non_leaf;
+    result_aggr->deleted_recs_len_leaf +=
+      result.deleted_recs_len_leaf;
+    result_aggr->n_contain_dropped_cols_recs_non_leaf +=
+      result.n_contain_dropped_cols_recs_non_leaf;
+    result_aggr->n_contain_dropped_cols_recs_leaf +=
+      result.n_contain_dropped_cols_recs_leaf;
+    result_aggr->dropped_cols_len_non_leaf +=
+      result.dropped_cols_len_non_leaf;
+    result_aggr->dropped_cols_len_leaf +=
+      result.dropped_cols_len_leaf;
+    result_aggr->innodb_internal_used_non_leaf +=
+      result.innodb_internal_used_non_leaf;
+    result_aggr->innodb_internal_used_leaf +=
+      result.innodb_internal_used_leaf;
+    result_aggr->free_non_leaf +=
+      result.free_non_leaf;
+    result_aggr->free_leaf +=
+      result.free_leaf;
+  }
+
+  return true;
+}
+
+bool ibdNinja::ToLeftmostLeaf(Index* index,
+                              unsigned char* buf, uint32_t root,
+                              std::vector<uint32_t>* leaf_pages_no) {
+  if (!index->IsIndexParsingRecSupported()) {
+    // ninja_warn("Skip getting leftmost pages");
+    return false;
+  }
+  uint32_t bytes = ReadPage(root, buf);
+  if (bytes != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+            root, errno, strerror(errno));
+    return false;
+  }
+  uint32_t curr_page_no = root;
+  leaf_pages_no->push_back(curr_page_no);
+
+  uint32_t page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
+  // uint32_t n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
+
+  unsigned char* current_rec = nullptr;
+  while (page_level != 0) {
+    current_rec = GetFirstUserRec(buf);
+    if (current_rec == nullptr) {
+      break;
+    }
+    Record record(current_rec, index);
+    record.GetColumnOffsets();
+    uint32_t child_page_no = record.GetChildPageNo();
+
+    uint64_t curr_page_level = page_level;
+
+    bytes = ReadPage(child_page_no, buf);
+    if (bytes != g_page_physical_size) {
+      ninja_error("Failed to read page: %u, error: %d(%s)",
+              child_page_no, errno, strerror(errno));
+      return false;
+    }
+    page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
+
+    if (page_level != curr_page_level - 1) {
+      break;
+    }
+    curr_page_no = child_page_no;
+    leaf_pages_no->push_back(curr_page_no);
+  }
+
+  if (page_level != 0) {
+    ninja_error("Failed to find leatmost page");
+    return false;
+  }
+  return true;
+}
+
+bool ibdNinja::ParseIndex(uint32_t index_id) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to parse the index. "
+                "No index with ID %u was found", index_id);
+    return false;
+  }
+  return ParseIndex(index);
+}
+
+bool ibdNinja::ParseIndex(Index* index) {
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+
+  uint32_t page_no = index->ib_page();
+  std::vector<uint32_t> left_pages_no;
+  bool ret = ToLeftmostLeaf(index, buf, page_no, &left_pages_no);
+  if (!ret) {
+    return false;
+  }
+  uint32_t n_levels = left_pages_no.size();
+  IndexAnalyzeResult index_result;
+  index_result.histograms.resize(n_levels);
+  std::vector<uint32_t> leaf_pages;
+  // Keep stdout for the JSON document only
+  FILE* progress = json_analysis_ ? stderr : stdout;
+  fprintf(progress, "\n");
+  for (auto iter : left_pages_no) {
+    fprintf(progress, "Analyzing index %s at level %u...\n",
+                      index->name().c_str(), --n_levels);
+    index_result.n_level++;
+    uint32_t current_page_no = iter;
+    uint32_t next_page_no = FIL_NULL;
+    do {
+      ssize_t bytes = ReadPage(current_page_no, buf);
+      if (bytes != g_page_physical_size) {
+        ninja_error("Failed to read page: %u, error: %d(%s)",
+            current_page_no, errno, strerror(errno));
+        return false;
+      }
+      uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
+      if (page_level > 0) {
+        index_result.n_pages_non_leaf++;
+      } else {
+        index_result.n_pages_leaf++;
+        leaf_pages.push_back(current_page_no);
+      }
+      if (page_level < index_result.histograms.size()) {
+        index_result.histograms[page_level].AddPage(buf);
+      }
+      const char* free_list_error = nullptr;
+      if (!index_result.free_list.AddPage(index, buf, &free_list_error)) {
+        ninja_warn("Found a broken free list on page %u: %s",
+                   current_page_no, free_list_error);
+      }
+      bool ret = ParsePage(current_page_no, &(index_result.recs_result),
+                           false, true);
+      if (!ret) {
+        ninja_error("Error occurred while parsing page %u at level %u, "
+                    "Skipping analysis for this level.",
+                    current_page_no, n_levels);
+        break;
+      }
+      next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+      current_page_no = next_page_no;
+    } while (current_page_no != FIL_NULL);
+  }
+  if (json_analysis_) {
+    rapidjson::StringBuffer json_buf;
+    rapidjson::Writer<rapidjson::StringBuffer> json(json_buf);
+    std::string table_name = index->table()->schema_ref() + "." +
+                             index->table()->name();
+    json.StartObject();
+    json.Key("index");
+    json.String(index->name().c_str());
+    json.Key("index_id");
+    json.Uint(index->ib_id());
+    json.Key("table");
+    json.String(table_name.c_str());
+    json.Key("root_page_no");
+    json.Uint(index->ib_page());
+    json.Key("page_size");
+    json.Uint(g_page_physical_size);
+    json.Key("n_levels");
+    json.Uint(index_result.n_level);
+    json.Key("n_pages_non_leaf");
+    json.Uint(index_result.n_pages_non_leaf);
+    json.Key("n_pages_leaf");
+    json.Uint(index_result.n_pages_leaf);
+    json.Key("n_recs_leaf");
+    json.Uint(index_result.recs_result.n_recs_leaf);
+    WriteLevelHistogramsJSON(&json, index_result.histograms);
+    WriteFreeListStatsJSON(&json, index_result.free_list);
+    json.EndObject();
+    fprintf(stdout, "%s\n", json_buf.GetString());
+    return ret;
+  }
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  INDEX ANALYSIS RESULT                   "
+                  "                                         |\n");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Index name:                                       %s\n",
+                   index->name().c_str());
+  fprintf(stdout, "Index id:                                         %u\n",
+                   index->ib_id());
+  fprintf(stdout, "Belongs to:                                       %s.%s\n",
+                   index->table()->schema_ref().c_str(),
+                   index->table()->name().c_str());
+  fprintf(stdout, "Root page no:                                     %u\n",
+                   index->ib_page());
+  fprintf(stdout, "Num of fields(ALL):                               %u\n",
+                   index->GetNFields());
+  assert(left_pages_no.size() == index_result.n_level);
+  fprintf(stdout, "Num of levels:                                    %u\n",
+                   index_result.n_level);
+  fprintf(stdout, "Num of pages:                                     %u\n"
+                  "                                                  "
+                  "  [Non leaf pages: %u]\n"
+                  "                                                  "
+                  "  [Leaf pages:     %u]\n",
+                   index_result.n_pages_non_leaf + index_result.n_pages_leaf,
+                   index_result.n_pages_non_leaf, index_result.n_pages_leaf);
+  if (index_result.n_level > 1) {
+    uint32_t total_pages_size = index_result.n_pages_non_leaf *
+                                g_page_physical_size;
+    // Print non-leaf pages statistic
+    fprintf(stdout, "\n--------NON-LEAF-LEVELS--------\n");
+    fprintf(stdout, "Total pages count:                                "
+                    "%u\n",
+                     index_result.n_pages_non_leaf);
+    fprintf(stdout, "Total pages size:                                 "
+                    "%u B\n",
+                     total_pages_size);
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Total valid records count:                        "
+                    "%u\n",
+                     index_result.recs_result.n_recs_non_leaf);
+    fprintf(stdout, "Total valid records size:                         "
+                    "%u B\n"
+                    "                                                  "
+                    "  [Headers: %u B]\n"
+                    "                                                  "
+                    "  [Bodies:  %u B]\n",
+                     index_result.recs_result.headers_len_non_leaf +
+                     index_result.recs_result.recs_len_non_leaf,
+                     index_result.recs_result.headers_len_non_leaf,
+                     index_result.recs_result.recs_len_non_leaf);
+    fprintf(stdout, "Valid records to non-leaf pages space ratio:      "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          (index_result.recs_result.headers_len_non_leaf +
+           index_result.recs_result.recs_len_non_leaf)) /
+        total_pages_size * 100);
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Total delete-marked records count:                "
+                    "%u\n",
+                     index_result.recs_result.n_deleted_recs_non_leaf);
+    fprintf(stdout, "Total delete-marked records size:                 "
+                     "%u B\n",
+                     index_result.recs_result.deleted_recs_len_non_leaf);
+    fprintf(stdout, "Delete-marked recs to non-leaf pages space ratio: "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          index_result.recs_result.deleted_recs_len_non_leaf) /
+        total_pages_size * 100);
+
+    assert(index_result.recs_result.n_contain_dropped_cols_recs_non_leaf == 0);
+    assert(index_result.recs_result.dropped_cols_len_non_leaf == 0);
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Total Innodb internal space used:                 "
+                    "%u B\n",
+                    index_result.recs_result.innodb_internal_used_non_leaf);
+    fprintf(stdout, "InnoDB internals to non-leaf pages space ratio:   "
+        "%02.05lf %%\n",
+        static_cast<double>(
+          index_result.recs_result.innodb_internal_used_non_leaf) /
+        total_pages_size * 100);
+
+    fprintf(stdout, "\n");
+    fprintf(stdout, "Total free space:                                 "
+                    "%u B\n",
+                    index_result.recs_result.free_non_leaf);
+    fprintf(stdout, "Free space ratio:                                 "
+                    "%02.05lf %%\n",
+                     static_cast<double>(
+                      index_result.recs_result.free_non_leaf) /
+                      total_pages_size * 100);
+  }
+  uint32_t total_pages_size = index_result.n_pages_leaf * g_page_physical_size;
+  fprintf(stdout, "\n--------LEAF-LEVEL---------------\n");
+  fprintf(stdout, "Total pages count:                                "
+                  "%u\n",
+                   index_result.n_pages_leaf);
+  fprintf(stdout, "Total pages size:                                 "
+                  "%u B\n",
+                   total_pages_size);
+  fprintf(stdout, "\n");
+  fprintf(stdout, "Total valid records count:                        "
+                  "%u\n",
+                   index_result.recs_result.n_recs_leaf);
+  fprintf(stdout, "Total valid records size:                         "
+                  "%u B\n"
+                  "                                                  "
+                  "  [Headers: %u B]\n"
+                  "                                                  "
+                  "  [Bodies:  %u B]\n",
+                   index_result.recs_result.headers_len_leaf +
+                   index_result.recs_result.recs_len_leaf,
+                   index_result.recs_result.headers_len_leaf,
+                   index_result.recs_result.recs_len_leaf);
+  fprintf(stdout, "Valid records to leaf pages space ratio:          "
+                  "%02.05lf %%\n",
+                   static_cast<double>(
+                   (index_result.recs_result.headers_len_leaf +
+                    index_result.recs_result.recs_len_leaf)) /
+                    total_pages_size * 100);
+
+  fprintf(stdout, "\n");
+  fprintf(stdout, "Total records with instant dropped columns count: "
+                  "%u\n",
+                   index_result.recs_result.n_contain_dropped_cols_recs_leaf);
+  fprintf(stdout, "Total instant dropped columns size:               "
+                  "%u B\n",
+                   index_result.recs_result.dropped_cols_len_leaf);
+  fprintf(stdout, "Dropped columns to leaf pages space ratio:        "
+                  "%02.05lf %%\n",
+                   static_cast<double>(
+                    index_result.recs_result.dropped_cols_len_leaf) /
+                    total_pages_size * 100);
+
+  fprintf(stdout, "\n");
+  fprintf(stdout, "Total delete-marked records count:                "
+                  "%u\n",
+                   index_result.recs_result.n_deleted_recs_leaf);
+  fprintf(stdout, "Total delete-marked records size:                 "
+                   "%u B\n",
+                   index_result.recs_result.deleted_recs_len_leaf);
+  fprintf(stdout, "Delete-marked records to leaf pages space ratio:  "
+                  "%02.05lf %%\n",
+                   static_cast<double>(
+                    index_result.recs_result.deleted_recs_len_leaf) /
+                    total_pages_size * 100);
+
+  fprintf(stdout, "\n");
+  fprintf(stdout, "Total Innodb internal space used:                 "
+                  "%u B\n",
+                   index_result.recs_result.innodb_internal_used_leaf);
+  fprintf(stdout, "InnoDB internal space to leaf pages space ratio:  "
+                  "%02.05lf %%\n",
+                   static_cast<double>(
+                    index_result.recs_result.innodb_internal_used_leaf) /
+                    total_pages_size * 100);
+
+  fprintf(stdout, "\n");
+  fprintf(stdout, "Total free space:                                 "
+                  "%u B\n",
+                   index_result.recs_result.free_leaf);
+  fprintf(stdout, "Free space ratio:                                 "
+                  "%02.05lf %%\n",
+                   static_cast<double>(
+                    index_result.recs_result.free_leaf) /
+                    total_pages_size * 100);
+  PrintFreeListStats(index_result.free_list);
+  PrintLevelHistograms(index_result.histograms);
+  PrintLeafLocality(leaf_pages, read_ahead_pages());
+
+  return ret;
+}
+
+void ibdNinja::ShowTables(bool only_supported) {
+  LoadAllTables();
+  if (!only_supported) {
+    fprintf(stdout, "Listing all tables and indexes "
+                    "in the specified ibd file:\n");
+    for (auto table : all_tables_) {
+      fprintf(stdout, "---------------------------------------\n");
+      fprintf(stdout, "[Table] name: %s.%s\n",
+              table->schema_ref().c_str(),
+              table->name().c_str());
+      for (auto index : table->indexes()) {
+        fprintf(stdout, "        [Index] name: %s\n",
+                index->name().c_str());
+      }
+    }
+  } else {
+    fprintf(stdout, "Listing all *supported* tables and indexes "
+                    "in the specified ibd file:\n");
+    for (auto table : tables_) {
+      fprintf(stdout, "---------------------------------------\n");
+      fprintf(stdout, "[Table] id: %-7" PRIu64 " name: %s.%s\n", table.first,
+          table.second->schema_ref().c_str(),
+          table.second->name().c_str());
+      for (auto index : table.second->indexes()) {
+        if (index->IsIndexSupported() &&
+            indexes_.find(index->ib_id()) != indexes_.end()) {
+          fprintf(stdout, "        [Index] id: %-7u, "
+              "root page no: %-7u, name: %s\n",
+              index->ib_id(), index->ib_page(),
+              index->name().c_str());
+        }
+      }
+    }
+  }
+}
+
+void ibdNinja::ShowLeftmostPages(uint32_t index_id) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to parse the index. "
+                "No index with ID %u was found", index_id);
+    return;
+  }
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+
+  uint32_t page_no = index->ib_page();
+  std::vector<uint32_t> left_pages_no;
+  if (!PageMapLeftmostPages(index, &left_pages_no) &&
+      !ToLeftmostLeaf(index, buf, page_no, &left_pages_no)) {
+    return;
+  }
+
+  uint32_t n_levels = left_pages_no.size();
+  uint32_t curr_level = n_levels - 1;
+  fprintf(stdout, "---------------------------------------\n");
+  fprintf(stdout, "Table name: %s.%s\n",
+                   index->table()->schema_ref().c_str(),
+                   index->table()->name().c_str());
+  fprintf(stdout, "Index name: %s\n",
+                   index->name().c_str());
+  for (auto iter : left_pages_no) {
+    fprintf(stdout, "  Level %u: page %u\n",
+        curr_level, iter);
+    curr_level--;
+  }
+}
+
+bool ibdNinja::ParseTable(uint32_t table_id) {
+  Table* table = GetTable(table_id);
+  if (table == nullptr) {
+    ninja_error("Failed to parse the table. "
+                "No table with ID %u was found", table_id);
+    return false;
+  }
+  if (json_analysis_) {
+    // One JSON document per line, for each index
+    for (auto index : table->indexes()) {
+      if (index->IsIndexSupported()) {
+        ParseIndex(index);
+      }
+    }
+    return true;
+  }
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  TABLE ANALYSIS RESULT                   "
+                  "                                         |\n");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Table name:        %s.%s\n",
+                   table->schema_ref().c_str(),
+                   table->name().c_str());
+  fprintf(stdout, "Table id:          %u\n",
+                   table->ib_id());
+  fprintf(stdout, "Number of indexes: %lu\n",
+                   table->indexes().size());
+  fprintf(stdout, "Analyze each index:\n");
+  for (auto index : table->indexes()) {
+    if (index->IsIndexSupported()) {
+      ParseIndex(index);
+    }
+  }
+  return true;
+}
+
+/*
+ * Reports how the pages of each segment are spread over extents, from the
+ * FSP header, the extent descriptors and the segment inodes. A segment gets
+ * its first pages one by one from fragment extents shared by all segments,
+ * and whole extents after that. Partially used and scattered extents make
+ * read-ahead and range scans less sequential.
+ */
+bool ibdNinja::ShowFragmentation() {
+  LoadAllTables();
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  if (ReadPage(0, buf) != g_page_physical_size) {
+    ninja_error("Failed to read page: 0");
+    return false;
+  }
+  uint32_t extent_size = FSP_EXTENT_SIZE;
+  uint32_t free_limit = std::min(FSPHeaderGetField(buf, FSP_FREE_LIMIT),
+                                 n_pages_);
+  uint32_t frag_n_used = FSPHeaderGetField(buf, FSP_FRAG_N_USED);
+  const unsigned char* fsp_header = buf + FSP_HEADER_OFFSET;
+  uint32_t fsp_list_lens[3];
+  uint32_t fsp_lists[3] = {FSP_FREE, FSP_FREE_FRAG, FSP_FULL_FRAG};
+  for (int i = 0; i < 3; i++) {
+    fsp_list_lens[i] = ReadFrom4B(fsp_header + fsp_lists[i] + FLST_LEN);
+  }
+  uint32_t inode_lists[2];
+  inode_lists[0] = ReadFrom4B(fsp_header + FSP_SEG_INODES_FULL + FLST_FIRST +
+                              FIL_ADDR_PAGE);
+  inode_lists[1] = ReadFrom4B(fsp_header + FSP_SEG_INODES_FREE + FLST_FIRST +
+                              FIL_ADDR_PAGE);
+  uint32_t sdi_root = ReadFrom4B(buf + XDES_ARR_OFFSET +
+                          XDES_SIZE * (g_page_physical_size / FSP_EXTENT_SIZE) +
+                          INFO_MAX_SIZE + 4);
+
+  // Extent descriptors, from the FSP_HDR page and the XDES pages that
+  // repeat every page size pages
+  struct Extent {
+    uint64_t seg_id;
+    uint32_t state;
+    uint32_t n_used;
+  };
+  std::vector<Extent> extents;
+  uint32_t n_states[XDES_FSEG_FRAG + 1] = {0};
+  uint32_t n_frag_used = 0;
+  for (uint32_t first = 0; first < free_limit; first += extent_size) {
+    uint32_t xdes_page_no = first - first % g_page_physical_size;
+    if (first == xdes_page_no && first != 0 &&
+        (ReadPage(xdes_page_no, buf) != g_page_physical_size ||
+         ReadFrom2B(buf + FIL_PAGE_TYPE) != FIL_PAGE_TYPE_XDES)) {
+      ninja_error("Failed to read the XDES page %u", xdes_page_no);
+      return false;
+    }
+    const unsigned char* xdes = buf + XDES_ARR_OFFSET + XDES_SIZE *
+                  ((first % g_page_physical_size) / extent_size);
+    Extent extent;
+    extent.seg_id = ReadFrom8B(xdes + XDES_ID);
+    extent.state = ReadFrom4B(xdes + XDES_STATE);
+    extent.n_used = 0;
+    for (uint32_t i = 0; i < extent_size; i++) {
+      uint32_t bit = i * XDES_BITS_PER_PAGE + XDES_FREE_BIT;
+      if (!((xdes[XDES_BITMAP + bit / 8] >> (bit % 8)) & 1)) {
+        extent.n_used++;
+      }
+    }
+    if (extent.state > XDES_FSEG_FRAG) {
+      ninja_warn("Extent %zu has an unknown state %u", extents.size(),
+                 extent.state);
+      extent.state = XDES_NOT_INITED;
+    }
+    n_states[extent.state]++;
+    if (extent.state == XDES_FREE_FRAG || extent.state == XDES_FULL_FRAG) {
+      n_frag_used += extent.n_used;
+    }
+    extents.push_back(extent);
+  }
+
+  // Segment inodes, from the INODE pages on the two inode page lists
+  struct Segment {
+    uint64_t id;
+    std::string name;
+    Table* table;
+    uint32_t n_frag;
+    uint32_t not_full_n_used;
+    uint32_t n_listed;
+    std::vector<uint32_t> extents;
+    uint32_t n_used;
+  };
+  std::vector<Segment> segments;
+  std::map<std::pair<uint32_t, uint32_t>, size_t> segment_at;
+  std::unordered_map<uint64_t, size_t> segment_ids;
+  uint32_t n_inode_pages = 0;
+  for (uint32_t page_no : inode_lists) {
+    for (uint32_t n = 0; page_no != FIL_NULL && n <= n_pages_; n++) {
+      if (page_no >= n_pages_ ||
+          ReadPage(page_no, buf) != g_page_physical_size ||
+          ReadFrom2B(buf + FIL_PAGE_TYPE) != FIL_PAGE_INODE) {
+        ninja_error("Failed to read the INODE page %u", page_no);
+        return false;
+      }
+      n_inode_pages++;
+      for (uint32_t k = 0; k < FSP_SEG_INODES_PER_PAGE; k++) {
+        uint32_t offset = FSEG_ARR_OFFSET + k * FSEG_INODE_SIZE;
+        const unsigned char* inode = buf + offset;
+        uint64_t seg_id = ReadFrom8B(inode + FSEG_ID);
+        if (seg_id == 0 ||
+            ReadFrom4B(inode + FSEG_MAGIC_N) != FSEG_MAGIC_N_VALUE ||
+            segment_ids.count(seg_id) != 0) {
+          continue;
+        }
+        Segment segment;
+        segment.id = seg_id;
+        segment.table = nullptr;
+        segment.n_frag = 0;
+        for (uint32_t slot = 0; slot < FSEG_FRAG_ARR_N_SLOTS; slot++) {
+          if (ReadFrom4B(inode + FSEG_FRAG_ARR + slot * FSEG_FRAG_SLOT_SIZE) !=
+              FIL_NULL) {
+            segment.n_frag++;
+          }
+        }
+        segment.not_full_n_used = ReadFrom4B(inode + FSEG_NOT_FULL_N_USED);
+        segment.n_listed = ReadFrom4B(inode + FSEG_FREE + FLST_LEN) +
+                           ReadFrom4B(inode + FSEG_NOT_FULL + FLST_LEN) +
+                           ReadFrom4B(inode + FSEG_FULL + FLST_LEN);
+        segment.n_used = 0;
+        segment_at[{page_no, offset}] = segments.size();
+        segment_ids[seg_id] = segments.size();
+        segments.push_back(segment);
+      }
+      page_no = ReadFrom4B(buf + FSEG_INODE_PAGE_NODE + FLST_NEXT +
+                           FIL_ADDR_PAGE);
+    }
+  }
+  uint32_t n_orphan_extents = 0;
+  for (uint32_t e = 0; e < extents.size(); e++) {
+    if (extents[e].state != XDES_FSEG && extents[e].state != XDES_FSEG_FRAG) {
+      continue;
+    }
+    auto iter = segment_ids.find(extents[e].seg_id);
+    if (iter == segment_ids.end()) {
+      n_orphan_extents++;
+      continue;
+    }
+    segments[iter->second].extents.push_back(e);
+    segments[iter->second].n_used += extents[e].n_used;
+  }
+
+  // Name the segments after the file segment headers on the root pages
+  std::vector<size_t> order;
+  auto name_segments = [&](uint32_t root, const std::string& name,
+                           Table* table) {
+    if (root >= n_pages_ || ReadPage(root, buf) != g_page_physical_size) {
+      return;
+    }
+    const char* kinds[2] = {"leaf", "non-leaf"};
+    uint32_t headers[2] = {PAGE_BTR_SEG_LEAF, PAGE_BTR_SEG_TOP};
+    for (int i = 0; i < 2; i++) {
+      const unsigned char* header = buf + PAGE_HEADER + headers[i];
+      auto iter = segment_at.find({ReadFrom4B(header + FSEG_HDR_PAGE_NO),
+                                   ReadFrom2B(header + FSEG_HDR_OFFSET)});
+      if (iter == segment_at.end() ||
+          !segments[iter->second].name.empty()) {
+        continue;
+      }
+      segments[iter->second].name = name + " (" + kinds[i] + ")";
+      segments[iter->second].table = table;
+      order.push_back(iter->second);
+    }
+  };
+  for (auto* table : all_tables_) {
+    for (auto* index : table->indexes()) {
+      name_segments(index->ib_page(),
+                    table->schema_ref() + "." + table->name() + "." +
+                    index->name(), table);
+    }
+  }
+  name_segments(sdi_root, "SDI", nullptr);
+  for (size_t i = 0; i < segments.size(); i++) {
+    if (segments[i].name.empty()) {
+      segments[i].name = "Segment " + std::to_string(segments[i].id);
+      order.push_back(i);
+    }
+  }
+
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  %-80s|\n", "TABLESPACE EXTENTS");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Extent size:                %u pages\n", extent_size);
+  fprintf(stdout, "Pages below the free limit: %u (%zu extents)\n",
+                  free_limit, extents.size());
+  fprintf(stdout, "Free extents:               %u\n", n_states[XDES_FREE]);
+  fprintf(stdout, "Fragment extents:           %u partially used, %u full, "
+                  "%u used pages\n", n_states[XDES_FREE_FRAG],
+                  n_states[XDES_FULL_FRAG], n_frag_used);
+  fprintf(stdout, "Segment extents:            %u\n",
+                  n_states[XDES_FSEG] + n_states[XDES_FSEG_FRAG]);
+  fprintf(stdout, "Segment inodes:             %zu in %u INODE pages\n",
+                  segments.size(), n_inode_pages);
+  uint32_t n_counted[3] = {n_states[XDES_FREE], n_states[XDES_FREE_FRAG],
+                           n_states[XDES_FULL_FRAG]};
+  const char* fsp_list_names[3] = {"FSP_FREE", "FSP_FREE_FRAG",
+                                   "FSP_FULL_FRAG"};
+  for (int i = 0; i < 3; i++) {
+    if (fsp_list_lens[i] != n_counted[i]) {
+      ninja_warn("The %s list has %u extents, but %u extent descriptors "
+                 "are in that state", fsp_list_names[i], fsp_list_lens[i],
+                 n_counted[i]);
+    }
+  }
+  if (frag_n_used != n_frag_used - n_states[XDES_FULL_FRAG] * extent_size) {
+    ninja_warn("FSP_FRAG_N_USED is %u, but %u pages of partially used "
+               "fragment extents are used", frag_n_used,
+               n_frag_used - n_states[XDES_FULL_FRAG] * extent_size);
+  }
+  if (n_orphan_extents > 0) {
+    ninja_warn("%u extents belong to no segment inode", n_orphan_extents);
+  }
+
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  %-80s|\n", "SEGMENT FRAGMENTATION");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "%-30s %9s %8s %5s %7s %7s %5s %6s\n", "Segment",
+                  "Allocated", "Used", "Frag", "Extents", "Partial", "Runs",
+                  "Used");
+  struct TableUsage {
+    uint64_t n_alloc;
+    uint64_t n_used;
+    uint32_t n_extents;
+    uint32_t n_runs;
+  };
+  std::map<Table*, TableUsage> table_usage;
+  for (size_t i : order) {
+    Segment& segment = segments[i];
+    uint32_t n_extents = segment.extents.size();
+    uint64_t n_alloc = segment.n_frag +
+                       static_cast<uint64_t>(n_extents) * extent_size;
+    uint64_t n_used = segment.n_frag + segment.n_used;
+    uint32_t n_partial = 0;
+    uint32_t n_not_full_used = 0;
+    uint32_t n_runs = 0;
+    for (uint32_t k = 0; k < n_extents; k++) {
+      uint32_t e = segment.extents[k];
+      if (extents[e].n_used < extent_size) {
+        n_partial++;
+        n_not_full_used += extents[e].n_used;
+      }
+      if (k == 0 || e != segment.extents[k - 1] + 1) {
+        n_runs++;
+      }
+    }
+    if (segment.n_listed != n_extents ||
+        segment.not_full_n_used != n_not_full_used) {
+      ninja_warn("The inode of segment %" PRIu64 " lists %u extents with %u "
+                 "pages used in the not full ones, but the extent "
+                 "descriptors give %u extents with %u pages", segment.id,
+                 segment.n_listed, segment.not_full_n_used, n_extents,
+                 n_not_full_used);
+    }
+    fprintf(stdout, "%-30s %9" PRIu64 " %8" PRIu64 " %5u %7u %7u %5u "
+                    "%5.1lf%%\n", segment.name.c_str(), n_alloc, n_used,
+                    segment.n_frag, n_extents, n_partial, n_runs,
+                    n_alloc == 0 ? 0.0 :
+                    static_cast<double>(n_used) / n_alloc * 100);
+    if (segment.table != nullptr) {
+      TableUsage& usage = table_usage[segment.table];
+      usage.n_alloc += n_alloc;
+      usage.n_used += n_used;
+      usage.n_extents += n_extents;
+      usage.n_runs += n_runs;
+    }
+  }
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Frag: pages in the fragment slots of the inode\n");
+  fprintf(stdout, "Partial: extents of the segment that are not full\n");
+  fprintf(stdout, "Runs: runs of extents with consecutive page numbers\n");
+
+  // A table is worth rebuilding once a quarter of its allocated pages are
+  // unused, or once its extents are scattered in more runs than half of
+  // their number
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "OPTIMIZE TABLE candidates:\n");
+  uint32_t n_candidates = 0;
+  for (auto* table : all_tables_) {
+    auto iter = table_usage.find(table);
+    if (iter == table_usage.end()) {
+      continue;
+    }
+    const TableUsage& usage = iter->second;
+    bool unused = usage.n_alloc >= 2 * extent_size &&
+                  (usage.n_alloc - usage.n_used) * 4 > usage.n_alloc;
+    bool scattered = usage.n_extents >= 4 &&
+                     usage.n_runs * 2 > usage.n_extents;
+    if (!unused && !scattered) {
+      continue;
+    }
+    n_candidates++;
+    fprintf(stdout, "  %s.%s:", table->schema_ref().c_str(),
+                    table->name().c_str());
+    if (unused) {
+      fprintf(stdout, " %" PRIu64 " of %" PRIu64 " allocated pages unused",
+                      usage.n_alloc - usage.n_used, usage.n_alloc);
+    }
+    if (scattered) {
+      fprintf(stdout, "%s %u extents in %u runs", unused ? "," : "",
+                      usage.n_extents, usage.n_runs);
+    }
+    fprintf(stdout, "\n");
+  }
+  if (n_candidates == 0) {
+    fprintf(stdout, "  None\n");
+  }
+  return true;
+}
+
+/*
+ * Positions on the last record of the page that is less than the key, or
+ * on the infimum if there is none (PAGE_CUR_L in InnoDB). The page directory
+ * is binary-searched first, then the records owned by the chosen slot are
+ * scanned linearly.
+ */
+unsigned char* ibdNinja::SearchPage(Index* index, unsigned char* buf,
+                                    const SearchKey& key) {
+  uint32_t n_slots = ReadFrom2B(buf + PAGE_HEADER + PAGE_N_DIR_SLOTS);
+  uint32_t page_no = ReadFrom4B(buf + FIL_PAGE_OFFSET);
+  if (n_slots < 2 ||
+      PAGE_DIR + PAGE_DIR_SLOT_SIZE * n_slots > g_page_logical_size / 2) {
+    ninja_error("Found corrupt page directory on page %u", page_no);
+    return nullptr;
+  }
+  auto slot_rec = [buf](uint32_t slot) -> unsigned char* {
+    uint32_t offset = ReadFrom2B(buf + g_page_logical_size - PAGE_DIR -
+                                 PAGE_DIR_SLOT_SIZE * (slot + 1));
+    if (offset < PAGE_NEW_INFIMUM ||
+        offset >= g_page_logical_size - PAGE_DIR) {
+      return nullptr;
+    }
+    return buf + offset;
+  };
+
+  uint32_t low = 0;
+  uint32_t up = n_slots - 1;
+  while (up - low > 1) {
+    uint32_t mid = (low + up) / 2;
+    unsigned char* mid_rec = slot_rec(mid);
+    if (mid_rec == nullptr) {
+      ninja_error("Found corrupt page directory slot %u on page %u",
+                  mid, page_no);
+      return nullptr;
+    }
+    Record record(mid_rec, index);
+    record.GetColumnOffsets();
+    if (index->CompareKey(key, &record) > 0) {
+      low = mid;
+    } else {
+      up = mid;
+    }
+  }
+
+  unsigned char* low_rec = slot_rec(low);
+  unsigned char* up_rec = slot_rec(up);
+  if (low_rec == nullptr || up_rec == nullptr) {
+    ninja_error("Found corrupt page directory on page %u", page_no);
+    return nullptr;
+  }
+  bool corrupt = false;
+  unsigned char* rec = GetNextRecInPage(low_rec, buf, &corrupt);
+  // A slot owns at most PAGE_DIR_SLOT_MAX_N_OWNED records
+  for (uint32_t n = 0; rec != nullptr && rec != up_rec; n++) {
+    if (n > PAGE_DIR_SLOT_MAX_N_OWNED) {
+      ninja_error("Found corrupt page directory on page %u", page_no);
+      return nullptr;
+    }
+    Record record(rec, index);
+    record.GetColumnOffsets();
+    if (index->CompareKey(key, &record) <= 0) {
+      break;
+    }
+    low_rec = rec;
+    rec = GetNextRecInPage(rec, buf, &corrupt);
+  }
+  if (corrupt) {
+    return nullptr;
+  }
+  return low_rec;
+}
+
+unsigned char* SearchCursor::GetPage(uint32_t depth, uint32_t page_no) {
+  if (depth < levels_.size() && levels_[depth].page_no == page_no) {
+    n_pages_reused_++;
+    return levels_[depth].buf;
+  }
+  if (page_no >= n_pages_) {
+    ninja_error("Page number %u is too large", page_no);
+    return nullptr;
+  }
+  while (levels_.size() <= depth) {
+    CachedPage level;
+    level.page_no = FIL_NULL;
+    level.buf_unalign = new unsigned char[2 * UNIV_PAGE_SIZE_MAX];
+    level.buf = static_cast<unsigned char*>(
+                    ut_align(level.buf_unalign, g_page_physical_size));
+    levels_.push_back(level);
+  }
+  CachedPage* level = &levels_[depth];
+  ssize_t bytes = ibdNinja::ReadPage(page_no, level->buf);
+  if (bytes != g_page_physical_size) {
+    ninja_error("Failed to read page: %u, error: %d(%s)",
+                page_no, errno, strerror(errno));
+    level->page_no = FIL_NULL;
+    return nullptr;
+  }
+  level->page_no = page_no;
+  n_pages_read_++;
+  return level->buf;
+}
+
+static bool PageBelongsToIndex(const unsigned char* buf, Index* index,
+                               uint32_t level) {
+  uint32_t type = ReadFrom2B(buf + FIL_PAGE_TYPE);
+  uint64_t index_id = ReadFrom8B(buf + PAGE_HEADER + PAGE_INDEX_ID);
+  uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
+  if (type != FIL_PAGE_INDEX || index_id != index->ib_id() ||
+      (level != UINT32_UNDEFINED && page_level != level)) {
+    ninja_error("Page %u does not belong to level %u of index %s",
+                ReadFrom4B(buf + FIL_PAGE_OFFSET), level,
+                index->name().c_str());
+    return false;
+  }
+  return true;
+}
+
+static const char KEY_MAP_MAGIC[8] = {'I', 'B', 'D', 'N', 'K', 'E', 'Y', 'S'};
+static const uint32_t KEY_MAP_VERSION = 3;
+static const char* KEY_MAP_SUFFIX = ".ninjakeys";
+
+std::string ibdNinja::KeyMapPath(uint64_t index_id) const {
+  return ibd_filename_ + "." + std::to_string(index_id) + KEY_MAP_SUFFIX;
+}
+
+/*
+ * Lists the leaf pages and their first keys, in the key map layout, from
+ * the node pointers on level 1, so the leaf pages themselves are not read.
+ */
+bool ibdNinja::CollectLeafFences(Index* index,
+                                 std::vector<uint64_t>* key_offsets,
+                                 std::vector<uint32_t>* page_nos,
+                                 std::string* keys) {
+  uint32_t n_fields = index->GetNUniqueInTreeNonleaf();
+  for (uint32_t i = 0; i < n_fields; i++) {
+    if (!CheckOrderSupported(index->ib_fields()->at(i)->column())) {
+      return false;
+    }
+  }
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  std::vector<uint32_t> left_pages_no;
+  if (!ToLeftmostLeaf(index, buf, index->ib_page(), &left_pages_no)) {
+    ninja_error("Failed to read the leaf page fences of index %s",
+                index->name().c_str());
+    return false;
+  }
+
+  key_offsets->clear();
+  page_nos->clear();
+  keys->clear();
+  if (left_pages_no.size() == 1) {
+    // The root is the only leaf page
+    key_offsets->push_back(0);
+    page_nos->push_back(index->ib_page());
+  }
+  std::string key;
+  std::string prev_key;
+  uint32_t page_no = (left_pages_no.size() == 1) ?
+                     FIL_NULL : left_pages_no[left_pages_no.size() - 2];
+  for (uint32_t n_pages = 0; page_no != FIL_NULL; n_pages++) {
+    if (n_pages > n_pages_ || ReadPage(page_no, buf) != g_page_physical_size ||
+        !PageBelongsToIndex(buf, index, 1)) {
+      ninja_error("Failed to read level 1 of index %s at page %u",
+                  index->name().c_str(), page_no);
+      return false;
+    }
+    bool error = false;
+    for (unsigned char* rec = GetNextRecInPage(buf + PAGE_NEW_INFIMUM,
+                                               buf, &error);
+         rec != nullptr; rec = GetNextRecInPage(rec, buf, &error)) {
+      Record node_ptr(rec, index);
+      node_ptr.GetColumnOffsets();
+      if (node_ptr.IsMinRec()) {
+        key.clear();
+      } else {
+        index->EncodeSortKey(&node_ptr, n_fields, &key);
+      }
+      if (!page_nos->empty() && key < prev_key) {
+        ninja_error("The node pointers on page %u of index %s are not "
+                    "in key order", page_no, index->name().c_str());
+        return false;
+      }
+      key_offsets->push_back(keys->size());
+      page_nos->push_back(node_ptr.GetChildPageNo());
+      *keys += key;
+      prev_key.swap(key);
+    }
+    if (error) {
+      return false;
+    }
+    page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+  }
+  key_offsets->push_back(keys->size());
+  return true;
+}
+
+bool ibdNinja::BuildKeyMap(uint32_t index_id) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to build the key map. "
+                "No index with ID %u was found", index_id);
+    return false;
+  }
+  std::vector<uint64_t> key_offsets;
+  std::vector<uint32_t> page_nos;
+  std::string keys;
+  if (!CollectLeafFences(index, &key_offsets, &page_nos, &keys)) {
+    return false;
+  }
+
+  KeyMapHeader header;
+  memset(&header, 0, sizeof(header));
+  if (!InitSidecarHeader(KEY_MAP_MAGIC, KEY_MAP_VERSION, &header.sidecar)) {
+    return false;
+  }
+  header.n_entries = page_nos.size();
+  header.index_id = index_id;
+
+  std::string path = KeyMapPath(index_id);
+  if (!WriteSidecar(path, "key map",
+                    {{&header, sizeof(header)},
+                     {key_offsets.data(), key_offsets.size() *
+                                          sizeof(uint64_t)},
+                     {page_nos.data(), page_nos.size() * sizeof(uint32_t)},
+                     {keys.data(), keys.size()}})) {
+    return false;
+  }
+  fprintf(stdout, "[ibdNinja]: Wrote the key map %s\n", path.c_str());
+  fprintf(stdout, "    Index:      %s.%s.%s\n",
+          index->table()->schema_ref().c_str(),
+          index->table()->name().c_str(), index->name().c_str());
+  fprintf(stdout, "    Leaf pages: %zu\n", page_nos.size());
+  fprintf(stdout, "    Key bytes:  %zu\n", keys.size());
+  return true;
+}
+
+/*
+ * Maps the key map of the index on first use. A map that doesn't match the
+ * current ibd file is ignored.
+ */
+const ibdNinja::KeyMap* ibdNinja::GetKeyMap(Index* index) {
+  auto iter = key_maps_.find(index->ib_id());
+  if (iter != key_maps_.end()) {
+    return iter->second.addr == nullptr ? nullptr : &iter->second;
+  }
+  KeyMap key_map;
+  memset(&key_map, 0, sizeof(key_map));
+  iter = key_maps_.insert({index->ib_id(), key_map}).first;
+
+  std::string path = KeyMapPath(index->ib_id());
+  int fd = open(path.c_str(), O_RDONLY);
+  if (fd < 0) {
+    return nullptr;
+  }
+  struct stat st;
+  void* addr = MAP_FAILED;
+  if (fstat(fd, &st) == 0 &&
+      static_cast<size_t>(st.st_size) >= sizeof(KeyMapHeader)) {
+    addr = mmap(nullptr, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  }
+  close(fd);
+  if (addr == MAP_FAILED) {
+    return nullptr;
+  }
+  size_t size = st.st_size;
+  KeyMapHeader header;
+  memcpy(&header, addr, sizeof(header));
+  size_t n_entries = header.n_entries;
+  size_t keys_start = sizeof(header) + (n_entries + 1) * sizeof(uint64_t) +
+                      n_entries * sizeof(uint32_t);
+  SidecarState state = CheckSidecarHeader(header.sidecar, KEY_MAP_MAGIC,
+                                          KEY_MAP_VERSION);
+  bool valid = state != SIDECAR_INVALID &&
+               header.index_id == index->ib_id() &&
+               n_entries > 0 && keys_start <= size;
+  key_map.addr = static_cast<unsigned char*>(addr);
+  key_map.size = size;
+  key_map.n_entries = n_entries;
+  if (valid) {
+    key_map.key_offsets = reinterpret_cast<const uint64_t*>(
+                              key_map.addr + sizeof(header));
+    key_map.page_nos = reinterpret_cast<const uint32_t*>(
+                           key_map.key_offsets + n_entries + 1);
+    key_map.keys = key_map.addr + keys_start;
+    for (size_t i = 0; valid && i <= n_entries; i++) {
+      valid = key_map.key_offsets[i] <= size - keys_start &&
+              (i == 0 || key_map.key_offsets[i] >= key_map.key_offsets[i - 1]);
+    }
+  }
+  if (!valid) {
+    ninja_warn("Ignoring the invalid key map %s", path.c_str());
+    munmap(addr, size);
+    return nullptr;
+  }
+  if (state == SIDECAR_STALE) {
+    ninja_warn("Ignoring the key map %s, the ibd file changed since. "
+               "Rebuild it with --build-keymap", path.c_str());
+    munmap(addr, size);
+    return nullptr;
+  }
+  iter->second = key_map;
+  return &iter->second;
+}
+
+/*
+ * The leaf page a search of the key starts from, like a descent: the child
+ * of the last node pointer that is less than the key as a prefix. Returns
+ * FIL_NULL if the index has no key map.
+ */
+uint32_t ibdNinja::KeyMapLeafPage(Index* index, const SearchKey& key) {
+  const KeyMap* key_map = GetKeyMap(index);
+  if (key_map == nullptr) {
+    return FIL_NULL;
+  }
+  std::string encoded;
+  index->EncodeSortKey(key, &encoded);
+  return FenceLeafPage(*key_map, encoded, false);
+}
+
+/*
+ * The child of the last entry that is less than the encoded key, or not
+ * greater than it if inclusive. An inclusive search of a full unique key
+ * finds the leaf page holding it, since a leaf page starts with the key of
+ * its node pointer.
+ */
+uint32_t ibdNinja::FenceLeafPage(const KeyMap& key_map,
+                                 const std::string& encoded, bool inclusive) {
+  // The first entry is less than any key, find the first entry that is not
+  uint32_t low = 1;
+  uint32_t high = key_map.n_entries;
+  while (low < high) {
+    uint32_t mid = low + (high - low) / 2;
+    const unsigned char* entry = key_map.keys + key_map.key_offsets[mid];
+    size_t entry_len = key_map.key_offsets[mid + 1] -
+                       key_map.key_offsets[mid];
+    int ret = memcmp(entry, encoded.data(),
+                     std::min(entry_len, encoded.size()));
+    if (ret < 0 || (ret == 0 && (entry_len < encoded.size() ||
+                                 (inclusive &&
+                                  entry_len == encoded.size())))) {
+      low = mid + 1;
+    } else {
+      high = mid;
+    }
+  }
+  return key_map.page_nos[low - 1];
+}
+
+static const char ZONE_MAP_MAGIC[8] = {'I', 'B', 'D', 'N', 'Z', 'O', 'N', 'E'};
+static const uint32_t ZONE_MAP_VERSION = 3;
+static const char* ZONE_MAP_SUFFIX = ".ninjazones";
+// Longer min or max values are not kept, the bound is then unknown
+static const uint32_t ZONE_MAP_MAX_VALUE_LEN = 64;
+
+/*
+ * Resolves a comma-separated list of column names to the fields of the
+ * index, in the order given. Unknown and repeated columns are refused, and
+ * *names gets the column names joined by ", ".
+ */
+bool ibdNinja::ParseColumnList(Index* index, const std::string& columns,
+                               std::vector<uint32_t>* field_nos,
+                               std::vector<Column*>* cols,
+                               std::string* names) {
+  size_t begin = 0;
+  while (begin <= columns.size()) {
+    size_t end = columns.find(',', begin);
+    if (end == std::string::npos) {
+      end = columns.size();
+    }
+    std::string name = columns.substr(begin, end - begin);
+    name.erase(0, name.find_first_not_of(" \t"));
+    name.erase(name.find_last_not_of(" \t") + 1);
+    begin = end + 1;
+    uint32_t field_no = 0;
+    Column* col = index->GetPhysicalFieldByName(name, &field_no);
+    if (col == nullptr) {
+      ninja_error("Unknown column '%s' in table %s", name.c_str(),
+                  index->table()->name().c_str());
+      return false;
+    }
+    if (std::find(field_nos->begin(), field_nos->end(), field_no) !=
+        field_nos->end()) {
+      ninja_error("Column %s is given twice", col->name().c_str());
+      return false;
+    }
+    field_nos->push_back(field_no);
+    cols->push_back(col);
+    *names += (names->empty() ? "" : ", ") + col->name();
+  }
+  return true;
+}
+
+std::string ibdNinja::ZoneMapPath(uint64_t index_id) const {
+  return ibd_filename_ + "." + std::to_string(index_id) + ZONE_MAP_SUFFIX;
+}
+
+/*
+ * Reads every leaf page once. The stats are computed over all records of a
+ * page, delete-marked ones included, with the comparisons of the filters.
+ */
+bool ibdNinja::BuildZoneMap(uint32_t index_id, const std::string& columns) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to build the zone map. "
+                "No index with ID %u was found", index_id);
+    return false;
+  }
+  if (index->table()->clust_index() != index ||
+      !index->IsIndexParsingRecSupported()) {
+    ninja_error("Zone maps are only supported on the primary key of a "
+                "supported table, and index %s is not one",
+                index->name().c_str());
+    return false;
+  }
+  std::vector<uint32_t> field_nos;
+  std::vector<Column*> cols;
+  std::string names;
+  if (!ParseColumnList(index, columns, &field_nos, &cols, &names)) {
+    return false;
+  }
+  for (auto* col : cols) {
+    if (!CheckOrderSupported(col)) {
+      return false;
+    }
+  }
+
+  std::string zones;
+  uint64_t n_zones = 0;
+  uint64_t n_unbounded = 0;
+  uint32_t n_leaf_pages = 0;
+  SearchCursor cursor(n_pages_);
+  bool ret = ScanLeafBatches(index, SearchKey(), nullptr, &cursor,
+      [&](const std::vector<Record*>& batch) {
+        uint32_t page_no = ReadFrom4B(page_align(batch[0]->rec()) +
+                                      FIL_PAGE_OFFSET);
+        DictCacheAppend(&zones, page_no);
+        DictCacheAppend(&zones, static_cast<uint32_t>(batch.size()));
+        for (size_t i = 0; i < field_nos.size(); i++) {
+          uint32_t n_nulls = 0;
+          const unsigned char* min = nullptr;
+          uint32_t min_len = 0;
+          const unsigned char* max = nullptr;
+          uint32_t max_len = 0;
+          // Only the local prefix of an off-page value is on the page, its
+          // order against the other values is unknown
+          bool has_external = false;
+          for (auto* record : batch) {
+            const unsigned char* data = nullptr;
+            uint32_t len = 0;
+            if (record->GetField(field_nos[i], &data, &len) &
+                REC_OFFS_EXTERNAL) {
+              has_external = true;
+            }
+            if (!record->GetFieldValue(field_nos[i], &data, &len)) {
+              n_nulls++;
+              continue;
+            }
+            if (min == nullptr ||
+                cols[i]->CompareValue(data, len, min, min_len) < 0) {
+              min = data;
+              min_len = len;
+            }
+            if (max == nullptr ||
+                cols[i]->CompareValue(data, len, max, max_len) > 0) {
+              max = data;
+              max_len = len;
+            }
+          }
+          DictCacheAppend(&zones, n_nulls);
+          for (int bound = 0; bound < 2; bound++) {
+            const unsigned char* value = bound == 0 ? min : max;
+            uint32_t len = bound == 0 ? min_len : max_len;
+            bool has_value = (value != nullptr && !has_external &&
+                              len <= ZONE_MAP_MAX_VALUE_LEN);
+            if (value != nullptr && !has_value) {
+              n_unbounded++;
+            }
+            DictCacheAppend(&zones, static_cast<uint8_t>(has_value));
+            if (has_value) {
+              DictCacheAppendString(&zones,
+                                    reinterpret_cast<const char*>(value),
+                                    len);
+            }
+          }
+        }
+        n_zones++;
+        return true;
+      }, &n_leaf_pages, nullptr);
+  if (!ret) {
+    ninja_error("Failed to build the zone map of index %s",
+                index->name().c_str());
+    return false;
+  }
+
+  ZoneMapHeader header;
+  memset(&header, 0, sizeof(header));
+  if (!InitSidecarHeader(ZONE_MAP_MAGIC, ZONE_MAP_VERSION, &header.sidecar)) {
+    return false;
+  }
+  header.n_fields = field_nos.size();
+  header.index_id = index_id;
+  header.n_zones = n_zones;
+
+  std::string path = ZoneMapPath(index_id);
+  if (!WriteSidecar(path, "zone map",
+                    {{&header, sizeof(header)},
+                     {field_nos.data(), field_nos.size() * sizeof(uint32_t)},
+                     {zones.data(), zones.size()}})) {
+    return false;
+  }
+  fprintf(stdout, "[ibdNinja]: Wrote the zone map %s\n", path.c_str());
+  fprintf(stdout, "    Index:            %s.%s.%s\n",
+          index->table()->schema_ref().c_str(),
+          index->table()->name().c_str(), index->name().c_str());
+  fprintf(stdout, "    Columns:          %s\n", names.c_str());
+  fprintf(stdout, "    Leaf pages:       %" PRIu64 "\n", n_zones);
+  fprintf(stdout, "    Unknown bounds:   %" PRIu64 " (values longer than "
+                  "%u bytes or stored off-page)\n",
+                  n_unbounded, ZONE_MAP_MAX_VALUE_LEN);
+  return true;
+}
+
+/*
+ * Loads the zone map of the index on first use. A map that doesn't match
+ * the current ibd file is ignored.
+ */
+const ibdNinja::ZoneMap* ibdNinja::GetZoneMap(Index* index) {
+  auto iter = zone_maps_.find(index->ib_id());
+  if (iter != zone_maps_.end()) {
+    return iter->second.valid ? &iter->second : nullptr;
+  }
+  iter = zone_maps_.insert({index->ib_id(), ZoneMap()}).first;
+  ZoneMap* zone_map = &iter->second;
+  zone_map->valid = false;
+
+  std::string path = ZoneMapPath(index->ib_id());
+  FILE* file = fopen(path.c_str(), "rb");
+  if (file == nullptr) {
+    return nullptr;
+  }
+  std::string data;
+  char buf[64 * 1024];
+  size_t n_bytes = 0;
+  while ((n_bytes = fread(buf, 1, sizeof(buf), file)) > 0) {
+    data.append(buf, n_bytes);
+  }
+  fclose(file);
+
+  DictCacheReader reader(reinterpret_cast<const unsigned char*>(data.data()),
+                         data.size());
+  ZoneMapHeader header;
+  SidecarState state = SIDECAR_INVALID;
+  if (reader.Read(&header)) {
+    state = CheckSidecarHeader(header.sidecar, ZONE_MAP_MAGIC,
+                               ZONE_MAP_VERSION);
+  }
+  bool valid = state != SIDECAR_INVALID &&
+               header.index_id == index->ib_id();
+  for (uint32_t i = 0; valid && i < header.n_fields; i++) {
+    uint32_t field_no = 0;
+    valid = reader.Read(&field_no) && field_no < index->GetNFields();
+    zone_map->field_nos.push_back(field_no);
+  }
+  for (uint64_t z = 0; valid && z < header.n_zones; z++) {
+    Zone zone;
+    valid = reader.Read(&zone.page_no) && reader.Read(&zone.n_recs) &&
+            zone.page_no < n_pages_ &&
+            zone_map->zone_of_page.insert({zone.page_no, z}).second;
+    zone.stats.resize(header.n_fields);
+    for (auto& stats : zone.stats) {
+      if (!valid) {
+        break;
+      }
+      valid = reader.Read(&stats.n_nulls) && stats.n_nulls <= zone.n_recs;
+      for (int bound = 0; valid && bound < 2; bound++) {
+        bool* has_value = bound == 0 ? &stats.has_min : &stats.has_max;
+        std::string* value = bound == 0 ? &stats.min : &stats.max;
+        uint8_t flag = 0;
+        uint32_t len = 0;
+        const char* bytes = nullptr;
+        valid = reader.Read(&flag) &&
+                (flag == 0 ||
+                 (reader.Read(&len) && reader.ReadBytes(len, &bytes)));
+        *has_value = (flag != 0);
+        if (valid && *has_value) {
+          value->assign(bytes, len);
+        }
+      }
+    }
+    zone_map->zones.push_back(std::move(zone));
+  }
+  if (!valid || !reader.AtEnd()) {
+    ninja_warn("Ignoring the invalid zone map %s", path.c_str());
+    return nullptr;
+  }
+  if (state == SIDECAR_STALE) {
+    ninja_warn("Ignoring the zone map %s, the ibd file changed since. "
+               "Rebuild it with --build-zonemap", path.c_str());
+    return nullptr;
+  }
+  zone_map->valid = true;
+  return zone_map;
+}
+
+bool ibdNinja::ZoneMapCanSkip(const ZoneMap* zone_map, uint32_t page_no,
+                              const RowFilter* filter,
+                              uint32_t* next_page_no) {
+  if (zone_map == nullptr || filter == nullptr) {
+    return false;
+  }
+  auto iter = zone_map->zone_of_page.find(page_no);
+  if (iter == zone_map->zone_of_page.end()) {
+    return false;
+  }
+  const Zone& zone = zone_map->zones[iter->second];
+  bool may_match = filter->MayMatch(zone.n_recs,
+      [&](uint32_t field_no) -> const RowFilter::FieldStats* {
+        for (size_t i = 0; i < zone_map->field_nos.size(); i++) {
+          if (zone_map->field_nos[i] == field_no) {
+            return &zone.stats[i];
+          }
+        }
+        return nullptr;
+      });
+  if (may_match) {
+    return false;
+  }
+  if (next_page_no != nullptr) {
+    *next_page_no = (iter->second + 1 < zone_map->zones.size()) ?
+                    zone_map->zones[iter->second + 1].page_no : FIL_NULL;
+  }
+  return true;
+}
+
+/*
+ * Descends from the root to the given level, and positions *rec on the last
+ * record of that level that is less than the key (possibly the infimum).
+ * Pages are read through the cursor, and *depth is set to the depth of the
+ * level (the root is 0). A tree lower than the level stops at its root.
+ */
+bool ibdNinja::SearchToLevel(Index* index, const SearchKey& key,
+                             SearchCursor* cursor, uint32_t level,
+                             unsigned char** rec, uint32_t* depth,
+                             std::vector<uint32_t>* path) {
+  if (level == 0) {
+    // The key map names the leaf page directly
+    uint32_t leaf_page_no = KeyMapLeafPage(index, key);
+    unsigned char* buf = (leaf_page_no == FIL_NULL) ?
+                         nullptr : cursor->GetPage(0, leaf_page_no);
+    if (buf != nullptr &&
+        ReadFrom2B(buf + FIL_PAGE_TYPE) == FIL_PAGE_INDEX &&
+        ReadFrom8B(buf + PAGE_HEADER + PAGE_INDEX_ID) == index->ib_id() &&
+        ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL) == 0) {
+      unsigned char* low_rec = SearchPage(index, buf, key);
+      if (low_rec != nullptr) {
+        if (path != nullptr) {
+          path->push_back(leaf_page_no);
+        }
+        *rec = low_rec;
+        *depth = 0;
+        return true;
+      }
+    }
+  }
+  uint32_t page_no = index->ib_page();
+  uint32_t expected_level = UINT32_UNDEFINED;
+  for (uint32_t curr_depth = 0; ; curr_depth++) {
+    unsigned char* buf = cursor->GetPage(curr_depth, page_no);
+    if (buf == nullptr || !PageBelongsToIndex(buf, index, expected_level)) {
+      return false;
+    }
+    if (path != nullptr) {
+      path->push_back(page_no);
+    }
+    uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
+
+    unsigned char* low_rec = SearchPage(index, buf, key);
+    if (low_rec == nullptr) {
+      return false;
+    }
+    if (page_level <= level) {
+      *rec = low_rec;
+      *depth = curr_depth;
+      return true;
+    }
+    if (RecIsInfimum(low_rec)) {
+      low_rec = GetFirstUserRec(buf);
+      if (low_rec == nullptr) {
+        return false;
+      }
+    }
+    Record record(low_rec, index);
+    record.GetColumnOffsets();
+    page_no = record.GetChildPageNo();
+    expected_level = page_level - 1;
+  }
+}
+
+bool ibdNinja::SearchToLeaf(Index* index, const SearchKey& key,
+                            SearchCursor* cursor, unsigned char** rec,
+                            uint32_t* leaf_depth,
+                            std::vector<uint32_t>* path) {
+  return SearchToLevel(index, key, cursor, 0, rec, leaf_depth, path);
+}
+
+/*
+ * Returns the user record following rec on the leaf level, moving to the
+ * next sibling page if needed, or nullptr at the end of the index.
+ */
+unsigned char* ibdNinja::GetNextLeafRec(Index* index, SearchCursor* cursor,
+                                        uint32_t leaf_depth,
+                                        unsigned char* rec, bool* error) {
+  *error = false;
+  unsigned char* buf = page_align(rec);
+  for (uint32_t n_pages = 0; n_pages <= n_pages_; n_pages++) {
+    rec = GetNextRecInPage(rec, buf, error);
+    if (*error) {
+      return nullptr;
+    }
+    if (rec != nullptr) {
+      return rec;
+    }
+    uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+    if (next_page_no == FIL_NULL) {
+      return nullptr;
+    }
+    buf = cursor->GetPage(leaf_depth, next_page_no);
+    if (buf == nullptr || !PageBelongsToIndex(buf, index, 0)) {
+      *error = true;
+      return nullptr;
+    }
+    rec = buf + PAGE_NEW_INFIMUM;
+  }
+  ninja_error("Found a loop in the sibling links of index %s",
+              index->name().c_str());
+  *error = true;
+  return nullptr;
+}
+
+/*
+ * Calls the visitor once per leaf page with the records of that page whose
+ * key lies in [low, high], comparing keys as prefixes. A nullptr high means
+ * no upper bound. Delete-marked records are included. The records point
+ * into the cursor's page buffer and are only valid during the call.
+ * With a filter, the leaf pages that the zone map of the index rules out
+ * are not read, and are counted in *n_skipped.
+ */
+bool ibdNinja::ScanLeafBatches(Index* index, const SearchKey& low,
+                const SearchKey* high, SearchCursor* cursor,
+                const std::function<bool(const std::vector<Record*>&)>& visitor,
+                uint32_t* n_leaf_pages, std::vector<uint32_t>* path,
+                const RowFilter* filter, uint32_t* n_skipped) {
+  unsigned char* rec = nullptr;
+  uint32_t leaf_depth = 0;
+  if (!SearchToLeaf(index, low, cursor, &rec, &leaf_depth, path)) {
+    return false;
+  }
+  unsigned char* buf = page_align(rec);
+  const ZoneMap* zone_map = (filter == nullptr) ? nullptr : GetZoneMap(index);
+  auto skip_page = [&](uint32_t page_no, uint32_t* next_page_no) {
+    if (!ZoneMapCanSkip(zone_map, page_no, filter, next_page_no)) {
+      return false;
+    }
+    (*n_skipped)++;
+    return true;
+  };
+  // The first leaf page is read by the search anyway, only its records are
+  // skipped, and the scan goes on from its FIL_PAGE_NEXT
+  if (skip_page(ReadFrom4B(buf + FIL_PAGE_OFFSET), nullptr)) {
+    rec = nullptr;
+  }
+  std::vector<Record*> batch;
+  auto flush = [&]() {
+    bool ret = batch.empty() || visitor(batch);
+    if (!batch.empty()) {
+      (*n_leaf_pages)++;
+    }
+    for (auto* record : batch) {
+      delete record;
+    }
+    batch.clear();
+    return ret;
+  };
+
+  bool error = false;
+  for (uint32_t n_pages = 0; n_pages <= n_pages_; ) {
+    if (rec != nullptr) {
+      rec = GetNextRecInPage(rec, buf, &error);
+    }
+    if (error) {
+      break;
+    }
+    if (rec == nullptr) {
+      // The batch must be consumed before the buffer is reused
+      if (!flush()) {
+        return false;
+      }
+      uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+      // The pages ruled out by the zone map are not read
+      while (next_page_no != FIL_NULL && n_pages <= n_pages_ &&
+             skip_page(next_page_no, &next_page_no)) {
+        n_pages++;
+      }
+      if (next_page_no == FIL_NULL) {
+        return true;
+      }
+      buf = cursor->GetPage(leaf_depth, next_page_no);
+      if (buf == nullptr || !PageBelongsToIndex(buf, index, 0)) {
+        return false;
+      }
+      rec = buf + PAGE_NEW_INFIMUM;
+      n_pages++;
+      continue;
+    }
+    Record* record = new Record(rec, index);
+    record->GetColumnOffsets();
+    if (high != nullptr && index->CompareKey(*high, record) < 0) {
+      delete record;
+      return flush();
+    }
+    batch.push_back(record);
+  }
+  if (!error) {
+    ninja_error("Found a loop in the sibling links of index %s",
+                index->name().c_str());
+  }
+  flush();
+  return false;
+}
+
+/*
+ * Calls the visitor on each leaf record whose key lies in [low, high].
+ * Delete-marked records are skipped and counted in *n_deleted.
+ */
+bool ibdNinja::ScanIndexRange(Index* index, const SearchKey& low,
+                              const SearchKey* high, SearchCursor* cursor,
+                              const std::function<bool(Record*)>& visitor,
+                              uint32_t* n_deleted,
+                              std::vector<uint32_t>* path) {
+  uint32_t n_leaf_pages = 0;
+  return ScanLeafBatches(index, low, high, cursor,
+                         [&](const std::vector<Record*>& batch) {
+                           for (auto* record : batch) {
+                             if (record->IsDeleted()) {
+                               (*n_deleted)++;
+                             } else if (!visitor(record)) {
+                               return false;
+                             }
+                           }
+                           return true;
+                         }, &n_leaf_pages, path);
+}
+
+/*
+ * Lists the leaf pages, in key order, that may hold records of the given
+ * ranges, as (page number, range number) pairs. The pages are taken from
+ * the node pointers on level 1, so the leaf pages themselves are not read.
+ */
+bool ibdNinja::CollectLeafPages(Index* index,
+                        const std::vector<SearchRange>& ranges,
+                        std::vector<std::pair<uint32_t, uint32_t>>* pages) {
+  // A whole index is listed from the leaf level chain in the page map
+  std::vector<uint32_t> leftmost_pages;
+  std::vector<uint32_t> leaf_pages;
+  if (ranges.size() == 1 && ranges[0].first.empty() &&
+      ranges[0].second.empty() &&
+      PageMapLeftmostPages(index, &leftmost_pages) &&
+      PageMapLevelPages(index, leftmost_pages.back(), &leaf_pages)) {
+    for (auto page_no : leaf_pages) {
+      pages->push_back({page_no, 0});
+    }
+    return true;
+  }
+  SearchCursor cursor(n_pages_);
+  for (uint32_t r = 0; r < ranges.size(); r++) {
+    const SearchKey* high = ranges[r].second.empty() ?
+                            nullptr : &ranges[r].second;
+    unsigned char* rec = nullptr;
+    uint32_t depth = 0;
+    if (!SearchToLevel(index, ranges[r].first, &cursor, 1,
+                       &rec, &depth, nullptr)) {
+      return false;
+    }
+    unsigned char* buf = page_align(rec);
+    if (ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL) == 0) {
+      // The root is the only leaf page
+      pages->push_back({ReadFrom4B(buf + FIL_PAGE_OFFSET), r});
+      continue;
+    }
+    // Start from the node pointer whose subtree may contain the low key
+    bool error = false;
+    if (RecIsInfimum(rec)) {
+      rec = GetNextRecInPage(rec, buf, &error);
+    }
+    for (uint32_t n_pages = 0; !error && n_pages <= n_pages_; ) {
+      if (rec == nullptr) {
+        uint32_t next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+        if (next_page_no == FIL_NULL) {
+          break;
+        }
+        buf = cursor.GetPage(depth, next_page_no);
+        if (buf == nullptr || !PageBelongsToIndex(buf, index, 1)) {
+          return false;
+        }
+        rec = GetNextRecInPage(buf + PAGE_NEW_INFIMUM, buf, &error);
+        n_pages++;
+        continue;
+      }
+      Record node_ptr(rec, index);
+      node_ptr.GetColumnOffsets();
+      if (high != nullptr && index->CompareKey(*high, &node_ptr) < 0) {
+        break;
+      }
+      pages->push_back({node_ptr.GetChildPageNo(), r});
+      rec = GetNextRecInPage(rec, buf, &error);
+    }
+    if (error) {
+      return false;
+    }
+  }
+  return true;
+}
+
+/*
+ * Splits the leaf pages of the ranges into contiguous chunks, one per
+ * thread, and calls the visitor with the thread number and the in-range
+ * records (including delete-marked ones) of each leaf page. The visitor is
+ * called concurrently from different threads.
+ */
+bool ibdNinja::ParallelLeafScan(Index* index,
+                const std::vector<SearchRange>& ranges,
+                const std::function<bool(uint32_t,
+                    const std::vector<Record*>&)>& visitor,
+                uint32_t* n_threads, uint32_t* n_leaf_pages,
+                const RowFilter* filter, uint32_t* n_skipped) {
+  std::vector<std::pair<uint32_t, uint32_t>> pages;
+  if (!CollectLeafPages(index, ranges, &pages)) {
+    return false;
+  }
+  const ZoneMap* zone_map = (filter == nullptr) ? nullptr : GetZoneMap(index);
+  if (zone_map != nullptr) {
+    size_t n_pages = pages.size();
+    pages.erase(std::remove_if(pages.begin(), pages.end(),
+                    [&](const std::pair<uint32_t, uint32_t>& page) {
+                      return ZoneMapCanSkip(zone_map, page.first, filter,
+                                            nullptr);
+                    }), pages.end());
+    *n_skipped += n_pages - pages.size();
+  }
+  *n_leaf_pages = pages.size();
+  *n_threads = std::max<uint32_t>(1, std::min<size_t>(*n_threads,
+                                                      pages.size()));
+  std::atomic<bool> failed(false);
+
+  auto worker = [&](uint32_t thread_no) {
+    size_t begin = pages.size() * thread_no / *n_threads;
+    size_t end = pages.size() * (thread_no + 1) / *n_threads;
+    unsigned char* buf_unalign = new unsigned char[2 * UNIV_PAGE_SIZE_MAX];
+    unsigned char* buf = static_cast<unsigned char*>(
+                             ut_align(buf_unalign, g_page_physical_size));
+    std::vector<Record*> batch;
+    for (size_t i = begin; i < end && !failed; i++) {
+      uint32_t page_no = pages[i].first;
+      const SearchKey& low = ranges[pages[i].second].first;
+      const SearchKey& high = ranges[pages[i].second].second;
+      if (page_no >= n_pages_ ||
+          ReadPage(page_no, buf) != g_page_physical_size) {
+        ninja_error("Failed to read page: %u", page_no);
+        failed = true;
+        break;
+      }
+      if (!PageBelongsToIndex(buf, index, 0)) {
+        failed = true;
+        break;
+      }
+      bool error = false;
+      bool past_low = low.empty();
+      for (unsigned char* rec = GetNextRecInPage(buf + PAGE_NEW_INFIMUM,
+                                                 buf, &error);
+           rec != nullptr;
+           rec = GetNextRecInPage(rec, buf, &error)) {
+        Record* record = new Record(rec, index);
+        record->GetColumnOffsets();
+        if (!past_low && index->CompareKey(low, record) > 0) {
+          delete record;
+          continue;
+        }
+        past_low = true;
+        if (!high.empty() && index->CompareKey(high, record) < 0) {
+          delete record;
+          break;
+        }
+        batch.push_back(record);
+      }
+      if (error || (!batch.empty() && !visitor(thread_no, batch))) {
+        failed = true;
+      }
+      for (auto* record : batch) {
+        delete record;
+      }
+      batch.clear();
+    }
+    delete[] buf_unalign;
+  };
+
+  std::vector<std::thread> threads;
+  for (uint32_t t = 1; t < *n_threads; t++) {
+    threads.emplace_back(worker, t);
+  }
+  worker(0);
+  for (auto& thread : threads) {
+    thread.join();
+  }
+  return !failed;
+}
+
+static void PrintSearchBanner(const char* title, Index* index) {
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  %-80s|\n", title);
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Table name: %s.%s\n",
+                  index->table()->schema_ref().c_str(),
+                  index->table()->name().c_str());
+  fprintf(stdout, "Index name: %s\n", index->name().c_str());
+}
+
+static void PrintRecordValues(Record* record, Index* index, uint32_t row_no) {
+  const unsigned char* rec = record->rec();
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "[ROW %u] Page: %u, Offset: %u\n", row_no,
+                  ReadFrom4B(page_align(rec) + FIL_PAGE_OFFSET),
+                  page_offset(rec));
+  std::string value;
+  for (uint32_t i = 0; i < index->GetNFields(); i++) {
+    Column* col = index->GetPhysicalField(i)->column();
+    if (col->IsColumnDropped()) {
+      continue;
+    }
+    record->GetFieldValueString(i, &value);
+    fprintf(stdout, "  %-24s: %s\n", col->name().c_str(), value.c_str());
+  }
+}
+
+static void PrintSearchPath(const std::vector<uint32_t>& path) {
+  fprintf(stdout, "Search path (root to leaf):    ");
+  for (size_t i = 0; i < path.size(); i++) {
+    fprintf(stdout, "%s%u", i == 0 ? "" : " -> ", path[i]);
+  }
+  fprintf(stdout, "\n");
+}
+
+Index* ibdNinja::GetSearchableClustIndex(uint32_t table_id) {
+  Table* table = GetTable(table_id);
+  if (table == nullptr) {
+    ninja_error("Failed to search the table. "
+                "No table with ID %u was found", table_id);
+    return nullptr;
+  }
+  Index* index = table->clust_index();
+  if (index == nullptr || !index->IsIndexParsingRecSupported()) {
+    ninja_error("Searching the primary key of table %s is not supported",
+                table->name().c_str());
+    return nullptr;
+  }
+  return index;
+}
+
+bool ibdNinja::SearchClustIndex(Index* index, const SearchKey& low,
+                                const SearchKey* high, bool point) {
+  PrintSearchBanner(point ? "LOOKUP RESULT" : "RANGE SCAN RESULT", index);
+  SearchCursor cursor(n_pages_);
+  std::vector<uint32_t> path;
+  uint32_t n_matched = 0;
+  uint32_t n_deleted = 0;
+  bool ret = ScanIndexRange(index, low, high, &cursor,
+                            [&](Record* record) {
+                              PrintRecordValues(record, index, ++n_matched);
+                              return true;
+                            }, &n_deleted, &path);
+  if (!ret) {
+    return false;
+  }
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  if (point && n_matched == 0) {
+    fprintf(stdout, "No matching record was found\n");
+  }
+  fprintf(stdout, "Matched records:               %u\n", n_matched);
+  fprintf(stdout, "Skipped delete-marked records: %u\n", n_deleted);
+  fprintf(stdout, "Pages read:                    %u\n",
+                  cursor.n_pages_read());
+  PrintSearchPath(path);
+  return true;
+}
+
+bool ibdNinja::LookupRecord(uint32_t table_id, const std::string& key_str) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  SearchKey key;
+  if (!index->BuildSearchKey(key_str, &key)) {
+    return false;
+  }
+  if (key.empty()) {
+    ninja_error("The lookup key must not be empty");
+    return false;
+  }
+  return SearchClustIndex(index, key, &key, true);
+}
 
-    ninja_pt(print, "\n");
-    ninja_pt(print, "Total delete-marked records count:       %u\n",
-        result.n_deleted_recs_non_leaf);
-    ninja_pt(print, "Total delete-marked records size:        %u B\n",
-        result.deleted_recs_len_non_leaf);
-    ninja_pt(print, "Delete-marked recs to page space ratio:  "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.deleted_recs_len_non_leaf) /
-        g_page_physical_size * 100);
+bool ibdNinja::RangeScan(uint32_t table_id, const std::string& low_str,
+                         const std::string& high_str) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  SearchKey low;
+  SearchKey high;
+  if (!index->BuildSearchKey(low_str, &low) ||
+      !index->BuildSearchKey(high_str, &high)) {
+    return false;
+  }
+  return SearchClustIndex(index, low, high.empty() ? nullptr : &high, false);
+}
 
-    assert(result.n_contain_dropped_cols_recs_non_leaf == 0);
-    assert(result.dropped_cols_len_non_leaf == 0);
+/*
+ * Splits "LO..HI" into its bounds, ignoring ".." inside quoted literals.
+ * A single key is used as both bounds.
+ */
+static bool SplitKeyRange(const std::string& str, std::string* low,
+                          std::string* high) {
+  bool quoted = false;
+  for (size_t i = 0; i + 1 < str.size(); i++) {
+    if (str[i] == '\'') {
+      quoted = !quoted;
+    } else if (!quoted && str[i] == '.' && str[i + 1] == '.') {
+      *low = str.substr(0, i);
+      *high = str.substr(i + 2);
+      return true;
+    }
+  }
+  *low = str;
+  *high = str;
+  return !str.empty();
+}
 
-    result.innodb_internal_used_non_leaf =
-      PAGE_NEW_SUPREMUM_END + result.headers_len_non_leaf +
-      n_dir_slots * PAGE_DIR_SLOT_SIZE  + FIL_PAGE_DATA_END;
-    ninja_pt(print, "\n");
-    ninja_pt(print, "Total innoDB internal space used:        %u B\n"
-        "                                           "
-        "[FIL HEADER     38 B]\n"
-        "                                           "
-        "[PAGE HEADER    36 B]\n"
-        "                                           "
-        "[FSEG HEADER    20 B]\n"
-        "                                           "
-        "[INFI + SUPRE   26 B]\n"
-        "                                           "
-        "[RECORD HEADERS %u B]*\n"
-        "                                           "
-        "[PAGE DIRECTORY %u B]\n"
-        "                                           "
-        "[FIL TRAILER    8 B]\n",
-        result.innodb_internal_used_non_leaf,
-        result.headers_len_non_leaf,
-        n_dir_slots * PAGE_DIR_SLOT_SIZE);
-    ninja_pt(print, "InnoDB internals to page space ratio:    "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.innodb_internal_used_non_leaf) /
-        g_page_physical_size * 100);
+/*
+ * Number of primary keys collected from the secondary index before they
+ * are sorted and fetched from the clustered index.
+ */
+constexpr uint32_t SECONDARY_LOOKUP_BATCH_SIZE = 1000;
 
-    ninja_pt(print, "\n");
-    result.free_non_leaf = garbage + UNIV_PAGE_SIZE - PAGE_DIR -
-      n_dir_slots * PAGE_DIR_SLOT_SIZE - heap_top;
-    ninja_pt(print, "Total free space:                        %u B\n",
-        result.free_non_leaf);
-    ninja_pt(print, "Free space ratio:                        "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          result.free_non_leaf) /
-        g_page_physical_size * 100);
+bool ibdNinja::LookupSecondary(uint32_t index_id,
+                               const std::string& range_str) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to search the index. "
+                "No index with ID %u was found", index_id);
+    return false;
   }
-  // aggregate the page result to the index result
-  if (result_aggr != nullptr) {
-    result_aggr->n_recs_non_leaf +=
-      result.n_recs_non_leaf;
-    result_aggr->n_recs_leaf +=
-      result.n_recs_leaf;
-    result_aggr->headers_len_non_leaf +=
-      result.headers_len_non_leaf;
-    result_aggr->headers_len_leaf +=
-      result.headers_len_leaf;
-    result_aggr->recs_len_non_leaf +=
-      result.recs_len_non_leaf;
-    result_aggr->recs_len_leaf +=
-      result.recs_len_leaf;
-    result_aggr->n_deleted_recs_non_leaf +=
-      result.n_deleted_recs_non_leaf;
-    result_aggr->n_deleted_recs_leaf +=
-      result.n_deleted_recs_leaf;
-    result_aggr->deleted_recs_len_non_leaf +=
-      result.deleted_recs_len_non_leaf;
-    result_aggr->deleted_recs_len_leaf +=
-      result.deleted_recs_len_leaf;
-    result_aggr->n_contain_dropped_cols_recs_non_leaf +=
-      result.n_contain_dropped_cols_recs_non_leaf;
-    result_aggr->n_contain_dropped_cols_recs_leaf +=
-      result.n_contain_dropped_cols_recs_leaf;
-    result_aggr->dropped_cols_len_non_leaf +=
-      result.dropped_cols_len_non_leaf;
-    result_aggr->dropped_cols_len_leaf +=
-      result.dropped_cols_len_leaf;
-    result_aggr->innodb_internal_used_non_leaf +=
-      result.innodb_internal_used_non_leaf;
-    result_aggr->innodb_internal_used_leaf +=
-      result.innodb_internal_used_leaf;
-    result_aggr->free_non_leaf +=
-      result.free_non_leaf;
-    result_aggr->free_leaf +=
-      result.free_leaf;
+  Index* clust_index = index->table()->clust_index();
+  if (index->IsClustered()) {
+    ninja_error("Index %s is the clustered index, use --lookup or --range "
+                "instead", index->name().c_str());
+    return false;
+  }
+  if (!index->IsIndexParsingRecSupported() || clust_index == nullptr ||
+      !clust_index->IsIndexParsingRecSupported()) {
+    ninja_error("Searching index %s is not supported",
+                index->name().c_str());
+    return false;
+  }
+
+  std::string low_str;
+  std::string high_str;
+  SearchKey low;
+  SearchKey high;
+  if (!SplitKeyRange(range_str, &low_str, &high_str)) {
+    ninja_error("The key range must not be empty");
+    return false;
+  }
+  if (!index->BuildSearchKey(low_str, &low) ||
+      !index->BuildSearchKey(high_str, &high)) {
+    return false;
+  }
+
+  // Positions of the primary key fields in the secondary index records
+  std::vector<uint32_t> pk_pos;
+  std::vector<IndexColumn*>* sec_fields = index->ib_fields();
+  for (uint32_t i = 0; i < clust_index->ib_n_uniq(); i++) {
+    Column* col = clust_index->ib_fields()->at(i)->column();
+    for (uint32_t j = 0; j < sec_fields->size(); j++) {
+      if (sec_fields->at(j)->column() == col) {
+        pk_pos.push_back(j);
+        break;
+      }
+    }
+  }
+  if (pk_pos.size() != clust_index->ib_n_uniq()) {
+    ninja_error("Failed to find the primary key in index %s",
+                index->name().c_str());
+    return false;
+  }
+  // The rows are fetched by descending the primary key
+  for (uint32_t i = 0; i < clust_index->ib_n_uniq(); i++) {
+    if (!CheckOrderSupported(clust_index->ib_fields()->at(i)->column())) {
+      return false;
+    }
+  }
+
+  PrintSearchBanner("SECONDARY INDEX LOOKUP RESULT", index);
+  SearchCursor sec_cursor(n_pages_);
+  SearchCursor clust_cursor(n_pages_);
+  std::vector<SearchKey> batch;
+  uint32_t n_sec_matched = 0;
+  uint32_t n_sec_deleted = 0;
+  uint32_t n_batches = 0;
+  uint32_t n_fetched = 0;
+  uint32_t n_missing = 0;
+  uint32_t clust_height = 0;
+
+  /*
+   * Fetches a batch of primary keys in key order, so that consecutive
+   * descents share the cached internal pages (and often the leaf page).
+   */
+  auto fetch_batch = [&]() -> bool {
+    std::sort(batch.begin(), batch.end(),
+              [&](const SearchKey& a, const SearchKey& b) {
+                return clust_index->CompareSearchKeys(a, b) < 0;
+              });
+    n_batches++;
+    for (size_t i = 0; i < batch.size(); i++) {
+      if (i > 0 && clust_index->CompareSearchKeys(batch[i - 1],
+                                                  batch[i]) == 0) {
+        continue;
+      }
+      unsigned char* rec = nullptr;
+      uint32_t leaf_depth = 0;
+      if (!SearchToLeaf(clust_index, batch[i], &clust_cursor,
+                        &rec, &leaf_depth, nullptr)) {
+        return false;
+      }
+      clust_height = leaf_depth + 1;
+      bool error = false;
+      rec = GetNextLeafRec(clust_index, &clust_cursor, leaf_depth,
+                           rec, &error);
+      if (error) {
+        return false;
+      }
+      if (rec != nullptr) {
+        Record record(rec, clust_index);
+        record.GetColumnOffsets();
+        if (clust_index->CompareKey(batch[i], &record) == 0 &&
+            !record.IsDeleted()) {
+          PrintRecordValues(&record, clust_index, ++n_fetched);
+          continue;
+        }
+      }
+      n_missing++;
+    }
+    batch.clear();
+    return true;
+  };
+
+  bool ret = ScanIndexRange(index, low, high.empty() ? nullptr : &high,
+                            &sec_cursor,
+                            [&](Record* record) {
+                              n_sec_matched++;
+                              SearchKey pk;
+                              for (uint32_t pos : pk_pos) {
+                                const unsigned char* data = nullptr;
+                                uint32_t len = 0;
+                                uint32_t flags = record->GetField(pos, &data,
+                                                                  &len);
+                                SearchKeyField field;
+                                field.is_null = (flags & REC_OFFS_SQL_NULL);
+                                field.data.assign(
+                                    reinterpret_cast<const char*>(data), len);
+                                pk.push_back(field);
+                              }
+                              batch.push_back(pk);
+                              if (batch.size() >=
+                                  SECONDARY_LOOKUP_BATCH_SIZE) {
+                                return fetch_batch();
+                              }
+                              return true;
+                            }, &n_sec_deleted, nullptr);
+  if (!ret || (!batch.empty() && !fetch_batch())) {
+    return false;
+  }
+
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Matched secondary records:     %u\n", n_sec_matched);
+  fprintf(stdout, "Skipped delete-marked records: %u\n", n_sec_deleted);
+  fprintf(stdout, "Fetched clustered records:     %u "
+                  "(in %u batches, sorted by primary key)\n",
+                  n_fetched, n_batches);
+  if (n_missing > 0) {
+    fprintf(stdout, "Missing clustered records:     %u "
+                    "(deleted or not found)\n", n_missing);
+  }
+  fprintf(stdout, "Secondary index pages read:    %u\n",
+                  sec_cursor.n_pages_read());
+  fprintf(stdout, "Clustered index pages read:    %u "
+                  "(%u reused from the cursor, %u for one descent per "
+                  "record)\n",
+                  clust_cursor.n_pages_read(), clust_cursor.n_pages_reused(),
+                  (n_fetched + n_missing) * clust_height);
+  return true;
+}
+
+bool ibdNinja::FilterRecords(uint32_t table_id, const std::string& expr) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  RowFilter* filter = RowFilter::CreateRowFilter(expr, index);
+  if (filter == nullptr) {
+    return false;
+  }
+  // Only the leaf pages covering these key ranges are read
+  std::vector<SearchRange> ranges;
+  filter->GetKeyRanges(&ranges);
+
+  PrintSearchBanner("FILTER RESULT", index);
+  SearchCursor cursor(n_pages_);
+  uint32_t n_matched = 0;
+  uint32_t n_evaluated = 0;
+  uint32_t n_deleted = 0;
+  uint32_t n_leaf_pages = 0;
+  uint32_t n_skipped = 0;
+  std::vector<uint8_t> sel;
+  bool ret = true;
+  for (const auto& range : ranges) {
+    ret = ScanLeafBatches(index, range.first,
+                          range.second.empty() ? nullptr : &range.second,
+                          &cursor,
+                          [&](const std::vector<Record*>& batch) {
+                            sel.assign(batch.size(), 1);
+                            for (size_t i = 0; i < batch.size(); i++) {
+                              if (batch[i]->IsDeleted()) {
+                                sel[i] = 0;
+                                n_deleted++;
+                              }
+                            }
+                            n_evaluated += batch.size();
+                            filter->EvaluateBatch(batch, &sel);
+                            for (size_t i = 0; i < batch.size(); i++) {
+                              if (sel[i]) {
+                                PrintRecordValues(batch[i], index,
+                                                  ++n_matched);
+                              }
+                            }
+                            return true;
+                          }, &n_leaf_pages, nullptr, filter, &n_skipped);
+    if (!ret) {
+      break;
+    }
+  }
+  delete filter;
+  if (!ret) {
+    return false;
+  }
+
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Matched records:               %u\n", n_matched);
+  fprintf(stdout, "Evaluated records:             %u\n", n_evaluated);
+  fprintf(stdout, "Skipped delete-marked records: %u\n", n_deleted);
+  fprintf(stdout, "Primary key ranges scanned:    %zu\n", ranges.size());
+  fprintf(stdout, "Leaf pages scanned:            %u\n", n_leaf_pages);
+  if (n_skipped > 0) {
+    fprintf(stdout, "Leaf pages skipped (zone map): %u\n", n_skipped);
+  }
+  fprintf(stdout, "Pages read:                    %u\n",
+                  cursor.n_pages_read());
+  return true;
+}
+
+bool ibdNinja::Aggregate(uint32_t table_id, const std::string& spec,
+                         const std::string& filter_expr) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  RowFilter* filter = nullptr;
+  std::vector<SearchRange> ranges;
+  if (filter_expr.empty()) {
+    ranges.push_back(SearchRange());
+  } else {
+    filter = RowFilter::CreateRowFilter(filter_expr, index);
+    if (filter == nullptr) {
+      return false;
+    }
+    filter->GetKeyRanges(&ranges);
+  }
+  uint32_t n_threads = ScanThreads();
+  Aggregator* aggregator = Aggregator::CreateAggregator(spec, index,
+                                                        n_threads);
+  if (aggregator == nullptr) {
+    delete filter;
+    return false;
+  }
+
+  std::atomic<uint64_t> n_aggregated(0);
+  std::atomic<uint64_t> n_deleted(0);
+  uint32_t n_leaf_pages = 0;
+  uint32_t n_skipped = 0;
+  bool ret = ParallelLeafScan(index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        std::vector<uint8_t> sel(batch.size(), 1);
+        for (size_t i = 0; i < batch.size(); i++) {
+          if (batch[i]->IsDeleted()) {
+            sel[i] = 0;
+            n_deleted++;
+          }
+        }
+        if (filter != nullptr) {
+          filter->EvaluateBatch(batch, &sel);
+        }
+        n_aggregated += std::count(sel.begin(), sel.end(), 1);
+        return aggregator->UpdateBatch(thread_no, batch, sel);
+      }, &n_threads, &n_leaf_pages, filter, &n_skipped);
+
+  if (ret) {
+    PrintSearchBanner("AGGREGATE RESULT", index);
+    ret = aggregator->PrintResult();
+    fprintf(stdout, "Aggregated records:            %" PRIu64 "\n",
+                    n_aggregated.load());
+    fprintf(stdout, "Skipped delete-marked records: %" PRIu64 "\n",
+                    n_deleted.load());
+    fprintf(stdout, "Leaf pages scanned:            %u (by %u threads)\n",
+                    n_leaf_pages, n_threads);
+    if (n_skipped > 0) {
+      fprintf(stdout, "Leaf pages skipped (zone map): %u\n", n_skipped);
+    }
+  }
+  delete aggregator;
+  delete filter;
+  return ret;
+}
+
+/*
+ * Exports the records of a table in key order. The leaf pages are scanned
+ * in parallel; the first thread writes to stdout directly, and the others
+ * write to temporary files that are appended in order afterwards.
+ * The summary is written to stderr, so that stdout only holds the records.
+ */
+bool ibdNinja::ExportRecords(uint32_t table_id, ExportMode mode,
+                             uint64_t since_trx,
+                             const std::string& filter_expr,
+                             RowExporter::Format format) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  uint32_t trx_id_field = 0;
+  if (index->GetPhysicalFieldByName("DB_TRX_ID", &trx_id_field) == nullptr) {
+    ninja_error("Failed to find DB_TRX_ID in index %s",
+                index->name().c_str());
+    return false;
+  }
+  RowFilter* filter = nullptr;
+  std::vector<SearchRange> ranges;
+  if (filter_expr.empty()) {
+    ranges.push_back(SearchRange());
+  } else {
+    filter = RowFilter::CreateRowFilter(filter_expr, index);
+    if (filter == nullptr) {
+      return false;
+    }
+    filter->GetKeyRanges(&ranges);
+  }
+  uint32_t n_threads = ScanThreads();
+  // Delete-marked rows are exported with the DB_TRX_ID that deleted them
+  bool with_changes = (mode != EXPORT_ROWS);
+  RowExporter* exporter = RowExporter::CreateRowExporter(index, format,
+                                                         with_changes);
+  std::vector<FILE*> outputs(n_threads, nullptr);
+  outputs[0] = stdout;
+
+  if (format == RowExporter::FORMAT_TEXT) {
+    PrintSearchBanner(mode == EXPORT_ROWS ? "EXPORTED ROWS" :
+                      mode == EXPORT_CHANGES ? "CHANGED ROWS" :
+                                               "DELETE-MARKED ROWS",
+                      index);
+  }
+  exporter->WriteHeader(stdout);
+  std::atomic<uint64_t> n_exported(0);
+  std::atomic<uint64_t> n_deletes(0);
+  std::atomic<uint64_t> n_scanned(0);
+  uint32_t n_leaf_pages = 0;
+  uint32_t n_skipped = 0;
+  bool ret = ParallelLeafScan(index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        if (outputs[thread_no] == nullptr) {
+          outputs[thread_no] = tmpfile();
+          if (outputs[thread_no] == nullptr) {
+            ninja_error("Failed to create a temporary file, error: %d(%s)",
+                        errno, strerror(errno));
+            return false;
+          }
+        }
+        // DB_TRX_ID and the delete mark are checked before any decoding
+        std::vector<uint8_t> sel(batch.size(), 0);
+        std::vector<uint64_t> trx_ids(batch.size(), 0);
+        for (size_t i = 0; i < batch.size(); i++) {
+          const unsigned char* data = nullptr;
+          uint32_t len = 0;
+          batch[i]->GetField(trx_id_field, &data, &len);
+          trx_ids[i] = ReadFromNB(data, len);
+          switch (mode) {
+            case EXPORT_ROWS:
+              sel[i] = !batch[i]->IsDeleted();
+              break;
+            case EXPORT_CHANGES:
+              sel[i] = (trx_ids[i] > since_trx);
+              break;
+            case EXPORT_DELETED:
+              sel[i] = batch[i]->IsDeleted();
+              break;
+          }
+        }
+        n_scanned += batch.size();
+        if (filter != nullptr) {
+          filter->EvaluateBatch(batch, &sel);
+        }
+        for (size_t i = 0; i < batch.size(); i++) {
+          if (!sel[i]) {
+            continue;
+          }
+          bool is_delete = with_changes && batch[i]->IsDeleted();
+          exporter->WriteRecord(outputs[thread_no], batch[i], is_delete,
+                                trx_ids[i]);
+          n_exported++;
+          if (is_delete) {
+            n_deletes++;
+          }
+        }
+        return true;
+      }, &n_threads, &n_leaf_pages, filter, &n_skipped);
+
+  // Append the output of the other threads in order
+  char buf[64 * 1024];
+  for (size_t t = 1; t < outputs.size(); t++) {
+    if (outputs[t] == nullptr) {
+      continue;
+    }
+    rewind(outputs[t]);
+    size_t n_bytes = 0;
+    while ((n_bytes = fread(buf, 1, sizeof(buf), outputs[t])) > 0) {
+      fwrite(buf, 1, n_bytes, stdout);
+    }
+    if (ferror(outputs[t])) {
+      ret = false;
+    }
+    fclose(outputs[t]);
+  }
+  // A full disk or a closed pipe must not pass for a complete export
+  if (fflush(stdout) != 0 || ferror(stdout) || !ret) {
+    ninja_error("The export of table %u failed, the output is incomplete",
+                table_id);
+    ret = false;
+  }
+
+  if (ret) {
+    fprintf(stderr, "Exported records:              %" PRIu64 "\n",
+                    n_exported.load());
+    if (mode == EXPORT_CHANGES) {
+      fprintf(stderr, "Deletes (delete-marked):       %" PRIu64 "\n",
+                      n_deletes.load());
+    }
+    fprintf(stderr, "Scanned records:               %" PRIu64 "\n",
+                    n_scanned.load());
+    fprintf(stderr, "Leaf pages scanned:            %u (by %u threads)\n",
+                    n_leaf_pages, n_threads);
+    if (n_skipped > 0) {
+      fprintf(stderr, "Leaf pages skipped (zone map): %u\n", n_skipped);
+    }
+    if (exporter->n_truncated() > 0) {
+      fprintf(stderr, "Truncated off-page values:     %" PRIu64 " "
+                      "(unreadable, only the local prefix was exported)\n",
+                      exporter->n_truncated());
+    }
+  }
+  delete exporter;
+  delete filter;
+  return ret;
+}
+
+/*
+ * Per-thread accumulator of AnalyzeTrxAge. Records are counted per
+ * DB_TRX_ID >> shift, and the shift grows whenever there are too many
+ * distinct keys, so memory stays bounded while small tables stay exact.
+ */
+struct TrxAgeStats {
+  static constexpr size_t MAX_KEYS = 1 << 16;
+  struct Counts {
+    uint64_t n_recs = 0;
+    uint64_t n_deleted = 0;
+    uint64_t deleted_len = 0;
+  };
+  uint32_t shift = 0;
+  std::map<uint64_t, Counts> by_trx;
+  uint64_t n_recs = 0;
+  uint64_t recs_len = 0;
+  uint64_t n_deleted = 0;
+  uint64_t deleted_len = 0;
+  uint64_t n_insert_undo = 0;
+  uint64_t max_trx_id = 0;
+  uint64_t min_trx_id = UINT64_MAX;
+  uint64_t min_deleted_trx_id = UINT64_MAX;
+  // Rollback segments referenced by DB_ROLL_PTR
+  std::vector<bool> rsegs = std::vector<bool>(128, false);
+
+  void Add(uint64_t trx_id, uint64_t roll_ptr, uint32_t len, bool deleted) {
+    Counts& counts = by_trx[trx_id >> shift];
+    counts.n_recs++;
+    n_recs++;
+    recs_len += len;
+    max_trx_id = std::max(max_trx_id, trx_id);
+    min_trx_id = std::min(min_trx_id, trx_id);
+    if (deleted) {
+      counts.n_deleted++;
+      counts.deleted_len += len;
+      n_deleted++;
+      deleted_len += len;
+      min_deleted_trx_id = std::min(min_deleted_trx_id, trx_id);
+    }
+    // [insert flag: 1 bit][rseg id: 7 bits][undo page no: 4 B][offset: 2 B]
+    if ((roll_ptr >> 55) & 1) {
+      n_insert_undo++;
+    }
+    rsegs[(roll_ptr >> 48) & 0x7F] = true;
+    if (by_trx.size() > MAX_KEYS) {
+      Coarsen(shift + 1);
+    }
+  }
+  void Coarsen(uint32_t new_shift) {
+    if (new_shift <= shift) {
+      return;
+    }
+    std::map<uint64_t, Counts> coarse;
+    for (const auto& iter : by_trx) {
+      Counts& counts = coarse[iter.first >> (new_shift - shift)];
+      counts.n_recs += iter.second.n_recs;
+      counts.n_deleted += iter.second.n_deleted;
+      counts.deleted_len += iter.second.deleted_len;
+    }
+    by_trx.swap(coarse);
+    shift = new_shift;
+  }
+  void Merge(TrxAgeStats* other) {
+    Coarsen(other->shift);
+    other->Coarsen(shift);
+    for (const auto& iter : other->by_trx) {
+      Counts& counts = by_trx[iter.first];
+      counts.n_recs += iter.second.n_recs;
+      counts.n_deleted += iter.second.n_deleted;
+      counts.deleted_len += iter.second.deleted_len;
+    }
+    n_recs += other->n_recs;
+    recs_len += other->recs_len;
+    n_deleted += other->n_deleted;
+    deleted_len += other->deleted_len;
+    n_insert_undo += other->n_insert_undo;
+    max_trx_id = std::max(max_trx_id, other->max_trx_id);
+    min_trx_id = std::min(min_trx_id, other->min_trx_id);
+    min_deleted_trx_id = std::min(min_deleted_trx_id,
+                                  other->min_deleted_trx_id);
+    for (size_t i = 0; i < rsegs.size(); i++) {
+      rsegs[i] = rsegs[i] || other->rsegs[i];
+    }
+    while (by_trx.size() > MAX_KEYS) {
+      Coarsen(shift + 1);
+    }
   }
+};
 
+/*
+ * There is no current transaction id offline, so ages are counted back
+ * from the largest DB_TRX_ID of the index. Delete-marked records are what
+ * purge has not removed yet: old ones point at a purge held back by a long
+ * running transaction (an old read view), and their size is what the
+ * table would shrink by once purge catches up.
+ */
+bool ibdNinja::AnalyzeTrxAge(uint32_t table_id) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  uint32_t trx_id_field = 0;
+  uint32_t roll_ptr_field = 0;
+  if (index->GetPhysicalFieldByName("DB_TRX_ID", &trx_id_field) == nullptr ||
+      index->GetPhysicalFieldByName("DB_ROLL_PTR",
+                                    &roll_ptr_field) == nullptr) {
+    ninja_error("Failed to find DB_TRX_ID and DB_ROLL_PTR in index %s",
+                index->name().c_str());
+    return false;
+  }
+  uint32_t n_threads = ScanThreads();
+  std::vector<TrxAgeStats> thread_stats(n_threads);
+  std::vector<SearchRange> ranges(1);
+  uint32_t n_leaf_pages = 0;
+  bool ret = ParallelLeafScan(index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        TrxAgeStats& stats = thread_stats[thread_no];
+        for (Record* record : batch) {
+          const unsigned char* data = nullptr;
+          uint32_t len = 0;
+          record->GetField(trx_id_field, &data, &len);
+          uint64_t trx_id = ReadFromNB(data, len);
+          record->GetField(roll_ptr_field, &data, &len);
+          uint64_t roll_ptr = ReadFromNB(data, len);
+          stats.Add(trx_id, roll_ptr, record->GetSize(),
+                    record->IsDeleted());
+        }
+        return true;
+      }, &n_threads, &n_leaf_pages);
+  if (!ret) {
+    return false;
+  }
+  TrxAgeStats& stats = thread_stats[0];
+  for (size_t t = 1; t < thread_stats.size(); t++) {
+    stats.Merge(&thread_stats[t]);
+  }
+
+  // Ages in log2 buckets: 0, 1, 2-3, 4-7, ..., up to the 6-byte trx ids
+  constexpr uint32_t N_AGE_BUCKETS = 8 * DATA_TRX_ID_LEN + 1;
+  std::vector<TrxAgeStats::Counts> ages(N_AGE_BUCKETS);
+  for (const auto& iter : stats.by_trx) {
+    // The youngest transaction of the key gives the age
+    uint64_t youngest = std::min(stats.max_trx_id,
+                                 ((iter.first + 1) << stats.shift) - 1);
+    uint64_t age = stats.max_trx_id - youngest;
+    uint32_t bucket = 0;
+    while (age != 0 && bucket < N_AGE_BUCKETS - 1) {
+      age >>= 1;
+      bucket++;
+    }
+    ages[bucket].n_recs += iter.second.n_recs;
+    ages[bucket].n_deleted += iter.second.n_deleted;
+    ages[bucket].deleted_len += iter.second.deleted_len;
+  }
+
+  PrintSearchBanner("TRANSACTION AGE AND PURGE LAG", index);
+  auto ratio = [](uint64_t n, uint64_t total) {
+    return total == 0 ? 0.0 : static_cast<double>(n) / total * 100;
+  };
+  fprintf(stdout, "Records:                       %" PRIu64 "\n",
+                  stats.n_recs);
+  if (stats.n_recs > 0) {
+    fprintf(stdout, "DB_TRX_ID range:               %" PRIu64 " - %" PRIu64
+                    "\n", stats.min_trx_id, stats.max_trx_id);
+  }
+  fprintf(stdout, "Delete-marked records:         %" PRIu64 " (%.2lf %%)\n",
+                  stats.n_deleted, ratio(stats.n_deleted, stats.n_recs));
+  fprintf(stdout, "Bytes pending purge:           %" PRIu64 " B "
+                  "(%.2lf %% of the record bytes)\n",
+                  stats.deleted_len, ratio(stats.deleted_len,
+                                           stats.recs_len));
+  if (stats.n_deleted > 0) {
+    fprintf(stdout, "Oldest delete-mark age:        %" PRIu64 " trx\n",
+                    stats.max_trx_id - stats.min_deleted_trx_id);
+  }
+  fprintf(stdout, "Last changed by an insert:     %" PRIu64 " "
+                  "(no older versions in the undo logs)\n",
+                  stats.n_insert_undo);
+  fprintf(stdout, "Last changed by an update:     %" PRIu64 " "
+                  "(older versions may remain in the undo logs)\n",
+                  stats.n_recs - stats.n_insert_undo);
+  fprintf(stdout, "Rollback segments referenced:  %zu\n",
+                  static_cast<size_t>(std::count(stats.rsegs.begin(),
+                                                 stats.rsegs.end(), true)));
+  fprintf(stdout, "Leaf pages scanned:            %u (by %u threads)\n",
+                  n_leaf_pages, n_threads);
+  fprintf(stdout, "\nAge in transactions before DB_TRX_ID %" PRIu64,
+                  stats.max_trx_id);
+  if (stats.shift > 0) {
+    fprintf(stdout, " (precise to %" PRIu64 " trx)",
+                    static_cast<uint64_t>(1) << stats.shift);
+  }
+  fprintf(stdout, ":\n");
+  fprintf(stdout, "  %-27s %12s %12s %10s %14s\n", "Age", "Records",
+                  "Deleted", "Deleted %", "Pending purge");
+  uint32_t first = N_AGE_BUCKETS;
+  uint32_t last = 0;
+  for (uint32_t i = 0; i < N_AGE_BUCKETS; i++) {
+    if (ages[i].n_recs > 0) {
+      first = std::min(first, i);
+      last = i;
+    }
+  }
+  char label[48];
+  for (uint32_t i = first; i <= last && first < N_AGE_BUCKETS; i++) {
+    if (i <= 1) {
+      snprintf(label, sizeof(label), "%u", i);
+    } else {
+      snprintf(label, sizeof(label), "%" PRIu64 "-%" PRIu64,
+               static_cast<uint64_t>(1) << (i - 1),
+               (static_cast<uint64_t>(1) << i) - 1);
+    }
+    fprintf(stdout, "  %-27s %12" PRIu64 " %12" PRIu64 " %8.2lf %% "
+                    "%12" PRIu64 " B\n",
+                    label, ages[i].n_recs, ages[i].n_deleted,
+                    ratio(ages[i].n_deleted, ages[i].n_recs),
+                    ages[i].deleted_len);
+  }
   return true;
 }
 
-bool ibdNinja::ToLeftmostLeaf(Index* index,
-                              unsigned char* buf, uint32_t root,
-                              std::vector<uint32_t>* leaf_pages_no) {
-  if (!index->IsIndexParsingRecSupported()) {
-    // ninja_warn("Skip getting leftmost pages");
-    return false;
+/*
+ * Mergeable sketch of value lengths: lengths below 128 are counted
+ * exactly, larger ones in 16 buckets per power of two, so a quantile is
+ * within 1/16 of the true length.
+ */
+struct LengthSketch {
+  static constexpr uint32_t N_EXACT = 128;
+  static constexpr uint32_t N_SUB = 16;
+  static constexpr uint32_t N_BUCKETS = N_EXACT + (32 - 7) * N_SUB;
+  uint64_t counts[N_BUCKETS] = {};
+
+  static uint32_t Bucket(uint64_t len) {
+    if (len < N_EXACT) {
+      return static_cast<uint32_t>(len);
+    }
+    uint32_t exp = 63 - __builtin_clzll(len);
+    if (exp >= 32) {
+      return N_BUCKETS - 1;
+    }
+    uint32_t sub = (len >> (exp - 4)) & (N_SUB - 1);
+    return N_EXACT + (exp - 7) * N_SUB + sub;
   }
-  uint32_t bytes = ReadPage(root, buf);
-  if (bytes != g_page_physical_size) {
-    ninja_error("Failed to read page: %u, error: %d(%s)",
-            root, errno, strerror(errno));
-    return false;
+  static uint64_t UpperBound(uint32_t bucket) {
+    if (bucket < N_EXACT) {
+      return bucket;
+    }
+    uint32_t exp = 7 + (bucket - N_EXACT) / N_SUB;
+    uint32_t sub = (bucket - N_EXACT) % N_SUB;
+    return ((static_cast<uint64_t>(N_SUB + sub + 1)) << (exp - 4)) - 1;
   }
-  uint32_t curr_page_no = root;
-  leaf_pages_no->push_back(curr_page_no);
-
-  uint32_t page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
-  // uint32_t n_of_recs = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_N_RECS);
-
-  unsigned char* current_rec = nullptr;
-  while (page_level != 0) {
-    current_rec = GetFirstUserRec(buf);
-    if (current_rec == nullptr) {
-      break;
+  void Add(uint64_t len) {
+    counts[Bucket(len)]++;
+  }
+  void Merge(const LengthSketch& other) {
+    for (uint32_t i = 0; i < N_BUCKETS; i++) {
+      counts[i] += other.counts[i];
     }
-    Record record(current_rec, index);
-    record.GetColumnOffsets();
-    uint32_t child_page_no = record.GetChildPageNo();
-
-    uint64_t curr_page_level = page_level;
-
-    bytes = ReadPage(child_page_no, buf);
-    if (bytes != g_page_physical_size) {
-      ninja_error("Failed to read page: %u, error: %d(%s)",
-              child_page_no, errno, strerror(errno));
-      return false;
+  }
+  // The upper bound of the bucket holding the q-quantile of n lengths
+  uint64_t Quantile(double q, uint64_t n) const {
+    uint64_t rank = std::max<uint64_t>(1, static_cast<uint64_t>(q * n + 0.5));
+    uint64_t seen = 0;
+    for (uint32_t i = 0; i < N_BUCKETS; i++) {
+      seen += counts[i];
+      if (seen >= rank) {
+        return UpperBound(i);
+      }
     }
-    page_level = ReadFrom2B(buf + FIL_PAGE_DATA + PAGE_LEVEL);
+    return UpperBound(N_BUCKETS - 1);
+  }
+};
 
-    if (page_level != curr_page_level - 1) {
-      break;
-    }
-    curr_page_no = child_page_no;
-    leaf_pages_no->push_back(curr_page_no);
+// Per-field accumulator of AnalyzeColumns
+struct ColumnStats {
+  uint64_t n_null = 0;
+  uint64_t n_default = 0;
+  uint64_t n_values = 0;
+  uint64_t n_external = 0;
+  uint64_t local_bytes = 0;
+  uint64_t external_bytes = 0;
+  uint64_t min_len = UINT64_MAX;
+  uint64_t max_len = 0;
+  LengthSketch lengths;
+
+  void Merge(const ColumnStats& other) {
+    n_null += other.n_null;
+    n_default += other.n_default;
+    n_values += other.n_values;
+    n_external += other.n_external;
+    local_bytes += other.local_bytes;
+    external_bytes += other.external_bytes;
+    min_len = std::min(min_len, other.min_len);
+    max_len = std::max(max_len, other.max_len);
+    lengths.Merge(other.lengths);
   }
+};
 
-  if (page_level != 0) {
-    ninja_error("Failed to find leatmost page");
+/*
+ * The length of a value is what it costs: its bytes in the record plus,
+ * for an off-page value, the BTR_EXTERN_LEN bytes stored externally. NULLs
+ * and instant defaults take no bytes in the record and are only counted.
+ */
+bool ibdNinja::AnalyzeColumns(uint32_t index_id) {
+  Index* index = GetIndex(index_id);
+  if (index == nullptr) {
+    ninja_error("Failed to analyze the index. "
+                "No index with ID %u was found", index_id);
+    return false;
+  }
+  if (!index->IsIndexParsingRecSupported()) {
+    ninja_error("Analyzing the records of index %s is not supported",
+                index->name().c_str());
+    return false;
+  }
+  uint32_t n_fields = index->GetNFields();
+  uint32_t n_threads = ScanThreads();
+  std::vector<std::vector<ColumnStats>> thread_stats(
+      n_threads, std::vector<ColumnStats>(n_fields));
+  std::atomic<uint64_t> n_recs(0);
+  std::atomic<uint64_t> n_deleted(0);
+  std::atomic<uint64_t> recs_len(0);
+  std::vector<SearchRange> ranges(1);
+  uint32_t n_leaf_pages = 0;
+  bool ret = ParallelLeafScan(index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        std::vector<ColumnStats>& stats = thread_stats[thread_no];
+        uint64_t batch_deleted = 0;
+        uint64_t batch_len = 0;
+        for (Record* record : batch) {
+          batch_deleted += record->IsDeleted();
+          batch_len += record->GetSize();
+          for (uint32_t i = 0; i < n_fields; i++) {
+            const unsigned char* data = nullptr;
+            uint32_t len = 0;
+            uint32_t flags = record->GetField(i, &data, &len);
+            ColumnStats& col = stats[i];
+            if (flags & (REC_OFFS_SQL_NULL | REC_OFFS_DROP)) {
+              col.n_null++;
+              continue;
+            }
+            if (flags & REC_OFFS_DEFAULT) {
+              col.n_default++;
+              continue;
+            }
+            uint64_t value_len = len;
+            if ((flags & REC_OFFS_EXTERNAL) &&
+                len >= BTR_EXTERN_FIELD_REF_SIZE) {
+              const unsigned char* ext_ref =
+                  data + len - BTR_EXTERN_FIELD_REF_SIZE;
+              uint64_t ext_len = ReadFrom4B(ext_ref + BTR_EXTERN_LEN + 4);
+              col.n_external++;
+              col.external_bytes += ext_len;
+              value_len += ext_len;
+            }
+            col.n_values++;
+            col.local_bytes += len;
+            col.min_len = std::min(col.min_len, value_len);
+            col.max_len = std::max(col.max_len, value_len);
+            col.lengths.Add(value_len);
+          }
+        }
+        n_recs += batch.size();
+        n_deleted += batch_deleted;
+        recs_len += batch_len;
+        return true;
+      }, &n_threads, &n_leaf_pages);
+  if (!ret) {
     return false;
   }
+  std::vector<ColumnStats>& stats = thread_stats[0];
+  for (size_t t = 1; t < thread_stats.size(); t++) {
+    for (uint32_t i = 0; i < n_fields; i++) {
+      stats[i].Merge(thread_stats[t][i]);
+    }
+  }
+  uint64_t fields_len = 0;
+  uint64_t local_len = 0;
+  for (const auto& col : stats) {
+    fields_len += col.local_bytes + col.external_bytes;
+    local_len += col.local_bytes;
+  }
+
+  PrintSearchBanner("COLUMN STORAGE STATISTICS", index);
+  auto ratio = [](uint64_t n, uint64_t total) {
+    return total == 0 ? 0.0 : static_cast<double>(n) / total * 100;
+  };
+  fprintf(stdout, "Records:                       %" PRIu64 " "
+                  "(%" PRIu64 " delete-marked, included)\n",
+                  n_recs.load(), n_deleted.load());
+  fprintf(stdout, "Record bytes:                  %" PRIu64 " B "
+                  "(%" PRIu64 " B in record headers)\n",
+                  recs_len.load(), recs_len.load() - local_len);
+  fprintf(stdout, "Off-page bytes:                %" PRIu64 " B\n",
+                  fields_len - local_len);
+  fprintf(stdout, "Leaf pages scanned:            %u (by %u threads)\n",
+                  n_leaf_pages, n_threads);
+
+  auto field_name = [index](uint32_t i) {
+    std::string name = index->GetPhysicalField(i)->column()->name();
+    return name.size() > 18 ? name.substr(0, 15) + "..." : name;
+  };
+  fprintf(stdout, "\nValue lengths in bytes (NULLs and defaults excluded, "
+                  "percentiles within 1/16):\n");
+  fprintf(stdout, "  %-18s %6s %6s %6s %8s %6s %6s %6s %8s\n", "Field",
+                  "Null%", "Dflt%", "Min", "Avg", "P50", "P90", "P99", "Max");
+  for (uint32_t i = 0; i < n_fields; i++) {
+    const ColumnStats& col = stats[i];
+    uint64_t n = col.n_values;
+    if (n == 0) {
+      fprintf(stdout, "  %-18s %6.2lf %6.2lf %6s %8s %6s %6s %6s %8s\n",
+                      field_name(i).c_str(), ratio(col.n_null, n_recs),
+                      ratio(col.n_default, n_recs),
+                      "-", "-", "-", "-", "-", "-");
+      continue;
+    }
+    fprintf(stdout, "  %-18s %6.2lf %6.2lf %6" PRIu64 " %8.1lf %6" PRIu64
+                    " %6" PRIu64 " %6" PRIu64 " %8" PRIu64 "\n",
+                    field_name(i).c_str(), ratio(col.n_null, n_recs),
+                    ratio(col.n_default, n_recs), col.min_len,
+                    static_cast<double>(col.local_bytes +
+                                        col.external_bytes) / n,
+                    std::min(col.lengths.Quantile(0.5, n), col.max_len),
+                    std::min(col.lengths.Quantile(0.9, n), col.max_len),
+                    std::min(col.lengths.Quantile(0.99, n), col.max_len),
+                    col.max_len);
+  }
+  fprintf(stdout, "\nStorage:\n");
+  fprintf(stdout, "  %-18s %14s %7s %14s %14s %9s\n", "Field", "Total B",
+                  "Share", "In record B", "Off-page B", "Off-page");
+  for (uint32_t i = 0; i < n_fields; i++) {
+    const ColumnStats& col = stats[i];
+    fprintf(stdout, "  %-18s %14" PRIu64 " %5.1lf %% %14" PRIu64 " %14"
+                    PRIu64 " %9" PRIu64 "\n",
+                    field_name(i).c_str(),
+                    col.local_bytes + col.external_bytes,
+                    ratio(col.local_bytes + col.external_bytes, fields_len),
+                    col.local_bytes, col.external_bytes, col.n_external);
+  }
   return true;
 }
 
-bool ibdNinja::ParseIndex(uint32_t index_id) {
-  auto iter = indexes_.find(index_id);
-  if (iter == indexes_.end()) {
-    ninja_error("Failed to parse the index. "
-                "No index with ID %u was found", index_id);
+/*
+ * Pages reserved by the leaf and non-leaf segments of the B-tree rooted at
+ * root, like fseg_n_reserved_pages(): the fragment pages plus the pages of
+ * every extent owned by the segment, used or not.
+ */
+bool ibdNinja::SegmentReservedPages(uint32_t root, uint64_t* n_pages) {
+  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
+  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
+  unsigned char* buf = static_cast<unsigned char*>(
+                    ut_align(buf_unalign, g_page_physical_size));
+  if (root >= n_pages_ || ReadPage(root, buf) != g_page_physical_size) {
     return false;
   }
-  return ParseIndex(iter->second);
+  uint32_t inode_page_no[2];
+  uint32_t inode_offset[2];
+  uint32_t headers[2] = {PAGE_BTR_SEG_LEAF, PAGE_BTR_SEG_TOP};
+  for (uint32_t i = 0; i < 2; i++) {
+    const unsigned char* header = buf + PAGE_HEADER + headers[i];
+    inode_page_no[i] = ReadFrom4B(header + FSEG_HDR_PAGE_NO);
+    inode_offset[i] = ReadFrom2B(header + FSEG_HDR_OFFSET);
+  }
+  *n_pages = 0;
+  for (uint32_t i = 0; i < 2; i++) {
+    if (inode_page_no[i] >= n_pages_ ||
+        inode_offset[i] + FSEG_INODE_SIZE > g_page_logical_size ||
+        ReadPage(inode_page_no[i], buf) != g_page_physical_size ||
+        PageGetType(buf) != FIL_PAGE_INODE) {
+      return false;
+    }
+    const unsigned char* inode = buf + inode_offset[i];
+    if (ReadFrom4B(inode + FSEG_MAGIC_N) != FSEG_MAGIC_N_VALUE) {
+      return false;
+    }
+    for (uint32_t slot = 0; slot < FSEG_FRAG_ARR_N_SLOTS; slot++) {
+      if (ReadFrom4B(inode + FSEG_FRAG_ARR +
+                     slot * FSEG_FRAG_SLOT_SIZE) != FIL_NULL) {
+        (*n_pages)++;
+      }
+    }
+    *n_pages += static_cast<uint64_t>(FSP_EXTENT_SIZE) *
+                (ReadFrom4B(inode + FSEG_FREE + FLST_LEN) +
+                 ReadFrom4B(inode + FSEG_NOT_FULL + FLST_LEN) +
+                 ReadFrom4B(inode + FSEG_FULL + FLST_LEN));
+  }
+  return true;
 }
 
-bool ibdNinja::ParseIndex(Index* index) {
+/*
+ * Pages in use by the B-tree, when its segments can not be read: the leaf
+ * pages plus the pages found along the sibling links of each upper level.
+ */
+bool ibdNinja::BtreePages(Index* index, uint32_t n_leaf_pages,
+                          uint64_t* n_pages) {
   unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
   memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
   unsigned char* buf = static_cast<unsigned char*>(
                     ut_align(buf_unalign, g_page_physical_size));
-
-  uint32_t page_no = index->ib_page();
-  std::vector<uint32_t> left_pages_no;
-  bool ret = ToLeftmostLeaf(index, buf, page_no, &left_pages_no);
-  if (!ret) {
+  std::vector<uint32_t> leftmost_pages;
+  if (!PageMapLeftmostPages(index, &leftmost_pages) &&
+      !ToLeftmostLeaf(index, buf, index->ib_page(), &leftmost_pages)) {
     return false;
   }
-  uint32_t n_levels = left_pages_no.size();
-  IndexAnalyzeResult index_result;
-  fprintf(stdout, "\n");
-  for (auto iter : left_pages_no) {
-    fprintf(stdout, "Analyzing index %s at level %u...\n",
-                    index->name().c_str(), --n_levels);
-    index_result.n_level++;
-    uint32_t current_page_no = iter;
-    uint32_t next_page_no = FIL_NULL;
-    do {
-      ssize_t bytes = ReadPage(current_page_no, buf);
-      if (bytes != g_page_physical_size) {
-        ninja_error("Failed to read page: %u, error: %d(%s)",
-            current_page_no, errno, strerror(errno));
+  *n_pages = n_leaf_pages;
+  for (size_t level = 0; level + 1 < leftmost_pages.size(); level++) {
+    uint32_t n = 0;
+    for (uint32_t page_no = leftmost_pages[level]; page_no != FIL_NULL;
+         n++) {
+      if (page_no >= n_pages_ || n > n_pages_ ||
+          ReadPage(page_no, buf) != g_page_physical_size) {
         return false;
       }
-      uint32_t page_level = ReadFrom2B(buf + PAGE_HEADER + PAGE_LEVEL);
-      if (page_level > 0) {
-        index_result.n_pages_non_leaf++;
-      } else {
-        index_result.n_pages_leaf++;
-      }
-      bool ret = ParsePage(current_page_no, &(index_result.recs_result),
-                           false, true);
-      if (!ret) {
-        ninja_error("Error occurred while parsing page %u at level %u, "
-                    "Skipping analysis for this level.",
-                    current_page_no, n_levels);
-        break;
-      }
-      next_page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
-      current_page_no = next_page_no;
-    } while (current_page_no != FIL_NULL);
+      page_no = ReadFrom4B(buf + FIL_PAGE_NEXT);
+    }
+    *n_pages += n;
   }
-  fprintf(stdout, "=========================================="
-                  "==========================================\n");
-  fprintf(stdout, "|  INDEX ANALYSIS RESULT                   "
-                  "                                         |\n");
-  fprintf(stdout, "------------------------------------------"
-                  "------------------------------------------\n");
-  fprintf(stdout, "Index name:                                       %s\n",
-                   index->name().c_str());
-  fprintf(stdout, "Index id:                                         %u\n",
-                   index->ib_id());
-  fprintf(stdout, "Belongs to:                                       %s.%s\n",
-                   index->table()->schema_ref().c_str(),
-                   index->table()->name().c_str());
-  fprintf(stdout, "Root page no:                                     %u\n",
-                   index->ib_page());
-  fprintf(stdout, "Num of fields(ALL):                               %u\n",
-                   index->GetNFields());
-  assert(left_pages_no.size() == index_result.n_level);
-  fprintf(stdout, "Num of levels:                                    %u\n",
-                   index_result.n_level);
-  fprintf(stdout, "Num of pages:                                     %u\n"
-                  "                                                  "
-                  "  [Non leaf pages: %u]\n"
-                  "                                                  "
-                  "  [Leaf pages:     %u]\n",
-                   index_result.n_pages_non_leaf + index_result.n_pages_leaf,
-                   index_result.n_pages_non_leaf, index_result.n_pages_leaf);
-  if (index_result.n_level > 1) {
-    uint32_t total_pages_size = index_result.n_pages_non_leaf *
-                                g_page_physical_size;
-    // Print non-leaf pages statistic
-    fprintf(stdout, "\n--------NON-LEAF-LEVELS--------\n");
-    fprintf(stdout, "Total pages count:                                "
-                    "%u\n",
-                     index_result.n_pages_non_leaf);
-    fprintf(stdout, "Total pages size:                                 "
-                    "%u B\n",
-                     total_pages_size);
-
-    fprintf(stdout, "\n");
-    fprintf(stdout, "Total valid records count:                        "
-                    "%u\n",
-                     index_result.recs_result.n_recs_non_leaf);
-    fprintf(stdout, "Total valid records size:                         "
-                    "%u B\n"
-                    "                                                  "
-                    "  [Headers: %u B]\n"
-                    "                                                  "
-                    "  [Bodies:  %u B]\n",
-                     index_result.recs_result.headers_len_non_leaf +
-                     index_result.recs_result.recs_len_non_leaf,
-                     index_result.recs_result.headers_len_non_leaf,
-                     index_result.recs_result.recs_len_non_leaf);
-    fprintf(stdout, "Valid records to non-leaf pages space ratio:      "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          (index_result.recs_result.headers_len_non_leaf +
-           index_result.recs_result.recs_len_non_leaf)) /
-        total_pages_size * 100);
-
-    fprintf(stdout, "\n");
-    fprintf(stdout, "Total delete-marked records count:                "
-                    "%u\n",
-                     index_result.recs_result.n_deleted_recs_non_leaf);
-    fprintf(stdout, "Total delete-marked records size:                 "
-                     "%u B\n",
-                     index_result.recs_result.deleted_recs_len_non_leaf);
-    fprintf(stdout, "Delete-marked recs to non-leaf pages space ratio: "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          index_result.recs_result.deleted_recs_len_non_leaf) /
-        total_pages_size * 100);
-
-    assert(index_result.recs_result.n_contain_dropped_cols_recs_non_leaf == 0);
-    assert(index_result.recs_result.dropped_cols_len_non_leaf == 0);
-
-    fprintf(stdout, "\n");
-    fprintf(stdout, "Total Innodb internal space used:                 "
-                    "%u B\n",
-                    index_result.recs_result.innodb_internal_used_non_leaf);
-    fprintf(stdout, "InnoDB internals to non-leaf pages space ratio:   "
-        "%02.05lf %%\n",
-        static_cast<double>(
-          index_result.recs_result.innodb_internal_used_non_leaf) /
-        total_pages_size * 100);
+  return true;
+}
 
-    fprintf(stdout, "\n");
-    fprintf(stdout, "Total free space:                                 "
-                    "%u B\n",
-                    index_result.recs_result.free_non_leaf);
-    fprintf(stdout, "Free space ratio:                                 "
-                    "%02.05lf %%\n",
-                     static_cast<double>(
-                      index_result.recs_result.free_non_leaf) /
-                      total_pages_size * 100);
-  }
-  uint32_t total_pages_size = index_result.n_pages_leaf * g_page_physical_size;
-  fprintf(stdout, "\n--------LEAF-LEVEL---------------\n");
-  fprintf(stdout, "Total pages count:                                "
-                  "%u\n",
-                   index_result.n_pages_leaf);
-  fprintf(stdout, "Total pages size:                                 "
-                  "%u B\n",
-                   total_pages_size);
-  fprintf(stdout, "\n");
-  fprintf(stdout, "Total valid records count:                        "
-                  "%u\n",
-                   index_result.recs_result.n_recs_leaf);
-  fprintf(stdout, "Total valid records size:                         "
-                  "%u B\n"
-                  "                                                  "
-                  "  [Headers: %u B]\n"
-                  "                                                  "
-                  "  [Bodies:  %u B]\n",
-                   index_result.recs_result.headers_len_leaf +
-                   index_result.recs_result.recs_len_leaf,
-                   index_result.recs_result.headers_len_leaf,
-                   index_result.recs_result.recs_len_leaf);
-  fprintf(stdout, "Valid records to leaf pages space ratio:          "
-                  "%02.05lf %%\n",
-                   static_cast<double>(
-                   (index_result.recs_result.headers_len_leaf +
-                    index_result.recs_result.recs_len_leaf)) /
-                    total_pages_size * 100);
+// Number of leading fields of two records that are equal, NULLs included
+static uint32_t MatchedFields(Index* index, Record* a, Record* b,
+                              uint32_t n_fields) {
+  for (uint32_t i = 0; i < n_fields; i++) {
+    const unsigned char* a_data = nullptr;
+    const unsigned char* b_data = nullptr;
+    uint32_t a_len = 0;
+    uint32_t b_len = 0;
+    bool a_null = (a->GetField(i, &a_data, &a_len) & REC_OFFS_SQL_NULL);
+    bool b_null = (b->GetField(i, &b_data, &b_len) & REC_OFFS_SQL_NULL);
+    if (a_null || b_null) {
+      if (a_null != b_null) {
+        return i;
+      }
+      continue;
+    }
+    if (index->GetPhysicalField(i)->column()->CompareValue(
+            a_data, a_len, b_data, b_len) != 0) {
+      return i;
+    }
+  }
+  return n_fields;
+}
 
-  fprintf(stdout, "\n");
-  fprintf(stdout, "Total records with instant dropped columns count: "
-                  "%u\n",
-                   index_result.recs_result.n_contain_dropped_cols_recs_leaf);
-  fprintf(stdout, "Total instant dropped columns size:               "
-                  "%u B\n",
-                   index_result.recs_result.dropped_cols_len_leaf);
-  fprintf(stdout, "Dropped columns to leaf pages space ratio:        "
-                  "%02.05lf %%\n",
-                   static_cast<double>(
-                    index_result.recs_result.dropped_cols_len_leaf) /
-                    total_pages_size * 100);
+/*
+ * Distinct key prefixes counted by one thread over its contiguous chunk of
+ * leaf pages. The pages holding the first and the last counted records are
+ * kept, so that the chunks can be stitched together afterwards.
+ */
+struct PrefixCounter {
+  explicit PrefixCounter(uint32_t n_uniq)
+      : n_diff(n_uniq, 0),
+        pages(3 * UNIV_PAGE_SIZE_MAX) {
+  }
+  unsigned char* first_page() {
+    return static_cast<unsigned char*>(
+               ut_align(pages.data(), g_page_physical_size));
+  }
+  unsigned char* last_page() {
+    return first_page() + UNIV_PAGE_SIZE_MAX;
+  }
+  std::vector<uint64_t> n_diff;
+  uint64_t n_recs = 0;
+  std::vector<unsigned char> pages;
+  uint32_t first_offset = 0;
+  uint32_t last_offset = 0;
+  bool empty = true;
+};
 
-  fprintf(stdout, "\n");
-  fprintf(stdout, "Total delete-marked records count:                "
-                  "%u\n",
-                   index_result.recs_result.n_deleted_recs_leaf);
-  fprintf(stdout, "Total delete-marked records size:                 "
-                   "%u B\n",
-                   index_result.recs_result.deleted_recs_len_leaf);
-  fprintf(stdout, "Delete-marked records to leaf pages space ratio:  "
-                  "%02.05lf %%\n",
-                   static_cast<double>(
-                    index_result.recs_result.deleted_recs_len_leaf) /
-                    total_pages_size * 100);
+/*
+ * Each leaf level is sorted, so a record starts a new distinct prefix of
+ * k fields exactly when it differs from the previous record in one of its
+ * first k fields. Delete-marked records are skipped and NULLs compare as
+ * equal, as InnoDB does with its default settings. The leaf pages are
+ * split among threads, and a record that starts a chunk is only new for
+ * the prefixes that differ from the last record of the previous chunk.
+ */
+bool ibdNinja::ComputeStats(uint32_t table_id) {
+  Table* table = GetTable(table_id);
+  if (table == nullptr) {
+    ninja_error("Failed to compute the statistics. "
+                "No table with ID %u was found", table_id);
+    return false;
+  }
+  auto quote = [](const std::string& str) {
+    std::string quoted = "'";
+    for (char c : str) {
+      if (c == '\'' || c == '\\') {
+        quoted.push_back(c);
+      }
+      quoted.push_back(c);
+    }
+    return quoted + "'";
+  };
+  std::string db_name = quote(table->schema_ref());
+  std::string table_name = quote(table->name());
+  uint64_t n_rows = 0;
+  uint64_t clust_size = 0;
+  uint64_t other_size = 0;
+  bool has_clust = false;
+  fprintf(stdout, "-- Exact statistics of %s.%s, computed by ibdNinja\n",
+                  table->schema_ref().c_str(), table->name().c_str());
+  for (auto* index : table->indexes()) {
+    if (!index->IsIndexSupported() || !index->IsIndexParsingRecSupported()) {
+      ninja_warn("Skipping index %s, parsing its records is not supported",
+                 index->name().c_str());
+      continue;
+    }
+    uint32_t n_uniq = index->ib_n_uniq();
+    // Distinct prefixes are counted by comparing neighbouring records
+    Column* unordered = nullptr;
+    for (uint32_t i = 0; i < n_uniq && unordered == nullptr; i++) {
+      Column* col = index->GetPhysicalField(i)->column();
+      if (!col->IsOrderSupported()) {
+        unordered = col;
+      }
+    }
+    if (unordered != nullptr) {
+      ninja_warn("Skipping index %s, column %s uses collation %s, whose "
+                 "equality is not implemented", index->name().c_str(),
+                 unordered->name().c_str(),
+                 unordered->CollationName().c_str());
+      continue;
+    }
+    uint32_t n_threads = ScanThreads();
+    std::vector<PrefixCounter> counters(n_threads, PrefixCounter(n_uniq));
+    std::vector<SearchRange> ranges(1);
+    uint32_t n_leaf_pages = 0;
+    bool ret = ParallelLeafScan(index, ranges,
+        [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+          PrefixCounter& counter = counters[thread_no];
+          Record* prev = nullptr;
+          for (Record* record : batch) {
+            if (record->IsDeleted()) {
+              continue;
+            }
+            uint32_t n_matched = 0;
+            if (prev != nullptr) {
+              n_matched = MatchedFields(index, prev, record, n_uniq);
+            } else if (!counter.empty) {
+              Record last(counter.last_page() + counter.last_offset, index);
+              last.GetColumnOffsets();
+              n_matched = MatchedFields(index, &last, record, n_uniq);
+            } else {
+              memcpy(counter.first_page(), page_align(record->rec()),
+                     g_page_physical_size);
+              counter.first_offset = page_offset(record->rec());
+              counter.empty = false;
+            }
+            for (uint32_t k = n_matched; k < n_uniq; k++) {
+              counter.n_diff[k]++;
+            }
+            counter.n_recs++;
+            prev = record;
+          }
+          if (prev != nullptr) {
+            memcpy(counter.last_page(), page_align(prev->rec()),
+                   g_page_physical_size);
+            counter.last_offset = page_offset(prev->rec());
+          }
+          return true;
+        }, &n_threads, &n_leaf_pages);
+    if (!ret) {
+      ninja_error("Failed to scan index %s", index->name().c_str());
+      return false;
+    }
 
-  fprintf(stdout, "\n");
-  fprintf(stdout, "Total Innodb internal space used:                 "
-                  "%u B\n",
-                   index_result.recs_result.innodb_internal_used_leaf);
-  fprintf(stdout, "InnoDB internal space to leaf pages space ratio:  "
-                  "%02.05lf %%\n",
-                   static_cast<double>(
-                    index_result.recs_result.innodb_internal_used_leaf) /
-                    total_pages_size * 100);
+    std::vector<uint64_t> n_diff(n_uniq, 0);
+    uint64_t n_recs = 0;
+    PrefixCounter* prev = nullptr;
+    for (auto& counter : counters) {
+      if (counter.empty) {
+        continue;
+      }
+      n_recs += counter.n_recs;
+      for (uint32_t k = 0; k < n_uniq; k++) {
+        n_diff[k] += counter.n_diff[k];
+      }
+      if (prev != nullptr) {
+        Record last(prev->last_page() + prev->last_offset, index);
+        Record first(counter.first_page() + counter.first_offset, index);
+        last.GetColumnOffsets();
+        first.GetColumnOffsets();
+        uint32_t n_matched = MatchedFields(index, &last, &first, n_uniq);
+        for (uint32_t k = 0; k < n_matched; k++) {
+          n_diff[k]--;
+        }
+      }
+      prev = &counter;
+    }
 
-  fprintf(stdout, "\n");
-  fprintf(stdout, "Total free space:                                 "
-                  "%u B\n",
-                   index_result.recs_result.free_leaf);
-  fprintf(stdout, "Free space ratio:                                 "
-                  "%02.05lf %%\n",
-                   static_cast<double>(
-                    index_result.recs_result.free_leaf) /
-                    total_pages_size * 100);
+    uint64_t size = 0;
+    if (!SegmentReservedPages(index->ib_page(), &size) &&
+        !BtreePages(index, n_leaf_pages, &size)) {
+      ninja_warn("Failed to count the pages of index %s, its size only "
+                 "counts the leaf pages", index->name().c_str());
+      size = n_leaf_pages;
+    }
+    if (index->IsClustered()) {
+      has_clust = true;
+      n_rows = n_uniq == 0 ? n_recs : n_diff[n_uniq - 1];
+      clust_size = size;
+    } else {
+      other_size += size;
+    }
+
+    fprintf(stdout, "-- Index %s: %" PRIu64 " records, %u leaf pages "
+                    "scanned by %u threads\n", index->name().c_str(),
+                    n_recs, n_leaf_pages, n_threads);
+    std::string index_name = quote(index->name());
+    auto print_stat = [&](const std::string& name, uint64_t value,
+                          const std::string& sample_size,
+                          const std::string& description) {
+      fprintf(stdout, "REPLACE INTO mysql.innodb_index_stats (database_name, "
+                      "table_name, index_name, last_update, stat_name, "
+                      "stat_value, sample_size, stat_description) VALUES "
+                      "(%s, %s, %s, NOW(), '%s', %" PRIu64 ", %s, %s);\n",
+                      db_name.c_str(), table_name.c_str(),
+                      index_name.c_str(), name.c_str(), value,
+                      sample_size.c_str(), quote(description).c_str());
+    };
+    std::string columns;
+    for (uint32_t k = 0; k < n_uniq; k++) {
+      char stat_name[32];
+      snprintf(stat_name, sizeof(stat_name), "n_diff_pfx%02u", k + 1);
+      if (k > 0) {
+        columns += ",";
+      }
+      columns += index->GetPhysicalField(k)->column()->name();
+      print_stat(stat_name, n_diff[k], std::to_string(n_leaf_pages),
+                 columns);
+    }
+    print_stat("n_leaf_pages", n_leaf_pages, "NULL",
+               "Number of leaf pages in the index");
+    print_stat("size", size, "NULL", "Number of pages in the index");
+  }
+  if (has_clust) {
+    fprintf(stdout, "REPLACE INTO mysql.innodb_table_stats (database_name, "
+                    "table_name, last_update, n_rows, clustered_index_size, "
+                    "sum_of_other_index_sizes) VALUES (%s, %s, NOW(), "
+                    "%" PRIu64 ", %" PRIu64 ", %" PRIu64 ");\n",
+                    db_name.c_str(), table_name.c_str(), n_rows,
+                    clust_size, other_size);
+  }
+  fprintf(stdout, "-- Run FLUSH TABLE %s.%s for the server to reload them\n",
+                  table->schema_ref().c_str(), table->name().c_str());
+  return true;
+}
 
+/*
+ * The histogram JSON is written alone on stdout, and the summary on
+ * stderr, so that the output can be passed to USING DATA as is.
+ */
+bool ibdNinja::BuildHistogram(uint32_t table_id, const std::string& column,
+                              uint32_t n_buckets) {
+  Index* index = GetSearchableClustIndex(table_id);
+  if (index == nullptr) {
+    return false;
+  }
+  uint32_t n_threads = ScanThreads();
+  HistogramBuilder* builder = HistogramBuilder::CreateHistogramBuilder(
+                                  index, column, n_buckets, n_threads);
+  if (builder == nullptr) {
+    return false;
+  }
+  std::vector<SearchRange> ranges(1);
+  uint32_t n_leaf_pages = 0;
+  bool ret = ParallelLeafScan(index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        return builder->UpdateBatch(thread_no, batch);
+      }, &n_threads, &n_leaf_pages);
+  std::string json;
+  ret = ret && builder->BuildResult(&json);
+  if (ret) {
+    fprintf(stdout, "%s\n", json.c_str());
+    Table* table = index->table();
+    fprintf(stderr, "Histogram type:                %s\n",
+                    builder->histogram_type());
+    fprintf(stderr, "Values:                        %" PRIu64
+                    " (%" PRIu64 " distinct)\n",
+                    builder->n_values(), builder->n_distinct());
+    fprintf(stderr, "NULLs:                         %" PRIu64 "\n",
+                    builder->n_nulls());
+    fprintf(stderr, "Sorted runs spilled to disk:   %" PRIu64 "\n",
+                    builder->n_spilled_runs());
+    fprintf(stderr, "Leaf pages scanned:            %u (by %u threads)\n",
+                    n_leaf_pages, n_threads);
+    if (builder->n_off_page() > 0) {
+      ninja_warn("%" PRIu64 " values are left out, their first characters "
+                 "are stored off-page", builder->n_off_page());
+    }
+    fprintf(stderr, "Load it with: ANALYZE TABLE `%s`.`%s` UPDATE HISTOGRAM "
+                    "ON `%s` USING DATA '<JSON>';\n",
+                    table->schema_ref().c_str(), table->name().c_str(),
+                    builder->column()->name().c_str());
+  }
+  delete builder;
   return ret;
 }
 
-void ibdNinja::ShowTables(bool only_supported) {
-  if (!only_supported) {
-    fprintf(stdout, "Listing all tables and indexes "
-                    "in the specified ibd file:\n");
-    for (auto table : all_tables_) {
-      fprintf(stdout, "---------------------------------------\n");
-      fprintf(stdout, "[Table] name: %s.%s\n",
-              table->schema_ref().c_str(),
-              table->name().c_str());
-      for (auto index : table->indexes()) {
-        fprintf(stdout, "        [Index] name: %s\n",
-                index->name().c_str());
-      }
+/*
+ * Counts, for each secondary index of a table, how often two consecutive
+ * entries in key order point to rows on different leaf pages of the
+ * primary key: the clustering factor. It is the number of clustered pages
+ * a scan of the whole index reads when it only keeps the last one, from
+ * the number of clustered leaf pages when the orders match to the number
+ * of entries when they do not. The primary key of each entry is mapped to
+ * its leaf page by the first keys of the leaf pages, taken from the key
+ * map of the primary key if there is one, or read once from its level 1.
+ */
+bool ibdNinja::AnalyzeClustering(uint32_t table_id) {
+  Index* clust_index = GetSearchableClustIndex(table_id);
+  if (clust_index == nullptr) {
+    return false;
+  }
+  Table* table = clust_index->table();
+  // The primary key of each entry is mapped to its page by its order
+  for (uint32_t i = 0; i < clust_index->ib_n_uniq(); i++) {
+    if (!CheckOrderSupported(clust_index->ib_fields()->at(i)->column())) {
+      return false;
     }
+  }
+  std::vector<uint64_t> key_offsets;
+  std::vector<uint32_t> page_nos;
+  std::string keys;
+  KeyMap fences;
+  const KeyMap* key_map = GetKeyMap(clust_index);
+  if (key_map != nullptr) {
+    fences = *key_map;
   } else {
-    fprintf(stdout, "Listing all *supported* tables and indexes "
-                    "in the specified ibd file:\n");
-    for (auto table : tables_) {
-      fprintf(stdout, "---------------------------------------\n");
-      fprintf(stdout, "[Table] id: %-7" PRIu64 " name: %s.%s\n", table.first,
-          table.second->schema_ref().c_str(),
-          table.second->name().c_str());
-      for (auto index : table.second->indexes()) {
-        if (index->IsIndexSupported() &&
-            indexes_.find(index->ib_id()) != indexes_.end()) {
-          fprintf(stdout, "        [Index] id: %-7u, "
-              "root page no: %-7u, name: %s\n",
-              index->ib_id(), index->ib_page(),
-              index->name().c_str());
+    if (!CollectLeafFences(clust_index, &key_offsets, &page_nos, &keys)) {
+      return false;
+    }
+    memset(&fences, 0, sizeof(fences));
+    fences.n_entries = page_nos.size();
+    fences.key_offsets = key_offsets.data();
+    fences.page_nos = page_nos.data();
+    fences.keys = reinterpret_cast<const unsigned char*>(keys.data());
+  }
+
+  fprintf(stdout, "=========================================="
+                  "==========================================\n");
+  fprintf(stdout, "|  %-80s|\n", "CLUSTERING FACTOR");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Table:                         %s.%s\n",
+                  table->schema_ref().c_str(), table->name().c_str());
+  fprintf(stdout, "Clustered leaf pages:          %u (from the %s)\n",
+                  fences.n_entries, key_map != nullptr ?
+                  "key map" : "node pointers on level 1");
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "%-22s %11s %12s %11s %12s %8s\n", "Index", "Entries",
+                  "Clust. fact.", "Leaf pages", "Entries/read", "Quality");
+
+  uint32_t n_pk_fields = clust_index->ib_n_uniq();
+  uint32_t n_reported = 0;
+  for (auto* index : table->indexes()) {
+    if (index == clust_index) {
+      continue;
+    }
+    if (!index->IsIndexSupported() || !index->IsIndexParsingRecSupported()) {
+      ninja_warn("Skipping index %s, parsing its records is not supported",
+                 index->name().c_str());
+      continue;
+    }
+    // Positions of the primary key fields in the secondary index records
+    std::vector<uint32_t> pk_pos;
+    std::vector<IndexColumn*>* sec_fields = index->ib_fields();
+    for (uint32_t i = 0; i < n_pk_fields; i++) {
+      Column* col = clust_index->ib_fields()->at(i)->column();
+      for (uint32_t j = 0; j < sec_fields->size(); j++) {
+        if (sec_fields->at(j)->column() == col) {
+          pk_pos.push_back(j);
+          break;
         }
       }
     }
+    if (pk_pos.size() != n_pk_fields) {
+      ninja_warn("Skipping index %s, its primary key fields were not found",
+                 index->name().c_str());
+      continue;
+    }
+
+    // Per thread: the page changes within its chunk, and the clustered
+    // pages of its first and last entries
+    struct Chunk {
+      uint64_t n_entries = 0;
+      uint64_t n_changes = 0;
+      uint32_t first_page = FIL_NULL;
+      uint32_t last_page = FIL_NULL;
+    };
+    uint32_t n_threads = ScanThreads();
+    std::vector<Chunk> chunks(n_threads);
+    std::vector<SearchRange> ranges(1);
+    uint32_t n_leaf_pages = 0;
+    bool ret = ParallelLeafScan(index, ranges,
+        [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+          Chunk& chunk = chunks[thread_no];
+          SearchKey pk(n_pk_fields);
+          std::string encoded;
+          for (Record* record : batch) {
+            if (record->IsDeleted()) {
+              continue;
+            }
+            for (uint32_t i = 0; i < n_pk_fields; i++) {
+              const unsigned char* data = nullptr;
+              uint32_t len = 0;
+              uint32_t flags = record->GetField(pk_pos[i], &data, &len);
+              pk[i].is_null = (flags & REC_OFFS_SQL_NULL);
+              pk[i].data.assign(reinterpret_cast<const char*>(data), len);
+            }
+            clust_index->EncodeSortKey(pk, &encoded);
+            uint32_t page_no = FenceLeafPage(fences, encoded, true);
+            if (chunk.n_entries == 0) {
+              chunk.first_page = page_no;
+            } else if (page_no != chunk.last_page) {
+              chunk.n_changes++;
+            }
+            chunk.last_page = page_no;
+            chunk.n_entries++;
+          }
+          return true;
+        }, &n_threads, &n_leaf_pages);
+    if (!ret) {
+      ninja_error("Failed to scan index %s", index->name().c_str());
+      return false;
+    }
+
+    uint64_t n_entries = 0;
+    uint64_t factor = 0;
+    uint32_t last_page = FIL_NULL;
+    for (const auto& chunk : chunks) {
+      if (chunk.n_entries == 0) {
+        continue;
+      }
+      // The first entry of a chunk is a change unless the previous chunk
+      // ended on the same clustered page
+      factor += chunk.n_changes + (chunk.first_page != last_page ? 1 : 0);
+      n_entries += chunk.n_entries;
+      last_page = chunk.last_page;
+    }
+    double per_read = factor == 0 ? 0.0 :
+                      static_cast<double>(n_entries) / factor;
+    // 100% when the factor is the number of clustered pages, 0% when it is
+    // the number of entries
+    double quality = 100.0;
+    if (factor > fences.n_entries && n_entries > fences.n_entries) {
+      quality = 100.0 * (n_entries - factor) /
+                (n_entries - fences.n_entries);
+    }
+    fprintf(stdout, "%-22s %11" PRIu64 " %12" PRIu64 " %11u %12.1f %7.1f%%\n",
+                    index->name().c_str(), n_entries, factor, n_leaf_pages,
+                    per_read, quality);
+    n_reported++;
+  }
+  if (n_reported == 0) {
+    fprintf(stdout, "No secondary index to analyze\n");
   }
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Clust. fact.: clustered leaf pages read by a scan of the "
+                  "whole index in key order\n");
+  fprintf(stdout, "Leaf pages:   leaf pages of the secondary index\n");
+  fprintf(stdout, "Entries/read: entries served per clustered page read\n");
+  fprintf(stdout, "Quality:      100%% if the factor is the number of "
+                  "clustered leaf pages, 0%% if it\n"
+                  "              is the number of entries\n");
+  return true;
 }
 
-void ibdNinja::ShowLeftmostPages(uint32_t index_id) {
-  auto iter = indexes_.find(index_id);
-  if (iter == indexes_.end()) {
-    ninja_error("Failed to parse the index. "
-                "No index with ID %u was found", index_id);
-    return;
+/* ------ What-if index ------ */
+// HyperLogLog registers per key prefix and thread, for a standard error of
+// 1.04 / sqrt(2^14), about 0.8%
+constexpr uint32_t WHATIF_HLL_BITS = 14;
+constexpr uint32_t WHATIF_HLL_REGISTERS = 1U << WHATIF_HLL_BITS;
+// InnoDB allows at most 16 columns in an index key
+constexpr uint32_t WHATIF_MAX_KEY_COLUMNS = 16;
+
+static uint64_t FnvAppend(uint64_t hash, const char* data, size_t len) {
+  for (size_t i = 0; i < len; i++) {
+    hash ^= static_cast<unsigned char>(data[i]);
+    hash *= 1099511628211ULL;
   }
-  Index* index = iter->second;
-  unsigned char buf_unalign[2 * UNIV_PAGE_SIZE_MAX];
-  memset(buf_unalign, 0, 2 * UNIV_PAGE_SIZE_MAX);
-  unsigned char* buf = static_cast<unsigned char*>(
-                    ut_align(buf_unalign, g_page_physical_size));
+  return hash;
+}
 
-  uint32_t page_no = index->ib_page();
-  std::vector<uint32_t> left_pages_no;
-  bool ret = ToLeftmostLeaf(index, buf, page_no, &left_pages_no);
-  if (!ret) {
-    return;
+// The finalizer of MurmurHash3, FNV-1a alone leaves the high bits used as
+// the register number poorly mixed
+static uint64_t Fmix64(uint64_t hash) {
+  hash ^= hash >> 33;
+  hash *= 0xff51afd7ed558ccdULL;
+  hash ^= hash >> 33;
+  hash *= 0xc4ceb9fe1a85ec53ULL;
+  hash ^= hash >> 33;
+  return hash;
+}
+
+static void HllAdd(uint8_t* registers, uint64_t hash) {
+  uint32_t reg = hash >> (64 - WHATIF_HLL_BITS);
+  // Position of the first 1 bit in the remaining bits, the sentinel bit
+  // bounds it when they are all 0
+  uint64_t rest = (hash << WHATIF_HLL_BITS) |
+                  (1ULL << (WHATIF_HLL_BITS - 1));
+  uint8_t rank = __builtin_clzll(rest) + 1;
+  if (registers[reg] < rank) {
+    registers[reg] = rank;
   }
+}
 
-  uint32_t n_levels = left_pages_no.size();
-  uint32_t curr_level = n_levels - 1;
-  fprintf(stdout, "---------------------------------------\n");
-  fprintf(stdout, "Table name: %s.%s\n",
-                   index->table()->schema_ref().c_str(),
-                   index->table()->name().c_str());
-  fprintf(stdout, "Index name: %s\n",
-                   index->name().c_str());
-  for (auto iter : left_pages_no) {
-    fprintf(stdout, "  Level %u: page %u\n",
-        curr_level, iter);
-    curr_level--;
+static double HllEstimate(const uint8_t* registers) {
+  double m = WHATIF_HLL_REGISTERS;
+  double sum = 0;
+  uint32_t n_zeros = 0;
+  for (uint32_t i = 0; i < WHATIF_HLL_REGISTERS; i++) {
+    sum += std::ldexp(1.0, -registers[i]);
+    if (registers[i] == 0) {
+      n_zeros++;
+    }
   }
+  double estimate = 0.7213 / (1 + 1.079 / m) * m * m / sum;
+  if (estimate <= 2.5 * m && n_zeros > 0) {
+    // Linear counting is more accurate on small sets
+    estimate = m * std::log(m / n_zeros);
+  }
+  return estimate;
 }
 
-bool ibdNinja::ParseTable(uint32_t table_id) {
-  auto iter = tables_.find(table_id);
-  if (iter == tables_.end()) {
-    ninja_error("Failed to parse the table. "
-                "No table with ID %u was found", table_id);
+// Pages of a segment holding n_pages pages: its first pages are fragment
+// pages, then it grows by whole extents
+static uint64_t WhatIfSegmentPages(uint64_t n_pages) {
+  if (n_pages <= FSEG_FRAG_ARR_N_SLOTS) {
+    return n_pages;
+  }
+  uint64_t n_extent_pages = n_pages - FSEG_FRAG_ARR_N_SLOTS;
+  return FSEG_FRAG_ARR_N_SLOTS +
+         (n_extent_pages + FSP_EXTENT_SIZE - 1) / FSP_EXTENT_SIZE *
+         FSP_EXTENT_SIZE;
+}
+
+/*
+ * Estimates a secondary index on some columns of a table from one scan of
+ * its primary key, without writing any page. The entries of the index are
+ * the key columns followed by the primary key fields that are not in the
+ * key, sized as COMPACT records. They are packed into pages in key order
+ * up to the fill factor with a directory slot per 4 records, the way
+ * ALTER TABLE ... ADD INDEX bulk loads them, and the node pointers above
+ * them the same way up to a single root. The distinct values of each
+ * prefix of the key are estimated with HyperLogLog, merged from the
+ * registers of every thread.
+ */
+bool ibdNinja::EstimateIndex(uint32_t table_id, const std::string& columns,
+                             uint32_t fill_factor) {
+  Index* clust_index = GetSearchableClustIndex(table_id);
+  if (clust_index == nullptr) {
+    return false;
+  }
+  Table* table = clust_index->table();
+  if (!table->IsCompact()) {
+    ninja_error("What-if indexes are not supported on table %s, its row "
+                "format is REDUNDANT", table->name().c_str());
+    return false;
+  }
+  if (fill_factor < 10 || fill_factor > 100) {
+    ninja_error("The fill factor must be between 10 and 100");
+    return false;
+  }
+
+  std::vector<uint32_t> field_nos;
+  std::vector<Column*> cols;
+  std::string key_names;
+  if (!ParseColumnList(clust_index, columns, &field_nos, &cols,
+                       &key_names)) {
+    return false;
+  }
+  for (auto* col : cols) {
+    if (col->IsSystemColumn() || col->IsSeHidden()) {
+      ninja_error("Unknown column '%s' in table %s", col->name().c_str(),
+                  table->name().c_str());
+      return false;
+    }
+    if (col->ib_mtype() == DATA_BLOB || col->ib_mtype() == DATA_GEOMETRY ||
+        col->ib_mtype() == DATA_POINT || col->ib_mtype() == DATA_VAR_POINT) {
+      ninja_error("Column %s of type %s needs a prefix or spatial index, "
+                  "which is not supported", col->name().c_str(),
+                  col->FieldTypeString().c_str());
+      return false;
+    }
+  }
+  uint32_t n_key_fields = field_nos.size();
+  if (n_key_fields > WHATIF_MAX_KEY_COLUMNS) {
+    ninja_error("An index key has at most %u columns",
+                WHATIF_MAX_KEY_COLUMNS);
+    return false;
+  }
+  // The primary key fields that are not in the key are appended to it
+  std::string pk_names;
+  for (uint32_t i = 0; i < clust_index->ib_n_uniq(); i++) {
+    if (std::find(field_nos.begin(), field_nos.end(), i) !=
+        field_nos.end()) {
+      continue;
+    }
+    Column* col = clust_index->GetPhysicalField(i)->column();
+    field_nos.push_back(i);
+    cols.push_back(col);
+    pk_names += (pk_names.empty() ? "" : ", ") + col->name();
+  }
+  uint32_t n_nullable = 0;
+  std::vector<uint32_t> fixed_sizes;
+  for (auto* col : cols) {
+    n_nullable += col->is_nullable() ? 1 : 0;
+    fixed_sizes.push_back(col->GetFixedSize());
+  }
+  uint32_t header_size = REC_N_NEW_EXTRA_BYTES +
+                         UT_BITS_IN_BYTES(n_nullable);
+  // Distinct values are only counted up to the first key column whose
+  // collation is not implemented
+  uint32_t n_ordered = 0;
+  while (n_ordered < n_key_fields && cols[n_ordered]->IsOrderSupported()) {
+    n_ordered++;
+  }
+
+  // Per thread: the entries and their bytes, and the HyperLogLog
+  // registers of each key prefix
+  struct ThreadState {
+    uint64_t n_entries = 0;
+    uint64_t n_bytes = 0;
+    uint32_t max_size = 0;
+    uint64_t n_off_page = 0;
+    std::vector<uint8_t> registers;
+  };
+  uint32_t n_threads = ScanThreads();
+  std::vector<ThreadState> threads(n_threads);
+  for (auto& thread : threads) {
+    thread.registers.resize(n_key_fields * WHATIF_HLL_REGISTERS, 0);
+  }
+  std::vector<SearchRange> ranges(1);
+  uint32_t n_leaf_pages = 0;
+  bool ret = ParallelLeafScan(clust_index, ranges,
+      [&](uint32_t thread_no, const std::vector<Record*>& batch) {
+        ThreadState& thread = threads[thread_no];
+        std::string prefix;
+        for (Record* record : batch) {
+          if (record->IsDeleted()) {
+            continue;
+          }
+          bool is_external = false;
+          for (uint32_t i = 0; i < field_nos.size(); i++) {
+            const unsigned char* data = nullptr;
+            uint32_t len = 0;
+            if (record->GetField(field_nos[i], &data, &len) &
+                REC_OFFS_EXTERNAL) {
+              is_external = true;
+              break;
+            }
+          }
+          if (is_external) {
+            // Its full length is only known from the off-page part
+            thread.n_off_page++;
+            continue;
+          }
+          uint32_t size = header_size;
+          uint64_t hash = 14695981039346656037ULL;
+          prefix.clear();
+          for (uint32_t i = 0; i < field_nos.size(); i++) {
+            const unsigned char* data = nullptr;
+            uint32_t len = 0;
+            bool is_null = !record->GetFieldValue(field_nos[i], &data, &len);
+            if (!is_null) {
+              if (fixed_sizes[i] == 0) {
+                size += (len >= 128 && cols[i]->IsBigCol()) ? 2 : 1;
+              }
+              size += len;
+            }
+            if (i < n_ordered) {
+              size_t start = prefix.size();
+              prefix.push_back(is_null ? 0 : 1);
+              if (!is_null) {
+                cols[i]->AppendSortKey(data, len, &prefix);
+              }
+              hash = FnvAppend(hash, prefix.data() + start,
+                               prefix.size() - start);
+              HllAdd(&thread.registers[i * WHATIF_HLL_REGISTERS],
+                     Fmix64(hash));
+            }
+          }
+          thread.n_entries++;
+          thread.n_bytes += size;
+          thread.max_size = std::max(thread.max_size, size);
+        }
+        return true;
+      }, &n_threads, &n_leaf_pages);
+  if (!ret) {
+    ninja_error("Failed to scan index %s", clust_index->name().c_str());
     return false;
   }
-  assert(iter->second != nullptr);
+
+  uint64_t n_entries = 0;
+  uint64_t n_bytes = 0;
+  uint32_t max_size = 0;
+  uint64_t n_off_page = 0;
+  std::vector<uint8_t> registers(n_key_fields * WHATIF_HLL_REGISTERS, 0);
+  for (const auto& thread : threads) {
+    n_entries += thread.n_entries;
+    n_bytes += thread.n_bytes;
+    max_size = std::max(max_size, thread.max_size);
+    n_off_page += thread.n_off_page;
+    for (size_t i = 0; i < registers.size(); i++) {
+      registers[i] = std::max(registers[i], thread.registers[i]);
+    }
+  }
+  double avg_size = n_entries == 0 ? 0.0 :
+                    static_cast<double>(n_bytes) / n_entries;
+
+  // Bytes of an empty page for records and their directory slots, less
+  // the space the fill factor leaves free. Like a bulk load, a fill factor
+  // of 100 still leaves 1/16 of the page free for later inserts.
+  uint32_t reserved = fill_factor == 100 ?
+                      UNIV_PAGE_SIZE / 16 :
+                      UNIV_PAGE_SIZE * (100 - fill_factor) / 100;
+  double page_capacity = UNIV_PAGE_SIZE - PAGE_NEW_SUPREMUM_END -
+                         PAGE_EMPTY_DIR_START - reserved;
+  // A bulk loaded page has a directory slot per 4 records
+  double slot_size = PAGE_DIR_SLOT_SIZE / 4.0;
+  struct Level {
+    uint64_t n_entries;
+    uint64_t n_pages;
+  };
+  std::vector<Level> levels;
+  uint64_t level_entries = n_entries;
+  double level_size = avg_size;
+  while (true) {
+    uint64_t n_pages = static_cast<uint64_t>(std::ceil(
+        level_entries * (level_size + slot_size) / page_capacity));
+    n_pages = std::max<uint64_t>(n_pages, 1);
+    levels.push_back({level_entries, n_pages});
+    if (n_pages == 1) {
+      break;
+    }
+    // A node pointer is the whole entry and the child page number
+    level_entries = n_pages;
+    level_size = avg_size + REC_NODE_PTR_SIZE;
+  }
+  uint64_t n_pages = 0;
+  for (const auto& level : levels) {
+    n_pages += level.n_pages;
+  }
+  // The root is in the non-leaf segment, even when it is the only page
+  uint64_t n_leaf_segment = levels.size() > 1 ? levels[0].n_pages : 0;
+  uint64_t n_alloc_pages = WhatIfSegmentPages(n_leaf_segment) +
+                           WhatIfSegmentPages(n_pages - n_leaf_segment);
+
   fprintf(stdout, "=========================================="
                   "==========================================\n");
-  fprintf(stdout, "|  TABLE ANALYSIS RESULT                   "
-                  "                                         |\n");
+  fprintf(stdout, "|  %-80s|\n", "WHAT-IF INDEX ESTIMATE");
   fprintf(stdout, "------------------------------------------"
                   "------------------------------------------\n");
-  fprintf(stdout, "Table name:        %s.%s\n",
-                   iter->second->schema_ref().c_str(),
-                   iter->second->name().c_str());
-  fprintf(stdout, "Table id:          %u\n",
-                   iter->second->ib_id());
-  fprintf(stdout, "Number of indexes: %lu\n",
-                   iter->second->indexes().size());
-  fprintf(stdout, "Analyze each index:\n");
-  for (auto index : iter->second->indexes()) {
-    if (index->IsIndexSupported()) {
-      ParseIndex(index);
+  fprintf(stdout, "Table:                         %s.%s\n",
+                  table->schema_ref().c_str(), table->name().c_str());
+  fprintf(stdout, "Key:                           %s\n", key_names.c_str());
+  fprintf(stdout, "Primary key fields appended:   %s\n",
+                  pk_names.empty() ? "(none)" : pk_names.c_str());
+  fprintf(stdout, "Entries:                       %" PRIu64 "\n", n_entries);
+  fprintf(stdout, "Entry size:                    %.1lf bytes on average, "
+                  "%u at most\n", avg_size, max_size);
+  fprintf(stdout, "Fill factor:                   %u%% (%u bytes left free "
+                  "per page)\n", fill_factor, reserved);
+  fprintf(stdout, "Clustered leaf pages scanned:  %u (by %u threads)\n",
+                  n_leaf_pages, n_threads);
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "%-8s %14s %14s %14s\n", "Level", "Pages", "Entries",
+                  "Entries/page");
+  for (size_t i = levels.size(); i-- > 0;) {
+    fprintf(stdout, "%-8zu %14" PRIu64 " %14" PRIu64 " %14.1lf\n", i,
+                    levels[i].n_pages, levels[i].n_entries,
+                    static_cast<double>(levels[i].n_entries) /
+                    levels[i].n_pages);
+  }
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Height:                        %zu\n", levels.size());
+  fprintf(stdout, "Pages:                         %" PRIu64 " (%" PRIu64
+                  " leaf, %" PRIu64 " non-leaf)\n", n_pages,
+                  levels[0].n_pages, n_pages - levels[0].n_pages);
+  fprintf(stdout, "Size:                          %" PRIu64 " bytes "
+                  "(%.2lf MB)\n", n_pages * UNIV_PAGE_SIZE,
+                  static_cast<double>(n_pages) * UNIV_PAGE_SIZE /
+                  (1024 * 1024));
+  fprintf(stdout, "Allocated:                     %" PRIu64 " pages, %"
+                  PRIu64 " bytes (%.2lf MB)\n", n_alloc_pages,
+                  n_alloc_pages * UNIV_PAGE_SIZE,
+                  static_cast<double>(n_alloc_pages) * UNIV_PAGE_SIZE /
+                  (1024 * 1024));
+  fprintf(stdout, "------------------------------------------"
+                  "------------------------------------------\n");
+  fprintf(stdout, "Distinct values of each key prefix (HyperLogLog, about "
+                  "0.8%% standard error):\n");
+  std::string prefix_names;
+  double last_estimate = 0;
+  for (uint32_t i = 0; i < n_key_fields; i++) {
+    prefix_names += (i == 0 ? "" : ", ") + cols[i]->name();
+    if (i >= n_ordered) {
+      fprintf(stdout, "  %-40s %14s (collation %s is not implemented)\n",
+                      prefix_names.c_str(), "n/a",
+                      cols[n_ordered]->CollationName().c_str());
+      continue;
     }
+    // A longer prefix has at least as many distinct values, and no more
+    // than the entries
+    double estimate = HllEstimate(&registers[i * WHATIF_HLL_REGISTERS]);
+    estimate = std::max(last_estimate,
+                        std::min(estimate, static_cast<double>(n_entries)));
+    last_estimate = estimate;
+    fprintf(stdout, "  %-40s %14" PRIu64 "\n", prefix_names.c_str(),
+                    static_cast<uint64_t>(std::llround(estimate)));
+  }
+  if (!pk_names.empty()) {
+    prefix_names += ", " + pk_names;
+    fprintf(stdout, "  %-40s %14" PRIu64 " (exact)\n",
+                    prefix_names.c_str(), n_entries);
+  }
+  if (g_page_physical_size != UNIV_PAGE_SIZE) {
+    ninja_warn("The table is compressed, the pages are estimated before "
+               "compression");
+  }
+  if (n_off_page > 0) {
+    ninja_warn("%" PRIu64 " rows are left out, some of their key or primary "
+               "key values are stored off-page", n_off_page);
   }
   return true;
 }
@@ -7,6 +7,7 @@
 #include "ibdUtils.h"
 
 #include <rapidjson/document.h>
+#include <sys/mman.h>
 
 #include <iostream>
 #include <optional>
@@ -15,14 +16,94 @@
 #include <limits>
 #include <set>
 #include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <atomic>
+#include <functional>
+#include <algorithm>
+#include <thread>
 
 
 namespace ibd_ninja {
 
+// A string of the dictionary shared by all the objects holding the same
+// value, e.g., column types, schema and engine names. Interned strings are
+// never freed
+class InternedString {
+ public:
+  InternedString();
+  InternedString(const std::string& str);  // NOLINT(runtime/explicit)
+  InternedString& operator=(const std::string& str);
+  operator const std::string&() const {  // NOLINT(runtime/explicit)
+    return *str_;
+  }
+  const std::string& str() const {
+    return *str_;
+  }
+  const char* c_str() const {
+    return str_->c_str();
+  }
+  bool empty() const {
+    return str_->empty();
+  }
+  size_t size() const {
+    return str_->size();
+  }
+  size_t length() const {
+    return str_->length();
+  }
+
+ private:
+  const std::string* str_;
+};
+inline bool operator==(const InternedString& a, const std::string& b) {
+  return a.str() == b;
+}
+inline bool operator==(const InternedString& a, const char* b) {
+  return a.str() == b;
+}
+inline bool operator!=(const InternedString& a, const std::string& b) {
+  return a.str() != b;
+}
+inline bool operator!=(const InternedString& a, const char* b) {
+  return a.str() != b;
+}
+inline std::ostream& operator<<(std::ostream& os, const InternedString& a) {
+  return os << a.str();
+}
+
+// Allocates the dictionary objects of a table from a few large blocks,
+// which are all released with the table
+class DictArena {
+ public:
+  DictArena() : block_used_(0), block_size_(0) {
+  }
+  DictArena(const DictArena&) = delete;
+  DictArena& operator=(const DictArena&) = delete;
+  ~DictArena();
+  template <typename T, typename... Args>
+  T* New(Args&&... args) {
+    T* obj = new (Allocate(sizeof(T), alignof(T)))
+                 T(std::forward<Args>(args)...);
+    destructors_.push_back({[](void* ptr) {
+                              static_cast<T*>(ptr)->~T();
+                            }, obj});
+    return obj;
+  }
+
+ private:
+  void* Allocate(size_t size, size_t align);
+  std::vector<unsigned char*> blocks_;
+  size_t block_used_;
+  size_t block_size_;
+  std::vector<std::pair<void (*)(void*), void*>> destructors_;
+};
+
 class Properties {
  public:
-  Properties() = default;
-  explicit Properties(const std::set<std::string>& keys) : keys_(keys) {
+  Properties() : keys_(nullptr) {
+  }
+  explicit Properties(const std::set<std::string>& keys) : keys_(&keys) {
   }
   bool InsertValues(const std::string& opt_string);
   void DebugDump(int space = 0) {
@@ -32,8 +113,8 @@ class Properties {
     std::cout << space_str << "Dump Properties:" << std::endl;
 
     for (const auto& iter : kvs_) {
-      std::cout << space_str << "  " << iter.first << ": "
-                << iter.second << std::endl;
+      std::cout << space_str << "  " << iter.key << ": "
+                << iter.ToString() << std::endl;
     }
 
     std::cout << space_str << "]" << std::endl;
@@ -44,15 +125,27 @@ class Properties {
   bool Exists(const std::string& key) const;
 
  private:
+  // Numbers are parsed once when loaded, other values are kept as text
+  struct Value {
+    InternedString key;
+    std::string text;
+    uint64_t number;
+    bool is_number;
+    bool is_negative;
+    std::string ToString() const;
+  };
   bool ValidKey(const std::string& key) const;
-  std::set<std::string> keys_;
-  std::map<std::string, std::string> kvs_;
+  const Value* Find(const std::string& key) const;
+  // Shared by all the objects of a class, nullptr if any key is valid
+  const std::set<std::string>* keys_;
+  std::vector<Value> kvs_;
 };
 
 class IndexColumn;
 class Column {
  public:
-  static Column* CreateColumn(const rapidjson::Value& dd_col_obj);
+  static Column* CreateColumn(const rapidjson::Value& dd_col_obj,
+                              DictArena* arena);
   // Only used in creating SE system column
   Column(std::string name, uint32_t ind) :
          dd_name_(name), dd_is_nullable_(false),
@@ -266,6 +359,9 @@ class Column {
   bool IsSeHidden() const {
     return dd_hidden_ == enum_hidden_type::HT_HIDDEN_SE;
   }
+  uint64_t collation_id() const {
+    return dd_collation_id_;
+  }
   const Properties& options() const {
     return dd_options_;
   }
@@ -307,7 +403,7 @@ class Column {
   void set_ib_ind(uint32_t ind) {
     ib_ind_ = ind;
   }
-  std::string dd_column_type_utf8() {
+  const std::string& dd_column_type_utf8() {
     return dd_column_type_utf8_;
   }
   uint32_t ib_mtype() {
@@ -358,6 +454,12 @@ class Column {
   bool ib_instant_default() {
     return ib_instant_default_;
   }
+  const std::string& ib_instant_default_value() const {
+    return ib_instant_default_value_;
+  }
+  void set_ib_instant_default_value(const std::string& value) {
+    ib_instant_default_value_ = value;
+  }
   bool se_explicit() {
     return se_explicit_;
   }
@@ -367,13 +469,46 @@ class Column {
   bool IsAddedAfter(uint8_t version) const;
   bool IsBigCol() const;
 
+  /*------VALUE------*/
+  bool IsUnsignedInt() const;
+  // Decodes a value in InnoDB storage format into a readable string
+  std::string ValueToString(const unsigned char* data, uint32_t len) const;
+  // Encodes a user-supplied literal into InnoDB storage format
+  bool StringToValue(const std::string& str, std::string* value) const;
+  // Compares two stored values the way InnoDB orders them in an index
+  int CompareValue(const unsigned char* a, uint32_t a_len,
+                   const unsigned char* b, uint32_t b_len) const;
+  // Appends a byte string that memcmp() orders like CompareValue(). No
+  // encoded value is a prefix of another, so encodings can be concatenated
+  void AppendSortKey(const unsigned char* data, uint32_t len,
+                     std::string* out) const;
+  // Whether CompareValue() and AppendSortKey() follow the order of InnoDB
+  // exactly. Strings are only ordered exactly in binary and _bin collations
+  bool IsOrderSupported() const;
+  // Whether trailing spaces are ignored when comparing values
+  bool IsPadSpace() const;
+  std::string CollationName() const;
+  bool IsNumeric() const;
+  // Decodes a value of a numeric column, see IsNumeric()
+  bool ValueToNumber(const unsigned char* data, uint32_t len,
+                     long double* value) const;
+  // Decodes a value of an exact numeric column as decimal text
+  bool ValueToDecimal(const unsigned char* data, uint32_t len,
+                      std::string* value) const;
+  // Number of fractional digits of a numeric column, -1 if approximate
+  int NumberScale() const;
+  // Checks whether a stored string value starts with prefix (LIKE 'abc%')
+  bool HasPrefix(const unsigned char* data, uint32_t len,
+                 const std::string& prefix) const;
+
  private:
+  friend class DictArena;
   Column() : dd_options_(default_valid_option_keys),
              dd_se_private_data_(),
              se_explicit_(false), index_column_(nullptr) {
   }
   bool Init(const rapidjson::Value& dd_col_obj);
-  std::string dd_name_;
+  InternedString dd_name_;
   enum_column_types dd_type_;
   bool dd_is_nullable_;
   bool dd_is_zerofill_;
@@ -392,20 +527,20 @@ class Column {
   bool dd_default_value_null_;
   bool dd_srs_id_null_;
   std::optional<std::uint32_t> dd_srs_id_;
-  std::string dd_default_value_;
+  InternedString dd_default_value_;
   bool dd_default_value_utf8_null_;
-  std::string dd_default_value_utf8_;
-  std::string dd_default_option_;
-  std::string dd_update_option_;
-  std::string dd_comment_;
-  std::string dd_generation_expression_;
-  std::string dd_generation_expression_utf8_;
+  InternedString dd_default_value_utf8_;
+  InternedString dd_default_option_;
+  InternedString dd_update_option_;
+  InternedString dd_comment_;
+  InternedString dd_generation_expression_;
+  InternedString dd_generation_expression_utf8_;
   Properties dd_options_;
   Properties dd_se_private_data_;
-  std::string dd_engine_attribute_;
-  std::string dd_secondary_engine_attribute_;
+  InternedString dd_engine_attribute_;
+  InternedString dd_secondary_engine_attribute_;
   enum_column_key dd_column_key_;
-  std::string dd_column_type_utf8_;
+  InternedString dd_column_type_utf8_;
   // TODO(Zhao):
   // Column_type_element_collection dd_elements_;
   uint64_t dd_elements_size_tmp_;
@@ -421,6 +556,8 @@ class Column {
   uint32_t ib_phy_pos_;
   uint32_t ib_col_len_;
   bool ib_instant_default_;
+  // Stored value of a non-NULL instant default
+  std::string ib_instant_default_value_;
 
   bool se_explicit_;
   IndexColumn* index_column_;
@@ -430,11 +567,14 @@ class IndexColumn {
  public:
   static IndexColumn* CreateIndexColumn(
                          const rapidjson::Value& dd_index_col_obj,
-                         const std::vector<Column*>& columns);
+                         const std::vector<Column*>& columns,
+                         DictArena* arena);
   // Used only when creating index columns for a dropped column.
-  static IndexColumn* CreateIndexDroppedColumn(Column* dropped_col);
+  static IndexColumn* CreateIndexDroppedColumn(Column* dropped_col,
+                                               DictArena* arena);
   // Used only when creating a FTS_DOC_ID index column.
-  static IndexColumn* CreateIndexFTSDocIdColumn(Column* doc_id_col);
+  static IndexColumn* CreateIndexFTSDocIdColumn(Column* doc_id_col,
+                                                DictArena* arena);
   void DebugDump(int space = 0) {
     std::string space_str(space, ' ');
     std::cout << space_str << "[" << std::endl;
@@ -466,6 +606,9 @@ class IndexColumn {
   bool hidden() const {
     return dd_hidden_;
   }
+  enum_index_element_order order() const {
+    return dd_order_;
+  }
   uint32_t ib_fixed_len() {
     return ib_fixed_len_;
   }
@@ -480,6 +623,7 @@ class IndexColumn {
   }
 
  private:
+  friend class DictArena;
   explicit IndexColumn(bool se_explicit) : se_explicit_(se_explicit),
     column_(nullptr) {
   }
@@ -504,24 +648,25 @@ constexpr uint32_t DICT_UNIQUE = 2;
 constexpr uint32_t DICT_FTS = 32;
 constexpr uint32_t DICT_SPATIAL = 64;
 const uint8_t MAX_ROW_VERSION = 64;
+/*
+ * A search key holds the leading fields of an index in InnoDB storage
+ * format. Keys shorter than the index key are compared as prefixes.
+ */
+struct SearchKeyField {
+  bool is_null;
+  std::string data;
+};
+typedef std::vector<SearchKeyField> SearchKey;
+// Inclusive [low, high] bounds, where an empty key is an open bound
+typedef std::pair<SearchKey, SearchKey> SearchRange;
+
 class Table;
+class Record;
 class Index {
  public:
   static Index* CreateIndex(const rapidjson::Value& dd_index_obj,
                             const std::vector<Column*>& columns,
                             Table* table);
-  ~Index() {
-    if (IsClustered()) {
-      for (auto* iter : ib_fields_) {
-        if (iter->se_explicit()) {
-          delete iter;
-        }
-      }
-    }
-    for (auto* iter : dd_elements_) {
-      delete iter;
-    }
-  }
   void DebugDump(int space = 0) {
     std::string space_str(space, ' ');
     std::cout << space_str << "[" << std::endl;
@@ -671,6 +816,15 @@ class Index {
   uint16_t GetNUniqueInTree();
   uint16_t GetNUniqueInTreeNonleaf();
   IndexColumn* GetPhysicalField(size_t pos);
+  Column* GetPhysicalFieldByName(const std::string& name, uint32_t* n);
+  bool IsFieldAscending(uint32_t n);
+  bool BuildSearchKey(const std::string& key_str, SearchKey* key);
+  int CompareKey(const SearchKey& key, Record* record);
+  int CompareSearchKeys(const SearchKey& a, const SearchKey& b);
+  // memcmp()-comparable forms of a search key and of the leading n_fields
+  // fields of a record, compared as prefixes like CompareKey()
+  void EncodeSortKey(const SearchKey& key, std::string* out);
+  void EncodeSortKey(Record* record, uint32_t n_fields, std::string* out);
 
   bool IsIndexSupported();
   std::string UnsupportedReason();
@@ -678,6 +832,7 @@ class Index {
   bool IsIndexParsingRecSupported();
 
  private:
+  friend class DictArena;
   explicit Index(Table* table) :
             dd_options_(default_valid_option_keys),
             dd_se_private_data_(),
@@ -687,22 +842,22 @@ class Index {
   }
   bool Init(const rapidjson::Value& dd_index_obj,
             const std::vector<Column*>& columns);
-  std::string dd_name_;
+  InternedString dd_name_;
   bool dd_hidden_;
   bool dd_is_generated_;
   uint32_t dd_ordinal_position_;
-  std::string dd_comment_;
+  InternedString dd_comment_;
   Properties dd_options_;
   Properties dd_se_private_data_;
   enum_index_type dd_type_;
   enum_index_algorithm dd_algorithm_;
   bool dd_is_algorithm_explicit_;
   bool dd_is_visible_;
-  std::string dd_engine_;
-  std::string dd_engine_attribute_;
-  std::string dd_secondary_engine_attribute_;
+  InternedString dd_engine_;
+  InternedString dd_engine_attribute_;
+  InternedString dd_secondary_engine_attribute_;
   std::vector<IndexColumn*> dd_elements_;
-  std::string dd_tablespace_ref_;
+  InternedString dd_tablespace_ref_;
 
   /* ------TABLE SHARE------ */
   uint32_t s_user_defined_key_parts_;
@@ -732,21 +887,10 @@ class Index {
 
 class Table {
  public:
-  static Table* CreateTable(const rapidjson::Value& dd_obj,
-                            unsigned char* sdi_data);
-  ~Table() {
-    for (auto iter : indexes_) {
-      delete iter;
-    }
-    for (auto iter : ib_cols_) {
-      if (iter->se_explicit()) {
-        delete iter;
-      }
-    }
-    for (auto iter : columns_) {
-      delete iter;
-    }
-    delete[] sdi_data_;
+  static Table* CreateTable(const rapidjson::Value& dd_obj);
+  // Columns, indexes and index columns are all freed with the arena
+  DictArena* arena() {
+    return &arena_;
   }
   void DebugDump() {
     std::cout << "Dump Table:" << std::endl
@@ -1004,7 +1148,7 @@ class Table {
   enum_hidden_type hidden() {
     return dd_hidden_;
   }
-  std::string& schema_ref() {
+  const std::string& schema_ref() {
     return dd_schema_ref_;
   }
   uint64_t se_private_id() {
@@ -1037,6 +1181,9 @@ class Table {
   std::vector<Index*>& indexes() {
     return indexes_;
   }
+  std::vector<Column*>& columns() {
+    return columns_;
+  }
   Index* clust_index() {
     return clust_index_;
   }
@@ -1089,8 +1236,7 @@ class Table {
   bool IsTableParsingRecSupported();
 
  private:
-  explicit Table(unsigned char* sdi_data) : sdi_data_(sdi_data),
-            dd_options_(default_valid_option_keys),
+  Table() : dd_options_(default_valid_option_keys),
             dd_se_private_data_(),
             s_fields_(0), s_null_fields_(0),
             unsupported_reason_(0),
@@ -1099,31 +1245,32 @@ class Table {
     indexes_.clear();
   }
   bool Init(const rapidjson::Value& dd_obj);
-  unsigned char* sdi_data_;
+  // First, so that it is destroyed last
+  DictArena arena_;
   /* DD */
-  std::string dd_name_;
+  InternedString dd_name_;
   uint32_t dd_mysql_version_id_;
   uint64_t dd_created_;
   uint64_t dd_last_altered_;
   enum_hidden_type dd_hidden_;
   Properties dd_options_;
   std::vector<Column*> columns_;
-  std::string dd_schema_ref_;
+  InternedString dd_schema_ref_;
   uint64_t dd_se_private_id_;
-  std::string dd_engine_;
-  std::string dd_comment_;
+  InternedString dd_engine_;
+  InternedString dd_comment_;
   uint32_t dd_last_checked_for_upgrade_version_id_;
   Properties dd_se_private_data_;
-  std::string dd_engine_attribute_;
-  std::string dd_secondary_engine_attribute_;
+  InternedString dd_engine_attribute_;
+  InternedString dd_secondary_engine_attribute_;
   enum_row_format dd_row_format_;
   enum_partition_type dd_partition_type_;
-  std::string dd_partition_expression_;
-  std::string dd_partition_expression_utf8_;
+  InternedString dd_partition_expression_;
+  InternedString dd_partition_expression_utf8_;
   enum_default_partitioning dd_default_partitioning_;
   enum_subpartition_type dd_subpartition_type_;
-  std::string dd_subpartition_expression_;
-  std::string dd_subpartition_expression_utf8_;
+  InternedString dd_subpartition_expression_;
+  InternedString dd_subpartition_expression_utf8_;
   enum_default_partitioning dd_default_subpartitioning_;
   std::vector<Index*> indexes_;
   // dd_foreign_keys
@@ -1175,9 +1322,20 @@ class Record {
       delete [] offsets_;
     }
   }
+  const unsigned char* rec() const {
+    return rec_;
+  }
   uint32_t GetStatus();
   uint32_t* GetColumnOffsets();
   uint32_t GetChildPageNo();
+  bool IsDeleted();
+  bool IsMinRec();
+  // Header and body size, needs GetColumnOffsets() first
+  uint32_t GetSize();
+  uint32_t GetField(uint32_t n, const unsigned char** data, uint32_t* len);
+  bool GetFieldValue(uint32_t n, const unsigned char** data, uint32_t* len);
+  bool GetFullFieldValue(uint32_t n, std::string* value, bool* truncated);
+  bool GetFieldValueString(uint32_t n, std::string* value);
   void ParseRecord(bool leaf, uint32_t row_no,
                    PageAnalysisResult* result,
                    bool print);
@@ -1232,15 +1390,388 @@ class Record {
   uint32_t* offsets_;
 };
 
+/*
+ * A --where expression over the physical fields of an index, e.g.,
+ * "status = 3 AND (created < '2024-01-01' OR name LIKE 'ab%')".
+ * Records are evaluated a leaf page at a time, one predicate after another.
+ */
+class RowFilter {
+ public:
+  // A lexical token of the expression
+  struct Token;
+
+  static RowFilter* CreateRowFilter(const std::string& expr, Index* index);
+  ~RowFilter() {
+    delete root_;
+  }
+  RowFilter(const RowFilter&) = delete;
+  RowFilter& operator=(const RowFilter&) = delete;
+
+  /*
+   * Clears sel[i] for each record that does not match the filter. Records
+   * whose sel[i] is already cleared are not evaluated.
+   */
+  void EvaluateBatch(const std::vector<Record*>& records,
+                     std::vector<uint8_t>* sel) const;
+  /*
+   * Returns the disjoint ranges, in index order, of the first key field
+   * that can contain matching records.
+   */
+  void GetKeyRanges(std::vector<SearchRange>* ranges) const;
+
+  // The values of a field over a group of records, e.g., a leaf page
+  struct FieldStats {
+    uint32_t n_nulls;
+    // Unset if all values are NULL, or if the bound is not known
+    bool has_min;
+    std::string min;
+    bool has_max;
+    std::string max;
+  };
+  /*
+   * Returns false if none of n_recs records with the given field stats can
+   * match the filter. get_stats returns nullptr for fields without stats.
+   */
+  bool MayMatch(uint32_t n_recs,
+                const std::function<const FieldStats*(uint32_t)>& get_stats)
+                const;
+
+ private:
+  enum NodeType {
+    NODE_AND,
+    NODE_OR,
+    NODE_PREDICATE
+  };
+  enum PredicateOp {
+    OP_EQ,
+    OP_NE,
+    OP_LT,
+    OP_LE,
+    OP_GT,
+    OP_GE,
+    OP_IS_NULL,
+    OP_IN,
+    OP_LIKE_PREFIX
+  };
+  struct Node {
+    ~Node() {
+      for (auto* child : children) {
+        delete child;
+      }
+    }
+    NodeType type;
+    std::vector<Node*> children;
+    // Predicate on a physical field of the index
+    uint32_t field_no;
+    Column* column;
+    PredicateOp op;
+    bool negated;
+    std::vector<std::string> values;
+  };
+  // Key range of the first key field, both bounds inclusive
+  struct KeyInterval {
+    bool has_low;
+    std::string low;
+    bool has_high;
+    std::string high;
+  };
+  explicit RowFilter(Index* index) : index_(index), root_(nullptr) {
+  }
+  Node* ParseOr(const std::vector<Token>& tokens, size_t* pos);
+  Node* ParseAnd(const std::vector<Token>& tokens, size_t* pos);
+  Node* ParsePrimary(const std::vector<Token>& tokens, size_t* pos);
+  Node* ParsePredicate(const std::vector<Token>& tokens, size_t* pos);
+  bool EncodeLiteral(Node* node, const Token& token, std::string* value);
+  void Evaluate(const Node* node, const std::vector<Record*>& records,
+                std::vector<uint8_t>* sel) const;
+  void EvaluatePredicate(const Node* node,
+                         const std::vector<Record*>& records,
+                         std::vector<uint8_t>* sel) const;
+  std::vector<KeyInterval> GetKeyIntervals(const Node* node) const;
+  bool MayMatch(const Node* node, uint32_t n_recs,
+                const std::function<const FieldStats*(uint32_t)>& get_stats)
+                const;
+
+  Index* index_;
+  Node* root_;
+};
+
+/*
+ * Computes --aggregate functions, e.g.,
+ * "COUNT(*), SUM(amount), MAX(created) GROUP BY status".
+ * Each scan thread updates its own hash table of groups, which is spilled
+ * to per-partition temporary files when it grows too large. The tables are
+ * merged when the result is printed.
+ */
+class Aggregator {
+ public:
+  static Aggregator* CreateAggregator(const std::string& spec, Index* index,
+                                      uint32_t n_threads);
+  ~Aggregator();
+  Aggregator(const Aggregator&) = delete;
+  Aggregator& operator=(const Aggregator&) = delete;
+
+  // Updates the groups of a thread with the records whose sel[i] is set
+  bool UpdateBatch(uint32_t thread_no, const std::vector<Record*>& records,
+                   const std::vector<uint8_t>& sel);
+  // Merges the tables of all threads and prints one entry per group
+  bool PrintResult();
+
+ private:
+  enum AggregateFunc {
+    AGG_COUNT,
+    AGG_SUM,
+    AGG_AVG,
+    AGG_MIN,
+    AGG_MAX
+  };
+  struct AggregateSpec {
+    AggregateFunc func;
+    // nullptr for COUNT(*)
+    Column* column;
+    uint32_t field_no;
+    std::string name;
+    // SUM/AVG of an integer or DECIMAL column are computed exactly
+    bool exact;
+  };
+  // Exact sum of decimal values scaled by 10^scale, kept as the sums of the
+  // positive and of the negative values, in base 10^9 digits, least
+  // significant first
+  struct DecimalSum {
+    std::vector<uint32_t> positive;
+    std::vector<uint32_t> negative;
+  };
+  struct AggregateState {
+    // Number of non-NULL values
+    uint64_t count;
+    long double sum;
+    // Stored MIN/MAX value
+    bool has_value;
+    std::string value;
+    DecimalSum exact_sum;
+  };
+  typedef std::unordered_map<std::string, std::vector<AggregateState>>
+          GroupTable;
+  struct ThreadState {
+    GroupTable groups;
+    uint64_t mem_size;
+    // One temporary file per spill partition, created on the first spill
+    std::vector<FILE*> spill_files;
+  };
+
+  explicit Aggregator(Index* index) : index_(index), n_spilled_groups_(0) {
+  }
+  bool Parse(const std::string& spec);
+  void MergeStates(std::vector<AggregateState>* to,
+                   const std::vector<AggregateState>& from);
+  bool Spill(ThreadState* thread);
+  bool ReadSpilled(FILE* file, GroupTable* groups);
+  bool PrintGroups(const GroupTable& groups, uint64_t* group_no);
+  std::string GroupValueString(const std::string& key, uint32_t n);
+  static void AddDecimal(DecimalSum* sum, const std::string& value);
+  static void MergeDecimalSums(DecimalSum* to, const DecimalSum& from);
+  static std::string DecimalSumToString(const DecimalSum& sum, int scale,
+                                        uint64_t divisor, int result_scale);
+
+  Index* index_;
+  std::vector<AggregateSpec> aggregates_;
+  // Physical fields of the GROUP BY columns
+  std::vector<uint32_t> group_fields_;
+  // Whether each GROUP BY column ignores trailing spaces
+  std::vector<bool> group_pad_space_;
+  std::vector<ThreadState> threads_;
+  uint64_t n_spilled_groups_;
+};
+
+/*
+ * Builds the histogram of a column that MySQL accepts with
+ * "UPDATE HISTOGRAM ON t (c) USING DATA '...'". Each scan thread appends
+ * the values it reads to a buffer, which is sorted and spilled to a
+ * temporary file as a sorted run when it grows too large. The runs are
+ * merged in order: a singleton histogram is built if there are no more
+ * distinct values than buckets, else an equi-height one.
+ */
+class HistogramBuilder {
+ public:
+  static HistogramBuilder* CreateHistogramBuilder(Index* index,
+                                                  const std::string& column,
+                                                  uint32_t n_buckets,
+                                                  uint32_t n_threads);
+  ~HistogramBuilder();
+  HistogramBuilder(const HistogramBuilder&) = delete;
+  HistogramBuilder& operator=(const HistogramBuilder&) = delete;
+
+  // Adds the values of the records that are not delete-marked
+  bool UpdateBatch(uint32_t thread_no, const std::vector<Record*>& records);
+  // Sorts and merges the values of all threads into the histogram JSON
+  bool BuildResult(std::string* json);
+
+  Column* column() const {
+    return column_;
+  }
+  uint64_t n_values() const;
+  uint64_t n_nulls() const;
+  // Off-page values whose histogram prefix is not stored in the record
+  uint64_t n_off_page() const;
+  uint64_t n_distinct() const {
+    return n_distinct_;
+  }
+  uint64_t n_spilled_runs() const;
+  const char* histogram_type() const {
+    return histogram_type_;
+  }
+
+ private:
+  enum ValueType {
+    VALUE_INT,
+    VALUE_UINT,
+    VALUE_DOUBLE,
+    VALUE_DECIMAL,
+    VALUE_DATETIME,
+    VALUE_DATE,
+    VALUE_TIME,
+    VALUE_STRING,
+    VALUE_ENUM,
+    VALUE_SET
+  };
+  // Distinct value read from the merged runs
+  struct Group {
+    std::string value;
+    uint64_t count;
+  };
+  struct ThreadState {
+    // Entries of sort key, value and count, see AppendEntry()
+    std::string buf;
+    std::vector<uint64_t> entries;
+    // Sorted runs spilled to disk
+    std::vector<FILE*> spill_files;
+    uint64_t n_values;
+    uint64_t n_nulls;
+    uint64_t n_off_page;
+  };
+
+  HistogramBuilder(Index* index, Column* column, uint32_t field_no,
+                   ValueType type, uint32_t n_buckets)
+    : index_(index), column_(column), field_no_(field_no), type_(type),
+      n_buckets_(n_buckets), n_distinct_(0), histogram_type_("") {
+  }
+  static bool GetValueType(Column* column, ValueType* type);
+  uint32_t HistogramPrefixLength(const unsigned char* data, uint32_t len,
+                                 uint32_t* n_chars);
+  static void SortRun(ThreadState* thread);
+  bool Spill(ThreadState* thread);
+  // Encodes a value the way MySQL writes it in a histogram
+  bool ValueToJSON(const std::string& value, std::string* result);
+
+  Index* index_;
+  Column* column_;
+  uint32_t field_no_;
+  ValueType type_;
+  uint32_t n_buckets_;
+  std::vector<ThreadState> threads_;
+  uint64_t n_distinct_;
+  const char* histogram_type_;
+};
+
+/*
+ * Writes clustered index records as text, CSV or JSON lines. The user
+ * columns are written in table order. In change-data mode, each record is
+ * preceded by its operation (upsert or delete) and DB_TRX_ID.
+ */
+class RowExporter {
+ public:
+  enum Format {
+    FORMAT_TEXT,
+    FORMAT_CSV,
+    FORMAT_JSON
+  };
+  static bool ParseFormat(const std::string& name, Format* format);
+  static RowExporter* CreateRowExporter(Index* index, Format format,
+                                        bool with_changes);
+
+  void WriteHeader(FILE* out);
+  void WriteRecord(FILE* out, Record* record, bool is_delete,
+                   uint64_t trx_id);
+  // Number of off-page values that could not be read, of which only the
+  // local prefix was written
+  uint64_t n_truncated() const {
+    return n_truncated_;
+  }
+
+ private:
+  RowExporter(Index* index, Format format, bool with_changes)
+    : index_(index), format_(format), with_changes_(with_changes),
+      n_truncated_(0) {
+  }
+  Index* index_;
+  Format format_;
+  bool with_changes_;
+  // Physical fields of the user columns, in table order
+  std::vector<uint32_t> fields_;
+  std::atomic<uint64_t> n_truncated_;
+};
+
+/*
+ * Caches the last page read at each depth of a B-tree descent, so that
+ * descents for nearby keys reuse the internal pages instead of reading
+ * them again.
+ */
+class SearchCursor {
+ public:
+  explicit SearchCursor(uint32_t n_pages)
+    : n_pages_(n_pages), n_pages_read_(0), n_pages_reused_(0) {
+  }
+  ~SearchCursor() {
+    for (auto& level : levels_) {
+      delete[] level.buf_unalign;
+    }
+  }
+  SearchCursor(const SearchCursor&) = delete;
+  SearchCursor& operator=(const SearchCursor&) = delete;
+
+  unsigned char* GetPage(uint32_t depth, uint32_t page_no);
+  uint32_t n_pages_read() const {
+    return n_pages_read_;
+  }
+  uint32_t n_pages_reused() const {
+    return n_pages_reused_;
+  }
+
+ private:
+  struct CachedPage {
+    uint32_t page_no;
+    unsigned char* buf_unalign;
+    unsigned char* buf;
+  };
+  uint32_t n_pages_;
+  uint32_t n_pages_read_;
+  uint32_t n_pages_reused_;
+  std::vector<CachedPage> levels_;
+};
+
 class ibdNinja {
  public:
-  static ibdNinja* CreateNinja(const char* idb_filename);
+  // The file information and loading summary are written to info_out
+  static ibdNinja* CreateNinja(const char* idb_filename,
+                               FILE* info_out = stdout);
   ~ibdNinja() {
     for (auto iter : all_tables_) {
       delete iter;
     }
+    if (dict_cache_ != nullptr) {
+      munmap(dict_cache_, dict_cache_size_);
+    }
+    if (page_map_ != nullptr) {
+      munmap(page_map_, page_map_size_);
+    }
+    for (auto& iter : key_maps_) {
+      if (iter.second.addr != nullptr) {
+        munmap(iter.second.addr, iter.second.size);
+      }
+    }
   }
 
+  // Only the tables loaded from SDI so far, see LoadAllTables()
   const std::map<uint64_t, Table*>* tables() const {
     return &tables_;
   }
@@ -1249,63 +1780,138 @@ class ibdNinja {
   }
 
   void AddTable(Table* table);
-  Table* GetTable(const std::string& db_name, const std::string& table_name) {
-    Table* tab = nullptr;
-    for (auto iter : tables_) {
-      if (iter.second->schema_ref() == db_name &&
-          iter.second->name() == table_name) {
-        tab = iter.second;
-        break;
-      }
-    }
-    return tab;
-  }
-  Table* GetTable(uint64_t table_id) {
-    Table* tab = nullptr;
-    for (auto iter : tables_) {
-      if (iter.first == table_id) {
-        tab = iter.second;
-        break;
-      }
-    }
-    return tab;
-  }
-  Index* GetIndex(uint64_t index_id) {
-    Index* idx = nullptr;
-    for (auto iter : indexes_) {
-      if (iter.first == index_id) {
-        idx = iter.second;
-        break;
-      }
-    }
-    return idx;
-  }
+  // Tables are loaded from SDI on demand, these load the needed SDI
+  // records on a miss
+  Table* GetTable(const std::string& db_name, const std::string& table_name);
+  Table* GetTable(uint64_t table_id);
+  Index* GetIndex(uint64_t index_id);
+  // Resolves the index an INDEX page belongs to, remembering it per page
+  // number so that passes over the whole file dispatch pages in constant
+  // time. Returns nullptr for other pages and pages of unknown indexes
+  Index* IndexOfPage(uint32_t page_no, const unsigned char* buf);
+  void LoadAllTables();
+  // Uses a binary dictionary cache file in cache_dir, written if missing or
+  // stale. Must be called before any table is loaded
+  bool OpenDictCache(const std::string& cache_dir, const char* ibd_filename,
+                     FILE* info_out);
+  // Builds, or refreshes, the page map next to the ibd file with one
+  // sequential scan, and summarizes it
+  bool BuildPageMap(const char* ibd_filename, FILE* info_out);
+  // Uses the page map next to the ibd file if there is one and the file was
+  // not modified since it was built, a stale map is ignored with a warning
+  bool OpenPageMap(const char* ibd_filename, FILE* info_out);
+  // Writes the key map of an index next to the ibd file: the first key of
+  // every leaf page, so that later searches of the index read one leaf
+  // page instead of descending the tree
+  bool BuildKeyMap(uint32_t index_id);
+  // Writes the zone map of some columns of a clustered index next to the
+  // ibd file: their range and NULL count per leaf page, so that later
+  // filtered scans skip the leaf pages that cannot match
+  bool BuildZoneMap(uint32_t index_id, const std::string& columns);
 
   static ssize_t ReadPage(uint32_t page_no, unsigned char* buf);
+  // Appends the off-page part of an external value to *value
+  static bool ReadExternalValue(const unsigned char* ext_ref,
+                                std::string* value);
   bool ParsePage(uint32_t page_no,
                  PageAnalysisResult* result_aggr,
                  bool print,
                  bool print_record);
   bool ParseIndex(uint32_t index_id);
+  // Summarizes the levels of an index from the page map only
+  bool ParseIndexFast(uint32_t index_id);
 
   bool ParseTable(uint32_t table_id);
 
+  bool LookupRecord(uint32_t table_id, const std::string& key_str);
+  bool RangeScan(uint32_t table_id, const std::string& low_str,
+                 const std::string& high_str);
+  bool LookupSecondary(uint32_t index_id, const std::string& range_str);
+  bool FilterRecords(uint32_t table_id, const std::string& expr);
+  bool Aggregate(uint32_t table_id, const std::string& spec,
+                 const std::string& filter_expr);
+  enum ExportMode {
+    // Rows that are not delete-marked
+    EXPORT_ROWS,
+    // Rows changed after a transaction, including delete-marked rows
+    EXPORT_CHANGES,
+    // Delete-marked rows that have not been purged yet
+    EXPORT_DELETED
+  };
+  bool ExportRecords(uint32_t table_id, ExportMode mode, uint64_t since_trx,
+                     const std::string& filter_expr,
+                     RowExporter::Format format);
+  // Reports the DB_TRX_ID ages, DB_ROLL_PTR kinds and the delete-marked
+  // records that purge has not removed yet in the primary key of a table
+  bool AnalyzeTrxAge(uint32_t table_id);
+  // Reports the NULLs, defaults, lengths and in-record and off-page bytes
+  // of every field of an index
+  bool AnalyzeColumns(uint32_t index_id);
+  // Computes the exact persistent statistics of a table and its indexes,
+  // written as SQL for mysql.innodb_index_stats and innodb_table_stats
+  bool ComputeStats(uint32_t table_id);
+  // Builds the histogram of a column for UPDATE HISTOGRAM ... USING DATA
+  bool BuildHistogram(uint32_t table_id, const std::string& column,
+                      uint32_t n_buckets);
+  // Reports the clustering factor of every secondary index of a table
+  bool AnalyzeClustering(uint32_t table_id);
+  // Estimates the pages, height and key cardinality of a secondary index
+  // on some columns of a table, without building it
+  bool EstimateIndex(uint32_t table_id, const std::string& columns,
+                     uint32_t fill_factor);
+
   void ShowTables(bool only_supported);
   void ShowLeftmostPages(uint32_t index_id);
+  // Reports the extents and fragment pages of each segment, from the FSP
+  // header, XDES and INODE pages
+  bool ShowFragmentation();
   static const char* g_version_;
   static void PrintName();
 
+  // Number of threads used by parallel leaf scans, 0 for one per core
+  void set_n_threads(uint32_t n_threads) {
+    n_threads_ = n_threads;
+  }
+  // Threads of a parallel scan, resolving 0 to one per core
+  uint32_t ScanThreads() const {
+    return n_threads_ != 0 ? n_threads_ :
+           std::max(1U, std::thread::hardware_concurrency());
+  }
+  // Pages fetched by one read in the full scan estimates of the index
+  // analysis, 0 for one extent
+  void set_read_ahead_pages(uint32_t n_pages) {
+    read_ahead_pages_ = n_pages;
+  }
+  uint32_t read_ahead_pages() const {
+    return read_ahead_pages_ == 0 ? FSP_EXTENT_SIZE : read_ahead_pages_;
+  }
+  // Writes the index and table analysis as JSON instead of text
+  void set_json_analysis(bool json) {
+    json_analysis_ = json;
+  }
+
  private:
-  explicit ibdNinja(uint32_t n_pages) : n_pages_(n_pages) {
+  explicit ibdNinja(uint32_t n_pages) : n_pages_(n_pages), n_threads_(0),
+                                         read_ahead_pages_(0),
+                                         json_analysis_(false),
+                                         space_id_(0), sdi_root_lsn_(0),
+                                         sdi_checksum_(0),
+                                         dict_cache_(nullptr),
+                                         dict_cache_size_(0),
+                                         page_map_(nullptr),
+                                         page_map_size_(0),
+                                         page_map_entries_(nullptr) {
     all_tables_.clear();
     tables_.clear();
     indexes_.clear();
   }
   static bool SDIToLeftmostLeaf(unsigned char* buf, uint32_t sdi_root,
                                 uint32_t* leaf_page_no);
+  // Visits the compressed SDI data chunk by chunk, in the page buffers
+  typedef std::function<bool(const unsigned char*, uint32_t)> SDIChunkVisitor;
   static uint64_t SDIFetchUncompBlob(uint32_t first_blob_page_no,
                                      uint64_t total_off_page_length,
-                                     unsigned char* dest_buf,
+                                     const SDIChunkVisitor& visitor,
                                      uint32_t* n_ext_pages,
                                      bool* error);
   static unsigned char* SDIGetFirstUserRec(unsigned char* buf,
@@ -1314,9 +1920,161 @@ class ibdNinja {
                                       unsigned char* buf,
                                       uint32_t buf_len,
                                       bool* corrupt);
+  // An empty visitor only reads the record header
   static bool SDIParseRec(unsigned char* rec,
                           uint64_t* sdi_type, uint64_t* sdi_id,
-                          unsigned char** sdi_data, uint64_t* sdi_data_len);
+                          const SDIChunkVisitor& visitor,
+                          uint64_t* comp_len, uint32_t* uncomp_len);
+
+  // An SDI record left compressed in its page until a command needs its
+  // table
+  struct SDIRecord {
+    uint32_t page_no;
+    uint32_t rec_offset;
+    uint32_t uncomp_len;
+    bool loaded;
+    // Its table and index ids are in sdi_table_keys_ and sdi_index_keys_
+    bool ids_known;
+  };
+  typedef std::pair<uint64_t, uint64_t> SDIKey;
+  // Buffers reused across the SDI records parsed by one thread
+  struct SDIParseContext {
+    std::vector<char> json;
+    rapidjson::MemoryPoolAllocator<> allocator;
+  };
+  static bool SDIInflate(const SDIRecord& record, SDIParseContext* context);
+  static bool ParseSDIRecord(SDIParseContext* context, Table** table,
+                             std::string* serialized);
+  static bool BuildSDITable(const rapidjson::Document& doc, Table** table);
+  bool LoadSDIRecord(SDIRecord* record, SDIParseContext* context);
+  bool LoadSDIRecordsParallel(const std::vector<SDIKey>& keys,
+                              std::vector<std::string>* serialized,
+                              std::vector<Table*>* tables);
+
+  // A serialized SDI document in the mapped dictionary cache
+  struct DictCacheEntry {
+    const unsigned char* data;
+    uint64_t len;
+  };
+  bool ParseCachedSDIRecord(const SDIKey& key, const DictCacheEntry& entry,
+                            SDIParseContext* context, Table** table) const;
+  bool LoadCachedSDIRecord(const SDIKey& key);
+  bool LoadSDIRecordByKey(const SDIKey& key);
+  void AddSDIRecordIds(const SDIKey& key, const char* json);
+  bool ReadDictCache(const std::string& path);
+  bool WriteDictCache(const std::string& path);
+  bool LoadSDIRecordsMatching(const std::string& pattern, bool is_number,
+                              const std::function<bool()>& found);
+
+  // The header every sidecar file written next to the ibd file (page map,
+  // key maps and zone maps) starts with
+  struct SidecarHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t page_size;
+    uint32_t space_id;
+    // The ibd file the sidecar was built from
+    uint64_t file_size;
+    int64_t mtime_sec;
+    int64_t mtime_nsec;
+  };
+  enum SidecarState {
+    SIDECAR_INVALID,
+    // Built from an older version of the ibd file
+    SIDECAR_STALE,
+    SIDECAR_FRESH
+  };
+  bool InitSidecarHeader(const char* magic, uint32_t version,
+                         SidecarHeader* header) const;
+  SidecarState CheckSidecarHeader(const SidecarHeader& header,
+                                  const char* magic, uint32_t version) const;
+  // Writes the parts to a temporary file renamed to path, so that readers
+  // never see a partial file
+  static bool WriteSidecar(const std::string& path, const char* what,
+      const std::vector<std::pair<const void*, size_t>>& parts);
+
+  // The page map sidecar is a PageMapHeader followed by one PageMapEntry
+  // per page, in page number order
+  struct PageMapHeader {
+    SidecarHeader sidecar;
+    uint32_t n_pages;
+  };
+  struct PageMapEntry {
+    uint64_t lsn;
+    // Only set for INDEX, RTREE and SDI pages, as level, n_recs and garbage
+    uint64_t index_id;
+    uint32_t prev;
+    uint32_t next;
+    uint16_t type;
+    uint16_t level;
+    uint16_t n_recs;
+    uint16_t garbage;
+  };
+  bool LoadPageMap(const char* ibd_filename, bool build, FILE* info_out);
+  bool ScanPageMap(const PageMapEntry* old_entries, uint32_t n_old_entries,
+                   PageMapEntry* entries, uint32_t* n_refreshed);
+  bool PageMapLeftmostPages(Index* index, std::vector<uint32_t>* pages);
+  bool PageMapLevelPages(Index* index, uint32_t leftmost_page_no,
+                         std::vector<uint32_t>* pages);
+
+  // A key map file is a KeyMapHeader, n_entries + 1 key offsets (uint64_t,
+  // relative to the keys), n_entries leaf page numbers (uint32_t) and the
+  // keys, in Index::EncodeSortKey() form and in leaf page order. The key of
+  // the leftmost leaf page is empty
+  struct KeyMapHeader {
+    SidecarHeader sidecar;
+    uint32_t n_entries;
+    uint64_t index_id;
+  };
+  struct KeyMap {
+    unsigned char* addr;
+    size_t size;
+    uint32_t n_entries;
+    const uint64_t* key_offsets;
+    const uint32_t* page_nos;
+    const unsigned char* keys;
+  };
+  std::string KeyMapPath(uint64_t index_id) const;
+  const KeyMap* GetKeyMap(Index* index);
+  uint32_t KeyMapLeafPage(Index* index, const SearchKey& key);
+  bool CollectLeafFences(Index* index, std::vector<uint64_t>* key_offsets,
+                         std::vector<uint32_t>* page_nos, std::string* keys);
+  static uint32_t FenceLeafPage(const KeyMap& key_map,
+                                const std::string& encoded, bool inclusive);
+
+  // A zone map file is a ZoneMapHeader, the field numbers (uint32_t) and
+  // then per zone, in leaf page order, the page number, the number of
+  // records, and per field the NULL count and the optional min and max
+  struct ZoneMapHeader {
+    SidecarHeader sidecar;
+    uint32_t n_fields;
+    uint64_t index_id;
+    uint64_t n_zones;
+  };
+  struct Zone {
+    uint32_t page_no;
+    uint32_t n_recs;
+    // One per field of the zone map
+    std::vector<RowFilter::FieldStats> stats;
+  };
+  struct ZoneMap {
+    bool valid;
+    std::vector<uint32_t> field_nos;
+    std::vector<Zone> zones;
+    // Page number to position in zones
+    std::unordered_map<uint32_t, uint32_t> zone_of_page;
+  };
+  // Used by the zone map and what-if index column lists
+  static bool ParseColumnList(Index* index, const std::string& columns,
+                              std::vector<uint32_t>* field_nos,
+                              std::vector<Column*>* cols, std::string* names);
+  std::string ZoneMapPath(uint64_t index_id) const;
+  const ZoneMap* GetZoneMap(Index* index);
+  // Returns true if the leaf page cannot hold records matching the filter,
+  // and sets *next_page_no, if given, to the next leaf page with records
+  static bool ZoneMapCanSkip(const ZoneMap* zone_map, uint32_t page_no,
+                             const RowFilter* filter,
+                             uint32_t* next_page_no);
 
   static unsigned char* GetFirstUserRec(unsigned char* buf);
   static unsigned char* GetNextRecInPage(unsigned char* current_rec,
@@ -1326,11 +2084,88 @@ class ibdNinja {
                              unsigned char* buf, uint32_t root,
                              std::vector<uint32_t>* leaf_pages_no);
   bool ParseIndex(Index* index);
+  static unsigned char* SearchPage(Index* index, unsigned char* buf,
+                                   const SearchKey& key);
+  bool SearchToLevel(Index* index, const SearchKey& key,
+                     SearchCursor* cursor, uint32_t level,
+                     unsigned char** rec, uint32_t* depth,
+                     std::vector<uint32_t>* path);
+  bool SearchToLeaf(Index* index, const SearchKey& key,
+                    SearchCursor* cursor, unsigned char** rec,
+                    uint32_t* leaf_depth, std::vector<uint32_t>* path);
+  unsigned char* GetNextLeafRec(Index* index, SearchCursor* cursor,
+                                uint32_t leaf_depth, unsigned char* rec,
+                                bool* error);
+  bool ScanLeafBatches(Index* index, const SearchKey& low,
+                       const SearchKey* high, SearchCursor* cursor,
+                       const std::function<bool(const std::vector<Record*>&)>&
+                           visitor,
+                       uint32_t* n_leaf_pages, std::vector<uint32_t>* path,
+                       const RowFilter* filter = nullptr,
+                       uint32_t* n_skipped = nullptr);
+  bool ScanIndexRange(Index* index, const SearchKey& low,
+                      const SearchKey* high, SearchCursor* cursor,
+                      const std::function<bool(Record*)>& visitor,
+                      uint32_t* n_deleted, std::vector<uint32_t>* path);
+  bool SearchClustIndex(Index* index, const SearchKey& low,
+                        const SearchKey* high, bool point);
+  Index* GetSearchableClustIndex(uint32_t table_id);
+  bool CollectLeafPages(Index* index, const std::vector<SearchRange>& ranges,
+                        std::vector<std::pair<uint32_t, uint32_t>>* pages);
+  bool SegmentReservedPages(uint32_t root, uint64_t* n_pages);
+  bool BtreePages(Index* index, uint32_t n_leaf_pages, uint64_t* n_pages);
+  bool ParallelLeafScan(Index* index, const std::vector<SearchRange>& ranges,
+                        const std::function<bool(uint32_t,
+                            const std::vector<Record*>&)>& visitor,
+                        uint32_t* n_threads, uint32_t* n_leaf_pages,
+                        const RowFilter* filter = nullptr,
+                        uint32_t* n_skipped = nullptr);
 
   uint32_t n_pages_;
+  uint32_t n_threads_;
+  uint32_t read_ahead_pages_;
+  bool json_analysis_;
   std::vector<Table*> all_tables_;
   std::map<uint64_t, Table*> tables_;
   std::map<uint64_t, Index*> indexes_;
+  // Hash indexes over the loaded tables, the ordered maps above are only
+  // used for listing
+  std::unordered_map<uint64_t, Table*> table_ids_;
+  std::unordered_map<uint64_t, Index*> index_ids_;
+  // Keyed by QualifiedName()
+  std::unordered_map<std::string, Table*> table_names_;
+  // Ids and names known to be absent from the SDI, so that a miss only
+  // searches the SDI records once
+  std::unordered_set<uint64_t> missing_table_ids_;
+  std::unordered_set<uint64_t> missing_index_ids_;
+  std::unordered_set<std::string> missing_table_names_;
+  // Page to index dispatch: page_index_slots_[page_no] is 0 if the page
+  // has not been resolved yet, otherwise an index into index_slots_, whose
+  // first entry is nullptr for pages that belong to no loaded index
+  std::vector<uint32_t> page_index_slots_;
+  std::vector<Index*> index_slots_;
+  std::unordered_map<uint64_t, uint32_t> index_slot_ids_;
+  // Keyed by (sdi_type, sdi_id)
+  std::map<SDIKey, SDIRecord> sdi_records_;
+  // Identify the SDI content the dictionary cache was built from
+  uint32_t space_id_;
+  uint64_t sdi_root_lsn_;
+  uint32_t sdi_checksum_;
+  unsigned char* dict_cache_;
+  size_t dict_cache_size_;
+  std::map<SDIKey, DictCacheEntry> dict_cache_entries_;
+  // The SDI record of each table and index id, read from the dictionary
+  // cache or off the records inflated by earlier searches
+  std::map<uint64_t, SDIKey> sdi_table_keys_;
+  std::map<uint64_t, SDIKey> sdi_index_keys_;
+  unsigned char* page_map_;
+  size_t page_map_size_;
+  const PageMapEntry* page_map_entries_;
+  std::string ibd_filename_;
+  // Keyed by index id, with a nullptr addr if the index has no usable map
+  std::map<uint64_t, KeyMap> key_maps_;
+  // Keyed by index id, not valid if the index has no usable map
+  std::map<uint64_t, ZoneMap> zone_maps_;
 };
 
 }  // namespace ibd_ninja
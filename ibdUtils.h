@@ -203,11 +203,41 @@ constexpr uint32_t XDES_CLEAN_BIT = 1;
   (XDES_BITMAP + UT_BITS_IN_BYTES(FSP_EXTENT_SIZE_MIN * XDES_BITS_PER_PAGE))
 constexpr uint32_t XDES_ARR_OFFSET = FSP_HEADER_OFFSET + FSP_HEADER_SIZE;
 const uint32_t XDES_FRAG_N_USED = 2;
+// Extent states
+constexpr uint32_t XDES_NOT_INITED = 0;
+constexpr uint32_t XDES_FREE = 1;
+constexpr uint32_t XDES_FREE_FRAG = 2;
+constexpr uint32_t XDES_FULL_FRAG = 3;
+constexpr uint32_t XDES_FSEG = 4;
+constexpr uint32_t XDES_FSEG_FRAG = 5;
 constexpr uint32_t FSEG_PAGE_DATA = FIL_PAGE_DATA;
 constexpr uint32_t FSEG_HDR_SPACE = 0;
 constexpr uint32_t FSEG_HDR_PAGE_NO = 4;
 constexpr uint32_t FSEG_HDR_OFFSET = 8;
 constexpr uint32_t FSEG_HEADER_SIZE = 10;
+// File lists
+constexpr uint32_t FLST_LEN = 0;
+constexpr uint32_t FLST_FIRST = 4;
+constexpr uint32_t FLST_LAST = 4 + FIL_ADDR_SIZE;
+constexpr uint32_t FLST_PREV = 0;
+constexpr uint32_t FLST_NEXT = FIL_ADDR_SIZE;
+// Segment inode pages
+constexpr uint32_t FSEG_INODE_PAGE_NODE = FSEG_PAGE_DATA;
+constexpr uint32_t FSEG_ARR_OFFSET = FSEG_PAGE_DATA + FLST_NODE_SIZE;
+constexpr uint32_t FSEG_ID = 0;
+constexpr uint32_t FSEG_NOT_FULL_N_USED = 8;
+constexpr uint32_t FSEG_FREE = 12;
+constexpr uint32_t FSEG_NOT_FULL = FSEG_FREE + FLST_BASE_NODE_SIZE;
+constexpr uint32_t FSEG_FULL = FSEG_NOT_FULL + FLST_BASE_NODE_SIZE;
+constexpr uint32_t FSEG_MAGIC_N = FSEG_FULL + FLST_BASE_NODE_SIZE;
+constexpr uint32_t FSEG_FRAG_ARR = FSEG_MAGIC_N + 4;
+constexpr uint32_t FSEG_FRAG_SLOT_SIZE = 4;
+constexpr uint32_t FSEG_MAGIC_N_VALUE = 97937874;
+#define FSEG_FRAG_ARR_N_SLOTS (FSP_EXTENT_SIZE / 2)
+#define FSEG_INODE_SIZE \
+  (FSEG_FRAG_ARR + FSEG_FRAG_ARR_N_SLOTS * FSEG_FRAG_SLOT_SIZE)
+#define FSP_SEG_INODES_PER_PAGE \
+  ((g_page_physical_size - FSEG_ARR_OFFSET - 10) / FSEG_INODE_SIZE)
 
 
 // Page dir related
@@ -387,6 +417,9 @@ rec type. */
 // static const uint32_t REC_OFF_TYPE = 3;
 /** Stored at rec_origin minus 2nd byte and length 2 bytes. */
 static const uint32_t REC_OFF_NEXT = 2;
+/** SDI types stored in the TYPE field, see dd::enum_sdi_type. */
+static const uint64_t SDI_TYPE_TABLE = 1;
+static const uint64_t SDI_TYPE_TABLESPACE = 2;
 /** Offset of TYPE field in record (0). */
 static const uint32_t REC_OFF_DATA_TYPE = REC_ORIGIN;
 // ut_ad(REC_OFF_DATA_ID == 0);
@@ -500,9 +533,19 @@ const uint32_t BTR_EXTERN_LEN = 12;
 const uint32_t BTR_EXTERN_OWNER_FLAG = 128UL;
 const uint32_t BTR_EXTERN_INHERITED_FLAG = 64UL;
 const uint32_t BTR_EXTERN_BEING_MODIFIED_FLAG = 32UL;
+const uint32_t BTR_EXTERN_FIELD_REF_SIZE = 20;
 const uint32_t LOB_HDR_PART_LEN = 0;
 const uint32_t LOB_HDR_NEXT_PAGE_NO = 4;
 const uint32_t LOB_HDR_SIZE = 8;
+// The first page of an uncompressed LOB (lob::first_page_t) has a header,
+// an array of index entries (lob::index_entry_t) and then data. The index
+// entries form a list, in value order, of the pages holding the data.
+const uint32_t LOB_FIRST_INDEX_LIST = FIL_PAGE_DATA + 26;
+const uint32_t LOB_FIRST_PAGE_DATA = FIL_PAGE_DATA + 58;
+const uint32_t LOB_INDEX_ENTRY_PAGE_NO = 48;
+const uint32_t LOB_INDEX_ENTRY_DATA_LEN = 52;
+const uint32_t LOB_INDEX_ENTRY_SIZE = 60;
+const uint32_t LOB_DATA_PAGE_DATA = FIL_PAGE_DATA + 11;
 const uint32_t ZLOB_PAGE_DATA = FIL_PAGE_DATA;
 
 // Index related
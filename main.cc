@@ -24,10 +24,78 @@ void Usage() {
                   "specified table\n");
   fprintf(stdout, "  --analyze-index, -i INDEX_ID              Analyze the "
                   "specified index\n");
+  fprintf(stdout, "    --fast, -F                              Only summarize "
+                  "the index levels from the page map\n");
+  fprintf(stdout, "    --read-ahead, -A PAGES                  Pages per read "
+                  "in the full scan estimate (default: one extent)\n");
+  fprintf(stdout, "    --format, -o json                       Write the "
+                  "analysis and its page histograms as JSON, one line per "
+                  "index\n");
+  fprintf(stdout, "  --fragmentation, -R                       Report the "
+                  "extents and fragment pages of each index segment\n");
+  fprintf(stdout, "  --trx-age, -T TABLE_ID                    Report the "
+                  "DB_TRX_ID ages and the delete-marked rows pending purge "
+                  "of a table\n");
+  fprintf(stdout, "  --column-stats, -C INDEX_ID               Report the "
+                  "NULLs, lengths and storage of every field of an index\n");
+  fprintf(stdout, "  --clustering-factor, -L TABLE_ID          Report how "
+                  "scattered the rows of each secondary index are over the "
+                  "primary key\n");
+  fprintf(stdout, "  --compute-stats, -S TABLE_ID              Compute the "
+                  "exact persistent statistics of a table as SQL for "
+                  "mysql.innodb_index_stats\n");
+  fprintf(stdout, "  --histogram, -H TABLE_ID COL              Build the "
+                  "histogram of a column as JSON for UPDATE HISTOGRAM ... "
+                  "USING DATA\n");
+  fprintf(stdout, "    --buckets, -B N                         Number of "
+                  "buckets, from 1 to 1024 (default: 100)\n");
+  fprintf(stdout, "  --whatif-index, -W TABLE_ID COLS          Estimate "
+                  "the size, height and cardinality of a secondary index on "
+                  "some columns, e.g., 'c1,c2'\n");
+  fprintf(stdout, "    --fill-factor, -P PERCENT               Page fill "
+                  "factor, from 10 to 100 (default: 100, which leaves "
+                  "1/16 free)\n");
   fprintf(stdout, "  --parse-page, -p PAGE_ID                  Parse the "
                   "specified page\n");
   fprintf(stdout, "    --no-print-record, -n                   Skip printing "
                   "record details when parsing a page\n");
+  fprintf(stdout, "  --lookup, -k TABLE_ID KEY                 Look up a "
+                  "row by its primary key, e.g., 42 or 7,'abc'\n");
+  fprintf(stdout, "  --range, -r TABLE_ID LO HI                Show the rows "
+                  "whose primary key is in [LO, HI], '' for no bound\n");
+  fprintf(stdout, "  --lookup-secondary, -s INDEX_ID KEY_RANGE Look up "
+                  "rows through a secondary index, e.g., 'abc' or 1..5\n");
+  fprintf(stdout, "  --where, -w TABLE_ID EXPR                 Show the rows "
+                  "matching a filter, e.g., \"id > 10 AND name LIKE 'a%%'\"\n");
+  fprintf(stdout, "  --aggregate, -g TABLE_ID SPEC             Compute "
+                  "aggregates, e.g., \"COUNT(*), SUM(c1) GROUP BY c2\", "
+                  "filtered by --where if given\n");
+  fprintf(stdout, "                                            -k, -r, -s, "
+                  "-w and -g compare strings only in binary and _bin "
+                  "collations, and refuse other ones, e.g., "
+                  "utf8mb4_0900_ai_ci\n");
+  fprintf(stdout, "  --export, -x TABLE_ID                     Export the "
+                  "rows of a table, filtered by --where if given\n");
+  fprintf(stdout, "  --export-deleted, -d TABLE_ID             Export the "
+                  "delete-marked rows of a table that are not purged yet\n");
+  fprintf(stdout, "    --since-trx, -c TRX_ID                  Only export "
+                  "rows changed after the transaction, with deletes\n");
+  fprintf(stdout, "    --format, -o FORMAT                     Export format: "
+                  "text (default), csv or json\n");
+  fprintf(stdout, "  --threads, -j N                           Number of "
+                  "threads for parallel scans and dictionary loading "
+                  "(default: one per core)\n");
+  fprintf(stdout, "  --dict-cache, -D DIR                      Cache the "
+                  "parsed dictionary in DIR to speed up later runs\n");
+  fprintf(stdout, "  --build-map, -M                           Build or "
+                  "refresh the page map next to the ibd file, used by "
+                  "later runs\n");
+  fprintf(stdout, "  --build-keymap, -K INDEX_ID               Write the "
+                  "first key of every leaf page of an index next to the ibd "
+                  "file, used by later searches\n");
+  fprintf(stdout, "  --build-zonemap, -Z INDEX_ID COLS         Write the "
+                  "range of some columns, e.g., 'c1,c2', per leaf page of a "
+                  "primary key, used by later filtered scans\n");
   fprintf(stdout, "  --version, -v                             Display version "
                   "information\n");
 }
@@ -44,8 +112,33 @@ int main(int argc, char* argv[]) {
     {"list-leftmost-pages", required_argument, 0, 'e'},
     {"analyze-table", required_argument, 0, 't'},
     {"analyze-index", required_argument, 0, 'i'},
+    {"fragmentation", no_argument, 0, 'R'},
+    {"trx-age", required_argument, 0, 'T'},
+    {"column-stats", required_argument, 0, 'C'},
+    {"clustering-factor", required_argument, 0, 'L'},
+    {"compute-stats", required_argument, 0, 'S'},
+    {"histogram", required_argument, 0, 'H'},
+    {"buckets", required_argument, 0, 'B'},
+    {"whatif-index", required_argument, 0, 'W'},
+    {"fill-factor", required_argument, 0, 'P'},
     {"parse-page", required_argument, 0, 'p'},
     {"no-print-record", no_argument, 0, 'n'},
+    {"lookup", required_argument, 0, 'k'},
+    {"range", required_argument, 0, 'r'},
+    {"lookup-secondary", required_argument, 0, 's'},
+    {"where", required_argument, 0, 'w'},
+    {"aggregate", required_argument, 0, 'g'},
+    {"threads", required_argument, 0, 'j'},
+    {"export", required_argument, 0, 'x'},
+    {"export-deleted", required_argument, 0, 'd'},
+    {"since-trx", required_argument, 0, 'c'},
+    {"format", required_argument, 0, 'o'},
+    {"dict-cache", required_argument, 0, 'D'},
+    {"build-map", no_argument, 0, 'M'},
+    {"build-keymap", required_argument, 0, 'K'},
+    {"build-zonemap", required_argument, 0, 'Z'},
+    {"fast", no_argument, 0, 'F'},
+    {"read-ahead", required_argument, 0, 'A'},
     {"version", no_argument, 0, 'v'},
     {0, 0, 0, 0}  // End of options
   };
@@ -57,13 +150,47 @@ int main(int argc, char* argv[]) {
   bool list_all_tables = false;
   bool list_tables = false;
   bool list_leftmost_pages = false;
+  bool fragmentation = false;
+  uint32_t trx_age_table_id = ibd_ninja::FIL_NULL;
+  uint32_t column_stats_index_id = ibd_ninja::FIL_NULL;
+  uint32_t clustering_table_id = ibd_ninja::FIL_NULL;
+  uint32_t compute_stats_table_id = ibd_ninja::FIL_NULL;
+  uint32_t histogram_table_id = ibd_ninja::FIL_NULL;
+  std::string histogram_column;
+  uint32_t n_buckets = 0;
+  uint32_t whatif_table_id = ibd_ninja::FIL_NULL;
+  std::string whatif_columns;
+  uint32_t fill_factor = 0;
   uint32_t table_id = ibd_ninja::FIL_NULL;
   uint32_t index_id = ibd_ninja::FIL_NULL;
   uint32_t page_no = ibd_ninja::FIL_NULL;
   bool print_record = true;
+  uint32_t search_table_id = ibd_ninja::FIL_NULL;
+  bool range_scan = false;
+  std::string search_low;
+  std::string search_high;
+  uint32_t search_index_id = ibd_ninja::FIL_NULL;
+  uint32_t filter_table_id = ibd_ninja::FIL_NULL;
+  std::string filter_expr;
+  uint32_t aggregate_table_id = ibd_ninja::FIL_NULL;
+  std::string aggregate_spec;
+  uint32_t n_threads = 0;
+  uint32_t export_table_id = ibd_ninja::FIL_NULL;
+  bool export_changes = false;
+  bool export_deleted = false;
+  uint64_t since_trx = 0;
+  ibd_ninja::RowExporter::Format export_format =
+    ibd_ninja::RowExporter::FORMAT_TEXT;
+  std::string dict_cache_dir;
+  bool build_map = false;
+  uint32_t keymap_index_id = ibd_ninja::FIL_NULL;
+  uint32_t zonemap_index_id = ibd_ninja::FIL_NULL;
+  std::string zonemap_columns;
+  bool fast = false;
+  uint32_t read_ahead = 0;
 
   while ((opt = getopt_long(argc,
-                argv, "halvf:e:t:i:p:n", options, &option_index)) != -1) {
+                argv, "halvf:e:t:i:RT:C:L:S:H:B:W:P:p:nk:r:s:w:g:j:x:d:c:o:D:MK:Z:FA:", options, &option_index)) != -1) {
     switch (opt) {
       case 'h':
         ibd_ninja::ibdNinja::PrintName();
@@ -126,6 +253,229 @@ int main(int argc, char* argv[]) {
       case 'n':
         print_record = false;
         break;
+      case 'R':
+        fragmentation = true;
+        break;
+      case 'T': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit)) {
+            trx_age_table_id = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'C': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit)) {
+            column_stats_index_id = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'L': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit)) {
+            clustering_table_id = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'S': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit)) {
+            compute_stats_table_id = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'H': {
+          std::string str(optarg);
+          if (str.empty() || !std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          histogram_table_id = std::stoul(optarg);
+          histogram_column = argv[optind++];
+        }
+        break;
+      case 'B': {
+          std::string str(optarg);
+          if (!str.empty() && str.size() <= 4 &&
+              std::all_of(str.begin(), str.end(), ::isdigit) &&
+              std::stoul(optarg) > 0 && std::stoul(optarg) <= 1024) {
+            n_buckets = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'W': {
+          std::string str(optarg);
+          if (str.empty() || !std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          whatif_table_id = std::stoul(optarg);
+          whatif_columns = argv[optind++];
+        }
+        break;
+      case 'P': {
+          std::string str(optarg);
+          if (!str.empty() && str.size() <= 3 &&
+              std::all_of(str.begin(), str.end(), ::isdigit) &&
+              std::stoul(optarg) >= 10 && std::stoul(optarg) <= 100) {
+            fill_factor = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'k':
+      case 'r': {
+          std::string str(optarg);
+          int n_args = (opt == 'k') ? 1 : 2;
+          if (!std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind + n_args > argc) {
+            Usage();
+            return 1;
+          }
+          search_table_id = std::stoul(optarg);
+          range_scan = (opt == 'r');
+          search_low = argv[optind++];
+          search_high = range_scan ? argv[optind++] : search_low;
+        }
+        break;
+      case 's': {
+          std::string str(optarg);
+          if (!std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          search_index_id = std::stoul(optarg);
+          search_low = argv[optind++];
+        }
+        break;
+      case 'w': {
+          std::string str(optarg);
+          if (!std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          filter_table_id = std::stoul(optarg);
+          filter_expr = argv[optind++];
+        }
+        break;
+      case 'g': {
+          std::string str(optarg);
+          if (!std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          aggregate_table_id = std::stoul(optarg);
+          aggregate_spec = argv[optind++];
+        }
+        break;
+      case 'j': {
+          std::string str(optarg);
+          if (std::all_of(str.begin(), str.end(), ::isdigit)) {
+            n_threads = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'x':
+      case 'd': {
+          std::string str(optarg);
+          if (std::all_of(str.begin(), str.end(), ::isdigit)) {
+            export_table_id = std::stoul(optarg);
+            export_deleted = (opt == 'd');
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'c': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit)) {
+            export_changes = true;
+            since_trx = std::stoull(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'o':
+        if (!ibd_ninja::RowExporter::ParseFormat(optarg, &export_format)) {
+          Usage();
+          return 1;
+        }
+        break;
+      case 'D':
+        dict_cache_dir = optarg;
+        break;
+      case 'M':
+        build_map = true;
+        break;
+      case 'K': {
+          std::string str(optarg);
+          if (std::all_of(str.begin(), str.end(), ::isdigit)) {
+            keymap_index_id = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
+      case 'Z': {
+          std::string str(optarg);
+          if (!std::all_of(str.begin(), str.end(), ::isdigit) ||
+              optind >= argc) {
+            Usage();
+            return 1;
+          }
+          zonemap_index_id = std::stoul(optarg);
+          zonemap_columns = argv[optind++];
+        }
+        break;
+      case 'F':
+        fast = true;
+        break;
+      case 'A': {
+          std::string str(optarg);
+          if (!str.empty() &&
+              std::all_of(str.begin(), str.end(), ::isdigit) &&
+              std::stoul(optarg) > 0) {
+            read_ahead = std::stoul(optarg);
+          } else {
+            Usage();
+            return 1;
+          }
+        }
+        break;
       case '?':
         return 1;
       default:
@@ -134,26 +484,148 @@ int main(int argc, char* argv[]) {
     }
   }
 
+  if (export_changes && export_table_id == ibd_ninja::FIL_NULL) {
+    fprintf(stderr, "--since-trx must be used with --export (-x).\n");
+    return 1;
+  }
+  if (export_changes && export_deleted) {
+    fprintf(stderr, "--since-trx cannot be used with --export-deleted.\n");
+    return 1;
+  }
+
+  if (fast && index_id == ibd_ninja::FIL_NULL) {
+    fprintf(stderr, "--fast must be used with --analyze-index (-i).\n");
+    return 1;
+  }
+  if (n_buckets != 0 && histogram_table_id == ibd_ninja::FIL_NULL) {
+    fprintf(stderr, "--buckets must be used with --histogram (-H).\n");
+    return 1;
+  }
+  if (fill_factor != 0 && whatif_table_id == ibd_ninja::FIL_NULL) {
+    fprintf(stderr, "--fill-factor must be used with --whatif-index (-W).\n");
+    return 1;
+  }
+  if (read_ahead != 0 && index_id == ibd_ninja::FIL_NULL &&
+      table_id == ibd_ninja::FIL_NULL) {
+    fprintf(stderr, "--read-ahead must be used with --analyze-index (-i) "
+                    "or --analyze-table (-t).\n");
+    return 1;
+  }
+
+  bool json_analysis = false;
+  if (export_table_id == ibd_ninja::FIL_NULL &&
+      export_format != ibd_ninja::RowExporter::FORMAT_TEXT) {
+    if ((index_id == ibd_ninja::FIL_NULL &&
+         table_id == ibd_ninja::FIL_NULL) ||
+        export_format != ibd_ninja::RowExporter::FORMAT_JSON || fast) {
+      fprintf(stderr, "--format must be used with --export (-x), or be "
+                      "json with --analyze-index (-i) or --analyze-table "
+                      "(-t) without --fast.\n");
+      return 1;
+    }
+    json_analysis = true;
+  }
+
   if (ibd_file.empty()) {
     fprintf(stderr, "You must specify the ibd file using the "
                     "--file (-f) option.\n");
     return 1;
   }
 
+  // Keep stdout for the exported records or the JSON analysis only
+  // The generated SQL or histogram is written alone on stdout, like
+  // exported rows
+  bool export_data = (export_format != ibd_ninja::RowExporter::FORMAT_TEXT ||
+                      compute_stats_table_id != ibd_ninja::FIL_NULL ||
+                      histogram_table_id != ibd_ninja::FIL_NULL);
   ibd_ninja::ibdNinja* ninja =
-    ibd_ninja::ibdNinja::CreateNinja(ibd_file.c_str());
+    ibd_ninja::ibdNinja::CreateNinja(ibd_file.c_str(),
+                                     export_data ? stderr : stdout);
 
+  // The commands whose output is consumed by other programs exit with 1
+  // when they fail, so that a partial or missing result is not taken as
+  // complete
+  bool ok = (ninja != nullptr);
   if (ninja != nullptr) {
-    if (list_tables) {
+    ninja->set_n_threads(n_threads);
+    ninja->set_read_ahead_pages(read_ahead);
+    ninja->set_json_analysis(json_analysis);
+    if (!dict_cache_dir.empty()) {
+      ninja->OpenDictCache(dict_cache_dir, ibd_file.c_str(),
+                           export_data ? stderr : stdout);
+    }
+    if (!build_map) {
+      ninja->OpenPageMap(ibd_file.c_str(), export_data ? stderr : stdout);
+    }
+    if (build_map) {
+      ninja->BuildPageMap(ibd_file.c_str(), stdout);
+    } else if (keymap_index_id != ibd_ninja::FIL_NULL) {
+      ninja->BuildKeyMap(keymap_index_id);
+    } else if (zonemap_index_id != ibd_ninja::FIL_NULL) {
+      ninja->BuildZoneMap(zonemap_index_id, zonemap_columns);
+    } else if (fragmentation) {
+      ninja->ShowFragmentation();
+    } else if (trx_age_table_id != ibd_ninja::FIL_NULL) {
+      ninja->AnalyzeTrxAge(trx_age_table_id);
+    } else if (column_stats_index_id != ibd_ninja::FIL_NULL) {
+      ninja->AnalyzeColumns(column_stats_index_id);
+    } else if (clustering_table_id != ibd_ninja::FIL_NULL) {
+      ninja->AnalyzeClustering(clustering_table_id);
+    } else if (compute_stats_table_id != ibd_ninja::FIL_NULL) {
+      ok = ninja->ComputeStats(compute_stats_table_id);
+    } else if (histogram_table_id != ibd_ninja::FIL_NULL) {
+      ok = ninja->BuildHistogram(histogram_table_id, histogram_column,
+                                 n_buckets == 0 ? 100 : n_buckets);
+    } else if (whatif_table_id != ibd_ninja::FIL_NULL) {
+      ninja->EstimateIndex(whatif_table_id, whatif_columns,
+                           fill_factor == 0 ? 100 : fill_factor);
+    } else if (list_tables) {
       ninja->ShowTables(true);
     } else if (list_all_tables) {
       ninja->ShowTables(false);
+    } else if (search_table_id != ibd_ninja::FIL_NULL) {
+      if (range_scan) {
+        ninja->RangeScan(search_table_id, search_low, search_high);
+      } else {
+        ninja->LookupRecord(search_table_id, search_low);
+      }
+    } else if (search_index_id != ibd_ninja::FIL_NULL) {
+      ninja->LookupSecondary(search_index_id, search_low);
+    } else if (export_table_id != ibd_ninja::FIL_NULL) {
+      if (filter_table_id != ibd_ninja::FIL_NULL &&
+          filter_table_id != export_table_id) {
+        fprintf(stderr, "--where and --export must use the same table.\n");
+        ok = false;
+      } else {
+        ok = ninja->ExportRecords(export_table_id,
+                             export_deleted ?
+                             ibd_ninja::ibdNinja::EXPORT_DELETED :
+                             export_changes ?
+                             ibd_ninja::ibdNinja::EXPORT_CHANGES :
+                             ibd_ninja::ibdNinja::EXPORT_ROWS,
+                             since_trx, filter_expr, export_format);
+      }
+    } else if (aggregate_table_id != ibd_ninja::FIL_NULL) {
+      if (filter_table_id != ibd_ninja::FIL_NULL &&
+          filter_table_id != aggregate_table_id) {
+        fprintf(stderr, "--where and --aggregate must use the same "
+                        "table.\n");
+        ok = false;
+      } else {
+        ok = ninja->Aggregate(aggregate_table_id, aggregate_spec, filter_expr);
+      }
+    } else if (filter_table_id != ibd_ninja::FIL_NULL) {
+      ninja->FilterRecords(filter_table_id, filter_expr);
     } else if (list_leftmost_pages) {
       ninja->ShowLeftmostPages(index_id);
     } else if (table_id != ibd_ninja::FIL_NULL) {
       ninja->ParseTable(table_id);
     } else if (index_id != ibd_ninja::FIL_NULL) {
-      ninja->ParseIndex(index_id);
+      if (fast) {
+        ninja->ParseIndexFast(index_id);
+      } else {
+        ninja->ParseIndex(index_id);
+      }
     } else if (page_no != ibd_ninja::FIL_NULL) {
       ninja->ParsePage(page_no, nullptr, true, print_record);
     } else {
@@ -161,5 +633,5 @@ int main(int argc, char* argv[]) {
     }
     delete ninja;
   }
-  return 0;
+  return ok ? 0 : 1;
 }
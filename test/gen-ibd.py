@@ -0,0 +1,934 @@
+#!/usr/bin/env python3
+"""Writes a synthetic MySQL 8.0 .ibd file for the ibdNinja regression tests.
+
+The rows of every table are also written to <out>.rows.json, and the ids and
+root pages of the indexes are printed to stderr.
+"""
+import argparse
+import base64
+import datetime
+import decimal
+import functools
+import json
+import random
+import struct
+import sys
+import unicodedata
+import zlib
+
+PAGE = 16384
+FIL_NULL = 0xFFFFFFFF
+PAGE_DATA = 94
+INF = 99
+SUP = 112
+FIL_PAGE_INDEX = 17855
+FIL_PAGE_SDI = 17853
+
+# dd column types
+DECIMAL, TINY, SHORT, LONG, FLOAT, DOUBLE = 1, 2, 3, 4, 5, 6
+LONGLONG, INT24, YEAR, NEWDATE, VARCHAR = 9, 10, 14, 15, 16
+TIMESTAMP2, DATETIME2, TIME2, NEWDECIMAL, ENUM = 18, 19, 20, 21, 22
+BLOB, STRING, JSON = 27, 29, 31
+
+INT_LEN = {TINY: 1, SHORT: 2, INT24: 3, LONG: 4, LONGLONG: 8}
+DIG2BYTES = [0, 1, 1, 2, 2, 3, 3, 4, 4, 4]
+
+
+class Col:
+    def __init__(self, name, typ, nullable=False, unsigned=False, length=0,
+                 prec=0, scale=0, dt_prec=0, coll=255, hidden=1,
+                 type_str='', elements=None):
+        self.name, self.typ, self.nullable, self.unsigned = name, typ, nullable, unsigned
+        self.length, self.prec, self.scale, self.dt_prec = length, prec, scale, dt_prec
+        self.coll, self.hidden, self.type_str = coll, hidden, type_str
+        self.elements = elements or []
+
+    def mbmax(self):
+        return {255: 4, 45: 4, 46: 4, 33: 3, 8: 1, 47: 1, 63: 1}[self.coll]
+
+    def char_length(self):
+        if self.typ in (VARCHAR, STRING):
+            return self.length * self.mbmax()
+        if self.typ == BLOB:
+            return 65535
+        if self.typ == JSON:
+            return 4294967295
+        return {TINY: 4, SHORT: 6, INT24: 9, LONG: 11, LONGLONG: 20,
+                DOUBLE: 22, DATETIME2: 19, NEWDATE: 10, YEAR: 4,
+                NEWDECIMAL: self.prec + 2, ENUM: 4}.get(self.typ, 6)
+
+    def col_len(self):  # InnoDB col len
+        if self.typ in INT_LEN:
+            return INT_LEN[self.typ]
+        if self.name == 'DB_TRX_ID':
+            return 6
+        if self.name == 'DB_ROLL_PTR':
+            return 7
+        if self.name == 'DB_ROW_ID':
+            return 6
+        if self.typ == VARCHAR:
+            return self.char_length()
+        if self.typ == STRING:
+            return self.char_length()
+        return 0
+
+    def is_sys(self):
+        return self.name in ('DB_TRX_ID', 'DB_ROLL_PTR', 'DB_ROW_ID')
+
+    def fixed_len(self):
+        """0 for variable-length columns."""
+        if self.is_sys():
+            return self.col_len()
+        t = self.typ
+        if t in INT_LEN:
+            return INT_LEN[t]
+        if t == YEAR:
+            return 1
+        if t == NEWDATE:
+            return 3
+        if t == DATETIME2:
+            return 5 + (self.dt_prec + 1) // 2
+        if t == TIMESTAMP2:
+            return 4 + (self.dt_prec + 1) // 2
+        if t == DOUBLE:
+            return 8
+        if t == FLOAT:
+            return 4
+        if t == NEWDECIMAL:
+            return dec_size(self.prec, self.scale)
+        if t == ENUM:
+            return 1 if len(self.elements) < 256 else 2
+        if t == STRING:
+            if self.mbmax() == 1:
+                return self.length
+            return 0
+        return 0
+
+    def big(self):
+        return self.col_len() > 255 or self.typ in (BLOB, JSON)
+
+    def encode(self, v):
+        t = self.typ
+        if self.name in ('DB_TRX_ID', 'DB_ROW_ID'):
+            return v.to_bytes(6, 'big')
+        if self.name == 'DB_ROLL_PTR':
+            return v.to_bytes(7, 'big')
+        if t in INT_LEN:
+            n = INT_LEN[t]
+            if not self.unsigned:
+                v += 1 << (8 * n - 1)
+            return v.to_bytes(n, 'big')
+        if t == YEAR:
+            return bytes([0 if v == 0 else v - 1900])
+        if t == NEWDATE:
+            y, m, d = v.year, v.month, v.day
+            x = (y << 9) | (m << 5) | d
+            return (x | 0x800000).to_bytes(3, 'big')
+        if t == DATETIME2:
+            ym = v.year * 13 + v.month
+            ymd = (ym << 5) | v.day
+            hms = (v.hour << 12) | (v.minute << 6) | v.second
+            intpart = (ymd << 17) | hms
+            b = (intpart + 0x8000000000).to_bytes(5, 'big')
+            return b
+        if t == DOUBLE:
+            return struct.pack('<d', v)
+        if t == FLOAT:
+            return struct.pack('<f', v)
+        if t == NEWDECIMAL:
+            return dec_encode(v, self.prec, self.scale)
+        if t == ENUM:
+            return v.to_bytes(self.fixed_len(), 'big')
+        if t == VARCHAR or t == BLOB:
+            if isinstance(v, str):
+                return v.encode('latin1' if self.coll in (8, 47) else 'utf8')
+            return v
+        if t == STRING:
+            b = v.encode('utf8')
+            return b + b' ' * max(0, self.length - len(b))
+        raise Exception('type %d' % t)
+
+    def sdi(self, pos):
+        elements = [{"name": base64.b64encode(e.encode()).decode(),
+                     "index": i + 1} for i, e in enumerate(self.elements)]
+        return {
+            "name": self.name, "type": self.typ, "is_nullable": self.nullable,
+            "is_zerofill": False, "is_unsigned": self.unsigned,
+            "is_auto_increment": False, "is_virtual": False,
+            "hidden": self.hidden, "ordinal_position": pos,
+            "char_length": self.char_length(),
+            "numeric_precision": self.prec, "numeric_scale": self.scale,
+            "numeric_scale_null": self.typ != NEWDECIMAL,
+            "datetime_precision": self.dt_prec,
+            "datetime_precision_null": 0 if self.typ == DATETIME2 else 1,
+            "has_no_default": not self.nullable,
+            "default_value_null": self.nullable,
+            "srs_id_null": True, "srs_id": 0,
+            "default_value": "", "default_value_utf8_null": self.nullable,
+            "default_value_utf8": "", "default_option": "",
+            "update_option": "", "comment": "",
+            "generation_expression": "", "generation_expression_utf8": "",
+            "options": "interval_count=%d;" % len(self.elements),
+            "se_private_data": "table_id=1067;",
+            "engine_attribute": "", "secondary_engine_attribute": "",
+            "column_key": 1, "column_type_utf8": self.type_str,
+            "elements": elements, "collation_id": self.coll,
+            "is_explicit_collation": False}
+
+
+def dec_size(p, s):
+    intg = p - s
+    return (intg // 9) * 4 + DIG2BYTES[intg % 9] + (s // 9) * 4 + DIG2BYTES[s % 9]
+
+
+def dec_encode(v, p, s):
+    v = decimal.Decimal(v)
+    neg = v < 0
+    v = abs(v)
+    txt = ('{:.%df}' % s).format(v)
+    ip, _, fp = txt.partition('.')
+    intg = p - s
+    ip = ip.rjust(intg, '0')
+    fp = fp.ljust(s, '0')
+    out = b''
+    lead = intg % 9
+    if lead:
+        out += int(ip[:lead]).to_bytes(DIG2BYTES[lead], 'big')
+    for i in range(lead, intg, 9):
+        out += int(ip[i:i + 9]).to_bytes(4, 'big')
+    for i in range(0, (s // 9) * 9, 9):
+        out += int(fp[i:i + 9]).to_bytes(4, 'big')
+    if s % 9:
+        out += int(fp[(s // 9) * 9:]).to_bytes(DIG2BYTES[s % 9], 'big')
+    out = bytearray(out)
+    if neg:
+        out = bytearray(b ^ 0xFF for b in out)
+    out[0] ^= 0x80
+    return bytes(out)
+
+
+class Index:
+    def __init__(self, name, typ, key_cols, iid, unique=False):
+        self.name, self.typ, self.key_cols, self.id = name, typ, key_cols, iid
+        self.unique = unique
+        self.root = None
+
+
+class Table:
+    def __init__(self, name, cols, pk, secondaries, tid, schema='test'):
+        self.name, self.cols, self.tid, self.schema = name, cols, tid, schema
+        self.cols.append(Col('DB_TRX_ID', INT24, hidden=2))
+        self.cols.append(Col('DB_ROLL_PTR', LONGLONG, hidden=2))
+        self.pk = pk
+        self.indexes = [Index('PRIMARY', 1, pk, tid * 10 + 1, True)]
+        for i, (n, kc, uniq) in enumerate(secondaries):
+            self.indexes.append(Index(n, 2 if uniq else 3, kc, tid * 10 + 2 + i, uniq))
+        self.rows = []
+
+    def col(self, n):
+        return [c for c in self.cols if c.name == n][0]
+
+    def clust_fields(self):
+        f = list(self.pk) + ['DB_TRX_ID', 'DB_ROLL_PTR']
+        f += [c.name for c in self.cols if c.name not in f]
+        return f
+
+    def index_fields(self, idx):
+        if idx.typ == 1:
+            return self.clust_fields(), len(self.pk)
+        f = list(idx.key_cols)
+        f += [p for p in self.pk if p not in f]
+        n_uniq = len(idx.key_cols) if idx.unique else len(f)
+        return f, n_uniq
+
+    def sdi(self):
+        cols = [c.sdi(i + 1) for i, c in enumerate(self.cols)]
+        idxs = []
+        opx = {c.name: i for i, c in enumerate(self.cols)}
+        for pos, idx in enumerate(self.indexes):
+            els = []
+            if idx.typ == 1:
+                order = list(self.pk) + ['DB_TRX_ID', 'DB_ROLL_PTR'] + \
+                    [c.name for c in self.cols if c.name not in self.pk and not c.is_sys()]
+                for i, n in enumerate(order):
+                    els.append({"ordinal_position": i + 1, "length": 4294967295 if n not in self.pk else 4,
+                                "order": 2, "hidden": n not in self.pk, "column_opx": opx[n]})
+            else:
+                f, _ = self.index_fields(idx)
+                for i, n in enumerate(f):
+                    els.append({"ordinal_position": i + 1, "length": 4,
+                                "order": 2, "hidden": n not in idx.key_cols, "column_opx": opx[n]})
+            idxs.append({
+                "name": idx.name, "hidden": False, "is_generated": False,
+                "ordinal_position": pos + 1, "comment": "", "options": "flags=0;",
+                "se_private_data": "id=%d;root=%d;space_id=5;table_id=%d;trx_id=1234;" % (idx.id, idx.root, self.tid),
+                "type": idx.typ, "algorithm": 2, "is_algorithm_explicit": False,
+                "is_visible": True, "engine": "InnoDB", "engine_attribute": "",
+                "secondary_engine_attribute": "", "elements": els,
+                "tablespace_ref": "test/" + self.name})
+        obj = {
+            "name": self.name, "mysql_version_id": 80040, "created": 20240101000000,
+            "last_altered": 20240101000000, "hidden": 1,
+            "options": "avg_row_length=0;encrypt_type=N;key_block_size=0;keys_disabled=0;pack_record=1;stats_auto_recalc=0;stats_sample_pages=0;",
+            "columns": cols, "schema_ref": self.schema, "se_private_id": self.tid,
+            "engine": "InnoDB", "last_checked_for_upgrade_version_id": 0,
+            "comment": "", "se_private_data": "", "engine_attribute": "",
+            "secondary_engine_attribute": "", "row_format": 2,
+            "partition_type": 0, "partition_expression": "",
+            "partition_expression_utf8": "", "default_partitioning": 0,
+            "subpartition_type": 0, "subpartition_expression": "",
+            "subpartition_expression_utf8": "", "default_subpartitioning": 0,
+            "indexes": idxs, "foreign_keys": [], "check_constraints": [],
+            "partitions": [], "collation_id": 255}
+        return {"mysqld_version_id": 80040, "dd_version": 80023,
+                "sdi_version": 80019, "dd_object_type": "Table", "dd_object": obj}
+
+
+EXTERN_OVER = 2000   # BLOB values longer than this are stored off-page
+LOB_PAGES = {}       # page_no -> bytes of the LOB pages written so far
+LOB_SPACE = None
+
+
+def write_lob(value, lsn=100000):
+    """Writes value to 8.0 LOB pages (a first page with its index entries,
+    then data pages), returns the 20 byte reference."""
+    first_no = LOB_SPACE.alloc()
+    first = bytearray(PAGE)
+    data_begin = 96 + 10 * 60
+    cap_first = PAGE - 8 - data_begin
+    cap_data = PAGE - 8 - 49
+    chunks = [(first_no, value[:cap_first])]
+    rest = value[cap_first:]
+    while rest:
+        chunks.append((LOB_SPACE.alloc(), rest[:cap_data]))
+        rest = rest[cap_data:]
+    assert len(chunks) <= 10
+    struct.pack_into('>IIIIQHQI', first, 0, 0, first_no, FIL_NULL, FIL_NULL, lsn, 24, 0, 5)
+    struct.pack_into('>I', first, 40, 1)                 # lob version
+    struct.pack_into('>I', first, 54, len(chunks[0][1])) # data len
+    def addr(i):
+        return struct.pack('>IH', first_no, 96 + 60 * i)
+    nul = struct.pack('>IH', FIL_NULL, 0)
+    # index list base node
+    first[64:80] = struct.pack('>I', len(chunks)) + addr(0) + addr(len(chunks) - 1)
+    first[80:96] = struct.pack('>I', 0) + nul + nul
+    for i, (no, ch) in enumerate(chunks):
+        e = 96 + 60 * i
+        first[e:e + 6] = addr(i - 1) if i else nul
+        first[e + 6:e + 12] = addr(i + 1) if i + 1 < len(chunks) else nul
+        first[e + 12:e + 28] = struct.pack('>I', 0) + nul + nul
+        struct.pack_into('>III', first, e + 48, no, len(ch), 1)
+        if i == 0:
+            first[data_begin:data_begin + len(ch)] = ch
+        else:
+            b = bytearray(PAGE)
+            struct.pack_into('>IIIIQHQI', b, 0, 0, no, FIL_NULL, FIL_NULL, lsn, 23, 0, 5)
+            struct.pack_into('>BI', b, 38, 0, len(ch))
+            b[49:49 + len(ch)] = ch
+            struct.pack_into('>II', b, PAGE - 8, 0, lsn & 0xFFFFFFFF)
+            LOB_PAGES[no] = bytes(b)
+    struct.pack_into('>II', first, PAGE - 8, 0, lsn & 0xFFFFFFFF)
+    LOB_PAGES[first_no] = bytes(first)
+    return struct.pack('>IIIQ', 5, first_no, 1, len(value))
+
+
+def build_rec(table, idx, fields, values, status, extra_nullable, child=None, info=0):
+    """Return (extra_bytes_without_header, data_bytes)."""
+    down = []  # bytes below header, down[0] at rec-6
+    n_nullable = extra_nullable
+    null_bits = []
+    lens = []
+    data = b''
+    for f, v in zip(fields, values):
+        c = table.col(f)
+        if c.nullable:
+            null_bits.append(v is None)
+            if v is None:
+                continue
+        b = c.encode(v)
+        if c.fixed_len() == 0:
+            L = len(b)
+            if c.typ in (BLOB, JSON) and L > EXTERN_OVER and child is None:
+                b = write_lob(b)
+                lens.append([0xC0, 20])
+            elif c.big() and L >= 128:
+                lens.append([0x80 | (L >> 8), L & 0xFF])
+            else:
+                lens.append([L])
+        data += b
+    if child is not None:
+        data += child.to_bytes(4, 'big')
+    nb = (n_nullable + 7) // 8
+    nulls = [0] * nb
+    for i, isnull in enumerate(null_bits):
+        if isnull:
+            nulls[i // 8] |= 1 << (i % 8)
+    down += nulls
+    for l in lens:
+        down += l
+    extra = bytes(reversed(down))
+    return extra, data
+
+
+def pad_cmp(a, b):
+    """PAD SPACE byte comparison, the shorter string padded with spaces."""
+    n = min(len(a), len(b))
+    if a[:n] != b[:n]:
+        return -1 if a[:n] < b[:n] else 1
+    rest, sign = (a[n:], 1) if len(a) > len(b) else (b[n:], -1)
+    for ch in rest:
+        if ch != 32:
+            return sign if ch > 32 else -sign
+    return 0
+
+
+def n_nullable(table, fields):
+    return sum(1 for f in fields if table.col(f).nullable)
+
+
+class PageBuilder:
+    def __init__(self, page_no, level, index_id, page_type=FIL_PAGE_INDEX):
+        self.page_no, self.level, self.index_id, self.type = page_no, level, index_id, page_type
+        self.recs = []  # (extra, data, status, info)
+        self.prev = FIL_NULL
+        self.next = FIL_NULL
+        self.free = []  # purged recs in free list (extra, data)
+        self.leftover = 0  # bytes in PAGE_GARBAGE not on the free list
+
+    def size(self):
+        return sum(len(e) + 5 + len(d) for e, d, s, i in self.recs) + \
+            sum(len(e) + 5 + len(d) for e, d in self.free)
+
+    def n_slots_est(self):
+        return (len(self.recs) + 1) // 4 + 2
+
+    def fits(self, extra, data, limit):
+        used = 120 + self.size() + len(extra) + 5 + len(data) + 2 * (self.n_slots_est() + 1) + 8
+        return used <= limit
+
+    def render(self, lsn):
+        buf = bytearray(PAGE)
+        pos = 120
+        offs = []
+        heap = 2
+        for extra, data, status, info in self.recs:
+            buf[pos:pos + len(extra)] = extra
+            rec = pos + len(extra) + 5
+            buf[rec:rec + len(data)] = data
+            offs.append((rec, status, info, heap))
+            heap += 1
+            pos = rec + len(data)
+        free_offs = []
+        garbage = 0
+        for extra, data in self.free:
+            buf[pos:pos + len(extra)] = extra
+            rec = pos + len(extra) + 5
+            buf[rec:rec + len(data)] = data
+            free_offs.append((rec, heap))
+            garbage += len(extra) + 5 + len(data)
+            heap += 1
+            pos = rec + len(data)
+        pos += self.leftover
+        garbage += self.leftover
+        heap_top = pos
+        # groups
+        items = list(range(len(offs))) + ['sup']
+        groups = [items[i:i + 4] for i in range(0, len(items), 4)]
+        if len(groups) > 1 and len(groups[-1]) < 4:
+            last = groups.pop()
+            groups[-1] += last
+        owners = {}
+        for g in groups:
+            owners[g[-1]] = len(g)
+        # headers
+        def hdr(rec, n_owned, info, heap_no, status, nxt):
+            buf[rec - 5] = (info << 4 & 0xF0) | n_owned
+            struct.pack_into('>H', buf, rec - 4, (heap_no << 3) | status)
+            rel = (nxt - rec) & 0xFFFF if nxt else 0
+            struct.pack_into('>H', buf, rec - 2, rel)
+        chain = [INF] + [o[0] for o in offs] + [SUP]
+        # infimum
+        buf[INF:INF + 8] = b'infimum\0'
+        buf[SUP:SUP + 8] = b'supremum'
+        hdr(INF, 1, 0, 0, 2, chain[1])
+        for i, (rec, status, info, heap_no) in enumerate(offs):
+            hdr(rec, owners.get(i, 0), info, heap_no, status, chain[i + 2])
+        hdr(SUP, owners['sup'], 0, 1, 3, 0)
+        for j, (rec, heap_no) in enumerate(free_offs):
+            nxt = free_offs[j + 1][0] if j + 1 < len(free_offs) else 0
+            hdr(rec, 0, 2, heap_no, 0 if self.level == 0 else 1, nxt)
+        # directory
+        slots = [INF] + [offs[g[-1]][0] if g[-1] != 'sup' else SUP for g in groups]
+        for i, s in enumerate(slots):
+            struct.pack_into('>H', buf, PAGE - 8 - 2 * (i + 1), s)
+        # page header
+        struct.pack_into('>HHHHHHHHHQHQ', buf, 38, len(slots), heap_top,
+                         0x8000 | heap, free_offs[0][0] if free_offs else 0,
+                         garbage, 0, 5, 0, len(offs), 0, self.level, self.index_id)
+        # fil header
+        struct.pack_into('>IIIIQHQI', buf, 0, 0, self.page_no, self.prev,
+                         self.next, lsn, self.type, 0, 5)
+        struct.pack_into('>II', buf, PAGE - 8, 0, lsn & 0xFFFFFFFF)
+        return bytes(buf)
+
+
+class Space:
+    def __init__(self):
+        self.next_page = 4
+        self.lsn = 100000
+
+    def alloc(self):
+        p = self.next_page
+        self.next_page += 1
+        return p
+
+
+def build_tree(space, table, idx, rows, fill, shuffle, deleted, purged, rng, leftover=0):
+    fields, n_uniq = table.index_fields(idx)
+    nn = n_nullable(table, fields)
+    limit = int(PAGE * fill)
+    # sort rows by index key
+    def ck(f, v):
+        c = table.col(f)
+        if isinstance(v, str) and c.coll != 63 and not c.coll in (46, 47):
+            v = ''.join(ch for ch in unicodedata.normalize('NFD', v)
+                        if not unicodedata.combining(ch)).upper().rstrip(' ')
+        return v
+    def fcmp(f, x, y):
+        c = table.col(f)
+        if x is None or y is None:
+            return 0 if x is y else (-1 if x is None else 1)
+        if isinstance(x, str) and c.coll in (46, 47):
+            return pad_cmp(c.encode(x), c.encode(y))
+        x, y = ck(f, x), ck(f, y)
+        return (x > y) - (x < y)
+    kf = idx.key_cols if idx.typ == 1 else fields
+    def rcmp(r1, r2):
+        for f in kf:
+            d = fcmp(f, r1[f], r2[f])
+            if d:
+                return d
+        return 0
+    srows = sorted(rows, key=functools.cmp_to_key(rcmp))
+    leaves = []
+    cur = PageBuilder(None, 0, idx.id)
+    for r in srows:
+        vals = [r[f] for f in fields]
+        extra, data = build_rec(table, idx, fields, vals, 0, nn)
+        # a DELETE delete-marks the row in every index until purge
+        info = 2 if r['__deleted'] else 0
+        if not cur.fits(extra, data, limit) and cur.recs:
+            leaves.append(cur)
+            cur = PageBuilder(None, 0, idx.id)
+        cur.recs.append((extra, data, 0, info))
+        cur.__dict__.setdefault('first', vals)
+    leaves.append(cur)
+    if purged:
+        for pg in leaves:
+            for _ in range(rng.randint(0, purged)):
+                e, d, s, i = pg.recs[rng.randrange(len(pg.recs))]
+                if pg.fits(e, d, PAGE - 200):
+                    pg.free.append((e, d))
+            if leftover and pg.free:
+                pg.leftover = leftover
+    nums = [space.alloc() for _ in leaves]
+    if shuffle:
+        rng.shuffle(nums)
+    for pg, no in zip(leaves, nums):
+        pg.page_no = no
+    level_pages = leaves
+    level = 0
+    while len(level_pages) > 1:
+        level += 1
+        ups = []
+        cur = PageBuilder(None, level, idx.id)
+        nptr_fields = fields[:n_uniq]
+        for k, child in enumerate(level_pages):
+            vals = child.first[:n_uniq]
+            extra, data = build_rec(table, idx, nptr_fields, vals, 1, nn, child=child.page_no)
+            if not cur.fits(extra, data, limit) and cur.recs:
+                ups.append(cur)
+                cur = PageBuilder(None, level, idx.id)
+            info = 1 if (not ups and not cur.recs) else 0
+            cur.recs.append((extra, data, 1, info))
+            cur.__dict__.setdefault('first', child.first)
+        ups.append(cur)
+        for pg in ups:
+            pg.page_no = space.alloc()
+        level_pages = ups
+        # link siblings
+        for i, pg in enumerate(ups):
+            pg.prev = ups[i - 1].page_no if i else FIL_NULL
+            pg.next = ups[i + 1].page_no if i + 1 < len(ups) else FIL_NULL
+        all_levels.append(ups)
+        idx.__dict__.setdefault('upper', []).extend(ups)
+    for i, pg in enumerate(leaves):
+        pg.prev = leaves[i - 1].page_no if i else FIL_NULL
+        pg.next = leaves[i + 1].page_no if i + 1 < len(leaves) else FIL_NULL
+    idx.root = level_pages[0].page_no
+    idx.pages = leaves
+    return leaves, level_pages
+
+
+all_levels = []
+
+
+def write_fsp(out, n_pages, space, tables, sdi_leaves, allpages, blob_pages):
+    E = 64
+    owner = {0: 0, 1: 0, 2: 0}
+    segs = []  # dict(id, root, kind)
+    def new_seg(name):
+        sg = {'id': len(segs) + 1, 'name': name, 'frag': [], 'free': [], 'not_full': [],
+              'full': [], 'nfu': 0}
+        segs.append(sg)
+        return sg
+    roots = []
+    for t in tables:
+        for idx in t.indexes:
+            name = 'test.%s.%s' % (t.name, idx.name)
+            leaf, top = new_seg(name + ' (leaf)'), new_seg(name + ' (non-leaf)')
+            for pg in idx.pages:
+                owner[pg.page_no] = leaf['id']
+            for pg in getattr(idx, 'upper', []):
+                owner[pg.page_no] = top['id']
+            roots.append((idx.root, leaf, top))
+    leaf, top = new_seg('SDI (leaf)'), new_seg('SDI (non-leaf)')
+    for pg in sdi_leaves:
+        owner[pg.page_no] = leaf['id']
+    for no in blob_pages:
+        owner[no] = leaf['id']
+    if allpages[3] is not sdi_leaves[0]:
+        owner[3] = top['id']
+    else:
+        owner[3] = leaf['id']
+    roots.append((3, leaf, top))
+    assert len(segs) <= 85, 'too many segments for one INODE page'
+    byid = {sg['id']: sg for sg in segs}
+    p0 = bytearray(out[0:PAGE])
+    lists = {'free': [], 'free_frag': [], 'full_frag': []}
+    frag_used = 0
+    for e in range(n_pages // E):
+        pages = [p for p in range(e * E, e * E + E) if p in owner]
+        owners = set(owner[p] for p in pages)
+        xoff = 150 + 40 * e
+        bitmap = bytearray(16)
+        for k in range(E):
+            used = (e * E + k) in owner
+            bit = k * 2
+            if not used:
+                bitmap[bit // 8] |= 1 << (bit % 8)
+            bitmap[(bit + 1) // 8] |= 1 << ((bit + 1) % 8)
+        if not pages:
+            state, sid = 1, 0
+            lists['free'].append(e)
+        elif len(owners) > 1 or 0 in owners:
+            sid = 0
+            if len(pages) == E:
+                state = 3
+                lists['full_frag'].append(e)
+            else:
+                state = 2
+                lists['free_frag'].append(e)
+                frag_used += len(pages)
+            for p in pages:
+                if owner[p] and len(byid[owner[p]]['frag']) < 32:
+                    byid[owner[p]]['frag'].append(p)
+        else:
+            state, sid = 4, owners.pop()
+            sg = byid[sid]
+            if len(pages) == E:
+                sg['full'].append(e)
+            else:
+                sg['not_full'].append(e)
+                sg['nfu'] += len(pages)
+        struct.pack_into('>Q', p0, xoff, sid)
+        struct.pack_into('>I', p0, xoff + 20, state)
+        p0[xoff + 24:xoff + 40] = bitmap
+    def node_addr(e):
+        return (0, 150 + 40 * e + 8)
+    def write_list(base_buf, base_off, exts):
+        struct.pack_into('>I', base_buf, base_off, len(exts))
+        first = node_addr(exts[0]) if exts else (FIL_NULL, 0)
+        last = node_addr(exts[-1]) if exts else (FIL_NULL, 0)
+        struct.pack_into('>IHIH', base_buf, base_off + 4, first[0], first[1], last[0], last[1])
+        for i, e in enumerate(exts):
+            prv = node_addr(exts[i - 1]) if i else (FIL_NULL, 0)
+            nxt = node_addr(exts[i + 1]) if i + 1 < len(exts) else (FIL_NULL, 0)
+            struct.pack_into('>IHIH', p0, 150 + 40 * e + 8, prv[0], prv[1], nxt[0], nxt[1])
+    FH = 38
+    struct.pack_into('>I', p0, FH + 20, frag_used)
+    write_list(p0, FH + 24, lists['free'])
+    write_list(p0, FH + 40, lists['free_frag'])
+    write_list(p0, FH + 56, lists['full_frag'])
+    struct.pack_into('>Q', p0, FH + 72, len(segs) + 1)
+    # SEG_INODES_FULL empty, SEG_INODES_FREE holds page 2
+    struct.pack_into('>IIHIH', p0, FH + 80, 0, FIL_NULL, 0, FIL_NULL, 0)
+    struct.pack_into('>IIHIH', p0, FH + 96, 1, 2, 38, 2, 38)
+    p2 = bytearray(out[2 * PAGE:3 * PAGE])
+    struct.pack_into('>IHIH', p2, 38, FIL_NULL, 0, FIL_NULL, 0)
+    for k, sg in enumerate(segs):
+        off = 50 + 192 * k
+        sg['off'] = off
+        struct.pack_into('>QI', p2, off, sg['id'], sg['nfu'])
+        write_list(p2, off + 12, sg['free'])
+        write_list(p2, off + 28, sg['not_full'])
+        write_list(p2, off + 44, sg['full'])
+        struct.pack_into('>I', p2, off + 60, 97937874)
+        for j in range(32):
+            struct.pack_into('>I', p2, off + 64 + 4 * j,
+                             sg['frag'][j] if j < len(sg['frag']) else FIL_NULL)
+    out[0:PAGE] = p0
+    out[2 * PAGE:3 * PAGE] = p2
+    for root, leaf, top in roots:
+        base = root * PAGE + 38 + 36
+        struct.pack_into('>IIH', out, base, 5, 2, leaf['off'])
+        struct.pack_into('>IIH', out, base + 10, 5, 2, top['off'])
+    # what --fragmentation should report
+    segments = {}
+    for sg in segs:
+        exts = sorted(sg['full'] + sg['not_full'])
+        segments[sg['name']] = {
+            'allocated': len(sg['frag']) + E * len(exts),
+            'used': len(sg['frag']) + E * len(sg['full']) + sg['nfu'],
+            'frag': len(sg['frag']), 'extents': len(exts), 'partial': len(sg['not_full']),
+            'runs': sum(1 for i, e in enumerate(exts) if i == 0 or e != exts[i - 1] + 1)}
+    return {'extents': n_pages // E, 'free': len(lists['free']),
+            'free_frag': len(lists['free_frag']), 'full_frag': len(lists['full_frag']),
+            'frag_used': frag_used + E * len(lists['full_frag']), 'segments': segments}
+
+
+def main():
+    ap = argparse.ArgumentParser()
+    ap.add_argument('out')
+    ap.add_argument('--rows', type=int, default=2000)
+    ap.add_argument('--fill', type=float, default=0.9)
+    ap.add_argument('--shuffle', action='store_true')
+    ap.add_argument('--deleted', type=float, default=0.05)
+    ap.add_argument('--purged', type=int, default=0)
+    ap.add_argument('--leftover', type=int, default=0)
+    ap.add_argument('--seed', type=int, default=1)
+    ap.add_argument('--extra-tables', type=int, default=0)
+    ap.add_argument('--big-sdi', action='store_true')
+    ap.add_argument('--fsp', action='store_true')
+    a = ap.parse_args()
+    rng = random.Random(a.seed)
+    space = Space()
+
+    t1 = Table('t1', [
+        Col('id', LONG, type_str='int'),
+        Col('name', VARCHAR, nullable=True, length=64, type_str='varchar(64)'),
+        Col('status', TINY, unsigned=True, type_str='tinyint unsigned'),
+        Col('created', DATETIME2, type_str='datetime'),
+        Col('amount', NEWDECIMAL, nullable=True, prec=10, scale=2, type_str='decimal(10,2)'),
+        Col('score', DOUBLE, nullable=True, type_str='double'),
+        Col('born', NEWDATE, nullable=True, type_str='date'),
+        Col('color', ENUM, elements=['red', 'green', 'blue'], type_str="enum('red','green','blue')"),
+        Col('code', STRING, length=4, type_str='char(4)'),
+        Col('note', BLOB, nullable=True, coll=255, type_str='text'),
+    ], ['id'], [('idx_status', ['status'], False), ('idx_name', ['name'], False)], 1067)
+    names = ['alice', 'bob', 'carol', 'dave', 'Eve', 'frank', 'grace', 'heidi', None]
+    base = datetime.datetime(2024, 1, 1)
+    for i in range(a.rows):
+        rid = i * 3 - 300
+        r = {'id': rid, 'name': (names[i % 9] + str(i % 50)) if names[i % 9] else None,
+             'status': i % 5, 'created': base + datetime.timedelta(minutes=7 * i),
+             'amount': None if i % 11 == 0 else decimal.Decimal(i * 13 % 100000) / 100 - 50,
+             'score': None if i % 7 == 0 else i * 0.5,
+             'born': None if i % 13 == 0 else datetime.date(1980 + i % 30, 1 + i % 12, 1 + i % 28),
+             'color': 1 + i % 3, 'code': 'c%02d' % (i % 100),
+             'note': None if i % 3 else ('note %d ' % i) * (1 + i % 20),
+             'DB_TRX_ID': 1000 + i * 2, 'DB_ROLL_PTR': (1 << 55) | i,
+             '__deleted': rng.random() < a.deleted}
+        t1.rows.append(r)
+
+    t2 = Table('t2', [
+        Col('a', LONG, type_str='int'),
+        Col('b', VARCHAR, length=20, coll=255, type_str='varchar(20)'),
+        Col('v', LONGLONG, unsigned=True, type_str='bigint unsigned'),
+    ], ['a', 'b'], [], 1068)
+    words = ['Apple', 'apple', 'banana', 'Cherry', 'date', 'Éclair', 'fig']
+    for i in range(a.rows // 2):
+        t2.rows.append({'a': i // 7, 'b': words[i % 7] + ('' if i % 2 else 'x'),
+                        'v': i * 1000, 'DB_TRX_ID': 5000 + i, 'DB_ROLL_PTR': i,
+                        '__deleted': False})
+
+    t3 = Table('t3', [
+        Col('k', VARCHAR, length=16, coll=46, type_str='varchar(16)'),
+        Col('l', VARCHAR, nullable=True, length=16, coll=47, type_str='varchar(16)'),
+        Col('v', LONG, type_str='int'),
+    ], ['k'], [('idx_l', ['l'], False)], 1069)
+    alphabet = [' ', '\t', 'a', 'b', 'A', '\u00e9', '\x1f', '~', 'z']
+    keys = ['']
+    for n in range(3):
+        keys += [k + ch for k in keys if len(k) == n for ch in alphabet]
+    seen = set()
+    for i, k in enumerate(keys):
+        if k.rstrip(' ') in seen:
+            continue
+        seen.add(k.rstrip(' '))
+        l = None if i % 17 == 0 else ['a', 'a ', 'a\t', 'a b', 'ab', '', ' ', '\u00e9',
+                                      '\\N', 'a\x00b', 'c:\\d', 'x,"y"'][i % 12]
+        t3.rows.append({'k': k, 'l': l, 'v': i, 'DB_TRX_ID': 9000 + i,
+                        'DB_ROLL_PTR': i, '__deleted': False})
+
+    t4 = Table('t4', [
+        Col('id', LONG, type_str='int'),
+        Col('b', BLOB, nullable=True, coll=63, type_str='blob'),
+    ], ['id'], [], 1070)
+    for i in range(300):
+        if i % 7 == 0:
+            b = None
+        elif i % 25 == 1:
+            n = [2500, 17000, 40000][(i // 25) % 3]
+            b = (b'~%d:' % i + b''.join(b'%06d' % k for k in range(n // 6 + 1)))[:n]
+        else:
+            b = b'v%04d' % ((i * 37) % 300)
+        t4.rows.append({'id': i, 'b': b, 'DB_TRX_ID': 12000 + i,
+                        'DB_ROLL_PTR': i, '__deleted': False})
+
+    t5 = Table('t5', [
+        Col('id', LONG, type_str='int'),
+        Col('y', YEAR, unsigned=True, type_str='year'),
+        Col('d', DOUBLE, nullable=True, type_str='double'),
+        Col('s', VARCHAR, nullable=True, length=16, coll=8, type_str='varchar(16)'),
+    ], ['id'], [], 1071)
+    specials = [float('nan'), float('inf'), float('-inf'), -0.0, 1e300, 5e-324, 0.1]
+    texts = [b'caf\xe9', b'\x80uro', b'\x93q\x94', b'\x81\x8d\x8f\x90\x9d', b'plain', b'\xff\xa0']
+    for i in range(40):
+        t5.rows.append({'id': i, 'y': 0 if i % 4 == 0 else 1901 + i * 6,
+                        'd': specials[i % 7] if i % 5 else None,
+                        's': texts[i % 6] if i % 9 else None,
+                        'DB_TRX_ID': 13000 + i, 'DB_ROLL_PTR': i, '__deleted': False})
+
+    tables = [t1, t2, t3, t4, t5]
+    global LOB_SPACE
+    LOB_SPACE = space
+    for k in range(a.extra_tables):
+        tables.append(Table('x%d' % k, [Col('id', LONG, type_str='int'),
+                                          Col('v', VARCHAR, length=10, type_str='varchar(10)')],
+                            ['id'], [], 2000 + k))
+    allpages = {}
+    for t in tables:
+        for idx in t.indexes:
+            build_tree(space, t, idx, t.rows, a.fill, a.shuffle and idx.typ == 1, a.deleted, a.purged, rng, a.leftover)
+            for pg in idx.pages:
+                allpages[pg.page_no] = pg
+    for lvl in all_levels:
+        for pg in lvl:
+            allpages[pg.page_no] = pg
+
+    # SDI
+    sdi_recs = []
+    for t in tables:
+        d = t.sdi()
+        if a.big_sdi and t is t1:
+            d['dd_object']['comment'] = rng.randbytes(20000).hex()
+        js = json.dumps(d, separators=(',', ':')).encode()
+        sdi_recs.append((1, t.tid, js))
+    ts = {"mysqld_version_id": 80040, "dd_version": 80023, "sdi_version": 80019,
+          "dd_object_type": "Tablespace", "dd_object": {"name": "test/t1"}}
+    sdi_recs.append((2, 5, json.dumps(ts).encode()))
+    sdi_recs.sort(key=lambda x: (x[0], x[1]))
+    sdi_leaves = [PageBuilder(3, 0, 0xFFFFFFFF, FIL_PAGE_SDI)]
+    blob_pages = {}
+    for typ, oid, js in sdi_recs:
+        comp = zlib.compress(js)
+        head = struct.pack('>IQ', typ, oid) + (1).to_bytes(6, 'big') + (1 << 55).to_bytes(7, 'big') + \
+            struct.pack('>II', len(js), len(comp))
+        if len(comp) > 8000:
+            # off-page, 20 byte ref
+            first = None
+            chunks = [comp[i:i + 16000] for i in range(0, len(comp), 16000)]
+            nos = [space.alloc() for _ in chunks]
+            for k, (ch, no) in enumerate(zip(chunks, nos)):
+                b = bytearray(PAGE)
+                nxt = nos[k + 1] if k + 1 < len(nos) else FIL_NULL
+                struct.pack_into('>IIIIQHQI', b, 0, 0, no, FIL_NULL, FIL_NULL, space.lsn, 18, 0, 5)
+                struct.pack_into('>II', b, 38, len(ch), nxt)
+                b[46:46 + len(ch)] = ch
+                struct.pack_into('>II', b, PAGE - 8, 0, space.lsn & 0xFFFFFFFF)
+                blob_pages[no] = bytes(b)
+            ref = struct.pack('>IIIQ', 5, nos[0], 38, len(comp))
+            extra = bytes([0x14, 0xC0])
+            data = head + ref
+        else:
+            L = len(comp)
+            extra = bytes([L & 0xFF, 0x80 | (L >> 8)]) if L >= 128 else bytes([L])
+            data = head + comp
+        cur = sdi_leaves[-1]
+        if not cur.fits(extra, data, PAGE - 100) and cur.recs:
+            cur = PageBuilder(None, 0, 0xFFFFFFFF, FIL_PAGE_SDI)
+            sdi_leaves.append(cur)
+        cur.recs.append((extra, data, 0, 0))
+        cur.__dict__.setdefault('first', (typ, oid))
+    if len(sdi_leaves) > 1:
+        root = PageBuilder(3, 1, 0xFFFFFFFF, FIL_PAGE_SDI)
+        for pg in sdi_leaves:
+            pg.page_no = space.alloc()
+        for i, pg in enumerate(sdi_leaves):
+            pg.prev = sdi_leaves[i - 1].page_no if i else FIL_NULL
+            pg.next = sdi_leaves[i + 1].page_no if i + 1 < len(sdi_leaves) else FIL_NULL
+            typ, oid = pg.first
+            root.recs.append((b'', struct.pack('>IQI', typ, oid, pg.page_no), 1, 1 if i == 0 else 0))
+        allpages[3] = root
+    for pg in sdi_leaves:
+        allpages[pg.page_no] = pg
+
+    n_pages = max(space.next_page, 64)
+    n_pages = (n_pages + 63) // 64 * 64
+    out = bytearray(PAGE * n_pages)
+    # page 0
+    p0 = bytearray(PAGE)
+    flags = 1 | (1 << 5) | (1 << 14)
+    struct.pack_into('>IIIIQHQI', p0, 0, 0, 0, FIL_NULL, FIL_NULL, space.lsn, 8, 0, 5)
+    struct.pack_into('>IIII', p0, 38, 5, 0, n_pages, n_pages)
+    struct.pack_into('>I', p0, 38 + 16, flags)
+    sdi_off = 150 + 40 * 256 + 115
+    struct.pack_into('>II', p0, sdi_off, 1, 3)
+    struct.pack_into('>II', p0, PAGE - 8, 0, space.lsn & 0xFFFFFFFF)
+    out[0:PAGE] = p0
+    for no in (1, 2):
+        b = bytearray(PAGE)
+        struct.pack_into('>IIIIQHQI', b, 0, 0, no, FIL_NULL, FIL_NULL, space.lsn, 5 if no == 1 else 3, 0, 5)
+        struct.pack_into('>II', b, PAGE - 8, 0, space.lsn & 0xFFFFFFFF)
+        out[no * PAGE:(no + 1) * PAGE] = b
+    for no, pg in allpages.items():
+        out[no * PAGE:(no + 1) * PAGE] = pg.render(space.lsn + no)
+    blob_pages.update(LOB_PAGES)
+    for no, b in blob_pages.items():
+        out[no * PAGE:(no + 1) * PAGE] = b
+    for no in range(space.next_page, n_pages):
+        b = bytearray(PAGE)
+        struct.pack_into('>IIIIQHQI', b, 0, 0, 0, 0, 0, 0, 0, 0, 0)
+        out[no * PAGE:(no + 1) * PAGE] = b
+    fsp = None
+    if a.fsp:
+        fsp = write_fsp(out, n_pages, space, tables, sdi_leaves, allpages, blob_pages)
+    open(a.out, 'wb').write(out)
+    info = {t.name: {idx.name: {'id': idx.id, 'root': idx.root} for idx in t.indexes} for t in tables}
+    json.dump(info, sys.stderr)
+    sys.stderr.write('\n')
+    # dump rows for oracle checks
+    with open(a.out + '.rows.json', 'w') as f:
+        def conv(v):
+            if isinstance(v, (datetime.date, datetime.datetime, decimal.Decimal)):
+                return str(v)
+            if isinstance(v, bytes):
+                return v.hex()
+            return v
+        dump = {t.name: [{k: conv(v) for k, v in r.items()} for r in t.rows] for t in tables}
+        # the purged records of each index, as the PAGE_FREE lists hold them
+        dump['__free'] = {
+            str(idx.id): {
+                'pages': sum(1 for pg in idx.pages if pg.free),
+                'records': sum(len(pg.free) for pg in idx.pages),
+                'bytes': sum(len(e) + 5 + len(d) for pg in idx.pages for e, d in pg.free),
+                'leftover': sum(pg.leftover for pg in idx.pages)}
+            for t in tables for idx in t.indexes if hasattr(idx, 'pages')}
+        if fsp:
+            dump['__fsp'] = fsp
+        json.dump(dump, f)
+
+
+if __name__ == '__main__':
+    main()
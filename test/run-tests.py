@@ -0,0 +1,1274 @@
+#!/usr/bin/env python3
+"""Regression tests of ibdNinja.
+
+Writes synthetic ibd files with gen-ibd.py into a temporary directory, runs
+ibdNinja on them and compares its output with the rows the generator wrote
+to <ibd>.rows.json.
+
+Usage: run-tests.py [IBDNINJA] [TEST...]
+"""
+import importlib.util
+import csv
+import decimal
+import io
+import json
+import os
+import random
+import re
+import shutil
+import struct
+import subprocess
+import sys
+import tempfile
+import zlib
+
+HERE = os.path.dirname(os.path.abspath(__file__))
+_spec = importlib.util.spec_from_file_location('gen_ibd', os.path.join(HERE, 'gen-ibd.py'))
+gen = importlib.util.module_from_spec(_spec)
+_spec.loader.exec_module(gen)
+
+T1, T2, T3, T4, T5 = 1067, 1068, 1069, 1070, 1071
+T1_PRIMARY, T1_STATUS, T1_NAME, T3_L = 10671, 10672, 10673, 10692
+
+# Generator options of the fixtures, generated on first use
+FIXTURES = {
+    # three-level primary key, pages out of key order
+    'tree': ['--rows', '5000', '--fill', '0.1', '--shuffle', '--seed', '7'],
+    'small': ['--fill', '0.5', '--seed', '7'],
+    # records on the PAGE_FREE lists, and garbage bytes that are not
+    'purged': ['--purged', '3', '--seed', '3', '--fill', '0.8', '--leftover', '24'],
+    # many small SDI records, and one compressed over several BLOB pages
+    'tables': ['--extra-tables', '300', '--seed', '7'],
+    'big_sdi': ['--big-sdi', '--seed', '7'],
+    # the rows of 'tree' with the pages in key order
+    'sequential': ['--rows', '5000', '--fill', '0.1', '--seed', '7'],
+    # pages filled like a bulk load at innodb_fill_factor=100, no delete-marked rows
+    'bulk': ['--rows', '10000', '--fill', '0.9375', '--deleted', '0', '--seed', '7'],
+    # extent descriptors and segment inodes
+    'fsp': ['--rows', '5000', '--fill', '0.1', '--shuffle', '--seed', '7', '--fsp'],
+}
+
+TESTS = []
+
+
+def test(fn):
+    TESTS.append(fn)
+    return fn
+
+
+class Runner:
+    def __init__(self, ninja, tmp):
+        self.ninja = ninja
+        self.tmp = tmp
+        self.ibds = {}
+        self.checks = 0
+        self.failures = 0
+        self.status = None
+
+    def fixture(self, name):
+        if name not in self.ibds:
+            path = os.path.join(self.tmp, name + '.ibd')
+            subprocess.run([sys.executable, os.path.join(HERE, 'gen-ibd.py'), path] + FIXTURES[name],
+                           check=True, stderr=subprocess.DEVNULL)
+            self.ibds[name] = path
+        return self.ibds[name]
+
+    def corrupt(self, name, base, fn):
+        """Registers a copy of fixture base with fn applied to its pages."""
+        if name not in self.ibds:
+            path = os.path.join(self.tmp, name + '.ibd')
+            with open(self.fixture(base), 'rb') as f:
+                data = bytearray(f.read())
+            fn(data)
+            with open(path, 'wb') as f:
+                f.write(data)
+            shutil.copy(self.fixture(base) + '.rows.json', path + '.rows.json')
+            self.ibds[name] = path
+        return self.ibds[name]
+
+    def rows(self, name, table):
+        with open(self.fixture(name) + '.rows.json') as f:
+            return json.load(f)[table]
+
+    def run(self, name, *args):
+        """Runs ibdNinja on a fixture, returns (stdout, stderr) as str."""
+        argv = [self.ninja, '-f', self.fixture(name)]
+        argv += [a if isinstance(a, bytes) else str(a) for a in args]
+        p = subprocess.run(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+        self.status = p.returncode
+        return p.stdout.decode('utf8', 'replace'), p.stderr.decode('utf8', 'replace')
+
+    def check(self, ok, what, *details):
+        self.checks += 1
+        if not ok:
+            self.failures += 1
+            print('  FAIL:', what, *details)
+        return ok
+
+
+def row_ids(out):
+    return sorted(int(x) for x in re.findall(r'^  id\s+: (-?\d+)$', out, re.M))
+
+
+def matched(out):
+    m = re.search(r'Matched (?:secondary )?records:\s+(\d+)', out)
+    return int(m.group(1)) if m else None
+
+
+def live(rows):
+    return [r for r in rows if not r['__deleted']]
+
+
+# ---------------------------------------------------------------------------
+# Key lookups and range descent
+# ---------------------------------------------------------------------------
+
+@test
+def primary_lookup(t):
+    rows = t.rows('tree', 't1')
+    rng = random.Random(1)
+    by_id = {r['id']: r for r in rows}
+    probes = [r['id'] for r in rng.sample(rows, 40)]
+    probes += [min(by_id) - 1, max(by_id) + 1, -299, 0, 1]
+    for key in probes:
+        out, err = t.run('tree', '-k', T1, key)
+        r = by_id.get(key)
+        exp = [key] if r and not r['__deleted'] else []
+        if t.check(row_ids(out) == exp, 'lookup', key, row_ids(out)) and exp:
+            name = re.search(r'^  name\s+: (.*)$', out, re.M).group(1)
+            t.check(name == (r['name'] or 'NULL'), 'lookup name', key, name)
+
+
+@test
+def primary_range(t):
+    rows = live(t.rows('tree', 't1'))
+    rng = random.Random(2)
+    ids = [r['id'] for r in rows]
+    bounds = [(-300, -300), (-5, 5), ('', -250), (14700, ''), ('', ''), (10, 9), (-1000, -400)]
+    for _ in range(12):
+        lo = rng.randint(min(ids) - 10, max(ids) + 10)
+        bounds.append((lo, lo + rng.randint(0, 600)))
+    for lo, hi in bounds:
+        out, err = t.run('tree', '-r', T1, lo, hi)
+        exp = [i for i in ids if (lo == '' or i >= lo) and (hi == '' or i <= hi)]
+        t.check(row_ids(out) == sorted(exp), 'range', lo, hi, len(row_ids(out)), len(exp))
+
+
+@test
+def padded_collations(t):
+    """The _bin collations compare with trailing spaces stripped."""
+    rows = t.rows('tree', 't3')
+    rng = random.Random(3)
+    alphabet = [' ', '\t', 'a', 'b', 'A', 'é', '\x1f', '~', 'z']
+
+    def word(n):
+        return ''.join(rng.choice(alphabet) for _ in range(rng.randint(0, n)))
+
+    def utf8(s):
+        return s.encode('utf8')
+
+    def latin1(s):
+        return s.encode('latin1')
+
+    probes = [r['k'] for r in rng.sample(rows, 60)] + [word(4) for _ in range(40)]
+    for k in probes:
+        out, err = t.run('tree', '-k', T3, utf8("'" + k + "'"))
+        exp = sum(1 for r in rows if gen.pad_cmp(utf8(r['k']), utf8(k)) == 0)
+        t.check(matched(out) == exp, 'lookup', repr(k), matched(out), exp)
+    for _ in range(30):
+        lo, hi = word(3), word(3)
+        out, err = t.run('tree', '-r', T3, utf8("'" + lo + "'"), utf8("'" + hi + "'"))
+        exp = sum(1 for r in rows if gen.pad_cmp(utf8(r['k']), utf8(lo)) >= 0
+                  and gen.pad_cmp(utf8(r['k']), utf8(hi)) <= 0)
+        t.check(matched(out) == exp, 'range', repr(lo), repr(hi), matched(out), exp)
+    for l in ['a', 'a ', 'a\t', 'a b', 'ab', '', ' ', 'é', 'b', 'a\x01']:
+        out, err = t.run('tree', '-s', T3_L, latin1("'" + l + "'"))
+        exp = sum(1 for r in rows if r['l'] is not None
+                  and gen.pad_cmp(latin1(r['l']), latin1(l)) == 0)
+        t.check(matched(out) == exp, 'secondary', repr(l), matched(out), exp)
+
+
+@test
+def secondary_range(t):
+    rows = live(t.rows('tree', 't1'))
+    for lo, hi in [(3, 3), (0, 1), (2, 4), (None, 0), (5, None), (4, 2)]:
+        spec = str(lo) if lo == hi else '%s..%s' % ('' if lo is None else lo, '' if hi is None else hi)
+        out, err = t.run('tree', '-s', T1_STATUS, spec)
+        exp = [r['id'] for r in rows
+               if (lo is None or r['status'] >= lo) and (hi is None or r['status'] <= hi)]
+        t.check(row_ids(out) == sorted(exp), 'status', spec, len(row_ids(out)), len(exp))
+
+
+@test
+def unsupported_collation(t):
+    """Keys of a collation whose order is not implemented are refused."""
+    for args in [('-k', T2, "1,'apple'"), ('-s', T1_NAME, "'alice0'")]:
+        out, err = t.run('tree', *args)
+        t.check('whose order is not implemented' in err and matched(out) is None,
+                'refused', *args)
+
+
+# ---------------------------------------------------------------------------
+# Filters
+# ---------------------------------------------------------------------------
+
+@test
+def filter_rows(t):
+    rows = live(t.rows('tree', 't1'))
+    cases = [
+        ("status = 3 AND id < 0", lambda r: r['status'] == 3 and r['id'] < 0),
+        ("id >= 100 AND id <= 400", lambda r: 100 <= r['id'] <= 400),
+        ("id IN (3, 30, 300, 9999, -300)", lambda r: r['id'] in (3, 30, 300, 9999, -300)),
+        ("id < -200 OR id > 14000", lambda r: r['id'] < -200 or r['id'] > 14000),
+        ("(id < 0 OR id > 100) AND id <= 200 AND status != 1",
+         lambda r: (r['id'] < 0 or r['id'] > 100) and r['id'] <= 200 and r['status'] != 1),
+        ("id <> 3 AND id < 10 AND id > -10", lambda r: r['id'] != 3 and -10 < r['id'] < 10),
+        ("id = 5 AND id = 6", lambda r: False),
+        ("name IS NULL AND id < 500", lambda r: r['name'] is None and r['id'] < 500),
+        ("note IS NOT NULL AND id < 60", lambda r: r['note'] is not None and r['id'] < 60),
+        ("amount IS NULL AND id < 3000", lambda r: r['amount'] is None and r['id'] < 3000),
+        ("amount < -49.5", lambda r: r['amount'] is not None and float(r['amount']) < -49.5),
+        ("score IS NOT NULL AND score > 0.5 AND id < 1000",
+         lambda r: r['score'] is not None and r['score'] > 0.5 and r['id'] < 1000),
+        ("score = 12.5", lambda r: r['score'] == 12.5),
+        ("created < '2024-01-02 00:00:00'", lambda r: r['created'] < '2024-01-02 00:00:00'),
+        ("born = '1981-02-02'", lambda r: r['born'] == '1981-02-02'),
+        ("status IN (1, 3) AND born >= '2000-01-01'",
+         lambda r: r['status'] in (1, 3) and r['born'] is not None and r['born'] >= '2000-01-01'),
+        ("color = 2 AND id < 100", lambda r: r['color'] == 2 and r['id'] < 100),
+        ("DB_TRX_ID > 9000", lambda r: r['DB_TRX_ID'] > 9000),
+    ]
+    pages = {}
+    for expr, fn in cases:
+        out, err = t.run('tree', '-w', T1, expr)
+        exp = sorted(r['id'] for r in rows if fn(r))
+        t.check(row_ids(out) == exp and not err, 'filter', expr, len(row_ids(out)), len(exp), err)
+        m = re.search(r'Pages read:\s+(\d+)', out)
+        pages[expr] = int(m.group(1)) if m else None
+    # bounds on the primary key limit the scan to part of the leaves
+    t.check(pages["id >= 100 AND id <= 400"] < pages["DB_TRX_ID > 9000"] / 10,
+            'pages read', pages["id >= 100 AND id <= 400"], pages["DB_TRX_ID > 9000"])
+
+
+@test
+def filter_strings(t):
+    """Strings of binary and _bin collations, also when stored off-page."""
+    k_rows = t.rows('tree', 't3')
+    for expr, fn in [("k LIKE 'a%'", lambda k: k.startswith('a')),
+                     ("k = 'a'", lambda k: k.rstrip(' ') == 'a'),
+                     ("k > 'z' AND k < '~'", lambda k: gen.pad_cmp(k.encode(), b'z') > 0
+                      and gen.pad_cmp(k.encode(), b'~') < 0)]:
+        out, err = t.run('tree', '-w', T3, expr)
+        exp = sum(1 for r in k_rows if fn(r['k']))
+        t.check(matched(out) == exp, 'filter', expr, matched(out), exp, err)
+    b_rows = t.rows('tree', 't4')
+    long_prefix = bytes.fromhex(b_rows[51]['b'])[:3000]
+    for expr, fn in [("b >= '~'", lambda b: b >= b'~'),
+                     ("b LIKE '~26:%'", lambda b: b.startswith(b'~26:')),
+                     ("b LIKE '%s%%'" % long_prefix.decode(), lambda b: b.startswith(long_prefix)),
+                     ("b = 'v0037'", lambda b: b == b'v0037')]:
+        out, err = t.run('tree', '-w', T4, expr)
+        exp = sorted(r['id'] for r in b_rows if r['b'] is not None and fn(bytes.fromhex(r['b'])))
+        t.check(row_ids(out) == exp, 'filter', expr[:40], row_ids(out), exp, err)
+
+
+@test
+def filter_errors(t):
+    for expr, msg in [("name = 'bob1'", 'whose order is not implemented'),
+                      ("status = 1 AND id BETWEEN 10 AND 20", "Unexpected 'BETWEEN'"),
+                      ("nosuch = 1", 'nosuch')]:
+        out, err = t.run('tree', '-w', T1, expr)
+        t.check(msg in err and matched(out) is None, 'error', expr, err.strip())
+
+
+# ---------------------------------------------------------------------------
+# Aggregates
+# ---------------------------------------------------------------------------
+
+def groups(out):
+    """The fields of each [GROUP n] block of --aggregate."""
+    result = []
+    for block in out.split('[GROUP ')[1:]:
+        result.append({m.group(1): m.group(2)
+                       for m in re.finditer(r'^  (\S.*?)\s*: (.*)$', block, re.M)})
+    return result
+
+
+def check_groups(t, name, table, spec, where, keys, rows, expect):
+    table_id = {'t1': T1, 't4': T4}[table]
+    args = ['-g', table_id, spec] + (['-w', table_id, where[0]] if where else [])
+    out, err = t.run(name, *args)
+    got = groups(out)
+    exp = {}
+    for r in rows:
+        if where is None or where[1](r):
+            exp.setdefault(tuple('NULL' if r[k] is None else str(r[k]) for k in keys), []).append(r)
+    if not exp and not keys:
+        exp[()] = []
+    if not t.check(len(got) == len(exp) and t.status == 0, 'groups', spec, len(got), len(exp),
+                   err):
+        return
+    for g in got:
+        key = tuple(g[k] for k in keys)
+        for field, value in expect(exp.get(key, [])).items():
+            t.check(g.get(field) == str(value), spec, key, field, g.get(field), value)
+
+
+def dec_sum(values):
+    values = [decimal.Decimal(v) for v in values if v is not None]
+    return sum(values) if values else 'NULL'
+
+
+def dec_avg(values, scale):
+    values = [decimal.Decimal(v) for v in values if v is not None]
+    if not values:
+        return 'NULL'
+    q = decimal.Decimal(1).scaleb(-(scale + 4))
+    return (sum(values) / len(values)).quantize(q, decimal.ROUND_HALF_UP)
+
+
+def num(v):
+    return '%g' % v if v != int(v) else str(int(v))
+
+
+@test
+def aggregate_groups(t):
+    rows = live(t.rows('tree', 't1'))
+    check_groups(t, 'tree', 't1', 'COUNT(*), COUNT(amount), SUM(amount), AVG(amount), '
+                 'MIN(amount), MAX(amount), MIN(id), MAX(id) GROUP BY status', None, ['status'], rows,
+                 lambda g: {'COUNT(*)': len(g),
+                            'COUNT(amount)': sum(r['amount'] is not None for r in g),
+                            'SUM(amount)': dec_sum(r['amount'] for r in g),
+                            'AVG(amount)': dec_avg([r['amount'] for r in g], 2),
+                            'MIN(amount)': min(decimal.Decimal(r['amount']) for r in g if r['amount']),
+                            'MAX(amount)': max(decimal.Decimal(r['amount']) for r in g if r['amount']),
+                            'MIN(id)': min(r['id'] for r in g), 'MAX(id)': max(r['id'] for r in g)})
+    check_groups(t, 'tree', 't1', 'COUNT(*), SUM(id), MAX(score) GROUP BY color, status',
+                 ('id < 2000 AND status != 2', lambda r: r['id'] < 2000 and r['status'] != 2),
+                 ['color', 'status'], rows,
+                 lambda g: {'COUNT(*)': len(g), 'SUM(id)': sum(r['id'] for r in g),
+                            'MAX(score)': num(max(r['score'] for r in g if r['score'] is not None))})
+    check_groups(t, 'tree', 't1', 'COUNT(*) GROUP BY born', ('id < 3000', lambda r: r['id'] < 3000),
+                 ['born'], rows, lambda g: {'COUNT(*)': len(g)})
+    check_groups(t, 'tree', 't1', 'COUNT(*), MAX(created), MIN(born)', None, [], rows,
+                 lambda g: {'COUNT(*)': len(g), 'MAX(created)': max(r['created'] for r in g),
+                            'MIN(born)': min(r['born'] for r in g if r['born'])})
+    check_groups(t, 'tree', 't1', 'COUNT(*), SUM(amount), AVG(amount)', ('id = 99999', lambda r: False),
+                 [], rows, lambda g: {'COUNT(*)': 0, 'SUM(amount)': 'NULL', 'AVG(amount)': 'NULL'})
+    for spec, where in [('MAX(note)', None), ('COUNT(*), SUM(nosuch)', None),
+                        ('COUNT(*)', 'status = ')]:
+        t.run('tree', '-g', T1, spec, *(['-w', T1, where] if where else []))
+        t.check(t.status == 1, 'failed aggregate', spec, where)
+
+
+@test
+def aggregate_off_page(t):
+    """MIN and MAX compare whole BLOB values, also those stored off-page."""
+    rows = t.rows('tree', 't4')
+    values = [bytes.fromhex(r['b']) for r in rows if r['b'] is not None]
+    check_groups(t, 'tree', 't4', 'COUNT(*), COUNT(b), MIN(b), MAX(b)', None, [], rows,
+                 lambda g: {'COUNT(*)': len(rows), 'COUNT(b)': len(values),
+                            'MIN(b)': '0x' + min(values).hex(), 'MAX(b)': '0x' + max(values).hex()})
+
+
+# ---------------------------------------------------------------------------
+# Export
+# ---------------------------------------------------------------------------
+
+def strict_json_lines(t, out, what):
+    """Parses JSON lines, failing on invalid UTF-8 and NaN or Infinity."""
+    def reject(name):
+        raise ValueError('non-standard constant ' + name)
+    try:
+        text = out.decode('utf8', 'strict')
+        return [json.loads(line, parse_float=decimal.Decimal, parse_int=decimal.Decimal,
+                           parse_constant=reject)
+                for line in text.splitlines()]
+    except ValueError as e:
+        t.check(False, what, e)
+        return []
+
+
+def run_bytes(t, name, *args):
+    argv = [t.ninja, '-f', t.fixture(name)] + [str(a) for a in args]
+    p = subprocess.run(argv, stdout=subprocess.PIPE, stderr=subprocess.PIPE)
+    return p.stdout, p.stderr.decode('utf8', 'replace')
+
+
+def mysql_latin1(b):
+    """MySQL's latin1 is cp1252, with the five undefined bytes kept as is."""
+    return ''.join(bytes([c]).decode('cp1252', 'ignore') or chr(c) for c in b)
+
+
+@test
+def export_json(t):
+    rows = live(t.rows('small', 't1'))
+    out, err = run_bytes(t, 'small', '-x', T1, '-o', 'json')
+    got = strict_json_lines(t, out, 'json t1')
+    t.check(len(got) == len(rows), 'rows', len(got), len(rows))
+    for g, r in zip(got, rows):
+        exp = dict(r, amount=None if r['amount'] is None else decimal.Decimal(r['amount']),
+                   color=str(r['color']))
+        for col in ['id', 'name', 'status', 'created', 'amount', 'score', 'born', 'color', 'code',
+                    'note']:
+            if not t.check(g.get(col) == exp[col], 'json', r['id'], col, g.get(col), exp[col]):
+                return
+    t.check(isinstance(got[1]['amount'], decimal.Decimal), 'DECIMAL is a JSON number')
+
+
+@test
+def export_json_special_values(t):
+    """YEAR 0, NaN, infinities, denormals and latin1 text give valid JSON."""
+    rows = t.rows('small', 't5')
+    out, err = run_bytes(t, 'small', '-x', T5, '-o', 'json')
+    got = strict_json_lines(t, out, 'json t5')
+    t.check(len(got) == len(rows), 'rows', len(got), len(rows))
+    for g, r in zip(got, rows):
+        d = r['d']
+        if d is None:
+            exp_d = None
+        elif d != d:
+            exp_d = 'nan'
+        elif d in (float('inf'), float('-inf')):
+            exp_d = 'inf' if d > 0 else '-inf'
+        else:
+            exp_d = d
+        got_d = float(g['d']) if isinstance(g['d'], decimal.Decimal) else g['d']
+        t.check(got_d == exp_d and str(got_d) == str(exp_d), 'd', r['id'], g['d'], exp_d)
+        exp_s = None if r['s'] is None else mysql_latin1(bytes.fromhex(r['s']))
+        t.check(g['y'] == r['y'] and g['s'] == exp_s, 'y, s', r['id'], g['y'], g['s'], exp_s)
+
+
+@test
+def export_csv(t):
+    rows = live(t.rows('small', 't1'))
+    out, err = t.run('small', '-x', T1, '-o', 'csv')
+    lines = list(csv.reader(io.StringIO(out, newline='')))
+    t.check(lines[0] == ['id', 'name', 'status', 'created', 'amount', 'score', 'born', 'color',
+                         'code', 'note'], 'header', lines[0])
+    t.check(len(lines) == len(rows) + 1, 'lines', len(lines), len(rows) + 1)
+    for line, r in zip(lines[1:], rows):
+        amount = None if r['amount'] is None else '%.2f' % decimal.Decimal(r['amount'])
+        exp = [r['id'], r['name'], r['status'], r['created'], amount]
+        exp = ['\\N' if v is None else str(v) for v in exp]
+        if not t.check(line[:5] == exp, 'csv', line[:5], exp):
+            break
+    out, err = t.run('small', '-x', T5, '-o', 'csv')
+    lines = out.splitlines()
+    t.check(lines[1:4] == ['0,0000,\\N,\\N', '1,1907,inf,\ufffduro', '2,1913,-inf,\ufffdq\ufffd'],
+            'csv t5', lines[1:4])
+
+
+def load_data(out):
+    """Splits bytes the way LOAD DATA does with FIELDS TERMINATED BY ','
+    OPTIONALLY ENCLOSED BY '"' ESCAPED BY '\\', None for NULL."""
+    escapes = {b'0': b'\0', b'n': b'\n', b't': b'\t', b'r': b'\r', b'b': b'\b',
+               b'Z': b'\x1a'}
+    lines, fields, i = [], [], 0
+    while i < len(out):
+        quoted = out[i:i + 1] == b'"'
+        i += quoted
+        value, null = b'', False
+        while i < len(out):
+            c = out[i:i + 1]
+            if c == b'\\':
+                e = out[i + 1:i + 2]
+                null = e == b'N' and not value and not quoted
+                value += escapes.get(e, e)
+                i += 2
+            elif quoted and c == b'"':
+                if out[i + 1:i + 2] == b'"':
+                    value += b'"'
+                    i += 2
+                else:
+                    quoted = False
+                    i += 1
+            elif not quoted and c in (b',', b'\n'):
+                break
+            else:
+                value += c
+                i += 1
+        fields.append(None if null and value == b'N' else value)
+        if out[i:i + 1] != b',':
+            lines.append(fields)
+            fields = []
+        i += 1
+    return lines
+
+
+@test
+def export_csv_escapes(t):
+    """Backslashes, NULs, quotes and commas load back as the exported values."""
+    rows = live(t.rows('small', 't3'))
+    out, err = run_bytes(t, 'small', '-x', T3, '-o', 'csv')
+    lines = load_data(out)
+    t.check(lines[0] == [b'k', b'l', b'v'], 'header', lines[0])
+    t.check(len(lines) == len(rows) + 1, 'lines', len(lines), len(rows) + 1)
+    # the rows are in key order, compare them by key
+    got = {line[0].decode('utf8'): line[1:] for line in lines[1:]}
+    for r in rows:
+        exp = [None if r['l'] is None else r['l'].encode('latin1'), str(r['v']).encode()]
+        if not t.check(got.get(r['k']) == exp, 'row', repr(r['k']), got.get(r['k']), exp):
+            break
+    values = {r['l'] for r in rows}
+    t.check({'\\N', 'a\x00b', 'c:\\d', 'x,"y"'} <= values, 'escaped values in the fixture')
+
+
+@test
+def export_exit_status(t):
+    """A failed export exits with 1, so its partial output is not used."""
+    t.run('small', '-x', T1, '-o', 'csv')
+    t.check(t.status == 0, 'export', t.status)
+    for args in [('-x', T1, '-w', T1, 'nosuch = 1'), ('-x', T1, '-w', T4, 'id = 1')]:
+        t.run('small', *args)
+        t.check(t.status == 1, 'failed export', *args)
+    if os.path.exists('/dev/full'):
+        with open('/dev/full', 'w') as full:
+            p = subprocess.run([t.ninja, '-f', t.fixture('small'), '-x', str(T4), '-o', 'json'],
+                               stdout=full, stderr=subprocess.PIPE)
+        t.check(p.returncode == 1 and b'the output is incomplete' in p.stderr, 'full disk')
+
+
+FIL_PAGE_TYPE = 24
+FIL_PAGE_TYPE_LOB_DATA = 23
+
+
+def page_type(data, page_no):
+    return int.from_bytes(data[page_no * gen.PAGE + FIL_PAGE_TYPE:][:2], 'big')
+
+
+@test
+def export_off_page(t):
+    """Off-page values are exported in full, unreadable ones are marked."""
+    rows = t.rows('small', 't4')
+    exp = {r['id']: None if r['b'] is None else '0x' + r['b'] for r in rows}
+    out, err = run_bytes(t, 'small', '-x', T4, '-o', 'json')
+    got = {g['id']: g['b'] for g in strict_json_lines(t, out, 'json t4')}
+    t.check(got == exp, 'json values', len(got), len(exp))
+    out, err = t.run('small', '-x', T4)
+    got = dict(re.findall(r'^  id\s+: (\d+)\n  b\s+: (\S+)$', out, re.M))
+    t.check(got == {str(k): v or 'NULL' for k, v in exp.items()}, 'text values', len(got))
+
+    def break_lob_page(data):
+        page_no = next(no for no in range(len(data) // gen.PAGE)
+                       if page_type(data, no) == FIL_PAGE_TYPE_LOB_DATA)
+        offset = page_no * gen.PAGE + FIL_PAGE_TYPE
+        data[offset:offset + 2] = b'\0\0'
+    t.corrupt('bad-lob', 'small', break_lob_page)
+    out, err = run_bytes(t, 'bad-lob', '-x', T4, '-o', 'json')
+    got = strict_json_lines(t, out, 'json t4')
+    bad = [g for g in got if '_truncated' in g]
+    t.check(len(got) == len(rows) and len(bad) == 1, 'truncated rows', len(got), len(bad))
+    for g in got:
+        if g in bad:
+            t.check(g['_truncated'] == ['b'] and exp[g['id']].startswith(g['b'])
+                    and len(g['b']) < len(exp[g['id']]), 'truncated value', g['id'])
+        else:
+            t.check(g['b'] == exp[g['id']], 'value', g['id'])
+    t.check('Failed to read the off-page value of column b' in err, 'warning')
+    out, err = t.run('bad-lob', '-x', T4)
+    t.check(out.count(' [TRUNCATED]') == 1, 'text marker')
+
+
+# ---------------------------------------------------------------------------
+# Dictionary
+# ---------------------------------------------------------------------------
+
+DICT_TABLES = [T1, T2, T5, 2000, 2150, 2299]
+
+
+def dictionary(t, name, *args):
+    """Lists and analyzes the tables, without the lines naming the cache."""
+    outs = []
+    for cmd in [('-a',), ('-l',)] + [('-t', table_id) for table_id in DICT_TABLES]:
+        out, err = t.run(name, *(cmd + args))
+        t.check(t.status == 0 and 'Invalid' not in err, name, cmd, args, err)
+        outs.append(re.sub(r'^\[ibdNinja\]: (Using|Wrote) the dictionary cache .*\n\n', '',
+                           out, flags=re.M))
+    return outs
+
+
+def rewrite_dict_cache(path, fn):
+    """Applies fn to the data of each document of a cache and fixes its checksum."""
+    with open(path, 'rb') as f:
+        data = bytearray(f.read())
+    n_entries = struct.unpack_from('=I', data, 28)[0]
+    pos, documents = 36, []
+    for _ in range(n_entries):
+        _, _, offset, length, _, n_index_ids = struct.unpack_from('=QQQQQI', data, pos)
+        pos += 44 + 8 * n_index_ids
+        documents.append((offset, length))
+    for offset, length in documents:
+        data[pos + offset:pos + offset + length] = fn(data[pos + offset:pos + offset + length])
+    struct.pack_into('=I', data, 32, zlib.crc32(data[36:]))
+    with open(path, 'wb') as f:
+        f.write(data)
+
+
+@test
+def dictionary_loading(t):
+    """Tables load alike serially, in parallel and from the cache."""
+    dict_dir = os.path.join(t.tmp, 'dict')
+    os.makedirs(dict_dir)
+    for name in ['tables', 'big_sdi']:
+        with open(t.fixture(name) + '.rows.json') as f:
+            tables = {table for table in json.load(f) if not table.startswith('__')}
+        listing = t.run(name, '-l')[0]
+        t.check(set(re.findall(r'name: test\.(\w+)$', listing, re.M)) == tables, name, 'tables')
+        for k in range(2000, 2300 if name == 'tables' else 2000):
+            t.check(re.search(r'\[Table\] id: %d +name: test\.x%d\n.*id: %d1 ' % (k, k - 2000, k),
+                              listing) is not None, name, 'table', k)
+        serial = dictionary(t, name, '-j', 1)
+        for args, state in [(('-j', 8), 'parallel'), (('-D', dict_dir), 'cache written'),
+                            (('-D', dict_dir, '-j', 1), 'cache read')]:
+            t.check(dictionary(t, name, *args) == serial, name, state, 'differs from serial')
+        out, err = t.run(name, '-a', '-D', dict_dir)
+        t.check('Using the dictionary cache' in out, name, 'cache used')
+
+
+@test
+def dictionary_cache_fallback(t):
+    """Corrupt and stale caches are not used, and give the same output."""
+    dict_dir = os.path.join(t.tmp, 'dict-fallback')
+    os.makedirs(dict_dir)
+    serial = dictionary(t, 'tables', '-j', 1)
+    t.run('tables', '-l', '-D', dict_dir)
+    path = os.path.join(dict_dir, os.listdir(dict_dir)[0])
+
+    # a flipped byte fails the checksum of the file, which is written again
+    with open(path, 'r+b') as f:
+        f.seek(-1, os.SEEK_END)
+        last = f.read(1)[0]
+        f.seek(-1, os.SEEK_END)
+        f.write(bytes([last ^ 0xff]))
+    out, err = t.run('tables', '-a', '-D', dict_dir)
+    t.check('Wrote the dictionary cache' in out, 'corrupt cache written again')
+    t.check(dictionary(t, 'tables', '-D', dict_dir) == serial, 'corrupt', 'differs from serial')
+
+    # documents that don't parse are read from the tablespace instead
+    rewrite_dict_cache(path, lambda document: b'\xff' * len(document))
+    out, err = t.run('tables', '-t', 2150, '-D', dict_dir)
+    t.check('Using the dictionary cache' in out and
+            'Invalid SDI record (type 1, id 2150) in the dictionary cache' in err,
+            'garbled', 'warning', err)
+    t.check(re.sub(r'^\[ibdNinja\]: Using .*\n\n', '', out, flags=re.M) ==
+            serial[2 + DICT_TABLES.index(2150)], 'garbled', 'differs from serial')
+
+    # the cache of another tablespace at the same path is replaced
+    ibd = t.corrupt('stale', 'small', lambda data: None)
+    t.run('stale', '-l', '-D', dict_dir)
+    shutil.copy(t.fixture('big_sdi'), ibd)
+    out, err = t.run('stale', '-a', '-D', dict_dir)
+    t.check('Wrote the dictionary cache' in out, 'stale cache written again')
+    t.check(dictionary(t, 'stale', '-D', dict_dir) ==
+            [o.replace(t.fixture('big_sdi'), ibd) for o in dictionary(t, 'big_sdi', '-j', 1)],
+            'stale', 'differs from serial')
+
+
+# ---------------------------------------------------------------------------
+# Page, key and zone maps
+# ---------------------------------------------------------------------------
+
+def pages_read(out):
+    m = re.search(r'Pages read:\s+(\d+)', out)
+    return int(m.group(1)) if m else None
+
+
+def zones_skipped(out):
+    m = re.search(r'Leaf pages skipped \(zone map\):\s+(\d+)', out)
+    return int(m.group(1)) if m else 0
+
+
+@test
+def sidecar_maps(t):
+    """Maps are used while fresh, and stale or invalid ones are ignored."""
+    ibd = t.corrupt('maps', 'tree', lambda data: None)
+    lookup = ('-k', T1, 30)
+    scan = ('-w', T1, 'DB_TRX_ID > 9900')
+    rows = {args: row_ids(t.run('maps', *args)[0]) for args in (lookup, scan)}
+    maps = [ibd + '.ninjamap', ibd + '.%d.ninjakeys' % T1_PRIMARY,
+            ibd + '.%d.ninjazones' % T1_PRIMARY]
+
+    def build():
+        t.run('maps', '-M')
+        t.run('maps', '-K', T1_PRIMARY)
+        t.run('maps', '-Z', T1_PRIMARY, 'DB_TRX_ID,status')
+        t.check(all(os.path.exists(path) for path in maps), 'built', os.listdir(t.tmp))
+
+    def run(state, warnings):
+        out, err = t.run('maps', *lookup)
+        t.check(row_ids(out) == rows[lookup], state, 'lookup', row_ids(out))
+        t.check(pages_read(out) == (1 if state == 'fresh' else 3), state, 'pages read',
+                pages_read(out))
+        t.check(('Using the page map' in out) == (state == 'fresh'), state, 'page map used')
+        out, err = t.run('maps', *scan)
+        t.check(row_ids(out) == rows[scan], state, 'scan', len(row_ids(out)))
+        t.check((zones_skipped(out) > 0) == (state == 'fresh'), state, 'zones skipped',
+                zones_skipped(out))
+        for warning in warnings:
+            t.check(warning in err, state, 'warning', warning)
+
+    build()
+    run('fresh', [])
+    st = os.stat(ibd)
+    os.utime(ibd, ns=(st.st_atime_ns, st.st_mtime_ns + 10**9))
+    run('stale', ['The page map %s is stale' % maps[0], 'Ignoring the key map %s' % maps[1],
+                  'Ignoring the zone map %s' % maps[2]])
+    build()
+    run('fresh', [])
+    for path in maps:
+        with open(path, 'r+b') as f:
+            f.seek(8)  # the version after the magic
+            f.write(b'\xff\xff\xff\xff')
+    run('invalid', ['Ignoring the invalid page map', 'Ignoring the invalid key map',
+                    'Ignoring the invalid zone map'])
+
+
+# ---------------------------------------------------------------------------
+# Fragmentation
+# ---------------------------------------------------------------------------
+
+def segment_rows(out):
+    """{segment: {column: value}} of the --fragmentation table."""
+    keys = ['allocated', 'used', 'frag', 'extents', 'partial', 'runs']
+    return {m.group(1): dict(zip(keys, map(int, m.group(2).split())))
+            for m in re.finditer(r'^(.+?) +((?:\d+ +){6})[\d.]+%$', out, re.M)}
+
+
+@test
+def fragmentation(t):
+    """Extent and segment counts match the descriptors the generator wrote."""
+    with open(t.fixture('fsp') + '.rows.json') as f:
+        fsp = json.load(f)['__fsp']
+    out, err = t.run('fsp', '-R')
+    t.check(t.status == 0 and 'WARNING' not in err, 'status', err)
+    t.check('Pages below the free limit: %d (%d extents)' % (fsp['extents'] * 64, fsp['extents'])
+            in out, 'extents')
+    t.check('Free extents:               %d\n' % fsp['free'] in out, 'free extents')
+    t.check('Fragment extents:           %d partially used, %d full, %d used pages' %
+            (fsp['free_frag'], fsp['full_frag'], fsp['frag_used']) in out, 'fragment extents')
+    t.check('Segment inodes:             %d in 1 INODE pages' % len(fsp['segments']) in out,
+            'inodes')
+    got = segment_rows(out)
+    t.check(sorted(got) == sorted(fsp['segments']), 'segments', sorted(got))
+    for name, exp in fsp['segments'].items():
+        t.check(got.get(name) == exp, name, got.get(name), exp)
+    # every segment is full and in one run
+    t.check('OPTIMIZE TABLE candidates:\n  None' in out, 'candidates')
+
+    def inode_used(data):
+        struct.pack_into('>I', data, 2 * 16384 + 50 + 8, 7)
+    t.corrupt('fsp_inode', 'fsp', inode_used)
+    out, err = t.run('fsp_inode', '-R')
+    seg = fsp['segments']['test.t1.PRIMARY (leaf)']
+    t.check('The inode of segment 1 lists %d extents with 7 pages used in the not full ones, '
+            'but the extent descriptors give %d extents with 0 pages' %
+            (seg['extents'], seg['extents']) in err, 'inode warning', err)
+
+    def frag_n_used(data):
+        struct.pack_into('>I', data, 38 + 20, 1)
+    t.corrupt('fsp_frag', 'fsp', frag_n_used)
+    out, err = t.run('fsp_frag', '-R')
+    t.check('FSP_FRAG_N_USED is 1, but %d pages of partially used fragment extents are used' %
+            (fsp['frag_used'] - 64 * fsp['full_frag']) in err, 'FSP_FRAG_N_USED warning', err)
+
+
+# ---------------------------------------------------------------------------
+# Leaf chain locality
+# ---------------------------------------------------------------------------
+
+def leaf_chain(t, name, index_id):
+    """The leaf pages of an index in key order, following FIL_PAGE_NEXT in the file."""
+    with open(t.fixture(name), 'rb') as f:
+        data = f.read()
+
+    def field(page_no, offset, size):
+        return int.from_bytes(data[page_no * gen.PAGE + offset:][:size], 'big')
+    leaves = [no for no in range(len(data) // gen.PAGE)
+              if page_type(data, no) == FIL_PAGE_INDEX and
+              field(no, PAGE_INDEX_ID, 8) == index_id and field(no, PAGE_HEADER + 26, 2) == 0]
+    page_no = [no for no in leaves if field(no, 8, 4) == gen.FIL_NULL][0]
+    chain = []
+    while page_no != gen.FIL_NULL:
+        chain.append(page_no)
+        page_no = field(page_no, 12, 4)
+    t.check(sorted(chain) == sorted(leaves), name, index_id, 'chain')
+    return chain
+
+
+@test
+def leaf_locality(t):
+    """The sibling jumps and scan reads follow from the leaf chain."""
+    for name, index_id in [('tree', T1_PRIMARY), ('tree', T1_STATUS), ('small', T1_PRIMARY)]:
+        chain = leaf_chain(t, name, index_id)
+        pairs = list(zip(chain, chain[1:]))
+        jumps = [sum(1 for a, b in pairs if b == a + 1),
+                 sum(1 for a, b in pairs if b != a + 1 and a // 64 == b // 64),
+                 sum(1 for a, b in pairs if a // 64 != b // 64 and b < a),
+                 sum(1 for a, b in pairs if a // 64 != b // 64 and b > a)]
+        switches = sum(1 for a, b in pairs if a // 64 != b // 64)
+        for read_ahead in [64, 8, 1]:
+            out, err = t.run(name, '-i', index_id, '-A', read_ahead)
+            m = re.search(r'Sibling jumps: +(\d+)\n.*Sequential: +(\d+).*\n'
+                          r'.*Same extent: (\d+).*\n.*Backward: +(\d+).*\n'
+                          r'.*Far forward: (\d+).*\n'
+                          r'Extent switches per 1000 pages: +([\d.]+)\n'
+                          r'Estimated reads of a full scan: +(\d+) \((\d+)-page read-ahead\)\n'
+                          r'.*In physical order: (\d+).*\n.*Without read-ahead: (\d+)', out)
+            if not t.check(m is not None, name, index_id, 'locality', out[-1000:]):
+                continue
+            got = [int(x) for x in m.groups()[:5]]
+            t.check(got == [len(pairs)] + jumps, name, index_id, 'jumps', got, jumps)
+            t.check(m.group(6) == '%.2f' % (switches * 1000 / len(chain)), name, index_id,
+                    'extent switches', m.group(6), switches)
+            reads = 1 + sum(1 for a, b in pairs if a // read_ahead != b // read_ahead)
+            t.check([int(x) for x in m.group(7, 8, 9, 10)] ==
+                    [reads, read_ahead, -(-len(chain) // read_ahead), len(chain)],
+                    name, index_id, read_ahead, 'reads', m.group(7, 8, 9, 10), reads)
+        # pages of the shuffled primary key are out of key order, the others are not
+        t.check((jumps[0] < len(pairs)) == (name == 'tree' and index_id == T1_PRIMARY),
+                name, index_id, 'out of order', jumps)
+
+
+# ---------------------------------------------------------------------------
+# JSON analysis
+# ---------------------------------------------------------------------------
+
+@test
+def json_analysis(t):
+    """With --format json, stdout holds one JSON document per analyzed index."""
+    dict_dir = os.path.join(t.tmp, 'dict-json')
+    os.makedirs(dict_dir)
+    maps = t.corrupt('json_maps', 'tree', lambda data: None)
+    t.run('json_maps', '-M')
+    for name, extra in [('tree', ()), ('purged', ()), ('json_maps', ('-D', dict_dir))]:
+        with open(t.fixture(name), 'rb') as f:
+            data = f.read()
+        listing = t.run(name, '-l')[0]
+        for table_id in [T1, T2, T3, T4, T5]:
+            index_ids = [int(x) for x in re.findall(r'^\s+\[Index\] id: (%d\d)' % table_id,
+                                                     listing, re.M)]
+            runs = [('-t', table_id, index_ids)] + [('-i', i, [i]) for i in index_ids]
+            for option, object_id, exp_ids in runs:
+                out, err = run_bytes(t, name, option, object_id, '-o', 'json', *extra)
+                docs = strict_json_lines(t, out, (name, option, object_id))
+                t.check([int(d['index_id']) for d in docs] == exp_ids, name, option, object_id,
+                        'documents', out[:200], err)
+                for doc in docs:
+                    levels = doc['levels']
+                    t.check(len(levels) == doc['n_levels'] and
+                            sum(lv['pages'] for lv in levels) ==
+                            doc['n_pages_leaf'] + doc['n_pages_non_leaf'] ==
+                            doc['free_list']['pages'], name, doc['index_id'], 'page counts')
+                    for lv in levels:
+                        for key in ['fill_ratio', 'records_per_page', 'garbage_bytes']:
+                            t.check(sum(b['pages'] for b in lv[key]) == lv['pages'],
+                                    name, doc['index_id'], lv['level'], key)
+                    # records per leaf page, from PAGE_N_RECS of the pages in the file
+                    counts = [int.from_bytes(data[no * gen.PAGE + PAGE_HEADER + 16:][:2], 'big')
+                              for no in leaf_chain(t, name, int(doc['index_id']))]
+                    buckets = [b for b in levels[-1]['records_per_page'] if b['pages']]
+                    exp = [sum(1 for n in counts if b['min'] <= n <= b['max']) for b in buckets]
+                    t.check([b['pages'] for b in buckets] == exp, name, doc['index_id'],
+                            'records per page', buckets, exp)
+                    # PAGE_N_RECS also counts the delete-marked records
+                    rows = t.rows(name, 't%d' % (table_id - T1 + 1))
+                    t.check(sum(counts) - (len(rows) - len(live(rows))) == doc['n_recs_leaf'],
+                            name, doc['index_id'], 'leaf records', doc['n_recs_leaf'])
+    t.check(any(f.startswith(os.path.basename(maps)) for f in os.listdir(dict_dir)),
+            'dictionary cache written')
+
+
+# ---------------------------------------------------------------------------
+# Free lists
+# ---------------------------------------------------------------------------
+
+PAGE_HEADER = 38
+PAGE_FREE = PAGE_HEADER + 6
+PAGE_INDEX_ID = PAGE_HEADER + 28
+FIL_PAGE_INDEX = 17855
+
+
+def free_list(t, name, index_id):
+    out, err = t.run(name, '-i', index_id, '-o', 'json')
+    return json.loads(out.splitlines()[0])['free_list'], err
+
+
+@test
+def free_list_accounting(t):
+    """The freed records on PAGE_FREE and the garbage that is not on it."""
+    with open(t.fixture('purged') + '.rows.json') as f:
+        expected = json.load(f)['__free']
+    for index_id in (T1_PRIMARY, T1_STATUS, T1_NAME, T3_L):
+        exp = expected[str(index_id)]
+        got, err = free_list(t, 'purged', index_id)
+        t.check([got['pages_with_freed_records'], got['freed_records'], got['freed_bytes'],
+                 got['unlisted_garbage_bytes'], got['pages_corrupt']] ==
+                [exp['pages'], exp['records'], exp['bytes'], exp['leftover'], 0],
+                'free list', index_id, got, exp)
+        t.check(got['page_garbage_bytes'] == got['freed_bytes'] + got['unlisted_garbage_bytes'],
+                'garbage', index_id)
+        t.check(sum(b['records'] for b in got['freed_record_size']) == got['freed_records'],
+                'size histogram', index_id)
+        t.check(got['insert_reuses_head'] + got['insert_uses_heap'] + got['insert_reorganizes']
+                + got['insert_splits'] == got['pages'], 'insert outcomes', index_id)
+
+    def break_free_list(data):
+        for no in range(len(data) // gen.PAGE):
+            page = no * gen.PAGE
+            if (page_type(data, no) == FIL_PAGE_INDEX and
+                    int.from_bytes(data[page + PAGE_INDEX_ID:][:8], 'big') == T1_PRIMARY and
+                    int.from_bytes(data[page + PAGE_FREE:][:2], 'big') != 0):
+                data[page + PAGE_FREE:page + PAGE_FREE + 2] = (50).to_bytes(2, 'big')
+                return
+    t.corrupt('bad-free-list', 'purged', break_free_list)
+    exp = expected[str(T1_PRIMARY)]
+    got, err = free_list(t, 'bad-free-list', T1_PRIMARY)
+    t.check(got['pages_corrupt'] == 1 and got['pages_with_freed_records'] == exp['pages'] - 1
+            and got['freed_records'] < exp['records'], 'corrupt page', got)
+    t.check('Found a broken free list on page' in err, 'warning')
+
+
+# ---------------------------------------------------------------------------
+# Transaction ages
+# ---------------------------------------------------------------------------
+
+@test
+def trx_age(t):
+    """The age histogram and the purge counters follow from the rows."""
+    for table, table_id in [('t1', T1), ('t2', T2)]:
+        rows = t.rows('tree', table)
+        trx_ids = [r['DB_TRX_ID'] for r in rows]
+        deleted = [r['DB_TRX_ID'] for r in rows if r['__deleted']]
+        inserts = sum(1 for r in rows if r['DB_ROLL_PTR'] >> 55 & 1)
+        rsegs = {r['DB_ROLL_PTR'] >> 48 & 0x7f for r in rows}
+        newest = max(trx_ids)
+        buckets = {}
+        for r in rows:
+            age = newest - r['DB_TRX_ID']
+            counts = buckets.setdefault(age.bit_length(), [0, 0])
+            counts[0] += 1
+            counts[1] += r['__deleted']
+        index_out = t.run('tree', '-i', table_id * 10 + 1)[0]
+        # the leaf level comes last
+        pending = int(re.findall(r'Total delete-marked records size: +(\d+) B', index_out)[-1])
+        outs = []
+        for threads in [1, 4]:
+            out, err = t.run('tree', '-T', table_id, '-j', threads)
+            t.check(t.status == 0, table, 'status', err)
+            outs.append(re.sub(r'\(by \d+ threads\)', '', out))
+            exp = ['Records:                       %d' % len(rows),
+                   'DB_TRX_ID range:               %d - %d' % (min(trx_ids), newest),
+                   'Delete-marked records:         %d (%.2f %%)' %
+                   (len(deleted), len(deleted) * 100 / len(rows)),
+                   'Bytes pending purge:           %d B' % pending,
+                   'Last changed by an insert:     %d' % inserts,
+                   'Last changed by an update:     %d' % (len(rows) - inserts),
+                   'Rollback segments referenced:  %d' % len(rsegs)]
+            if deleted:
+                exp.append('Oldest delete-mark age:        %d trx' % (newest - min(deleted)))
+            for line in exp:
+                t.check(line in out, table, threads, line)
+            got = {}
+            for m in re.finditer(r'^  (\d+)(?:-(\d+))? +(\d+) +(\d+) ', out, re.M):
+                got[int(m.group(1)).bit_length()] = [int(m.group(3)), int(m.group(4))]
+            got = {k: v for k, v in got.items() if v[0]}
+            t.check(got == buckets, table, threads, 'histogram', got, buckets)
+            t.check(sum(v[0] for v in got.values()) == len(rows), table, 'histogram total')
+        t.check(outs[0] == outs[1], table, 'same output with 4 threads')
+
+
+# ---------------------------------------------------------------------------
+# Column storage
+# ---------------------------------------------------------------------------
+
+FIXED_SIZES = {'id': 4, 'DB_TRX_ID': 6, 'DB_ROLL_PTR': 7, 'status': 1, 'created': 5,
+               'amount': 5, 'score': 8, 'born': 3, 'color': 1, 'code': 4}
+
+
+@test
+def column_stats(t):
+    """NULLs, value lengths and bytes of each column follow from the rows."""
+    for table, index_id in [('t1', T1_PRIMARY), ('t4', T4 * 10 + 1)]:
+        rows = t.rows('tree', table)
+        outs = []
+        for threads in [1, 4]:
+            out, err = t.run('tree', '-C', index_id, '-j', threads)
+            t.check(t.status == 0, table, 'status', err)
+            outs.append(re.sub(r'\(by \d+ threads\)', '', out))
+        out = outs[0]
+        t.check(outs[1] == out, table, 'same output with 4 threads')
+        t.check('Records:                       %d (%d delete-marked, included)' %
+                (len(rows), len(rows) - len(live(rows))) in out, table, 'records')
+        lengths = re.findall(r'^  (\w+) +([\d.]+) +([\d.]+) +(\d+) +([\d.]+) +\d+ +\d+ +\d+ +(\d+)$',
+                             out, re.M)
+        storage = re.findall(r'^  (\w+) +(\d+) +[\d.]+ % +(\d+) +(\d+) +(\d+)$', out, re.M)
+        fields = [f for f in rows[0] if not f.startswith('__')]
+        t.check(sorted(f for f, *_ in lengths) == sorted(f for f, *_ in storage) == sorted(fields),
+                table, 'fields', lengths, storage)
+        total_in_record = total_off_page = 0
+        for field, null, default, lo, avg, hi in lengths:
+            values = [r[field] for r in rows if r[field] is not None]
+            if field in FIXED_SIZES:
+                sizes = [FIXED_SIZES[field]] * len(values)
+                off_page = []
+            else:
+                values = [len(v) // 2 if table == 't4' else len(v.encode()) for v in values]
+                off_page = [n for n in values if n > gen.EXTERN_OVER]
+                # off-page values leave a 20-byte reference in the record
+                sizes = [n + 20 if n > gen.EXTERN_OVER else n for n in values]
+            exp = ('%.2f' % ((len(rows) - len(values)) * 100 / len(rows)), '0.00',
+                   str(min(sizes)), '%.1f' % (sum(sizes) / len(sizes)), str(max(sizes)))
+            t.check((null, default, lo, avg, hi) == exp, table, field, 'lengths',
+                    (null, default, lo, avg, hi), exp)
+            in_record = sum(sizes) - sum(off_page)
+            exp = (field, str(sum(sizes)), str(in_record), str(sum(off_page)), str(len(off_page)))
+            got = [row for row in storage if row[0] == field]
+            t.check(got == [exp], table, field, 'storage', got, exp)
+            total_in_record += in_record
+            total_off_page += sum(off_page)
+        m = re.search(r'Record bytes: +(\d+) B \((\d+) B in record headers\)', out)
+        t.check(int(m.group(1)) - int(m.group(2)) == total_in_record, table, 'record bytes')
+        t.check('Off-page bytes:                %d B' % total_off_page in out, table, 'off-page')
+
+
+# ---------------------------------------------------------------------------
+# Persistent statistics
+# ---------------------------------------------------------------------------
+
+def index_stats(out):
+    """{index: {stat_name: (value, description)}} of the --compute-stats SQL."""
+    stats = {}
+    for m in re.finditer(r"VALUES \('[^']*', '[^']*', '([^']*)', NOW\(\), '(\w+)', (\d+), "
+                         r"(?:\d+|NULL), '([^']*)'\);$", out, re.M):
+        stats.setdefault(m.group(1), {})[m.group(2)] = (int(m.group(3)), m.group(4))
+    return stats
+
+
+@test
+def compute_stats(t):
+    """n_diff_pfxNN of each key prefix counts the distinct live entries."""
+    for table, table_id, indexes in [
+            ('t1', T1, {'PRIMARY': ['id'], 'idx_status': ['status', 'id']}),
+            ('t3', T3, {'PRIMARY': ['k'], 'idx_l': ['l', 'k']})]:
+        rows = live(t.rows('tree', table))
+        out, err = t.run('tree', '-S', table_id)
+        t.check(t.status == 0, table, 'exit status', err)
+        stats = index_stats(out)
+        t.check(sorted(stats) == sorted(indexes), table, 'indexes', sorted(stats))
+        for index, fields in indexes.items():
+            for n in range(1, len(fields) + 1):
+                # NULLs are equal, and PAD SPACE strings equal without trailing spaces
+                exp = len({tuple(r[f].rstrip(' ') if isinstance(r[f], str) else r[f]
+                                 for f in fields[:n]) for r in rows})
+                got = stats.get(index, {}).get('n_diff_pfx%02d' % n)
+                t.check(got == (exp, ','.join(fields[:n])), table, index, n, got, exp)
+        m = re.search(r'innodb_table_stats .* VALUES \([^)]*NOW\(\), (\d+),', out)
+        t.check(m is not None and int(m.group(1)) == len(rows), table, 'n_rows',
+                m and m.group(1), len(rows))
+    out, err = t.run('tree', '-S', T1)
+    t.check('Skipping index idx_name' in err, 'unsupported collation skipped')
+    t.run('tree', '-S', 4242)
+    t.check(t.status == 1, 'unknown table', t.status)
+
+
+# ---------------------------------------------------------------------------
+# Histograms
+# ---------------------------------------------------------------------------
+
+HISTOGRAM_KEYS = {'buckets', 'data-type', 'null-values', 'collation-id', 'last-updated',
+                  'sampling-rate', 'histogram-type', 'number-of-buckets-specified'}
+
+
+def histogram(t, name, table, col, n_buckets, threads=1):
+    out, err = t.run(name, '-H', table, col, '-B', n_buckets, '-j', threads)
+    t.check(t.status == 0, col, 'exit status', t.status)
+    return json.loads(out.splitlines()[-1], parse_float=decimal.Decimal), err
+
+
+def check_histogram_json(t, col, h, n_buckets):
+    """What ANALYZE TABLE ... UPDATE HISTOGRAM ... USING DATA requires."""
+    t.check(set(h) == HISTOGRAM_KEYS, col, 'keys', sorted(h))
+    t.check(h['histogram-type'] in ('singleton', 'equi-height'), col, 'type')
+    t.check(re.fullmatch(r'\d{4}-\d\d-\d\d \d\d:\d\d:\d\d\.\d{6}', h['last-updated']) is not None,
+            col, 'last-updated', h['last-updated'])
+    t.check(0 <= h['null-values'] <= 1 and h['sampling-rate'] == 1, col, 'fractions')
+    t.check(0 < len(h['buckets']) <= n_buckets == h['number-of-buckets-specified'], col, 'buckets')
+    previous, frequency = None, 0
+    for bucket in h['buckets']:
+        singleton = h['histogram-type'] == 'singleton'
+        t.check(len(bucket) == (2 if singleton else 4), col, 'bucket', bucket)
+        lower, upper = (bucket[0], bucket[0]) if singleton else (bucket[0], bucket[1])
+        t.check(lower <= upper and (previous is None or previous < lower), col, 'order', bucket)
+        t.check(frequency < bucket[-1 if singleton else 2] <= 1, col, 'frequency', bucket)
+        t.check(singleton or bucket[3] >= 1, col, 'distinct', bucket)
+        previous, frequency = upper, bucket[-1 if singleton else 2]
+    t.check(abs(frequency + h['null-values'] - 1) < 1e-9, col, 'total frequency')
+
+
+def same_bucket(got, exp):
+    """(value, frequency) or (lower, upper, frequency, distinct values)."""
+    frequency = 1 if len(got) == 2 else 2
+    return (got[:frequency] == exp[:frequency] and got[frequency + 1:] == exp[frequency + 1:]
+            and abs(got[frequency] - exp[frequency]) < 1e-12)
+
+
+@test
+def histograms(t):
+    rows = live(t.rows('tree', 't1'))
+    n = len(rows)
+    for col, n_buckets, key in [('status', 8, int), ('amount', 8, decimal.Decimal),
+                                ('id', 16, int), ('born', 1024, str),
+                                ('created', 10, lambda v: v[:19]), ('score', 5, float)]:
+        h, err = histogram(t, 'tree', T1, col, n_buckets)
+        check_histogram_json(t, col, h, n_buckets)
+        h4, err = histogram(t, 'tree', T1, col, n_buckets, 4)
+        h.pop('last-updated')
+        h4.pop('last-updated')
+        t.check(h == h4, col, 'threads')
+        counts = {}
+        for r in rows:
+            if r[col] is not None:
+                counts[key(str(r[col]))] = counts.get(key(str(r[col])), 0) + 1
+        t.check(abs(float(h['null-values']) - (n - sum(counts.values())) / n) < 1e-12, col,
+                'nulls')
+        exp, total, lower, n_distinct = [], 0, None, 0
+        if len(counts) <= n_buckets:
+            t.check(h['histogram-type'] == 'singleton', col, 'type')
+            for k in sorted(counts):
+                total += counts[k]
+                exp.append((k, total / n))
+            got = [(key(str(b[0])), float(b[1])) for b in h['buckets']]
+        else:
+            t.check(h['histogram-type'] == 'equi-height', col, 'type')
+            n_values = sum(counts.values())
+            for k in sorted(counts):
+                if n_distinct == 0:
+                    lower = k
+                n_distinct += 1
+                total += counts[k]
+                if total * n_buckets >= n_values * (len(exp) + 1):
+                    exp.append((lower, k, total / n, n_distinct))
+                    n_distinct = 0
+            got = [(key(str(b[0])), key(str(b[1])), float(b[2]), b[3]) for b in h['buckets']]
+        t.check(len(got) == len(exp) and all(map(same_bucket, got, exp)), col, 'buckets',
+                got[:2], exp[:2])
+
+
+@test
+def histogram_values(t):
+    """Values a JSON histogram cannot hold are refused."""
+    h, err = histogram(t, 'small', T5, 'y', 4)
+    check_histogram_json(t, 'y', h, 4)
+    t.check(h['buckets'][0][:2] == [0, 0], 'YEAR 0', h['buckets'][0])
+    out, err = t.run('small', '-H', T5, 'd')
+    t.check('"buckets"' not in out and 'which a histogram cannot hold' in err and t.status == 1,
+            'DOUBLE infinity')
+    t.run('small', '-H', T5, 'nosuch')
+    t.check(t.status == 1, 'unknown column')
+
+# ---------------------------------------------------------------------------
+# Clustering factor
+# ---------------------------------------------------------------------------
+
+def clustered_pages(t, name):
+    """{id: clustered leaf page} of t1, from the record counts along the leaf chain."""
+    with open(t.fixture(name), 'rb') as f:
+        data = f.read()
+    ids = iter(sorted(r['id'] for r in t.rows(name, 't1')))
+    pages = {}
+    for page_no in leaf_chain(t, name, T1_PRIMARY):
+        n_recs = int.from_bytes(data[page_no * gen.PAGE + PAGE_HEADER + 16:][:2], 'big')
+        for _ in range(n_recs):
+            pages[next(ids)] = page_no
+    return pages
+
+
+@test
+def clustering_factor(t):
+    """The factor counts the clustered page switches of a scan in key order."""
+    outs = {}
+    for name in ['tree', 'sequential']:
+        rows = live(t.rows(name, 't1'))
+        pages = clustered_pages(t, name)
+        n_clustered = len(set(pages.values()))
+        out, err = t.run(name, '-L', T1)
+        t.check(t.status == 0, name, 'status', err)
+        t.check('Clustered leaf pages:          %d ' % n_clustered in out, name, 'clustered')
+        # NULLs first, utf8mb4_0900_ai_ci ignores the case of the ASCII names
+        orders = {'idx_status': (T1_STATUS, lambda r: (r['status'], r['id'])),
+                  'idx_name': (T1_NAME, lambda r: (r['name'] is not None,
+                                                   (r['name'] or '').lower(), r['id']))}
+        for index, (index_id, key) in orders.items():
+            scan = [pages[r['id']] for r in sorted(rows, key=key)]
+            factor = 1 + sum(1 for a, b in zip(scan, scan[1:]) if a != b)
+            n_leaves = len(leaf_chain(t, name, index_id))
+            exp = [index, str(len(rows)), str(factor), str(n_leaves),
+                   '%.1f' % (len(rows) / factor),
+                   '%.1f%%' % ((len(rows) - factor) * 100 / (len(rows) - n_clustered))]
+            got = [line.split() for line in re.findall('^%s .*$' % index, out, re.M)]
+            t.check(got == [exp], name, index, got, exp)
+        outs[name] = re.findall(r'^idx_.*$', out, re.M)
+    # the factor depends on the key order of the rows only, not on where the pages are
+    t.check(outs['tree'] == outs['sequential'], 'shuffled pages', outs)
+    status, names = outs['tree']
+    t.check(float(status.split()[-1][:-1]) > 50 > float(names.split()[-1][:-1]),
+            'status in key order, names scattered', outs['tree'])
+
+# ---------------------------------------------------------------------------
+# What-if indexes
+# ---------------------------------------------------------------------------
+
+@test
+def whatif_index(t):
+    """The estimate of an existing secondary index is close to its real size."""
+    # 'bulk' fills its pages to 15/16 like a bulk load at fill factor 100
+    for name, fill, table, table_id, columns, index_id in [
+            ('bulk', 100, 't1', T1, 'status', T1_STATUS),
+            ('bulk', 100, 't1', T1, 'name', T1_NAME),
+            ('bulk', 100, 't3', T3, 'l', T3_L),
+            ('small', 50, 't1', T1, 'status', T1_STATUS),
+            ('small', 50, 't1', T1, 'name', T1_NAME),
+            ('small', 50, 't3', T3, 'l', T3_L)]:
+        out, err = t.run(name, '-i', index_id)
+        real = [int(re.search(pattern, out).group(1)) for pattern in
+                [r'Num of levels: +(\d+)', r'\[Leaf pages: +(\d+)\]']]
+        out, err = t.run(name, '-W', table_id, columns, '-P', fill)
+        t.check(t.status == 0, name, columns, 'status', err)
+        m = re.search(r'Entries: +(\d+)\n.*\nFill factor: +\d+% \((\d+) bytes', out)
+        t.check(m is not None and int(m.group(1)) == len(live(t.rows(name, table))) and
+                int(m.group(2)) == (1024 if fill == 100 else 16384 * (100 - fill) // 100),
+                name, columns, 'entries and free bytes', m and m.groups())
+        est = [int(re.search(pattern, out).group(1)) for pattern in
+               [r'Height: +(\d+)', r'Pages: +\d+ \((\d+) leaf']]
+        # the real indexes also hold the delete-marked entries
+        t.check(est[0] == real[0] and abs(est[1] - real[1]) <= 1 + real[1] // 10,
+                name, columns, 'height and leaf pages', est, real)
+
+
+def main():
+    args = sys.argv[1:]
+    ninja = os.path.abspath(args.pop(0)) if args else os.path.join(HERE, '..', 'ibdNinja')
+    selected = [fn for fn in TESTS if not args or fn.__name__ in args]
+    tmp = tempfile.mkdtemp(prefix='ibdninja-test-')
+    failed = []
+    try:
+        t = Runner(ninja, tmp)
+        for fn in selected:
+            before = t.failures
+            try:
+                fn(t)
+            except Exception as e:  # e.g., output that does not parse
+                t.check(False, 'exception', repr(e))
+            if t.failures != before:
+                failed.append(fn.__name__)
+            print('%-28s %s' % (fn.__name__, 'FAILED' if t.failures != before else 'ok'), flush=True)
+    finally:
+        shutil.rmtree(tmp)
+    print('%d tests, %d checks, %d failed: %s' % (len(selected), t.checks, len(failed),
+                                                  ' '.join(failed) or '-'))
+    return 1 if failed else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())